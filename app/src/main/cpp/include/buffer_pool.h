@@ -0,0 +1,46 @@
+//
+// Reusable I/O buffers for the read and write bridges.
+//
+// Buffers come in four size classes (64 B, 512 B, 4 KiB, 16 KiB) carved out
+// of 64 KiB slabs that are never unmapped. Each thread keeps a small cache per
+// class; the cache refills from and spills to a lock-free global free list in
+// batches, so steady-state forwarding allocates nothing. Requests above the
+// largest class fall back to malloc and are counted.
+//
+// JavaMethod_ReadSerial() returns its data in a pool buffer, the caller hands
+// it back with BufferPool_Put().
+//
+
+#ifndef SERIALSERVER_BUFFER_POOL_H
+#define SERIALSERVER_BUFFER_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BUFFER_POOL_CLASS_COUNT 4
+
+typedef struct {
+    uint32_t size;
+    uint64_t slabs;       // 64 KiB slabs carved so far
+    uint64_t refills;     // thread cache refills from the global list
+    uint64_t spills;      // thread cache overflows to the global list
+} BufferPoolClass;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Never returns NULL for sizes the pool covers unless mmap fails.
+void *BufferPool_Get(size_t size);
+void BufferPool_Put(void *buffer);
+// Usable size of a buffer returned by BufferPool_Get().
+size_t BufferPool_Capacity(const void *buffer);
+// Size of the class that serves `size`, `size` itself above the largest class.
+size_t BufferPool_ClassSize(size_t size);
+int BufferPool_Classes(BufferPoolClass *classes, int max);
+// Requests served by malloc because they exceeded the largest class.
+uint64_t BufferPool_Fallbacks(void);
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SERIALSERVER_BUFFER_POOL_H
@@ -0,0 +1,73 @@
+//
+// Always-on traffic capture into a preallocated, memory-mapped circular file.
+//
+// File layout (little endian, every record 8-byte aligned):
+//
+//   CaptureFileHeader            CAPTURE_HEADER_SIZE bytes
+//   data[data_size]              circular record area
+//
+// Each record is a CaptureRecord followed by `length` payload bytes, padded
+// to 8 bytes. `pos` is the absolute stream offset the record was reserved at
+// (its file offset is header_size + pos % data_size), which lets a reader
+// tell fresh records from stale ones left over from a previous lap. Writers
+// reserve space with one atomic add on `write_pos` and publish the record by
+// storing `magic` last, so the hot path never takes a lock. A reader walks
+// from write_pos - data_size to write_pos and resynchronises on the next
+// 8-byte boundary whose record has a matching magic and pos; records with
+// CAPTURE_FLAG_PAD only fill the end of the area before a wrap.
+//
+// tools/capture_export.cpp converts a capture file to pcapng.
+//
+
+#ifndef SERIALSERVER_CAPTURE_H
+#define SERIALSERVER_CAPTURE_H
+
+#include <stdint.h>
+
+#define CAPTURE_FILE_MAGIC "OTGCAP01"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 4096
+#define CAPTURE_RECORD_MAGIC 0x43455243u /* "CREC" */
+#define CAPTURE_DEFAULT_SIZE (16 << 20)
+#define CAPTURE_MAX_PAYLOAD 65536
+
+#define CAPTURE_DIR_RX 0
+#define CAPTURE_DIR_TX 1
+
+#define CAPTURE_FLAG_PAD 0x01
+#define CAPTURE_FLAG_TRUNCATED 0x02
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t data_size;
+    uint64_t write_pos;         // total bytes reserved, updated atomically
+    uint64_t monotonic_base_ns; // CLOCK_MONOTONIC at open
+    uint64_t realtime_base_ns;  // CLOCK_REALTIME at open, for absolute timestamps
+} CaptureFileHeader;
+
+typedef struct {
+    uint32_t magic;             // CAPTURE_RECORD_MAGIC once the record is complete
+    uint16_t port;
+    uint8_t direction;          // CAPTURE_DIR_RX / CAPTURE_DIR_TX
+    uint8_t flags;
+    uint32_t length;            // payload bytes following this header
+    uint32_t original_length;   // bytes on the wire before truncation
+    uint64_t pos;               // absolute stream offset of this record
+    uint64_t timestamp_ns;      // CLOCK_MONOTONIC
+} CaptureRecord;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Maps (creating or reusing) the capture file. `size` is the record area in bytes.
+int Capture_Open(const char *path, int size);
+void Capture_Close(void);
+// Lock free; does nothing while no capture file is open.
+void Capture_Record(int port, int direction, const void *data, int length);
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SERIALSERVER_CAPTURE_H
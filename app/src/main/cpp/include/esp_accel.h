@@ -0,0 +1,71 @@
+//
+// esptool accelerator in front of the RFC2217 server (esp_accel.cpp).
+//
+// Listens on its own port and relays every client to the Python server on
+// 127.0.0.1:upstream_port, watching the SLIP frames of esptool's serial
+// protocol in both directions.
+//
+// For every client, DTR and RTS requests are applied to port `id` here and
+// acknowledged without a trip to the server. When the client releases IO0
+// (DTR) while holding EN (RTS) low, which is how esptool enters the
+// bootloader, the rest of the reset runs locally with its own timing: EN is
+// released with IO0 low, IO0 is held for ESP_ACCEL_STRAP_MS, and the chip is
+// synced right away. The client's SYNC is then answered with the responses
+// collected, and its own line changes for that reset are absorbed.
+//
+// A client that answers IAC WILL ESP_ACCEL_OPTION with DO (tools/esp_bridge.cpp)
+// can also pipeline block writes: it acknowledges FLASH_DATA, FLASH_DEFL_DATA
+// and MEM_DATA to esptool itself and sends IAC SB ESP_ACCEL_OPTION
+// ESP_ACCEL_MARK IAC SE in front of each such frame. Marked frames are
+// released to the chip one at a time, each after the chip answered the one
+// before; their responses are swallowed and reported back as ESP_ACCEL_DONE,
+// or as ESP_ACCEL_FAIL carrying the response when the chip reports an error
+// or stays silent for ESP_ACCEL_TIMEOUT_MS. After a failure marked frames are
+// dropped, each still reported as DONE, until the next unmarked frame.
+// Such a client is also sent ESP_ACCEL_SYNCED with a response of the chip
+// when a local sync succeeds, empty when it fails, so that it can answer
+// esptool's SYNC, whose 100 ms timeout is shorter than many round trips.
+//
+
+#ifndef SERIALSERVER_ESP_ACCEL_H
+#define SERIALSERVER_ESP_ACCEL_H
+
+#include <stdint.h>
+
+// Not an assigned telnet option; both ends only need to agree.
+#define ESP_ACCEL_OPTION 201
+#define ESP_ACCEL_MARK 1             // client: the frame that follows was acknowledged by the client
+#define ESP_ACCEL_DONE 2             // server: one marked frame is done with
+#define ESP_ACCEL_FAIL 3             // server: a marked frame failed; followed by the response, if any
+#define ESP_ACCEL_SYNCED 4           // server: local sync done; followed by one response if it worked
+
+#define ESP_ACCEL_MAX_CLIENTS 4
+#define ESP_ACCEL_WINDOW 8           // marked frames a bridge keeps acknowledged ahead by default
+#define ESP_ACCEL_TIMEOUT_MS 10000   // for the chip's response to a marked frame
+#define ESP_ACCEL_STRAP_MS 50        // IO0 held low after EN is released
+#define ESP_ACCEL_SYNC_MS 100        // between local sync attempts
+#define ESP_ACCEL_SYNC_TRIES 10
+#define ESP_ACCEL_SYNC_RESPONSES 8   // the ROM answers one SYNC this many times
+
+typedef struct {
+    int clients;
+    int accelerated;          // clients that took the option
+    uint64_t frames;          // command frames from clients
+    uint64_t pipelined;       // marked frames released to the chip
+    uint64_t failures;        // marked frames answered with an error or not at all
+    uint64_t resets;          // bootloader entries timed here
+    uint64_t syncs;           // local syncs the chip answered
+    uint64_t sync_hits;       // client SYNCs answered from a local sync
+} EspAccelStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Returns 0 or -1; only one instance.
+int EspAccel_Start(int tcp_port, int upstream_port, int id);
+void EspAccel_Stats(EspAccelStats *stats);
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SERIALSERVER_ESP_ACCEL_H
@@ -0,0 +1,63 @@
+//
+// A few eventfds that are signalled together, for pollable native events
+// (tx_queue.cpp, usb_engine.cpp). Every subscriber gets its own non-blocking
+// eventfd and drains it itself; signal() is safe from any thread.
+//
+
+#ifndef SERIALSERVER_EVENT_SET_H
+#define SERIALSERVER_EVENT_SET_H
+
+#include <mutex>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define EVENT_SET_MAX 8
+
+class EventSet {
+public:
+    EventSet() {
+        for (int &fd : fds) {
+            fd = -1;
+        }
+    }
+
+    // Returns a new eventfd, or -1 when the set is full.
+    int add() {
+        std::lock_guard<std::mutex> guard(lock);
+        for (int &fd : fds) {
+            if (fd < 0) {
+                fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+                return fd;
+            }
+        }
+        return -1;
+    }
+
+    void remove(int event_fd) {
+        std::lock_guard<std::mutex> guard(lock);
+        for (int &fd : fds) {
+            if (fd >= 0 && fd == event_fd) {
+                close(fd);
+                fd = -1;
+            }
+        }
+    }
+
+    void signal() {
+        std::lock_guard<std::mutex> guard(lock);
+        uint64_t one = 1;
+        for (int fd : fds) {
+            if (fd >= 0) {
+                ssize_t r = write(fd, &one, sizeof(one));
+                (void) r;
+            }
+        }
+    }
+
+private:
+    std::mutex lock;
+    int fds[EVENT_SET_MAX];
+};
+
+#endif //SERIALSERVER_EVENT_SET_H
@@ -0,0 +1,69 @@
+//
+// Native flow control of a serial port: XON/XOFF and RTS/CTS.
+//
+// FlowCtl_Configure() takes pyserial's xonxoff and rtscts settings. With
+// XON/XOFF the receive path (RxRing_Push) drops the control characters before
+// they reach the ring, found with a word-at-a-time scan, and the last one seen
+// stops or resumes the transmit side; when the ring fills past
+// FLOW_CTL_HIGH_WATER percent an XOFF goes out, below FLOW_CTL_LOW_WATER an
+// XON. RTS/CTS is handed to the chip when the driver supports it (FTDI, CP210x,
+// ...); otherwise it is emulated: RTS drops at the same high-water mark and
+// writes wait while CTS is low, polled every FLOW_CTL_CTS_POLL_MS.
+//
+// Writers (JavaMethod_WriteSerial, the tx_queue.h writer) ask FlowCtl_TxWait()
+// before every piece; with flow control on pieces are cut to about
+// FLOW_CTL_CHUNK_MS of line time, so a stop from the peer is honoured within
+// that much data. Control characters and RTS changes are sent by a thread of
+// the port, never from the USB receive path.
+//
+
+#ifndef SERIALSERVER_FLOW_CTL_H
+#define SERIALSERVER_FLOW_CTL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FLOW_CTL_XON 0x11
+#define FLOW_CTL_XOFF 0x13
+#define FLOW_CTL_HIGH_WATER 75      // percent of the rx ring
+#define FLOW_CTL_LOW_WATER 25
+#define FLOW_CTL_CHUNK_MS 10
+#define FLOW_CTL_CTS_POLL_MS 2
+
+typedef struct {
+    bool xonxoff;
+    bool rtscts;
+    bool hardware;          // RTS/CTS done by the chip
+    bool stopped;           // transmit side stopped by the peer (XOFF or CTS low)
+    bool throttled;         // receive side stopped (XOFF sent or RTS low)
+    uint64_t xoff_rx;       // XOFF characters received
+    uint64_t xon_rx;
+    uint64_t xoff_tx;       // XOFF characters sent (high water or set_input_flow_control)
+    uint64_t xon_tx;
+    uint64_t rts_drops;     // emulated RTS lowered
+    uint64_t stalls;        // writes that had to wait
+    uint64_t stall_ns;      // time writes waited
+} FlowCtlStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Applies pyserial's flow control settings; returns 0 or -1. All false turns
+// flow control off and releases a stopped writer.
+int FlowCtl_Configure(int id, int baudrate, bool xonxoff, bool rtscts);
+// pyserial set_input_flow_control(): sends XON (true) or XOFF (false), or sets
+// emulated RTS; the receive side then stays stopped until enabled again.
+void FlowCtl_SetInput(int id, bool enable);
+// pyserial set_output_flow_control(): stops (false) or resumes our transmit side.
+void FlowCtl_SetOutput(int id, bool enable);
+// Waits until port `id` may send; returns how many bytes may go now (INT32_MAX
+// without flow control) or 0 when MonoClock_Now() passed `deadline`.
+int FlowCtl_TxWait(int id, int64_t deadline);
+// Index of the first XON or XOFF in data, or length.
+int FlowCtl_Scan(const uint8_t *data, int length);
+void FlowCtl_Stats(int id, FlowCtlStats *stats);
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SERIALSERVER_FLOW_CTL_H
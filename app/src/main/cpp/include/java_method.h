@@ -5,15 +5,23 @@
 #ifndef SERIALSERVER_JAVA_METHOD_H
 #define SERIALSERVER_JAVA_METHOD_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 // cc.axyz.serialserver.Serial.openSerial(int id)
+// id is a native port id, Serial.deviceFor() maps it to a USB adapter (port_map, else the n-th adapter).
 int JavaMethod_OpenSerial(int id);
 int JavaMethod_CloseSerial(int id);
 int JavaMethod_ConfigureSerial(int id, int baudRate, int dataBits, float stopBits, char parity);
-int JavaMethod_ReadSerial(int id, int size, int timeout, int8_t **data);
-int JavaMethod_WriteSerial(int id, int8_t *data, int length, int timeout);
+// Timeouts are nanoseconds (mono_clock.h).
+// *data is a buffer_pool.h buffer, released with BufferPool_Put().
+int JavaMethod_ReadSerial(int id, int size, int64_t timeout, int8_t **data);
+int JavaMethod_WriteSerial(int id, int8_t *data, int length, int64_t timeout);
+// 1: the chip does RTS/CTS now, 0: the driver cannot, < 0: error.
+int JavaMethod_FlowControlSerial(int id, bool rtscts);
 int JavaMethod_RtsSerialSet(int id, bool state);
 bool JavaMethod_RtsSerialGet(int id);
 int JavaMethod_DtrSerialSet(int id, bool state);
@@ -0,0 +1,74 @@
+//
+// Coalesced line settings of a serial port.
+//
+// An RFC2217 client sends SET-BAUDRATE, SET-DATASIZE, SET-PARITY,
+// SET-STOPSIZE and SET-CONTROL as separate subnegotiations, and each one used
+// to reach Java as a full setParameters() with its USB control transfers.
+// LineConfig_Stage() only records the wanted settings; they are applied once
+// the port has been quiet for the coalescing window, or right away by
+// LineConfig_Flush(), which the write paths call first so that no data goes
+// out with stale settings. android.Serial's begin_config()/commit() and
+// apply() hold them until the commit instead. An apply makes one
+// ConfigureSerial, which the session pool skips when baud rate, data bits,
+// parity and stop bits did not change (SessionPool_SameConfig), and calls
+// FlowCtl_Configure only when the flow control changed.
+//
+// DTR and RTS changes go through LineConfig_SetDtr()/LineConfig_SetRts(),
+// which apply the staged settings first, so that a line change never
+// overtakes a baud rate change staged before it. android.Serial and the
+// esptool accelerator (esp_accel.h) share them.
+//
+// The window (ms, default LINE_CONFIG_DEFAULT_WINDOW_MS, 0 applies every
+// stage at once) comes from the Android property debug.serialserver.coalesce
+// (host: SERIAL_COALESCE).
+//
+
+#ifndef SERIALSERVER_LINE_CONFIG_H
+#define SERIALSERVER_LINE_CONFIG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LINE_CONFIG_DEFAULT_WINDOW_MS 5
+// Special windows of LineConfig_Stage()
+#define LINE_CONFIG_HOLD (-1)        // until LineConfig_Flush()
+#define LINE_CONFIG_COALESCE (-2)    // the configured coalescing window
+
+typedef struct {
+    int baudrate;
+    char parity;
+    int bytesize;
+    float stopbits;     // 1, 1.5, 2
+    bool xonxoff;
+    bool rtscts;
+} LineSettings;
+
+typedef struct {
+    uint64_t stages;        // LineConfig_Stage() calls
+    uint64_t applies;       // settings pushed to the driver
+    uint64_t params;        // ConfigureSerial calls among them, including the ones the session pool skipped
+    uint64_t flows;         // FlowCtl_Configure calls among them
+    uint64_t failures;
+} LineConfigStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Records the settings wanted on port `id`, applied after `window` ns without
+// another stage (0: now). Returns 0, or the apply's result when applied now.
+int LineConfig_Stage(int id, const LineSettings *settings, int64_t window);
+// Applies what is staged; 0 when nothing was or it went through, -1 when the driver refused it.
+int LineConfig_Flush(int id);
+// Applies what is staged, then sets DTR / RTS; returns what the driver call returned.
+int LineConfig_SetDtr(int id, bool state);
+int LineConfig_SetRts(int id, bool state);
+// Whether settings are staged and not applied yet.
+bool LineConfig_Pending(int id);
+// Forgets staged and applied settings, for a port that was just opened or closed.
+void LineConfig_Reset(int id);
+void LineConfig_Stats(LineConfigStats *stats);
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SERIALSERVER_LINE_CONFIG_H
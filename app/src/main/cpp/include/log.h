@@ -1,6 +1,28 @@
 #pragma once
 
+// Asynchronous logging.
+//
+// A LOG_* statement does not format anything: it copies its arguments as a
+// binary record into a lock-free ring owned by the calling thread (taken from
+// a static pool, never allocated) and returns. A background thread formats the
+// records and writes them to logcat, or to stdout on __LINUX__. When a ring is
+// full or a call site exceeds LOG_RATE_LIMIT records per second the record is
+// dropped and counted instead, so logging never blocks the serial data path.
+//
+// LOG_LEVEL (before the include) removes levels at compile time; per-module
+// levels can be raised at runtime (module = source file name without
+// extension) with Log_SetLevel() or, at startup,
+//   Android: adb shell setprop debug.serialserver.log "serial=warn,rx_ring=debug"
+//   host:    SERIAL_LOG="serial=warn,*=info"
+
+#include <stdint.h>
+
+#ifdef __ANDROID__
 #include <android/log.h>
+#endif
+#ifdef __LINUX__
+#include <stdio.h>
+#endif
 
 #define COLOR_WHITE "\033[1;37;1m"
 #define COLOR_RED "\033[1;31m"
@@ -8,6 +30,7 @@
 #define COLOR_YELLOW "\033[1;33m"
 #define COLOR_RESET "\033[m"
 
+// Same values as android_LogPriority.
 #define LOG_LEVEL_DEBUG 3
 #define LOG_LEVEL_INFO 4
 #define LOG_LEVEL_WARN 5
@@ -17,43 +40,67 @@
 #define LOG_LEVEL LOG_LEVEL_DEBUG
 #endif
 
-#ifdef __LINUX__
-#define LOG_COMMMON(name, color, fmt, ...)                                                                            \
-    do                                                                                                                \
-    {                                                                                                                 \
-        printf(color "[%-5s] %s (%s #%d) " fmt COLOR_RESET "\n", name, __FILE__, __FUNCTION__, __LINE__, ##__VA_ARGS__); \
-    } while (0)
+#define LOG_RATE_LIMIT 100
+
+// One per LOG_* statement; the record only carries a pointer to it.
+typedef struct {
+    int level;
+    const char *name;
+    const char *color;
+    const char *file;
+    const char *function;
+    int line;
+    const char *fmt;
+    int *module_level;         // resolved on first use
+    uint64_t window_start_ns;  // rate limit window
+    uint32_t window_count;
+    uint32_t suppressed;
+} LogSite;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void Log_Init(void);
+void Log_Write(LogSite *site, ...);
+// Never called: lets the compiler check the arguments of a LOG_* statement against its format.
+static inline void Log_CheckFormat(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static inline void Log_CheckFormat(const char *fmt, ...) {}
+// `module` is a source file name without extension, "*" for all of them.
+void Log_SetLevel(const char *module, int level);
+// Writes out everything queued so far (used before exit and in tests).
+void Log_Flush(void);
+#ifdef __cplusplus
+}
 #endif
 
-#ifdef __ANDROID__
-#define LOG_COMMMON(level, name, color, fmt, ...) \
-    do                                                                                                                \
-    {                                                                                                                 \
-        __android_log_print(level, "native", "[%-5s] %s:%d (%s) " fmt, name, __FILE__, __LINE__, __FUNCTION__, ##__VA_ARGS__); \
+#define LOG_COMMMON(level, name, color, fmt, ...)                                                          \
+    do                                                                                                     \
+    {                                                                                                      \
+        static LogSite log_site_ = {level, name, color, __FILE__, __FUNCTION__, __LINE__, fmt, 0, 0, 0, 0}; \
+        if (0) Log_CheckFormat(fmt, ##__VA_ARGS__);                                                        \
+        Log_Write(&log_site_, ##__VA_ARGS__);                                                              \
     } while (0)
-#endif
 
 #if LOG_LEVEL <= LOG_LEVEL_DEBUG
-#define LOG_DEBUG(fmt, ...) LOG_COMMMON(ANDROID_LOG_DEBUG, "debug", COLOR_WHITE, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) LOG_COMMMON(LOG_LEVEL_DEBUG, "debug", COLOR_WHITE, fmt, ##__VA_ARGS__)
 #else
 #define LOG_DEBUG(fmt, ...)
 #endif
 
 #if LOG_LEVEL <= LOG_LEVEL_INFO
-#define LOG_INFO(fmt, ...) LOG_COMMMON(ANDROID_LOG_INFO, "info", COLOR_GREEN, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...) LOG_COMMMON(LOG_LEVEL_INFO, "info", COLOR_GREEN, fmt, ##__VA_ARGS__)
 #else
 #define LOG_INFO(fmt, ...)
 #endif
 
 #if LOG_LEVEL <= LOG_LEVEL_WARN
-#define LOG_WARN(fmt, ...) LOG_COMMMON(ANDROID_LOG_WARN, "warn", COLOR_YELLOW, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...) LOG_COMMMON(LOG_LEVEL_WARN, "warn", COLOR_YELLOW, fmt, ##__VA_ARGS__)
 #else
 #define LOG_WARN(fmt, ...)
 #endif
 
 #if LOG_LEVEL <= LOG_LEVEL_ERROR
-#define LOG_ERROR(fmt, ...) LOG_COMMMON(ANDROID_LOG_ERROR, "error", COLOR_RED, fmt, ##__VA_ARGS__)
+#define LOG_ERROR(fmt, ...) LOG_COMMMON(LOG_LEVEL_ERROR, "error", COLOR_RED, fmt, ##__VA_ARGS__)
 #else
 #define LOG_ERROR(fmt, ...)
 #endif
-
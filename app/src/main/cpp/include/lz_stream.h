@@ -0,0 +1,57 @@
+//
+// Streaming LZ77 codec for compressed endpoints (lz_stream.cpp).
+//
+// The compressor turns each chunk of received bytes into one block, and a
+// block may copy from the last 64 KiB of everything compressed before it, so
+// even the short blocks of interactive traffic compress once the history
+// holds similar text. A block on the wire is a big-endian u16 header, the
+// payload length with LZ_STREAM_STORED set when the payload is the bytes
+// themselves, followed by the payload. Compressed payloads are LZ4 block
+// format with the history as prefix dictionary, so liblz4's
+// LZ4_decompress_safe_continue() also reads them.
+//
+// Endpoints compress what they read in one go and send it at once, so a
+// block ends where the adapter's receive aggregation (latency timer, URB
+// completion) ended a transfer: no extra flush timer, no added latency.
+//
+
+#ifndef SERIALSERVER_LZ_STREAM_H
+#define SERIALSERVER_LZ_STREAM_H
+
+#include <stdint.h>
+
+#define LZ_STREAM_BLOCK_MAX 16384
+#define LZ_STREAM_WINDOW 65536
+#define LZ_STREAM_STORED 0x8000
+// Largest block, header included, for `length` input bytes.
+#define LZ_STREAM_BOUND(length) (2 + (length) + (length) / 255 + 16)
+
+typedef struct LzEncoder LzEncoder;
+typedef struct LzDecoder LzDecoder;
+typedef void (*LzSink)(void *context, const uint8_t *data, int length);
+
+typedef struct {
+    uint64_t raw_bytes;    // bytes handed to encoders
+    uint64_t wire_bytes;   // block bytes they produced
+    uint64_t blocks;
+} LzStreamStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+LzEncoder *LzStream_EncoderNew(void);
+void LzStream_EncoderFree(LzEncoder *encoder);
+// Writes one block for up to LZ_STREAM_BLOCK_MAX bytes to `out`, which has
+// room for LZ_STREAM_BOUND(length); returns the block size.
+int LzStream_Compress(LzEncoder *encoder, const uint8_t *data, int length, uint8_t *out);
+LzDecoder *LzStream_DecoderNew(void);
+void LzStream_DecoderFree(LzDecoder *decoder);
+// Takes wire bytes split anywhere and passes decoded bytes to `sink`.
+// Returns 0, or -1 once the stream is corrupt.
+int LzStream_Decompress(LzDecoder *decoder, const uint8_t *data, int length, LzSink sink, void *context);
+void LzStream_Stats(LzStreamStats *stats);
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SERIALSERVER_LZ_STREAM_H
@@ -0,0 +1,100 @@
+//
+// Per-port counters and latency histograms of the serial bridge.
+//
+// Every thread owns a shard that only it writes (relaxed loads and stores, no
+// read-modify-write, no locks); readers sum all shards on demand, so
+// collecting never stalls the USB reader or the Python server threads.
+// Latencies are kept in HDR-style log-linear histograms: 8 sub-buckets per
+// power of two, i.e. at most 12.5% relative error from 1 ns to 2^63 ns.
+//
+// Metrics_Serve() exposes everything in the Prometheus text format, the
+// Python side reads it through the android.Serial.metrics getter.
+//
+
+#ifndef SERIALSERVER_METRICS_H
+#define SERIALSERVER_METRICS_H
+
+#include <stdint.h>
+
+#define METRICS_MAX_PORTS 64
+
+typedef enum {
+    METRIC_RX_BYTES,     // bytes received from the device
+    METRIC_TX_BYTES,     // bytes written to the device
+    METRIC_READS,        // JavaMethod_ReadSerial calls
+    METRIC_WRITES,       // JavaMethod_WriteSerial calls
+    METRIC_TIMEOUTS,     // reads that returned less than requested after waiting
+    METRIC_OVERFLOWS,    // received bytes dropped because the ring was full
+    METRIC_RECONNECTS,   // successful opens after the first one
+    METRIC_CLIENTS,      // currently open handles (gauge)
+    METRIC_COUNTER_COUNT
+} MetricsCounter;
+
+typedef enum {
+    METRIC_OPEN,
+    METRIC_CLOSE,
+    METRIC_CONFIGURE,
+    METRIC_READ,
+    METRIC_WRITE,
+    METRIC_RTS_SET,
+    METRIC_RTS_GET,
+    METRIC_DTR_SET,
+    METRIC_DTR_GET,
+    METRIC_STATUS,
+    METRIC_IN_WAITING,
+    METRIC_RESET_INPUT,
+    METRIC_FORWARD,      // USB packet arrival until the server read it
+    METRIC_SCHED_QUEUE,  // port ready until a port_sched.h worker runs it
+    METRIC_LATENCY_COUNT
+} MetricsLatency;
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+} MetricsSummary;
+
+// Returns text allocated with malloc, the caller frees it.
+typedef char *(*MetricsPageFunc)(void);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// CLOCK_MONOTONIC in nanoseconds.
+uint64_t Metrics_Now(void);
+void Metrics_Add(int port, MetricsCounter counter, int64_t value);
+void Metrics_Record(MetricsLatency latency, uint64_t ns);
+
+int64_t Metrics_Counter(int port, MetricsCounter counter);
+void Metrics_Summary(MetricsLatency latency, MetricsSummary *summary);
+const char *Metrics_CounterName(MetricsCounter counter);
+const char *Metrics_LatencyName(MetricsLatency latency);
+// Prometheus text exposition format, the caller frees the result.
+char *Metrics_Format(void);
+// Other modules extend the endpoint: collectors are appended to /metrics,
+// pages are served on their own path.
+void Metrics_AddCollector(MetricsPageFunc collect);
+void Metrics_AddPage(const char *path, MetricsPageFunc page);
+// Serves Metrics_Format() over HTTP on 127.0.0.1:`tcp_port` from a background thread.
+int Metrics_Serve(int tcp_port);
+#ifdef __cplusplus
+}
+
+// Records the lifetime of the enclosing scope.
+class MetricsTimer {
+public:
+    explicit MetricsTimer(MetricsLatency latency) : latency_(latency), start_(Metrics_Now()) {}
+    ~MetricsTimer() { Metrics_Record(latency_, Metrics_Now() - start_); }
+    MetricsTimer(const MetricsTimer &) = delete;
+    MetricsTimer &operator=(const MetricsTimer &) = delete;
+
+private:
+    MetricsLatency latency_;
+    uint64_t start_;
+};
+#endif
+
+#endif //SERIALSERVER_METRICS_H
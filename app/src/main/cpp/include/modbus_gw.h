@@ -0,0 +1,56 @@
+//
+// Native Modbus TCP to RTU gateway on one serial port.
+//
+// Masters connect over TCP and send MBAP framed requests, several at a time
+// if they like; the gateway queues them in arrival order, sends each one on
+// the bus as an RTU frame (CRC16, 3.5 character silence computed from the
+// line settings) and answers the master with the slave's PDU under the
+// master's transaction id. A slave that does not answer in time, or answers
+// with a bad CRC, is reported as exception 0x0B.
+//
+// Reads of coils and registers (functions 1 to 4) can be served from a cache
+// of recent responses keyed by (unit, function, address, quantity): with a
+// TTL set, dashboards polling the same range share one bus transaction, and
+// identical requests queued behind one in flight are answered with its
+// response. A write to a unit drops that unit's cached responses.
+//
+// The spec is comma separated, every key optional:
+//   baud=9600,data=8,parity=E,stop=1   line settings (default 9600 8E1)
+//   timeout=1000                       response timeout in ms
+//   ttl=0                              cache TTL in ms, 0 disables the cache
+//
+
+#ifndef SERIALSERVER_MODBUS_GW_H
+#define SERIALSERVER_MODBUS_GW_H
+
+#include <stdint.h>
+
+#define MODBUS_GW_MAX_MASTERS 16
+#define MODBUS_GW_MAX_QUEUED 64       // requests waiting for the bus over all masters
+
+typedef struct {
+    int masters;             // connected TCP masters
+    uint64_t requests;       // requests received from masters
+    uint64_t transactions;   // RTU request/response exchanges on the bus
+    uint64_t cache_hits;     // answered from a cached response
+    uint64_t coalesced;      // answered with the response of an identical request
+    uint64_t timeouts;       // no or incomplete response from the slave
+    uint64_t crc_errors;     // response with a bad CRC or from the wrong unit
+} ModbusGwStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Listens on tcp_port for masters and drives port `id`, 1 or above: port n is
+// the n-th USB adapter unless the service's port_map says otherwise (see
+// Serial.deviceFor()); 0 is the RFC2217 server's. Returns 0 or -1; only one
+// instance.
+int ModbusGw_Start(int tcp_port, int id, const char *spec);
+void ModbusGw_Stats(ModbusGwStats *stats);
+// Modbus CRC16 (polynomial 0xA001, initial 0xFFFF) of `length` bytes.
+uint16_t ModbusGw_Crc16(const uint8_t *data, int length);
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SERIALSERVER_MODBUS_GW_H
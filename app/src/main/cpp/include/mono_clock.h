@@ -0,0 +1,103 @@
+//
+// Monotonic nanosecond time for timeouts.
+//
+// Timeouts travel through the bridge as int64_t nanoseconds and are turned
+// into an absolute CLOCK_MONOTONIC deadline once, at the point where the
+// caller starts waiting, so neither float seconds nor whole milliseconds cut
+// a 0.5 ms Modbus poll down to a non-blocking read.
+//
+// MonoCondition is a condition variable that waits on that clock with
+// pthread_cond_timedwait (std::condition_variable may convert to the
+// realtime clock and to microseconds). The last MONO_CLOCK_SPIN_NS before a
+// deadline are spent yielding instead of sleeping, since a timed sleep that
+// short is rounded up by the timer slack of the thread.
+//
+
+#ifndef SERIALSERVER_MONO_CLOCK_H
+#define SERIALSERVER_MONO_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define NS_PER_US 1000LL
+#define NS_PER_MS 1000000LL
+#define NS_PER_SEC 1000000000LL
+#define MONO_CLOCK_SPIN_NS (50 * NS_PER_US)
+
+static inline int64_t MonoClock_Now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+// Seconds (Python float) to nanoseconds; negative becomes 0.
+static inline int64_t MonoClock_FromSeconds(double seconds) {
+    return seconds > 0 ? (int64_t) (seconds * NS_PER_SEC + 0.5) : 0;
+}
+
+// Rounds up, for the interfaces that only take milliseconds.
+static inline int MonoClock_ToMs(int64_t ns) {
+    return ns > 0 ? (int) ((ns + NS_PER_MS - 1) / NS_PER_MS) : 0;
+}
+
+#ifdef __cplusplus
+
+#include <mutex>
+#include <sched.h>
+#include <pthread.h>
+
+class MonoCondition {
+public:
+    MonoCondition() {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&cond, &attr);
+        pthread_condattr_destroy(&attr);
+    }
+    ~MonoCondition() { pthread_cond_destroy(&cond); }
+    MonoCondition(const MonoCondition &) = delete;
+    MonoCondition &operator=(const MonoCondition &) = delete;
+
+    void notify_one() { pthread_cond_signal(&cond); }
+    void notify_all() { pthread_cond_broadcast(&cond); }
+
+    // A single wait: returns on a notify, at the deadline or spuriously.
+    void wait_until(std::unique_lock<std::mutex> &lock, int64_t deadline) {
+        struct timespec ts = {(time_t) (deadline / NS_PER_SEC), (long) (deadline % NS_PER_SEC)};
+        pthread_cond_timedwait(&cond, lock.mutex()->native_handle(), &ts);
+    }
+
+    // Waits until pred() holds or MonoClock_Now() passes deadline; returns pred().
+    template<class Predicate>
+    bool wait_until(std::unique_lock<std::mutex> &lock, int64_t deadline, Predicate pred) {
+        while (!pred()) {
+            int64_t left = deadline - MonoClock_Now();
+            if (left <= 0) {
+                return pred();
+            }
+            if (left <= MONO_CLOCK_SPIN_NS) {
+                lock.unlock();
+                sched_yield();
+                lock.lock();
+                continue;
+            }
+            int64_t sleep_until = deadline - MONO_CLOCK_SPIN_NS;
+            struct timespec ts = {(time_t) (sleep_until / NS_PER_SEC), (long) (sleep_until % NS_PER_SEC)};
+            pthread_cond_timedwait(&cond, lock.mutex()->native_handle(), &ts);
+        }
+        return true;
+    }
+
+    template<class Predicate>
+    bool wait_for(std::unique_lock<std::mutex> &lock, int64_t timeout_ns, Predicate pred) {
+        return wait_until(lock, MonoClock_Now() + timeout_ns, pred);
+    }
+
+private:
+    pthread_cond_t cond;
+};
+
+#endif
+
+#endif //SERIALSERVER_MONO_CLOCK_H
@@ -0,0 +1,93 @@
+//
+// Multiplexed TCP endpoint: several serial ports over one connection.
+//
+// Everything on the connection is a frame with a 4 byte header
+//   type (u8), channel (u8), payload length (u16, big endian)
+// followed by the payload; the channel is the port id, mapped to a USB adapter
+// like the raw ports (the n-th adapter, or the service's port_map, see
+// Serial.deviceFor()). Channel 0 is the RFC2217 server's port and does not
+// open. Multi-byte fields are big endian. A client opens the channels it
+// wants and may then batch data and control frames for all of them into the
+// same segments; the server does the same with whatever is ready on its side.
+//
+// Data is flow controlled per channel and direction with credits: a side
+// sends DATA only as far as the credit the other side granted, and grants
+// more with CREDIT frames as it consumes. The server grants what is free in
+// the port's transmit queue (tx_queue.h), so a slow port never stalls the
+// channels sharing its connection. The server's own credit starts at 0.
+//
+// Client to server:
+//   OPEN        -                       open the port
+//   CLOSE       -                       close it, dropping unsent bytes
+//   DATA        bytes                   within the server's credit
+//   CREDIT      u32 bytes               more data the client will take
+//   CONFIGURE   u32 baud, u8 data bits, u8 parity ('N', 'E', ...),
+//               u8 stop bits * 10
+//   MODEM       u8 mask, u8 state       set MUX_MODEM_RTS/DTR in mask to
+//                                       state; mask 0 only asks
+//   PURGE       u8 MUX_PURGE_* bits     reset_input/output_buffer
+//   COMPRESS    -                       send this channel's data as ZDATA
+// Server to client:
+//   OPEN        u8 ok, u32 credit
+//   CLOSE       -                       the port went away
+//   DATA, CREDIT                        as above
+//   CONFIGURE   u8 ok
+//   MODEM       u8 MUX_MODEM_* state    answer, and on modem changes when
+//                                       the port has the native USB engine
+//   COMPRESS    u8 ok
+//   ZDATA       one lz_stream.h block   data, compressed with the history of
+//                                       the channel's earlier ZDATA; credit
+//                                       counts the decompressed bytes
+//
+
+#ifndef SERIALSERVER_MUX_SERVER_H
+#define SERIALSERVER_MUX_SERVER_H
+
+#include <stdint.h>
+
+#define MUX_HEADER_SIZE 4
+#define MUX_MAX_PAYLOAD 16384
+#define MUX_MAX_CONNECTIONS 8
+
+enum {
+    MUX_DATA = 0,
+    MUX_OPEN = 1,
+    MUX_CLOSE = 2,
+    MUX_CREDIT = 3,
+    MUX_CONFIGURE = 4,
+    MUX_MODEM = 5,
+    MUX_PURGE = 6,
+    MUX_COMPRESS = 7,
+    MUX_ZDATA = 8,
+};
+
+// Same bits as USB_MODEM_* for the inputs.
+#define MUX_MODEM_RTS 0x01
+#define MUX_MODEM_DTR 0x02
+#define MUX_MODEM_CTS 0x10
+#define MUX_MODEM_DSR 0x20
+#define MUX_MODEM_RI 0x40
+#define MUX_MODEM_CD 0x80
+
+#define MUX_PURGE_INPUT 0x01
+#define MUX_PURGE_OUTPUT 0x02
+
+typedef struct {
+    int connections;
+    int channels;          // open over all connections
+    uint64_t frames_in;
+    uint64_t frames_out;
+    uint64_t segments;     // send() calls carrying frames
+} MuxServerStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Listens on tcp_port; returns 0 or -1. Only one instance.
+int MuxServer_Start(int tcp_port);
+void MuxServer_Stats(MuxServerStats *stats);
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SERIALSERVER_MUX_SERVER_H
@@ -0,0 +1,70 @@
+//
+// Native raw TCP endpoint for many ports on a few threads.
+//
+// Every served port listens on tcp_base + id and forwards bytes between one
+// TCP client and the java_method.h interface, without telnet or Python. A
+// port is a task: the USB receive path (RxRing_Push) and an epoll reactor
+// watching the sockets mark it ready, a worker runs it until it has moved a
+// budget of bytes or run dry, and then it yields. Workers follow the core count
+// rather than the port count; each one owns a run queue, and idle workers
+// steal from the back of the others.
+//
+// Ports share the workers by deficit round robin. Every turn a port earns
+// PORT_SCHED_QUANTUM * weight bytes towards its client and goes to the back
+// of the queue while it has more, so a port streaming a dump gets its share
+// per round and an interactive port never waits longer than one round. A
+// port can also be capped at a rate (token bucket), it then sleeps on a timer
+// while it has no tokens. Client sockets get TCP_NOTSENT_LOWAT: the kernel
+// keeps little unsent data per port, so the round robin rather than the
+// socket buffers decides who gets the uplink. Weights and caps come from
+// PortSched_Configure() or debug.serialserver.portsched (host:
+// SERIAL_PORTSCHED), e.g. "1.weight=4,3.rate=20000,*.weight=1" (rate in
+// bytes per second, 0 for none).
+//
+// Client bytes go into the port's tx_queue.h queue without blocking a worker;
+// while it is full the socket is not read, so TCP pushes back on the client.
+// The serial port is opened when a client connects and closed when it leaves,
+// after what the client sent before closing its side has been written.
+// On a compressed endpoint (PortSched_SetCompress) what goes to the client is
+// an lz_stream.h block stream, one block per ring read; client bytes stay plain.
+//
+
+#ifndef SERIALSERVER_PORT_SCHED_H
+#define SERIALSERVER_PORT_SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PORT_SCHED_MAX_WORKERS 16
+#define PORT_SCHED_BUDGET (16 * 1024)   // client to device bytes per run
+#define PORT_SCHED_QUANTUM 4096          // device to client bytes per run and weight
+#define PORT_SCHED_MAX_WEIGHT 64
+#define PORT_SCHED_NOTSENT_LOWAT (16 * 1024)
+
+typedef struct {
+    int workers;
+    uint64_t runs;       // task runs over all workers
+    uint64_t steals;     // runs of tasks taken from another worker's queue
+    uint64_t yields;     // runs that ended with the budget used up
+    uint64_t throttles;  // runs that ended on the rate cap
+    uint64_t wakeups;    // ready notifications (USB and socket)
+} PortSchedStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Serves ports [first_id, first_id + count) on tcp_base + id with `workers`
+// threads (<= 0: one per online core). Returns 0 or -1; only one instance.
+int PortSched_Start(int tcp_base, int first_id, int count, int workers);
+// Marks port `id` ready; cheap and safe from any thread, no-op when not served.
+void PortSched_Notify(int id);
+// Sets weights and rate caps, see above; returns 0 or -1 (nothing changed).
+int PortSched_Configure(const char *spec);
+// Compresses the device to client direction of the ports started next.
+void PortSched_SetCompress(bool compress);
+void PortSched_Stats(PortSchedStats *stats);
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SERIALSERVER_PORT_SCHED_H
@@ -0,0 +1,73 @@
+//
+// Allocators of the embedded interpreter.
+//
+// PyAlloc_Install() wraps the RAW, MEM and OBJ domains (PyMem_SetAllocator)
+// before init_start() brings the interpreter up. Every block carries a small
+// header with its size, so each domain keeps allocation counts, bytes in use
+// and the peak. The MEM and OBJ domains run under the GIL and update their
+// counters with plain relaxed stores; RAW may be called without it.
+//
+// In arena mode OBJ requests between pymalloc's 512 byte limit and 16 KiB,
+// i.e. the bytes objects Serial.read/write create per chunk, are served from
+// per size class free lists carved out of 64 KiB arenas instead of malloc.
+//
+// The header costs 16 bytes per block and pushes 497 to 512 byte objects past
+// pymalloc's limit, so both modes are opt-in: Android property
+// debug.serialserver.pymem, host SERIAL_PYMEM: "off" (default), "stats" or
+// "arena".
+//
+
+#ifndef SERIALSERVER_PY_ALLOC_H
+#define SERIALSERVER_PY_ALLOC_H
+
+#include <stdint.h>
+
+typedef enum {
+    PY_ALLOC_RAW,
+    PY_ALLOC_MEM,
+    PY_ALLOC_OBJ,
+    PY_ALLOC_DOMAIN_COUNT
+} PyAllocDomain;
+
+typedef enum {
+    PY_ALLOC_OFF,
+    PY_ALLOC_STATS,
+    PY_ALLOC_ARENA
+} PyAllocMode;
+
+#define PY_ALLOC_CLASS_COUNT 6
+
+typedef struct {
+    uint64_t allocs;     // malloc/calloc calls, realloc of NULL included
+    uint64_t reallocs;
+    uint64_t frees;
+    uint64_t bytes;      // requested bytes over the lifetime
+    uint64_t in_use;     // requested bytes currently allocated
+    uint64_t peak;       // highest in_use
+} PyAllocStats;
+
+typedef struct {
+    uint32_t size;       // block size of the class
+    uint64_t hits;       // served from the free list
+    uint64_t misses;     // carved from an arena
+    uint64_t free;       // blocks on the free list
+} PyAllocClass;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Reads the mode from the property/environment when `mode` is negative.
+// Must run before the interpreter is initialised; later calls are ignored.
+void PyAlloc_Install(int mode);
+PyAllocMode PyAlloc_Mode(void);
+void PyAlloc_Stats(PyAllocDomain domain, PyAllocStats *stats);
+// Returns the number of classes written, 0 unless in arena mode.
+int PyAlloc_Classes(PyAllocClass *classes, int max);
+const char *PyAlloc_DomainName(PyAllocDomain domain);
+// One summary line per domain, with the churn per MB forwarded.
+void PyAlloc_Log(void);
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SERIALSERVER_PY_ALLOC_H
@@ -0,0 +1,51 @@
+//
+// Native receive buffer of a serial port, backed by a shared-memory ring.
+//
+// The USB reader pushes received bytes with RxRing_Push(), the Python side
+// drains them through JavaMethod_ReadSerial() -> RxRing_Read(), and local
+// consumers can follow the same memory read-only (see shm_ring.h).
+//
+
+#ifndef SERIALSERVER_RX_RING_H
+#define SERIALSERVER_RX_RING_H
+
+#include <stdint.h>
+
+#define RX_RING_MAX_PORTS 64
+#define RX_RING_MAX_SUBSCRIBERS 8
+#define RX_RING_DEFAULT_CAPACITY (1 << 20)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Creates the ring of port `id` if it does not exist yet. Returns 0 on success.
+int RxRing_Open(int id, int capacity);
+void RxRing_Close(int id);
+// Appends received bytes. Bytes that do not fit before the primary reader are dropped.
+int RxRing_Push(int id, const int8_t *data, int length);
+// Primary reader: waits up to `timeout` ns until `size` bytes arrived, returns the count read.
+int RxRing_Read(int id, int8_t *data, int size, int64_t timeout);
+int RxRing_Available(int id);
+int RxRing_Reset(int id);
+// Returns a new read-only fd of the ring memory; the caller owns it.
+int RxRing_ShareFd(int id);
+// Returns a new eventfd signalled on every push; release it with RxRing_Unsubscribe().
+int RxRing_Subscribe(int id);
+void RxRing_Unsubscribe(int id, int event_fd);
+// Called after every push that stored bytes, outside the ring lock; one hook
+// for all rings (the port scheduler).
+void RxRing_SetNotify(void (*notify)(int id));
+// Flow control hooks (flow_ctl.h); one set for all rings, both called outside the ring lock.
+typedef struct {
+    // Returns how many received bytes to store. When some had to be dropped the
+    // kept bytes are in *kept, a buffer_pool.h buffer the ring releases.
+    int (*filter)(int id, const int8_t *data, int length, int8_t **kept);
+    // Fill level after every push, read and reset.
+    void (*level)(int id, uint64_t used, uint64_t capacity);
+} RxRingFlow;
+void RxRing_SetFlow(const RxRingFlow *flow);
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SERIALSERVER_RX_RING_H
@@ -7,6 +7,7 @@ extern "C"
 {
 #endif
     PyMODINIT_FUNC PyInit_android(void);
+    int RxRingReader_AddType(PyObject *module);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,62 @@
+//
+// Warm port sessions between clients.
+//
+// Opening a port from Java enumerates the USB devices, probes the driver,
+// opens the connection and starts the reader, which takes hundreds of ms.
+// The pool keeps a port open for a linger time after its last client left;
+// a client that connects within it attaches to the running port, with the
+// data received meanwhile kept or purged. A reaper thread closes ports whose
+// linger time ran out. The last line settings are remembered, so a client
+// that configures the same ones again does not reach Java either.
+//
+// Lingering is opt-in: a lingering port still holds its USB adapter, and the
+// ids that map to the same adapter (port 0 and 1, see Serial.deviceFor())
+// cannot open it until the linger time ran out.
+//
+// Configuration "linger=<ms>,rx=keep|purge" (default linger=0,rx=purge)
+// from the Android property debug.serialserver.session (host:
+// SERIAL_SESSION) or SessionPool_Configure().
+//
+
+#ifndef SERIALSERVER_SESSION_POOL_H
+#define SERIALSERVER_SESSION_POOL_H
+
+#include <stdint.h>
+
+#define SESSION_POOL_DEFAULT_LINGER_MS 0
+
+typedef int (*SessionOpenFunc)(int id);
+typedef int (*SessionCloseFunc)(int id);
+
+typedef struct {
+    uint64_t warm_opens;     // clients that attached to a lingering port
+    uint64_t cold_opens;     // opens that went through Java
+    uint64_t expired;        // ports closed by the reaper
+    uint64_t config_skips;   // ConfigureSerial calls answered from the cache
+    int lingering;           // ports open without a client right now
+} SessionPoolStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Applies "linger=<ms>,rx=keep|purge" on top of the current settings; 0 or -1.
+int SessionPool_Configure(const char *spec);
+// Attaches to the warm port or calls open(id); returns open()'s result, 1 when warm.
+int SessionPool_Open(int id, SessionOpenFunc open);
+// Detaches a client; the last one starts the linger time, or calls close(id)
+// right away when linger is 0. close() is kept for the reaper.
+int SessionPool_Close(int id, SessionCloseFunc close);
+// The device went away: a lingering port is closed now instead of reused.
+void SessionPool_Drop(int id);
+// Closes every lingering port now, e.g. before a host tool exits.
+void SessionPool_Flush(void);
+// 1 if these are the line settings the port already has, then the call can be skipped.
+int SessionPool_SameConfig(int id, int baudRate, int dataBits, float stopBits, char parity);
+// Records line settings that were applied successfully.
+void SessionPool_SetConfig(int id, int baudRate, int dataBits, float stopBits, char parity);
+void SessionPool_Stats(SessionPoolStats *stats);
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SERIALSERVER_SESSION_POOL_H
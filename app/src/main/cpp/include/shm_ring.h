@@ -0,0 +1,215 @@
+//
+// Shared-memory receive ring layout and a header-only read-only client.
+//
+// The native receive buffer of every serial port lives in a sealed memfd:
+//
+//   offset 0          ShmRingHeader (one page)
+//   offset PAGE       data[capacity]   (capacity is a power of two, page aligned)
+//
+// The producer (rx_ring.cpp) appends bytes and publishes the total number of
+// bytes ever written in `head` with release semantics. Followers map the fd
+// read-only, keep their own 64-bit position and never write to the mapping, so
+// any number of local consumers can follow a port without the producer copying
+// data per consumer. A follower that falls more than `capacity` bytes behind
+// has been overrun and must skip ahead; `ShmRingClient` reports that as lost
+// bytes. Before writing, the producer advertises the end of the write in
+// `reserve`, so a follower can tell whether a span it copied was being
+// overwritten at the same time. Wakeups are delivered through an eventfd per
+// subscriber.
+//
+
+#ifndef SERIALSERVER_SHM_RING_H
+#define SERIALSERVER_SHM_RING_H
+
+#include <stdint.h>
+
+#define SHM_RING_MAGIC 0x52535853u /* "SXSR" */
+#define SHM_RING_VERSION 1
+#define SHM_RING_HEADER_SIZE 4096
+
+#ifdef __cplusplus
+#include <atomic>
+
+struct ShmRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;          // bytes in the data area, power of two
+    uint64_t data_offset;       // offset of the data area inside the fd
+    int32_t port_id;
+    uint32_t reserved0;
+    alignas(64) std::atomic<uint64_t> head;     // total bytes written, release-published
+    std::atomic<uint64_t> reserve;              // head plus the bytes currently being written
+    alignas(64) std::atomic<uint64_t> overflow; // bytes dropped because the primary reader lagged
+};
+
+static_assert(sizeof(ShmRingHeader) <= SHM_RING_HEADER_SIZE, "ShmRingHeader too large");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "64-bit atomics required in shared memory");
+#endif
+
+#ifdef __cplusplus
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Read-only follower of a port's receive ring. Header only so that out of tree
+// tools can attach to the fds handed out by RxRing_ShareFd()/RxRing_Subscribe().
+class ShmRingClient {
+public:
+    ShmRingClient() = default;
+    ShmRingClient(const ShmRingClient &) = delete;
+    ShmRingClient &operator=(const ShmRingClient &) = delete;
+    ~ShmRingClient() { detach(); }
+
+    // Maps the ring read-only. `event_fd` may be -1 when the caller only polls.
+    // The fds stay owned by the caller. Starts following at the current head.
+    bool attach(int ring_fd, int event_fd) {
+        detach();
+        void *h = mmap(nullptr, SHM_RING_HEADER_SIZE, PROT_READ, MAP_SHARED, ring_fd, 0);
+        if (h == MAP_FAILED) {
+            return false;
+        }
+        const ShmRingHeader *hdr = static_cast<const ShmRingHeader *>(h);
+        if (hdr->magic != SHM_RING_MAGIC || hdr->version != SHM_RING_VERSION ||
+            hdr->capacity == 0 || (hdr->capacity & (hdr->capacity - 1)) != 0) {
+            munmap(h, SHM_RING_HEADER_SIZE);
+            return false;
+        }
+        size_t cap = hdr->capacity;
+        // Map the data area twice back to back so that every readable span is contiguous.
+        void *area = mmap(nullptr, cap * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (area == MAP_FAILED) {
+            munmap(h, SHM_RING_HEADER_SIZE);
+            return false;
+        }
+        char *base = static_cast<char *>(area);
+        if (mmap(base, cap, PROT_READ, MAP_SHARED | MAP_FIXED, ring_fd, (off_t) hdr->data_offset) == MAP_FAILED ||
+            mmap(base + cap, cap, PROT_READ, MAP_SHARED | MAP_FIXED, ring_fd, (off_t) hdr->data_offset) == MAP_FAILED) {
+            munmap(area, cap * 2);
+            munmap(h, SHM_RING_HEADER_SIZE);
+            return false;
+        }
+        header_ = hdr;
+        data_ = reinterpret_cast<const uint8_t *>(base);
+        capacity_ = cap;
+        event_fd_ = event_fd;
+        position_ = header_->head.load(std::memory_order_acquire);
+        lost_ = 0;
+        return true;
+    }
+
+    void detach() {
+        if (data_) {
+            munmap(const_cast<uint8_t *>(data_), capacity_ * 2);
+            data_ = nullptr;
+        }
+        if (header_) {
+            munmap(const_cast<ShmRingHeader *>(header_), SHM_RING_HEADER_SIZE);
+            header_ = nullptr;
+        }
+        event_fd_ = -1;
+    }
+
+    bool attached() const { return header_ != nullptr; }
+    uint64_t position() const { return position_; }
+    uint64_t lost() const { return lost_; }
+    uint64_t capacity() const { return capacity_; }
+    int event_fd() const { return event_fd_; }
+
+    uint64_t head() const { return header_ ? header_->head.load(std::memory_order_acquire) : 0; }
+
+    // Bytes published but not yet consumed by this follower (capped at capacity).
+    uint64_t available() const {
+        uint64_t h = head();
+        uint64_t n = h - position_;
+        return n > capacity_ ? capacity_ : n;
+    }
+
+    // Zero-copy access: points `*ptr` at up to `max` unread bytes inside the
+    // mapping. The span stays valid until the producer laps it; call
+    // `consume()` afterwards, which reports whether the span was overwritten
+    // while it was being used.
+    size_t peek(const uint8_t **ptr, size_t max) {
+        if (!header_) {
+            return 0;
+        }
+        uint64_t h = header_->head.load(std::memory_order_acquire);
+        skip_overrun(h);
+        uint64_t n = h - position_;
+        if (n > max) {
+            n = max;
+        }
+        *ptr = data_ + (position_ & (capacity_ - 1));
+        return (size_t) n;
+    }
+
+    // Returns false if the bytes handed out by the last peek() were overwritten.
+    bool consume(size_t n) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t r = header_->reserve.load(std::memory_order_relaxed);
+        bool intact = r - position_ <= capacity_;
+        position_ += n;
+        skip_overrun(header_->head.load(std::memory_order_acquire));
+        return intact;
+    }
+
+    // Copies up to `len` bytes. Returns the number of bytes copied; bytes that
+    // were overrun while copying are counted in lost() and not returned.
+    size_t read(void *dst, size_t len) {
+        const uint8_t *src = nullptr;
+        size_t n = peek(&src, len);
+        if (n == 0) {
+            return 0;
+        }
+        memcpy(dst, src, n);
+        if (!consume(n)) {
+            lost_ += n;
+            return 0;
+        }
+        return n;
+    }
+
+    // Waits for the producer to publish data past our position. timeout_ms < 0 waits forever.
+    bool wait(int timeout_ms) {
+        if (available() > 0) {
+            return true;
+        }
+        if (event_fd_ < 0) {
+            return false;
+        }
+        struct pollfd pfd = {event_fd_, POLLIN, 0};
+        int ret;
+        do {
+            ret = poll(&pfd, 1, timeout_ms);
+        } while (ret < 0 && errno == EINTR);
+        if (ret > 0) {
+            uint64_t counter;
+            ssize_t r = ::read(event_fd_, &counter, sizeof(counter));
+            (void) r;
+        }
+        return available() > 0;
+    }
+
+private:
+    void skip_overrun(uint64_t h) {
+        if (h - position_ > capacity_) {
+            uint64_t next = h - capacity_;
+            lost_ += next - position_;
+            position_ = next;
+        }
+    }
+
+    const ShmRingHeader *header_ = nullptr;
+    const uint8_t *data_ = nullptr;
+    uint64_t capacity_ = 0;
+    uint64_t position_ = 0;
+    uint64_t lost_ = 0;
+    int event_fd_ = -1;
+};
+
+#endif // __cplusplus
+
+#endif //SERIALSERVER_SHM_RING_H
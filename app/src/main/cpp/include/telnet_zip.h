@@ -0,0 +1,32 @@
+//
+// Compressing front for the RFC2217 server (telnet_zip.cpp).
+//
+// Listens on its own port and relays every client to the Python server on
+// 127.0.0.1:upstream_port. Each client is offered IAC WILL TELNET_ZIP_OPTION;
+// one that answers IAC DO gets IAC SB TELNET_ZIP_OPTION IAC SE, and every
+// byte from the server after it is an lz_stream.h block stream. Clients that
+// refuse or ignore the option see the server unchanged. Negotiation of the
+// option is answered here and never reaches the server. Only the server to
+// client direction, a phone's uplink, is compressed.
+//
+// tools/lz_bridge.cpp is a client side bridge that negotiates the option and
+// serves the plain protocol locally, for standard RFC2217 tools.
+//
+
+#ifndef SERIALSERVER_TELNET_ZIP_H
+#define SERIALSERVER_TELNET_ZIP_H
+
+// Not an assigned telnet option; both ends only need to agree.
+#define TELNET_ZIP_OPTION 200
+#define TELNET_ZIP_MAX_CLIENTS 4
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Returns 0 or -1; only one instance.
+int TelnetZip_Start(int tcp_port, int upstream_port);
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SERIALSERVER_TELNET_ZIP_H
@@ -0,0 +1,60 @@
+//
+// Scheduling policy of the threads that move serial data.
+//
+// Every role (USB reader, Python server, native writer) has a nice value, an
+// optional SCHED_FIFO priority and a CPU set ("big", "little", "all" or a
+// list such as "4-7"). Threads pick their role up lazily: the bridge calls
+// ThreadSched_Enter() on its hot paths, which applies the policy the first
+// time and again after every reconfiguration, then is a single load.
+// SCHED_FIFO usually needs privileges the app does not have; the thread then
+// falls back to the nice value and the effective policy says so. The timer
+// slack (us) bounds how late a timed wait may wake up.
+//
+// Configuration, comma separated "<role>.<key>=<value>":
+//   usb.nice=-10,usb.cpus=big,server.fifo=2,server.cpus=big,server.slack=1,writer.nice=-4
+// from the Android property debug.serialserver.sched (host: SERIAL_SCHED),
+// SerialService.schedConfigure() or android.Serial.set_sched().
+//
+
+#ifndef SERIALSERVER_THREAD_SCHED_H
+#define SERIALSERVER_THREAD_SCHED_H
+
+#include <stdint.h>
+
+typedef enum {
+    SCHED_ROLE_USB,      // SerialInputOutputManager reader thread (rxPush)
+    SCHED_ROLE_SERVER,   // Python server threads (Serial.read / Serial.write)
+    SCHED_ROLE_WRITER,   // native writer threads
+    SCHED_ROLE_COUNT
+} SchedRole;
+
+#define THREAD_SCHED_MAX_THREADS 32
+
+typedef struct {
+    int tid;
+    SchedRole role;
+    int policy;          // SCHED_OTHER / SCHED_FIFO as read back
+    int priority;        // SCHED_FIFO priority, 0 otherwise
+    int nice;
+    uint64_t cpus;       // affinity mask as read back, cpu 0 = bit 0
+    int error;           // errno of the last refused request, 0 if all applied
+} SchedThread;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Applies the configuration string above on top of the current one; returns
+// 0 or -1 (nothing changed) on a syntax error.
+int ThreadSched_Configure(const char *spec);
+// Applies the role's policy to the calling thread if it has not been yet.
+void ThreadSched_Enter(SchedRole role);
+// Copies the threads that entered a role; returns the count.
+int ThreadSched_Threads(SchedThread *threads, int max);
+// "usb.nice=-10,usb.cpus=big,..." of the current configuration, caller frees.
+char *ThreadSched_Config(void);
+const char *ThreadSched_RoleName(SchedRole role);
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SERIALSERVER_THREAD_SCHED_H
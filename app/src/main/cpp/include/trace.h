@@ -0,0 +1,85 @@
+//
+// Scoped trace sections for the native bridge.
+//
+// On Android the sections go to ATrace (visible in Perfetto/systrace with the
+// "app" category), per-port spans become async slices. Host builds write
+// Chrome trace_event JSON to $SERIAL_TRACE_FILE (open it in ui.perfetto.dev
+// or chrome://tracing).
+//
+// Build with -DSERIAL_TRACE=0 and every macro below compiles to nothing.
+// Compiled in but switched off, a section costs one relaxed atomic load:
+//   Android: adb shell setprop debug.serialserver.trace 1 (read on server start)
+//   host:    SERIAL_TRACE_FILE=/tmp/trace.json
+//
+
+#ifndef SERIALSERVER_TRACE_H
+#define SERIALSERVER_TRACE_H
+
+#include <stdint.h>
+
+#ifndef SERIAL_TRACE
+#define SERIAL_TRACE 1
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern int Trace_enabled;
+// Reads the switch (system property or environment), call once at startup.
+void Trace_Init(void);
+void Trace_Enable(int enabled);
+void Trace_Begin(const char *name);
+void Trace_End(void);
+// Async slices may begin and end on different threads; `cookie` pairs them.
+void Trace_AsyncBegin(const char *name, int32_t cookie);
+void Trace_AsyncEnd(const char *name, int32_t cookie);
+#ifdef __cplusplus
+}
+#endif
+
+#if SERIAL_TRACE
+
+#define TRACE_ON() __builtin_expect(__atomic_load_n(&Trace_enabled, __ATOMIC_RELAXED), 0)
+#define TRACE_BEGIN(name) do { if (TRACE_ON()) Trace_Begin(name); } while (0)
+#define TRACE_END() do { if (TRACE_ON()) Trace_End(); } while (0)
+#define TRACE_ASYNC_BEGIN(name, cookie) do { if (TRACE_ON()) Trace_AsyncBegin(name, cookie); } while (0)
+#define TRACE_ASYNC_END(name, cookie) do { if (TRACE_ON()) Trace_AsyncEnd(name, cookie); } while (0)
+
+#ifdef __cplusplus
+// Ends the section when leaving the scope, even if tracing was switched off meanwhile.
+class TraceScope {
+public:
+    explicit TraceScope(const char *name) : active_(TRACE_ON()) {
+        if (active_) {
+            Trace_Begin(name);
+        }
+    }
+    ~TraceScope() {
+        if (active_) {
+            Trace_End();
+        }
+    }
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    bool active_;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#endif
+
+#else
+
+#define TRACE_ON() 0
+#define TRACE_BEGIN(name) do { } while (0)
+#define TRACE_END() do { } while (0)
+#define TRACE_ASYNC_BEGIN(name, cookie) do { } while (0)
+#define TRACE_ASYNC_END(name, cookie) do { } while (0)
+#define TRACE_SCOPE(name) do { } while (0)
+
+#endif
+
+#endif //SERIALSERVER_TRACE_H
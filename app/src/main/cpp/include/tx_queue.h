@@ -0,0 +1,46 @@
+//
+// Native transmit queue for non-blocking writes.
+//
+// TxQueue_Write() copies what fits into the port's queue and returns at once;
+// a writer thread per port (SCHED_ROLE_WRITER) drains it in chunks through
+// JavaMethod_WriteSerial() without a timeout, however long a chunk takes at
+// the port's baud rate. Subscribers get an eventfd that is signalled every
+// time a chunk has left the queue, i.e. when space frees up.
+//
+// A failed write means the port is gone: what is still queued is dropped and
+// the queue refuses writes until the failure has been reported by
+// TxQueue_Flush() or cleared by TxQueue_Reset().
+//
+
+#ifndef SERIALSERVER_TX_QUEUE_H
+#define SERIALSERVER_TX_QUEUE_H
+
+#include <stdint.h>
+
+#define TX_QUEUE_CAPACITY (64 * 1024)
+#define TX_QUEUE_CHUNK 4096
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#define TX_QUEUE_TIMEOUT (-1)
+#define TX_QUEUE_FAILED (-2)
+
+// Queues up to `length` bytes; returns the count taken (0 when full) or -1,
+// also after a failed write.
+int TxQueue_Write(int id, const int8_t *data, int length);
+// Bytes queued or being written.
+int TxQueue_Pending(int id);
+// Waits until the queue is empty; 0, TX_QUEUE_TIMEOUT, or TX_QUEUE_FAILED
+// once for a write that failed since the last flush or reset.
+// Timeout in ns: 0 does not wait, < 0 waits as long as it takes.
+int TxQueue_Flush(int id, int64_t timeout);
+// Drops what has not been handed to the driver yet and clears a failure.
+void TxQueue_Reset(int id);
+int TxQueue_Subscribe(int id);
+void TxQueue_Unsubscribe(int id, int event_fd);
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SERIALSERVER_TX_QUEUE_H
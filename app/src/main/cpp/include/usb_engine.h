@@ -0,0 +1,76 @@
+//
+// Native bulk transfer engine over usbfs.
+//
+// Takes the fd of an opened UsbDeviceConnection and keeps a queue of bulk-IN
+// URBs in flight (USBDEVFS_SUBMITURB / USBDEVFS_REAPURB), so the device is
+// polled every frame even while a completed transfer is being handled. A
+// reaper thread per port strips the adapter framing and hands the payload to
+// RxRing_Push() directly, without Java. Writes are split into bulk-OUT URBs
+// that are submitted together and reaped by the same thread.
+//
+// Line settings, modem lines and the adapter's vendor requests stay with the
+// Java driver; only the data endpoints move here. FTDI adapters report their
+// modem inputs in every packet, those changes are published to subscribers.
+//
+// All ioctls go through a UsbOps table, so tools/usbfs_mock.cpp can stand in
+// for the kernel on Linux.
+//
+
+#ifndef SERIALSERVER_USB_ENGINE_H
+#define SERIALSERVER_USB_ENGINE_H
+
+#include <stdint.h>
+
+#define USB_ENGINE_DEFAULT_URBS 8
+#define USB_ENGINE_DEFAULT_URB_SIZE 4096
+#define USB_ENGINE_MAX_URBS 32
+
+#define USB_MODEM_CTS 0x10
+#define USB_MODEM_DSR 0x20
+#define USB_MODEM_RI 0x40
+#define USB_MODEM_CD 0x80
+
+typedef enum {
+    USB_FRAMING_RAW,        // CDC-ACM, CP210x, CH34x: bulk data is the payload
+    USB_FRAMING_FTDI,       // two modem/line status bytes ahead of every max-packet
+} UsbFraming;
+
+typedef struct {
+    int (*ioctl)(int fd, unsigned long request, void *arg);
+} UsbOps;
+
+typedef struct {
+    uint64_t in_urbs;        // completed bulk-IN URBs
+    uint64_t out_urbs;       // completed bulk-OUT URBs
+    uint64_t in_bytes;       // payload after deframing
+    uint64_t errors;         // URBs that completed with an error status
+    uint64_t line_errors;    // FTDI overrun/parity/framing flags seen
+    int in_flight;           // bulk-IN URBs currently submitted
+} UsbEngineStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// NULL restores the real ioctl().
+void UsbEngine_SetOps(const UsbOps *ops);
+// Starts the engine of port `id` on an open usbfs fd (not taken over, the
+// connection stays owned by Java). The receive ring must already be open.
+// urbs/urb_size <= 0 select the defaults.
+int UsbEngine_Start(int id, int fd, UsbFraming framing, int ep_in, int ep_out, int max_packet, int urbs,
+                    int urb_size);
+// Discards the outstanding URBs and waits for the reaper to finish.
+void UsbEngine_Stop(int id);
+int UsbEngine_Active(int id);
+// Returns 0 once all bytes completed, -1 on error or timeout (ns, 0: one second).
+int UsbEngine_Write(int id, const int8_t *data, int length, int64_t timeout);
+void UsbEngine_Stats(int id, UsbEngineStats *stats);
+// Eventfd signalled when the FTDI modem status (CTS/DSR/RI/CD) changes.
+int UsbEngine_ModemSubscribe(int id);
+void UsbEngine_ModemUnsubscribe(int id, int event_fd);
+// Last FTDI modem status, USB_MODEM_* bits, or -1 if not known.
+int UsbEngine_Modem(int id);
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SERIALSERVER_USB_ENGINE_H
@@ -0,0 +1,64 @@
+//
+// Stall detector for the threads that move serial data.
+//
+// The server loop (Serial.read / Serial.write and the GIL reacquire after
+// them), the USB reader (rxPush) and every JavaMethod_* call mark themselves
+// busy with Watchdog_Enter()/Watchdog_Leave(); entering and leaving is the
+// heartbeat. A section may nest, the outermost one carries the time the call
+// is allowed to block (e.g. the read timeout). A watchdog thread checks all
+// busy threads every threshold/4 and records a stall event once a section
+// overruns its allowance by more than the threshold: the stack of native call
+// sites, the Python traceback of the thread (of all threads while waiting for
+// the GIL) and the duration, updated until the section ends.
+//
+// Events are kept in a bounded in-memory log, served on the metrics port
+// (/stalls, serial_stalls_total) and through android.Serial.metrics.
+//
+
+#ifndef SERIALSERVER_WATCHDOG_H
+#define SERIALSERVER_WATCHDOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WATCHDOG_DEFAULT_THRESHOLD_MS 200
+#define WATCHDOG_MAX_EVENTS 32
+#define WATCHDOG_GIL_SITE "GIL acquire"
+
+typedef struct {
+    uint64_t realtime_ns;   // when the stall was detected
+    uint64_t duration_ns;   // section time so far, final once resolved
+    uint64_t expected_ns;   // allowed blocking time of the outermost section
+    int tid;
+    int port;
+    bool resolved;
+    char sites[128];        // "Serial.write > JavaMethod_WriteSerial > writeSerial"
+    char python[2048];      // traceback as written by faulthandler
+} WatchdogEvent;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Starts the watchdog thread once; later calls only change the threshold.
+void Watchdog_Start(int threshold_ms);
+// `expected_ms` only counts for the outermost section; `tstate` is the
+// PyThreadState of a Python thread (NULL keeps the one of the outer section).
+void Watchdog_Enter(const char *site, int port, int expected_ms, void *tstate);
+void Watchdog_Leave(void);
+// Copies up to `max` events, newest first; returns the count.
+int Watchdog_Events(WatchdogEvent *events, int max);
+#ifdef __cplusplus
+}
+
+class WatchdogScope {
+public:
+    WatchdogScope(const char *site, int port, int expected_ms = 0) {
+        Watchdog_Enter(site, port, expected_ms, nullptr);
+    }
+    ~WatchdogScope() { Watchdog_Leave(); }
+    WatchdogScope(const WatchdogScope &) = delete;
+    WatchdogScope &operator=(const WatchdogScope &) = delete;
+};
+#endif
+
+#endif //SERIALSERVER_WATCHDOG_H
@@ -26,9 +26,26 @@
 #include <string>
 #include <cstdarg>
 #include <functional>
+#include <atomic>
 #include <mutex>
 
+#include "buffer_pool.h"
+#include "capture.h"
+#include "esp_accel.h"
+#include "flow_ctl.h"
 #include "java_method.h"
+#include "metrics.h"
+#include "modbus_gw.h"
+#include "mono_clock.h"
+#include "mux_server.h"
+#include "port_sched.h"
+#include "rx_ring.h"
+#include "session_pool.h"
+#include "telnet_zip.h"
+#include "thread_sched.h"
+#include "trace.h"
+#include "usb_engine.h"
+#include "watchdog.h"
 
 #define LOG_LEVEL LOG_LEVEL_WARN
 #include "log.h"
@@ -58,12 +75,136 @@ Java_cc_axyz_serialserver_SerialService_rfc2217Init(JNIEnv *env, jobject thiz,
     librfc2217_init_c(binary_filename.c_str());
 }
 
+extern "C"
+JNIEXPORT jint JNICALL
+Java_cc_axyz_serialserver_SerialService_captureOpen(JNIEnv *env, jobject thiz, jstring path, jint size) {
+    const char *nativeString = env->GetStringUTFChars(path, nullptr);
+    int ret = Capture_Open(nativeString, size);
+    env->ReleaseStringUTFChars(path, nativeString);
+    return ret;
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_cc_axyz_serialserver_SerialService_metricsServe(JNIEnv *env, jobject thiz, jint tcpPort) {
+    return Metrics_Serve(tcpPort);
+}
+
 extern "C"
 JNIEXPORT void JNICALL
 Java_cc_axyz_serialserver_SerialService_rfc2217Start(JNIEnv *env, jobject thiz, jint port, jint tcpPort, jint verbose) {
+    ThreadSched_Enter(SCHED_ROLE_SERVER);
     librfc2217_start_c(port, tcpPort, verbose);
 }
 
+extern "C"
+JNIEXPORT jint JNICALL
+Java_cc_axyz_serialserver_SerialService_portSchedStart(JNIEnv *env, jobject thiz, jint tcpBase, jint firstId,
+                                                      jint count, jint workers) {
+    return PortSched_Start(tcpBase, firstId, count, workers);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_cc_axyz_serialserver_SerialService_portSchedCompress(JNIEnv *env, jobject thiz, jboolean compress) {
+    PortSched_SetCompress(compress);
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_cc_axyz_serialserver_SerialService_portSchedConfigure(JNIEnv *env, jobject thiz, jstring spec) {
+    const char *nativeString = env->GetStringUTFChars(spec, nullptr);
+    int ret = PortSched_Configure(nativeString);
+    env->ReleaseStringUTFChars(spec, nativeString);
+    return ret;
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_cc_axyz_serialserver_SerialService_telnetZipStart(JNIEnv *env, jobject thiz, jint tcpPort, jint upstreamPort) {
+    return TelnetZip_Start(tcpPort, upstreamPort);
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_cc_axyz_serialserver_SerialService_espAccelStart(JNIEnv *env, jobject thiz, jint tcpPort, jint upstreamPort,
+                                                      jint id) {
+    return EspAccel_Start(tcpPort, upstreamPort, id);
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_cc_axyz_serialserver_SerialService_muxStart(JNIEnv *env, jobject thiz, jint tcpPort) {
+    return MuxServer_Start(tcpPort);
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_cc_axyz_serialserver_SerialService_modbusStart(JNIEnv *env, jobject thiz, jint tcpPort, jint id, jstring spec) {
+    const char *nativeString = env->GetStringUTFChars(spec, nullptr);
+    int ret = ModbusGw_Start(tcpPort, id, nativeString);
+    env->ReleaseStringUTFChars(spec, nativeString);
+    return ret;
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_cc_axyz_serialserver_SerialService_sessionConfigure(JNIEnv *env, jobject thiz, jstring spec) {
+    const char *nativeString = env->GetStringUTFChars(spec, nullptr);
+    int ret = SessionPool_Configure(nativeString);
+    env->ReleaseStringUTFChars(spec, nativeString);
+    return ret;
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_cc_axyz_serialserver_SerialService_schedConfigure(JNIEnv *env, jobject thiz, jstring spec) {
+    const char *nativeString = env->GetStringUTFChars(spec, nullptr);
+    int ret = ThreadSched_Configure(nativeString);
+    env->ReleaseStringUTFChars(spec, nativeString);
+    return ret;
+}
+
+// Called from the SerialInputOutputManager thread for every received USB packet.
+extern "C"
+JNIEXPORT void JNICALL
+Java_cc_axyz_serialserver_Serial_rxPush(JNIEnv *env, jobject thiz, jint id, jbyteArray data) {
+    TRACE_SCOPE("rxPush");
+    WatchdogScope watchdog("rxPush", id);
+    ThreadSched_Enter(SCHED_ROLE_USB);
+    jsize length = env->GetArrayLength(data);
+    // Copied out rather than pinned: the push takes locks and runs the notify hooks, which must not happen
+    // inside a critical region.
+    auto *bytes = static_cast<int8_t *>(BufferPool_Get(length));
+    if (bytes == nullptr) {
+        return;
+    }
+    env->GetByteArrayRegion(data, 0, length, bytes);
+    RxRing_Push(id, bytes, length);
+    BufferPool_Put(bytes);
+}
+
+// Replaces SerialInputOutputManager: the bulk endpoints of the opened connection move to usb_engine.cpp.
+extern "C"
+JNIEXPORT jint JNICALL
+Java_cc_axyz_serialserver_Serial_usbEngineStart(JNIEnv *env, jobject thiz, jint id, jint fd, jint framing,
+                                                 jint epIn, jint epOut, jint maxPacket) {
+    return UsbEngine_Start(id, fd, (UsbFraming) framing, epIn, epOut, maxPacket, 0, 0);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_cc_axyz_serialserver_Serial_usbEngineStop(JNIEnv *env, jobject thiz, jint id) {
+    UsbEngine_Stop(id);
+}
+
+// The device of port `id` was unplugged; a lingering session must not be reused.
+extern "C"
+JNIEXPORT void JNICALL
+Java_cc_axyz_serialserver_Serial_sessionDrop(JNIEnv *env, jobject thiz, jint id) {
+    SessionPool_Drop(id);
+}
+
 /*
  * This is called by the VM when the shared library is first loaded.
  */
@@ -78,6 +219,19 @@ static JavaVM *g_vm;
 static jobject classLoader;
 static jclass serialClass;
 static std::mutex mutex;
+static std::atomic<bool> portOpened[METRICS_MAX_PORTS];
+static std::atomic<bool> portEverOpened[METRICS_MAX_PORTS];
+// Reused Java array per port: one writer per port, grown to the buffer pool
+// class of the largest write so far.
+struct WriteArray {
+    std::mutex lock;
+    jbyteArray array;
+    jsize capacity;
+};
+static WriteArray writeArrays[METRICS_MAX_PORTS];
+static jmethodID writeSerialMethod;
+// Looked up once: mux_server.cpp asks for all four modem lines on every MODEM frame.
+static jmethodID statusSerialMethod;
 
 // https://zhuanlan.zhihu.com/p/157890838
 // https://developer.android.com/training/articles/perf-jni#faq:-why-didnt-findclass-find-my-class
@@ -88,6 +242,7 @@ jint JNI_OnLoad(JavaVM *vm, void *reserved) {
     jint result = -1;
     JNIEnv *env = nullptr;
 
+    Log_Init();
     LOG_DEBUG("JNI_OnLoad");
     g_vm = vm;
 
@@ -116,6 +271,8 @@ jint JNI_OnLoad(JavaVM *vm, void *reserved) {
 
     jclass pClass = env->FindClass("cc/axyz/serialserver/Serial");
     serialClass = static_cast<jclass>(env->NewGlobalRef(pClass));
+    writeSerialMethod = env->GetStaticMethodID(serialClass, "writeSerial", "(I[BIJ)I");
+    statusSerialMethod = env->GetStaticMethodID(serialClass, "statusSerial", "(ILjava/lang/String;)I");
 
     return result;
 }
@@ -125,6 +282,7 @@ static int get_env(JNIEnv **env) {
     int status = (*g_vm).GetEnv((void **) env, JNI_VERSION_1_4);
     if (status < 0) {
         LOG_DEBUG("callback_handler:failed to get JNI environment assuming native thread");
+        TRACE_SCOPE("AttachCurrentThread");
         status = (*g_vm).AttachCurrentThread(env, nullptr);
         if (status < 0) {
             LOG_ERROR("callback_handler: failed to attach current thread");
@@ -139,6 +297,8 @@ template<typename T, typename... Args>
 static T callMethod(const T ret_value, const char *method_name, const char *signature,
                     std::function<T(JNIEnv*, jclass, jmethodID, Args...)> callFunc,
                     Args... args) {
+    TRACE_SCOPE(method_name);
+    WatchdogScope watchdog(method_name, -1);
     T ret = ret_value;
     JNIEnv *env = nullptr;
     jclass pClass = nullptr;
@@ -197,85 +357,188 @@ static T callMethod(const T ret_value, const char *method_name, const char *sign
     return ret;
 }
 
+// Opens the port through Java: device enumeration, driver probe, reader start.
+static int open_cold(int id) {
+    TRACE_SCOPE(__func__);
+    // The receive ring must exist before the USB reader thread starts pushing.
+    if (RxRing_Open(id, RX_RING_DEFAULT_CAPACITY) < 0) {
+        return -1;
+    }
+    std::function<int(JNIEnv *, jclass, jmethodID)> call_func = [id](JNIEnv *env, jclass cls,
+                                                                        jmethodID mid) -> jint {
+        return env->CallStaticIntMethod(cls, mid, id);
+    };
+    int ret = callMethod(-65535, "openSerial", "(I)I", call_func);
+    if (ret != 1) {
+        RxRing_Close(id);
+    }
+    return ret;
+}
+
+// Also called from the session pool reaper once a port lingered long enough.
+static int close_cold(int id) {
+    TRACE_SCOPE(__func__);
+    std::function<int(JNIEnv *, jclass, jmethodID)> call_func = [id](JNIEnv *env, jclass cls, jmethodID mid) -> jint {
+        return env->CallStaticIntMethod(cls, mid, id);
+    };
+    int ret = callMethod(-65535, "closeSerial", "(I)I", call_func);
+    RxRing_Close(id);
+    return ret;
+}
+
 extern "C" {
 // cc.axyz.serialserver.Serial.openSerial(int id)
 int JavaMethod_OpenSerial(int id) {
+    MetricsTimer timer(METRIC_OPEN);
+    TRACE_SCOPE(__func__);
+    WatchdogScope watchdog(__func__, id);
     // std::lock_guard<std::mutex> lock(mutex);
     LOG_DEBUG("");
-    std::function<int(JNIEnv *, jclass, jmethodID)> call_func = [id](JNIEnv *env, jclass cls,
-                                                                        jmethodID mid) -> jint {
-        return env->CallStaticIntMethod(cls, mid, id);
-    };
-    return callMethod(-65535, "openSerial", "(I)I", call_func);
+    int ret = SessionPool_Open(id, open_cold);
+    if (ret != 1) {
+        return ret;
+    }
+    if (id >= 0 && id < METRICS_MAX_PORTS && !portOpened[id].exchange(true)) {
+        TRACE_ASYNC_BEGIN("port open", id);
+        Metrics_Add(id, METRIC_CLIENTS, 1);
+        if (portEverOpened[id].exchange(true)) {
+            Metrics_Add(id, METRIC_RECONNECTS, 1);
+        }
+    }
+    return ret;
 }
 
 int JavaMethod_CloseSerial(int id) {
+    MetricsTimer timer(METRIC_CLOSE);
+    TRACE_SCOPE(__func__);
+    WatchdogScope watchdog(__func__, id);
     // std::lock_guard<std::mutex> lock(mutex);
     LOG_DEBUG("");
-    std::function<int(JNIEnv *, jclass, jmethodID)> call_func = [id](JNIEnv *env, jclass cls, jmethodID mid) -> jint {
-        return env->CallStaticIntMethod(cls, mid, id);
-    };
-    return callMethod(-65535, "closeSerial", "(I)I", call_func);
+    int ret = SessionPool_Close(id, close_cold);
+    // closeSerial() reports 0 for a device that is already gone, count by state instead.
+    if (id >= 0 && id < METRICS_MAX_PORTS && portOpened[id].exchange(false)) {
+        TRACE_ASYNC_END("port open", id);
+        Metrics_Add(id, METRIC_CLIENTS, -1);
+    }
+    return ret;
 }
 
 // configureSerial(id: Int, baudRate: Int, dataBits: Int, stopBits: Float, parity: Char)
 int JavaMethod_ConfigureSerial(int id, int baudRate, int dataBits, float stopBits, char parity) {
+    MetricsTimer timer(METRIC_CONFIGURE);
+    TRACE_SCOPE(__func__);
+    WatchdogScope watchdog(__func__, id);
     // std::lock_guard<std::mutex> lock(mutex);
     LOG_DEBUG("baudRate: %d, dataBits: %d, stopBits: %.2f, parity: %c", baudRate, dataBits, stopBits, parity);
+    // A client attaching to a warm port usually sends the settings it already has.
+    if (SessionPool_SameConfig(id, baudRate, dataBits, stopBits, parity)) {
+        return 1;
+    }
     std::function<int(JNIEnv *, jclass, jmethodID)> call_func = [&](
             JNIEnv *env, jclass cls, jmethodID mid) -> jint {
         return env->CallStaticIntMethod(cls, mid, id, baudRate, dataBits, stopBits,parity);
     };
-    return callMethod(-65535, "configureSerial", "(IIIFC)I", call_func);
-}
-
-// fun readSerial(id: Int, size: Int, timeout: Int) : ByteArray
-int JavaMethod_ReadSerial(int id, int size, int timeout, int8_t **data) {
-    std::lock_guard<std::mutex> lock(mutex);
-    LOG_DEBUG("size: %d, timeout: %d", size, timeout);
-    JNIEnv *env = nullptr;
-    int attached = get_env(&env);
-    *data = nullptr;
-    jbyteArray result = nullptr;
-    jmethodID pMethod = env->GetStaticMethodID(serialClass, "readSerial", "(III)[B");
-    result = static_cast<jbyteArray>(env->CallStaticObjectMethod(serialClass, pMethod, id, size,
-                                                                 timeout));
-    if (result == nullptr) {
-        LOG_ERROR("Failed to read serial with id %d", id);
-        return -1;
-    }
-    LOG_DEBUG("result: %p", result);
-    int length = 0;
-    length = env->GetArrayLength(result);
-    jbyte *bytes = env->GetByteArrayElements(result, nullptr);
-    *data = (int8_t *) malloc(length);
-    memcpy(*data, bytes, length);
-    env->ReleaseByteArrayElements(result, bytes, JNI_OK);
-    if (attached) {
-        g_vm->DetachCurrentThread();
+    int ret = callMethod(-65535, "configureSerial", "(IIIFC)I", call_func);
+    if (ret == 1) {
+        SessionPool_SetConfig(id, baudRate, dataBits, stopBits, parity);
     }
-    return length;
+    return ret;
 }
 
-// fun writeSerial(id: Int, data : ByteArray, timeout: Int) : Int
-int JavaMethod_WriteSerial(int id, int8_t *data, int length, int timeout) {
+// fun writeSerial(id: Int, data : ByteArray, length: Int, timeoutNs: Long) : Int
+static int write_serial(int id, int8_t *data, int length, int64_t timeout) {
+    MetricsTimer timer(METRIC_WRITE);
+    TRACE_SCOPE(__func__);
+    WatchdogScope watchdog(__func__, id, MonoClock_ToMs(timeout));
     // std::lock_guard<std::mutex> lock(mutex);
-    LOG_DEBUG("data: %p, length: %d, timeout: %d", data, length, timeout);
+    LOG_DEBUG("data: %p, length: %d, timeout: %lld ns", data, length, (long long) timeout);
+    Capture_Record(id, CAPTURE_DIR_TX, data, length);
+    if (UsbEngine_Active(id)) {
+        int ret = UsbEngine_Write(id, data, length, timeout);
+        Metrics_Add(id, METRIC_WRITES, 1);
+        if (ret >= 0) {
+            Metrics_Add(id, METRIC_TX_BYTES, length);
+        }
+        return ret;
+    }
     jbyteArray j_data = nullptr;
     JNIEnv *env = nullptr;
     int attached = get_env(&env);
-    j_data = env->NewByteArray(length);
-    env->SetByteArrayRegion(j_data, 0, length, (const jbyte *) data);
-    jmethodID pMethod = env->GetStaticMethodID(serialClass, "writeSerial", "(I[BI)I");
-    int ret = env->CallStaticIntMethod(serialClass, pMethod, id, j_data, timeout);
+    int ret;
+    if (id >= 0 && id < METRICS_MAX_PORTS) {
+        WriteArray &cached = writeArrays[id];
+        std::lock_guard<std::mutex> guard(cached.lock);
+        if (cached.capacity < length) {
+            if (cached.array) {
+                env->DeleteGlobalRef(cached.array);
+            }
+            jsize capacity = (jsize) BufferPool_ClassSize(length);
+            jbyteArray local = env->NewByteArray(capacity);
+            cached.array = static_cast<jbyteArray>(env->NewGlobalRef(local));
+            env->DeleteLocalRef(local);
+            cached.capacity = capacity;
+        }
+        env->SetByteArrayRegion(cached.array, 0, length, (const jbyte *) data);
+        ret = env->CallStaticIntMethod(serialClass, writeSerialMethod, id, cached.array, length, (jlong) timeout);
+    } else {
+        j_data = env->NewByteArray(length);
+        env->SetByteArrayRegion(j_data, 0, length, (const jbyte *) data);
+        ret = env->CallStaticIntMethod(serialClass, writeSerialMethod, id, j_data, length, (jlong) timeout);
+        env->DeleteLocalRef(j_data);
+    }
+    Metrics_Add(id, METRIC_WRITES, 1);
+    if (ret >= 0) {
+        Metrics_Add(id, METRIC_TX_BYTES, length);
+    }
     if (attached) {
         g_vm->DetachCurrentThread();
     }
     return ret;
 }
 
+// Writes in the pieces flow control allows (flow_ctl.h); one piece without it.
+int JavaMethod_WriteSerial(int id, int8_t *data, int length, int64_t timeout) {
+    int64_t deadline = timeout > 0 ? MonoClock_Now() + timeout : INT64_MAX;
+    int offset = 0;
+    do {
+        int allowed = FlowCtl_TxWait(id, deadline);
+        if (allowed <= 0) {
+            LOG_WARN("port %d: write held by flow control for %lld ms", id, (long long) MonoClock_ToMs(timeout));
+            return -1;
+        }
+        int n = length - offset < allowed ? length - offset : allowed;
+        // No deadline: the timeout (<= 0, wait as long as it takes) goes through as is.
+        int64_t left = timeout;
+        if (deadline != INT64_MAX) {
+            left = deadline - MonoClock_Now();
+            left = left > 0 ? left : 1;
+        }
+        int ret = write_serial(id, data + offset, n, left);
+        if (ret < 0) {
+            return ret;
+        }
+        offset += n;
+    } while (offset < length);
+    return 0;
+}
+
+// fun flowControlSerial(id: Int, rtscts: Boolean) : Int
+int JavaMethod_FlowControlSerial(int id, bool rtscts) {
+    TRACE_SCOPE(__func__);
+    WatchdogScope watchdog(__func__, id);
+    LOG_DEBUG("rtscts: %d", rtscts);
+    std::function<jint(JNIEnv *, jclass, jmethodID)> call_func = [&](
+            JNIEnv *env, jclass cls, jmethodID mid) -> jint {
+        return env->CallStaticIntMethod(cls, mid, id, rtscts);
+    };
+    return callMethod(-65535, "flowControlSerial", "(IZ)I", call_func);
+}
+
 // fun rtsSerialSet(id: Int, state: Boolean) : Int
 int JavaMethod_RtsSerialSet(int id, bool state) {
+    MetricsTimer timer(METRIC_RTS_SET);
+    TRACE_SCOPE(__func__);
+    WatchdogScope watchdog(__func__, id);
     // std::lock_guard<std::mutex> lock(mutex);
     LOG_DEBUG("state: %d", state);
     std::function<jint(JNIEnv *, jclass, jmethodID)> call_func = [&](
@@ -287,6 +550,9 @@ int JavaMethod_RtsSerialSet(int id, bool state) {
 
 // fun rtsSerialGet(id: Int) : Boolean
 bool JavaMethod_RtsSerialGet(int id) {
+    MetricsTimer timer(METRIC_RTS_GET);
+    TRACE_SCOPE(__func__);
+    WatchdogScope watchdog(__func__, id);
     // std::lock_guard<std::mutex> lock(mutex);
     LOG_DEBUG("");
     std::function<jboolean(JNIEnv *, jclass, jmethodID)> call_func = [&](
@@ -300,6 +566,9 @@ bool JavaMethod_RtsSerialGet(int id) {
 
 // fun dtrSerialSet(id: Int, state: Boolean) : Int
 int JavaMethod_DtrSerialSet(int id, bool state) {
+    MetricsTimer timer(METRIC_DTR_SET);
+    TRACE_SCOPE(__func__);
+    WatchdogScope watchdog(__func__, id);
     // std::lock_guard<std::mutex> lock(mutex);
     LOG_DEBUG("state: %d", state);
     std::function<jint(JNIEnv *, jclass, jmethodID)> call_func = [&](
@@ -311,6 +580,9 @@ int JavaMethod_DtrSerialSet(int id, bool state) {
 
 // fun dtrSerialGet(id: Int) : Boolean
 bool JavaMethod_DtrSerialGet(int id) {
+    MetricsTimer timer(METRIC_DTR_GET);
+    TRACE_SCOPE(__func__);
+    WatchdogScope watchdog(__func__, id);
     // std::lock_guard<std::mutex> lock(mutex);
     LOG_DEBUG("");
     std::function<jboolean(JNIEnv *, jclass, jmethodID)> call_func = [&](
@@ -324,48 +596,24 @@ bool JavaMethod_DtrSerialGet(int id) {
 
 // fun statusSerial(id: Int, name: String) : Boolean
 int JavaMethod_StatusSerial(int id, const char *name) {
+    MetricsTimer timer(METRIC_STATUS);
+    TRACE_SCOPE(__func__);
+    WatchdogScope watchdog(__func__, id);
     // std::lock_guard<std::mutex> lock(mutex);
     LOG_DEBUG("name: %s", name);
     jstring jName = nullptr;
     JNIEnv *env = nullptr;
     int attached = get_env(&env);
     jName = env->NewStringUTF(name);
-    jmethodID pMethod = env->GetStaticMethodID(serialClass, "statusSerial", "(ILjava/lang/String;)I");
-    jint result = env->CallStaticIntMethod(serialClass, pMethod, id, jName);
+    jint result = env->CallStaticIntMethod(serialClass, statusSerialMethod, id, jName);
+    env->DeleteLocalRef(jName);
     if (attached) {
         g_vm->DetachCurrentThread();
     }
     return result;
 }
 
-// fun inWaiting(id: Int) : Int
-int JavaMethod_InWaitingSerial(int id) {
-    // std::lock_guard<std::mutex> lock(mutex);
-    LOG_DEBUG("");
-    jmethodID pMethod = nullptr;
-    JNIEnv *env = nullptr;
-    int attached = get_env(&env);
-    pMethod = env->GetStaticMethodID(serialClass, "inWaitingSerial", "(I)I");
-    jint ret = env->CallStaticIntMethod(serialClass, pMethod, id);
-    if (attached) {
-        g_vm->DetachCurrentThread();
-    }
-    return ret;
-}
-
-// fun resetInputBuffer(id: Int) : Boolean
-bool JavaMethod_ResetInputBufferSerial(int id) {
-    // std::lock_guard<std::mutex> lock(mutex);
-    LOG_DEBUG("");
-    jmethodID pMethod = nullptr;
-    JNIEnv *env = nullptr;
-    int attached = get_env(&env);
-    pMethod = env->GetStaticMethodID(serialClass, "resetInputBufferSerial", "(I)Z");
-    jboolean ret = env->CallStaticBooleanMethod(serialClass, pMethod, id);
-    if (attached) {
-        g_vm->DetachCurrentThread();
-    }
-    return (ret == JNI_TRUE);
-}
+// JavaMethod_ReadSerial, JavaMethod_InWaitingSerial and JavaMethod_ResetInputBufferSerial
+// are served from the native receive buffer, see rx_ring.cpp.
 
 }
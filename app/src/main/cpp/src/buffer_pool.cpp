@@ -0,0 +1,249 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+#include <sys/mman.h>
+
+#include "buffer_pool.h"
+#include "metrics.h"
+
+#define LOG_LEVEL LOG_LEVEL_INFO
+#include "log.h"
+
+#define BUFFER_POOL_MAGIC 0x42554642u
+#define BUFFER_POOL_MALLOC 0xffffffffu
+#define BUFFER_POOL_SLAB (64 * 1024)
+#define BUFFER_POOL_CACHE 32           // blocks per class and thread
+#define BUFFER_POOL_BATCH 16           // moved between cache and global list at once
+#define BUFFER_POOL_TAG_SHIFT 48       // user space pointers of mmap'ed slabs fit in 48 bits
+
+// Precedes every buffer, keeps the payload 16 byte aligned.
+struct BufferHeader {
+    uint32_t cls;
+    uint32_t magic;
+    uint64_t capacity;
+};
+static_assert(sizeof(BufferHeader) == 16, "header must keep the payload aligned");
+
+struct FreeBuffer {
+    std::atomic<FreeBuffer *> next;
+};
+
+struct PoolClass {
+    // Treiber stack; the upper 16 bits count pops against ABA.
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> slabs{0};
+    std::atomic<uint64_t> refills{0};
+    std::atomic<uint64_t> spills{0};
+    std::mutex grow;
+};
+
+static const uint32_t class_sizes[BUFFER_POOL_CLASS_COUNT] = {64, 512, 4096, 16384};
+static PoolClass pool[BUFFER_POOL_CLASS_COUNT];
+static std::atomic<uint64_t> fallbacks{0};
+static std::once_flag registered;
+
+static inline FreeBuffer *untag(uint64_t head) {
+    return (FreeBuffer *) (uintptr_t) (head & ((1ull << BUFFER_POOL_TAG_SHIFT) - 1));
+}
+
+static void global_push(PoolClass &c, FreeBuffer *block) {
+    uint64_t head = c.head.load(std::memory_order_relaxed);
+    do {
+        block->next.store(untag(head), std::memory_order_relaxed);
+    } while (!c.head.compare_exchange_weak(head, (head & ~((1ull << BUFFER_POOL_TAG_SHIFT) - 1)) | (uintptr_t) block,
+                                           std::memory_order_release, std::memory_order_relaxed));
+}
+
+static FreeBuffer *global_pop(PoolClass &c) {
+    uint64_t head = c.head.load(std::memory_order_acquire);
+    for (;;) {
+        FreeBuffer *block = untag(head);
+        if (!block) {
+            return nullptr;
+        }
+        // Slabs are never unmapped, so reading a block another thread just took is harmless.
+        uint64_t next = (head >> BUFFER_POOL_TAG_SHIFT) + 1;
+        next = (next << BUFFER_POOL_TAG_SHIFT) | (uintptr_t) block->next.load(std::memory_order_relaxed);
+        if (c.head.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire)) {
+            return block;
+        }
+    }
+}
+
+static char *pool_collect() {
+    std::string out = "# TYPE serial_buffer_pool_slabs gauge\n";
+    char line[128];
+    for (int i = 0; i < BUFFER_POOL_CLASS_COUNT; i++) {
+        snprintf(line, sizeof(line), "serial_buffer_pool_slabs{size=\"%u\"} %llu\n", class_sizes[i],
+                 (unsigned long long) pool[i].slabs.load(std::memory_order_relaxed));
+        out += line;
+    }
+    snprintf(line, sizeof(line), "# TYPE serial_buffer_pool_fallbacks_total counter\n"
+                                 "serial_buffer_pool_fallbacks_total %llu\n",
+             (unsigned long long) fallbacks.load(std::memory_order_relaxed));
+    out += line;
+    return strdup(out.c_str());
+}
+
+// Carves a new slab into the global list; serialised per class so that a burst
+// of empty caches maps one slab instead of one per thread.
+static bool grow(int cls) {
+    PoolClass &c = pool[cls];
+    std::lock_guard<std::mutex> guard(c.grow);
+    if (untag(c.head.load(std::memory_order_acquire))) {
+        return true;
+    }
+    std::call_once(registered, [] { Metrics_AddCollector(pool_collect); });
+    size_t block = sizeof(BufferHeader) + class_sizes[cls];
+    size_t size = BUFFER_POOL_SLAB < 4 * block ? 4 * block : BUFFER_POOL_SLAB;
+    char *slab = (char *) mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slab == MAP_FAILED) {
+        LOG_ERROR("buffer pool: mmap of %zu bytes failed", size);
+        return false;
+    }
+    for (size_t offset = 0; offset + block <= size; offset += block) {
+        BufferHeader *h = (BufferHeader *) (slab + offset);
+        h->cls = (uint32_t) cls;
+        h->magic = BUFFER_POOL_MAGIC;
+        h->capacity = class_sizes[cls];
+        global_push(c, (FreeBuffer *) (h + 1));
+    }
+    c.slabs.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+struct ThreadCache {
+    FreeBuffer *blocks[BUFFER_POOL_CLASS_COUNT][BUFFER_POOL_CACHE];
+    int count[BUFFER_POOL_CLASS_COUNT] = {0};
+    ~ThreadCache() {
+        for (int cls = 0; cls < BUFFER_POOL_CLASS_COUNT; cls++) {
+            while (count[cls] > 0) {
+                global_push(pool[cls], blocks[cls][--count[cls]]);
+            }
+        }
+    }
+};
+
+static thread_local ThreadCache cache;
+
+extern "C" {
+
+void *BufferPool_Get(size_t size) {
+    int cls = 0;
+    while (cls < BUFFER_POOL_CLASS_COUNT && size > class_sizes[cls]) {
+        cls++;
+    }
+    if (cls == BUFFER_POOL_CLASS_COUNT) {
+        fallbacks.fetch_add(1, std::memory_order_relaxed);
+        BufferHeader *h = (BufferHeader *) malloc(sizeof(BufferHeader) + size);
+        if (!h) {
+            return nullptr;
+        }
+        h->cls = BUFFER_POOL_MALLOC;
+        h->magic = BUFFER_POOL_MAGIC;
+        h->capacity = size;
+        return h + 1;
+    }
+    int &count = cache.count[cls];
+    if (count == 0) {
+        PoolClass &c = pool[cls];
+        while (count < BUFFER_POOL_BATCH) {
+            FreeBuffer *block = global_pop(c);
+            if (!block) {
+                if (count > 0 || !grow(cls)) {
+                    break;
+                }
+                continue;
+            }
+            cache.blocks[cls][count++] = block;
+        }
+        c.refills.fetch_add(1, std::memory_order_relaxed);
+        if (count == 0) {
+            return nullptr;
+        }
+    }
+    return cache.blocks[cls][--count];
+}
+
+void BufferPool_Put(void *buffer) {
+    if (!buffer) {
+        return;
+    }
+    BufferHeader *h = (BufferHeader *) buffer - 1;
+    if (h->magic != BUFFER_POOL_MAGIC) {
+        LOG_ERROR("buffer pool: %p was not allocated by the pool", buffer);
+        abort();
+    }
+    if (h->cls == BUFFER_POOL_MALLOC) {
+        free(h);
+        return;
+    }
+    int cls = (int) h->cls;
+    int &count = cache.count[cls];
+    if (count == BUFFER_POOL_CACHE) {
+        PoolClass &c = pool[cls];
+        while (count > BUFFER_POOL_CACHE - BUFFER_POOL_BATCH) {
+            global_push(c, cache.blocks[cls][--count]);
+        }
+        c.spills.fetch_add(1, std::memory_order_relaxed);
+    }
+    cache.blocks[cls][count++] = (FreeBuffer *) buffer;
+}
+
+size_t BufferPool_Capacity(const void *buffer) {
+    return buffer ? (size_t) ((const BufferHeader *) buffer - 1)->capacity : 0;
+}
+
+size_t BufferPool_ClassSize(size_t size) {
+    for (uint32_t class_size : class_sizes) {
+        if (size <= class_size) {
+            return class_size;
+        }
+    }
+    return size;
+}
+
+int BufferPool_Classes(BufferPoolClass *classes, int max) {
+    int n = max < BUFFER_POOL_CLASS_COUNT ? max : BUFFER_POOL_CLASS_COUNT;
+    for (int i = 0; i < n; i++) {
+        classes[i].size = class_sizes[i];
+        classes[i].slabs = pool[i].slabs.load(std::memory_order_relaxed);
+        classes[i].refills = pool[i].refills.load(std::memory_order_relaxed);
+        classes[i].spills = pool[i].spills.load(std::memory_order_relaxed);
+    }
+    return n;
+}
+
+uint64_t BufferPool_Fallbacks(void) {
+    return fallbacks.load(std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,185 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+
+#define LOG_LEVEL LOG_LEVEL_WARN
+#include "log.h"
+
+struct Capture {
+    CaptureFileHeader *header;
+    uint8_t *data;
+    uint64_t data_size;
+    size_t map_size;
+};
+
+static std::atomic<Capture *> current{nullptr};
+static std::atomic<int> writers{0};
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static inline uint64_t align8(uint64_t n) {
+    return (n + 7) & ~7ull;
+}
+
+static void write_record(Capture *cap, uint64_t pos, const CaptureRecord &rec, const void *payload) {
+    uint8_t *dst = cap->data + pos % cap->data_size;
+    memcpy(dst + sizeof(CaptureRecord), payload, rec.length);
+    memcpy(dst + sizeof(uint32_t), reinterpret_cast<const uint8_t *>(&rec) + sizeof(uint32_t),
+           sizeof(CaptureRecord) - sizeof(uint32_t));
+    // Publishing the magic last marks the record complete for readers.
+    __atomic_store_n(reinterpret_cast<uint32_t *>(dst), rec.magic, __ATOMIC_RELEASE);
+}
+
+extern "C" {
+
+int Capture_Open(const char *path, int size) {
+    if (current.load(std::memory_order_acquire)) {
+        return 0;
+    }
+    uint64_t data_size = align8(size > 0 ? (uint64_t) size : CAPTURE_DEFAULT_SIZE);
+    if (data_size < 4 * CAPTURE_MAX_PAYLOAD) {
+        data_size = 4 * CAPTURE_MAX_PAYLOAD;
+    }
+    // Keep the previous session next to the new one instead of overwriting it.
+    std::string previous = std::string(path) + ".1";
+    rename(path, previous.c_str());
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("open %s failed: %s", path, strerror(errno));
+        return -1;
+    }
+    size_t map_size = CAPTURE_HEADER_SIZE + data_size;
+    // Allocate all blocks up front so the hot path never faults on a full disk.
+    int err = posix_fallocate(fd, 0, (off_t) map_size);
+    if (err != 0 && ftruncate(fd, (off_t) map_size) < 0) {
+        LOG_ERROR("allocate %s failed: %s", path, strerror(err));
+        close(fd);
+        return -1;
+    }
+    void *addr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        LOG_ERROR("mmap %s failed: %s", path, strerror(errno));
+        return -1;
+    }
+    auto *header = static_cast<CaptureFileHeader *>(addr);
+    memset(header, 0, CAPTURE_HEADER_SIZE);
+    memcpy(header->magic, CAPTURE_FILE_MAGIC, sizeof(header->magic));
+    header->version = CAPTURE_VERSION;
+    header->header_size = CAPTURE_HEADER_SIZE;
+    header->data_size = data_size;
+    header->monotonic_base_ns = clock_ns(CLOCK_MONOTONIC);
+    header->realtime_base_ns = clock_ns(CLOCK_REALTIME);
+
+    auto *cap = new Capture{header, static_cast<uint8_t *>(addr) + CAPTURE_HEADER_SIZE, data_size, map_size};
+    Capture *expected = nullptr;
+    if (!current.compare_exchange_strong(expected, cap, std::memory_order_acq_rel)) {
+        munmap(addr, map_size);
+        delete cap;
+    }
+    LOG_INFO("capturing to %s (%d KiB)", path, (int) (data_size >> 10));
+    return 0;
+}
+
+void Capture_Close(void) {
+    Capture *cap = current.exchange(nullptr, std::memory_order_acq_rel);
+    if (!cap) {
+        return;
+    }
+    while (writers.load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+    msync(cap->header, cap->map_size, MS_ASYNC);
+    munmap(cap->header, cap->map_size);
+    delete cap;
+}
+
+void Capture_Record(int port, int direction, const void *data, int length) {
+    if (!current.load(std::memory_order_relaxed) || length <= 0) {
+        return;
+    }
+    writers.fetch_add(1, std::memory_order_acquire);
+    Capture *cap = current.load(std::memory_order_acquire);
+    if (cap) {
+        CaptureRecord rec;
+        rec.magic = CAPTURE_RECORD_MAGIC;
+        rec.port = (uint16_t) port;
+        rec.direction = (uint8_t) direction;
+        rec.flags = 0;
+        rec.length = (uint32_t) length;
+        rec.original_length = (uint32_t) length;
+        if (rec.length > CAPTURE_MAX_PAYLOAD) {
+            rec.length = CAPTURE_MAX_PAYLOAD;
+            rec.flags |= CAPTURE_FLAG_TRUNCATED;
+        }
+        rec.timestamp_ns = clock_ns(CLOCK_MONOTONIC);
+        uint64_t size = align8(sizeof(CaptureRecord) + rec.length);
+        auto *write_pos = reinterpret_cast<uint64_t *>(&cap->header->write_pos);
+        for (;;) {
+            uint64_t pos = __atomic_fetch_add(write_pos, size, __ATOMIC_RELAXED);
+            uint64_t offset = pos % cap->data_size;
+            uint64_t room = cap->data_size - offset;
+            if (room >= size) {
+                rec.pos = pos;
+                write_record(cap, pos, rec, data);
+                break;
+            }
+            // The reservation straddles the end of the area: pad out the tail
+            // (readers skip remainders too small for a header) and retry.
+            if (room >= sizeof(CaptureRecord)) {
+                CaptureRecord pad = {};
+                pad.magic = CAPTURE_RECORD_MAGIC;
+                pad.flags = CAPTURE_FLAG_PAD;
+                pad.length = (uint32_t) (room - sizeof(CaptureRecord));
+                pad.pos = pos;
+                pad.timestamp_ns = rec.timestamp_ns;
+                uint8_t *dst = cap->data + offset;
+                memcpy(dst + sizeof(uint32_t), reinterpret_cast<const uint8_t *>(&pad) + sizeof(uint32_t),
+                       sizeof(CaptureRecord) - sizeof(uint32_t));
+                __atomic_store_n(reinterpret_cast<uint32_t *>(dst), pad.magic, __ATOMIC_RELEASE);
+            }
+        }
+    }
+    writers.fetch_sub(1, std::memory_order_release);
+}
+
+}
@@ -0,0 +1,692 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "esp_accel.h"
+#include "line_config.h"
+#include "metrics.h"
+#include "mono_clock.h"
+#include "thread_sched.h"
+
+#define LOG_LEVEL LOG_LEVEL_INFO
+#include "log.h"
+
+#define TELNET_IAC 255
+#define TELNET_DONT 254
+#define TELNET_DO 253
+#define TELNET_WONT 252
+#define TELNET_WILL 251
+#define TELNET_SB 250
+#define TELNET_SE 240
+
+#define COM_PORT_OPTION 44
+#define SET_CONTROL 5
+#define SERVER_REPLY 100
+#define CONTROL_DTR_ON 8
+#define CONTROL_DTR_OFF 9
+#define CONTROL_RTS_ON 11
+#define CONTROL_RTS_OFF 12
+
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+// Larger than any command esptool sends, so a stream that is not SLIP
+// cannot pile up here.
+#define SLIP_FRAME_MAX 0x8000
+
+#define ESP_FLASH_DATA 0x03
+#define ESP_MEM_DATA 0x07
+#define ESP_SYNC 0x08
+#define ESP_FLASH_DEFL_DATA 0x11
+#define ESP_FLASH_ENCRYPT_DATA 0xD4
+
+enum TelnetState {
+    TELNET_STATE_DATA,
+    TELNET_STATE_IAC,
+    TELNET_STATE_VERB,
+    TELNET_STATE_SB,
+    TELNET_STATE_SB_IAC,
+};
+
+enum SyncState {
+    SYNC_IDLE,
+    SYNC_RUNNING,    // attempts sent, no answer yet
+    SYNC_DONE,       // answered; collecting responses for the client's SYNC
+};
+
+// One direction of a relay: telnet on the outside, SLIP frames inside.
+struct Stream {
+    TelnetState telnet = TELNET_STATE_DATA;
+    uint8_t verb = 0;
+    std::vector<uint8_t> sub;      // between IAC SB and IAC SE
+    bool in_frame = false;
+    bool escaped = false;
+    std::vector<uint8_t> wire;     // the frame as received, telnet escaping included
+    std::vector<uint8_t> frame;    // the frame decoded
+};
+
+// Client bytes waiting behind a marked frame, in arrival order.
+struct Item {
+    std::vector<uint8_t> wire;
+    bool frame = false;
+    bool marked = false;
+    uint8_t op = 0;
+};
+
+struct Relay {
+    int client = -1;
+    int upstream = -1;
+    Stream in;                     // client to server
+    Stream out;                    // server to client
+    bool accelerated = false;
+    bool next_marked = false;
+    std::deque<Item> queue;
+    std::vector<uint8_t> to_client;
+    std::vector<uint8_t> to_upstream;
+    // The marked frame the chip is working on.
+    bool waiting = false;
+    uint8_t waiting_op = 0;
+    int64_t waiting_deadline = 0;
+    bool failed = false;
+    // Lines as applied and as last requested by the client.
+    bool dtr = false;
+    bool rts = false;
+    bool want_dtr = false;
+    bool want_rts = false;
+    int64_t strap_until = 0;       // IO0 held low for the bootloader until then
+    int64_t absorb_until = 0;      // the client's own reset sequence is ignored until then
+    SyncState sync = SYNC_IDLE;
+    int sync_tries = 0;
+    int64_t sync_at = 0;           // next attempt, or end of collecting once done
+    std::vector<std::vector<uint8_t>> sync_responses;
+    bool client_sync = false;      // the client's own SYNC went to the chip
+};
+
+static std::atomic<int> listenFd{-1};
+static int upstreamPort = 0;
+static int portId = 0;
+
+static std::atomic<int> clientCount{0};
+static std::atomic<int> acceleratedCount{0};
+static std::atomic<uint64_t> frameCount{0};
+static std::atomic<uint64_t> pipelinedCount{0};
+static std::atomic<uint64_t> failureCount{0};
+static std::atomic<uint64_t> resetCount{0};
+static std::atomic<uint64_t> syncCount{0};
+static std::atomic<uint64_t> syncHitCount{0};
+
+// SYNC command: direction, op, size 36, checksum 0, then 07 07 12 20 and 32 x 55.
+static const std::vector<uint8_t> syncFrame = [] {
+    std::vector<uint8_t> f = {SLIP_END, 0x00, ESP_SYNC, 36, 0, 0, 0, 0, 0, 0x07, 0x07, 0x12, 0x20};
+    f.insert(f.end(), 32, 0x55);
+    f.push_back(SLIP_END);
+    return f;
+}();
+
+static bool pipelined_op(uint8_t op) {
+    return op == ESP_FLASH_DATA || op == ESP_MEM_DATA || op == ESP_FLASH_DEFL_DATA || op == ESP_FLASH_ENCRYPT_DATA;
+}
+
+static bool send_all(int fd, const uint8_t *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= (size_t) n;
+    }
+    return true;
+}
+
+static void put_sub(std::vector<uint8_t> &out, const std::vector<uint8_t> &sub) {
+    out.insert(out.end(), {TELNET_IAC, TELNET_SB});
+    for (uint8_t b : sub) {
+        out.push_back(b);
+        if (b == TELNET_IAC) {
+            out.push_back(TELNET_IAC);
+        }
+    }
+    out.insert(out.end(), {TELNET_IAC, TELNET_SE});
+}
+
+// Splits telnet bytes into negotiation, subnegotiation, SLIP frames and
+// everything else; the handler gets pass() for bytes to relay unchanged,
+// command(), sub() and frame().
+template<typename Handler>
+static void parse(Stream *s, const uint8_t *data, int length, Handler &h) {
+    for (int i = 0; i < length; i++) {
+        uint8_t b = data[i];
+        bool is_data = false;
+        switch (s->telnet) {
+            case TELNET_STATE_DATA:
+                if (b == TELNET_IAC) {
+                    s->telnet = TELNET_STATE_IAC;
+                } else {
+                    is_data = true;
+                }
+                break;
+            case TELNET_STATE_IAC:
+                s->telnet = TELNET_STATE_DATA;
+                if (b == TELNET_IAC) {
+                    is_data = true;
+                } else if (b >= TELNET_WILL) {
+                    s->verb = b;
+                    s->telnet = TELNET_STATE_VERB;
+                } else if (b == TELNET_SB) {
+                    s->sub.clear();
+                    s->telnet = TELNET_STATE_SB;
+                } else {
+                    const uint8_t command[] = {TELNET_IAC, b};
+                    h.pass(command, sizeof(command));
+                }
+                break;
+            case TELNET_STATE_VERB:
+                s->telnet = TELNET_STATE_DATA;
+                h.command(s->verb, b);
+                break;
+            case TELNET_STATE_SB:
+                if (b == TELNET_IAC) {
+                    s->telnet = TELNET_STATE_SB_IAC;
+                } else {
+                    s->sub.push_back(b);
+                }
+                break;
+            case TELNET_STATE_SB_IAC:
+                if (b == TELNET_SE) {
+                    s->telnet = TELNET_STATE_DATA;
+                    h.sub(s->sub);
+                } else {
+                    s->sub.push_back(b);
+                    s->telnet = TELNET_STATE_SB;
+                }
+                break;
+        }
+        if (!is_data) {
+            continue;
+        }
+        if (!s->in_frame) {
+            if (b == SLIP_END) {
+                s->in_frame = true;
+                s->escaped = false;
+                s->wire.assign(1, SLIP_END);
+                s->frame.clear();
+            } else {
+                const uint8_t plain[] = {b, b};
+                h.pass(plain, b == TELNET_IAC ? 2 : 1);
+            }
+            continue;
+        }
+        s->wire.push_back(b);
+        if (b == TELNET_IAC) {
+            s->wire.push_back(b);
+        }
+        if (b == SLIP_END) {
+            if (s->frame.empty()) {
+                // Two ENDs in a row: the first one closed nothing.
+                h.pass(s->wire.data(), 1);
+                s->wire.assign(1, SLIP_END);
+                continue;
+            }
+            s->in_frame = false;
+            h.frame(s);
+        } else if (s->escaped) {
+            s->escaped = false;
+            s->frame.push_back(b == SLIP_ESC_END ? SLIP_END : b == SLIP_ESC_ESC ? SLIP_ESC : b);
+        } else if (b == SLIP_ESC) {
+            s->escaped = true;
+        } else {
+            s->frame.push_back(b);
+        }
+        if (s->in_frame && s->wire.size() > SLIP_FRAME_MAX) {
+            s->in_frame = false;
+            h.pass(s->wire.data(), s->wire.size());
+        }
+    }
+}
+
+static void set_dtr(Relay *r, bool state) {
+    r->dtr = state;
+    if (LineConfig_SetDtr(portId, state) != 0) {
+        LOG_WARN("esp accel: setting DTR on port %d failed", portId);
+    }
+}
+
+static void set_rts(Relay *r, bool state) {
+    r->rts = state;
+    if (LineConfig_SetRts(portId, state) != 0) {
+        LOG_WARN("esp accel: setting RTS on port %d failed", portId);
+    }
+}
+
+static void control(Relay *r, uint8_t value, int64_t now) {
+    if (value == CONTROL_DTR_ON || value == CONTROL_DTR_OFF) {
+        r->want_dtr = value == CONTROL_DTR_ON;
+    } else {
+        r->want_rts = value == CONTROL_RTS_ON;
+    }
+    if (!r->accelerated) {
+        // The bridge acknowledges on its side.
+        put_sub(r->to_client, {COM_PORT_OPTION, SET_CONTROL + SERVER_REPLY, value});
+    }
+    if (r->absorb_until) {
+        if (!r->want_dtr && !r->want_rts) {
+            r->absorb_until = 0;
+        }
+        return;
+    }
+    if (r->want_dtr && !r->dtr && r->rts) {
+        // IO0 low requested while EN is held: release EN with IO0 low now
+        // rather than through the (1, 1) state the client passes.
+        set_dtr(r, true);
+        set_rts(r, false);
+        r->strap_until = now + ESP_ACCEL_STRAP_MS * 1000000LL;
+        r->absorb_until = now + 1000 * 1000000LL;
+        r->sync = SYNC_IDLE;
+        r->sync_responses.clear();
+        resetCount.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (value == CONTROL_DTR_ON || value == CONTROL_DTR_OFF) {
+        set_dtr(r, r->want_dtr);
+    } else {
+        set_rts(r, r->want_rts);
+    }
+}
+
+static void queue_bytes(Relay *r, const uint8_t *data, size_t length) {
+    if (r->queue.empty() || r->queue.back().frame) {
+        r->queue.emplace_back();
+    }
+    r->queue.back().wire.insert(r->queue.back().wire.end(), data, data + length);
+}
+
+struct ClientHandler {
+    Relay *r;
+    int64_t now;
+
+    void pass(const uint8_t *data, size_t length) {
+        queue_bytes(r, data, length);
+    }
+
+    void command(uint8_t verb, uint8_t option) {
+        if (option != ESP_ACCEL_OPTION) {
+            const uint8_t command[] = {TELNET_IAC, verb, option};
+            queue_bytes(r, command, sizeof(command));
+        } else if (verb == TELNET_DO && !r->accelerated) {
+            r->accelerated = true;
+            acceleratedCount.fetch_add(1, std::memory_order_relaxed);
+            LOG_INFO("esp accel: client pipelines block writes");
+        }
+    }
+
+    void sub(const std::vector<uint8_t> &sub) {
+        if (sub.size() == 3 && sub[0] == COM_PORT_OPTION && sub[1] == SET_CONTROL &&
+            (sub[2] == CONTROL_DTR_ON || sub[2] == CONTROL_DTR_OFF || sub[2] == CONTROL_RTS_ON ||
+             sub[2] == CONTROL_RTS_OFF)) {
+            control(r, sub[2], now);
+        } else if (sub.size() == 2 && sub[0] == ESP_ACCEL_OPTION && sub[1] == ESP_ACCEL_MARK) {
+            r->next_marked = r->accelerated;
+        } else if (sub.empty() || sub[0] != ESP_ACCEL_OPTION) {
+            std::vector<uint8_t> wire;
+            put_sub(wire, sub);
+            queue_bytes(r, wire.data(), wire.size());
+        }
+    }
+
+    void frame(Stream *s) {
+        Item item;
+        item.frame = true;
+        item.wire.swap(s->wire);
+        if (s->frame.size() >= 8 && s->frame[0] == 0x00) {
+            item.op = s->frame[1];
+            item.marked = r->next_marked && pipelined_op(item.op);
+            frameCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        r->next_marked = false;
+        r->queue.push_back(std::move(item));
+    }
+};
+
+static void report(Relay *r, uint8_t what, const std::vector<uint8_t> &response) {
+    std::vector<uint8_t> sub = {ESP_ACCEL_OPTION, what};
+    sub.insert(sub.end(), response.begin(), response.end());
+    put_sub(r->to_client, sub);
+}
+
+struct ServerHandler {
+    Relay *r;
+    int64_t now;
+
+    void pass(const uint8_t *data, size_t length) {
+        r->to_client.insert(r->to_client.end(), data, data + length);
+    }
+
+    void command(uint8_t verb, uint8_t option) {
+        r->to_client.insert(r->to_client.end(), {TELNET_IAC, verb, option});
+    }
+
+    void sub(const std::vector<uint8_t> &sub) {
+        put_sub(r->to_client, sub);
+    }
+
+    void frame(Stream *s) {
+        const std::vector<uint8_t> &f = s->frame;
+        if (f.size() >= 8 && f[0] == 0x01) {
+            uint8_t op = f[1];
+            if (r->waiting && op == r->waiting_op) {
+                // Size 2 or 4 status bytes, the first one 0 for success.
+                int size = f[2] | f[3] << 8;
+                r->waiting = false;
+                if (size >= 2 && f.size() > 8 && f[8] != 0) {
+                    r->failed = true;
+                    failureCount.fetch_add(1, std::memory_order_relaxed);
+                    LOG_WARN("esp accel: command 0x%02x failed with status %d/%d", op, f[8],
+                             f.size() > 9 ? f[9] : 0);
+                    report(r, ESP_ACCEL_FAIL, f);
+                } else {
+                    report(r, ESP_ACCEL_DONE, {});
+                }
+                return;
+            }
+            if (op == ESP_SYNC && !r->client_sync) {
+                if (r->sync == SYNC_RUNNING) {
+                    r->sync = SYNC_DONE;
+                    r->sync_at = now + ESP_ACCEL_SYNC_MS * 1000000LL;
+                    syncCount.fetch_add(1, std::memory_order_relaxed);
+                    LOG_INFO("esp accel: chip synced after %d attempts", r->sync_tries);
+                    if (r->accelerated) {
+                        report(r, ESP_ACCEL_SYNCED, f);
+                    }
+                }
+                if (r->sync == SYNC_DONE && r->sync_responses.size() < ESP_ACCEL_SYNC_RESPONSES) {
+                    r->sync_responses.push_back(s->wire);
+                }
+                // Late answers to local attempts are of no use to anyone.
+                return;
+            }
+        }
+        pass(s->wire.data(), s->wire.size());
+    }
+};
+
+static void run_timers(Relay *r, int64_t now) {
+    if (r->strap_until && now >= r->strap_until) {
+        r->strap_until = 0;
+        set_dtr(r, false);
+        r->sync = SYNC_RUNNING;
+        r->sync_tries = 0;
+        r->sync_at = now;
+    }
+    if (r->absorb_until && now >= r->absorb_until) {
+        r->absorb_until = 0;
+    }
+    if (r->sync == SYNC_RUNNING && now >= r->sync_at) {
+        if (r->sync_tries == ESP_ACCEL_SYNC_TRIES) {
+            r->sync = SYNC_IDLE;
+            LOG_WARN("esp accel: no answer to %d sync attempts", r->sync_tries);
+            if (r->accelerated) {
+                report(r, ESP_ACCEL_SYNCED, {});
+            }
+        } else {
+            r->sync_tries++;
+            r->sync_at = now + ESP_ACCEL_SYNC_MS * 1000000LL;
+            r->to_upstream.insert(r->to_upstream.end(), syncFrame.begin(), syncFrame.end());
+        }
+    }
+    if (r->waiting && now >= r->waiting_deadline) {
+        r->waiting = false;
+        r->failed = true;
+        failureCount.fetch_add(1, std::memory_order_relaxed);
+        LOG_WARN("esp accel: no response to command 0x%02x", r->waiting_op);
+        report(r, ESP_ACCEL_FAIL, {});
+    }
+}
+
+// Moves client bytes on until a marked frame, the reset or the local sync
+// has to finish first.
+static void drain_queue(Relay *r, int64_t now) {
+    while (!r->queue.empty() && !r->waiting && !r->strap_until && r->sync != SYNC_RUNNING) {
+        Item &item = r->queue.front();
+        if (item.frame && item.op == ESP_SYNC && r->sync == SYNC_DONE) {
+            if (r->sync_responses.size() < ESP_ACCEL_SYNC_RESPONSES && now < r->sync_at) {
+                break;
+            }
+            for (const auto &response : r->sync_responses) {
+                r->to_client.insert(r->to_client.end(), response.begin(), response.end());
+            }
+            syncHitCount.fetch_add(1, std::memory_order_relaxed);
+            r->sync = SYNC_IDLE;
+            r->sync_responses.clear();
+            r->queue.pop_front();
+            continue;
+        }
+        if (item.frame) {
+            if (item.marked && r->failed) {
+                report(r, ESP_ACCEL_DONE, {});
+                r->queue.pop_front();
+                continue;
+            }
+            r->sync = SYNC_IDLE;
+            r->client_sync = item.op == ESP_SYNC;
+            if (item.marked) {
+                r->waiting = true;
+                r->waiting_op = item.op;
+                r->waiting_deadline = now + ESP_ACCEL_TIMEOUT_MS * 1000000LL;
+                pipelinedCount.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                r->failed = false;
+            }
+        }
+        r->to_upstream.insert(r->to_upstream.end(), item.wire.begin(), item.wire.end());
+        r->queue.pop_front();
+    }
+}
+
+static int poll_timeout(Relay *r, int64_t now) {
+    bool sync_pending = r->sync == SYNC_RUNNING || (r->sync == SYNC_DONE && r->sync_at > now);
+    int64_t next = INT64_MAX;
+    for (int64_t at : {r->strap_until, r->absorb_until, r->waiting ? r->waiting_deadline : 0,
+                       sync_pending ? r->sync_at : 0}) {
+        if (at && at < next) {
+            next = at;
+        }
+    }
+    return next == INT64_MAX ? -1 : MonoClock_ToMs(next - now) + 1;
+}
+
+static int connect_upstream() {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t) upstreamPort);
+    if (fd >= 0 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static void relay_run(int client) {
+    ThreadSched_Enter(SCHED_ROLE_SERVER);
+    Relay r;
+    r.client = client;
+    r.upstream = connect_upstream();
+    static const uint8_t offer[] = {TELNET_IAC, TELNET_WILL, ESP_ACCEL_OPTION};
+    if (r.upstream < 0) {
+        LOG_WARN("esp accel: server on %d not reachable: %s", upstreamPort, strerror(errno));
+    } else if (send_all(client, offer, sizeof(offer))) {
+        int one = 1;
+        setsockopt(r.upstream, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        uint8_t buffer[16384];
+        struct pollfd fds[2] = {{client, POLLIN, 0}, {r.upstream, POLLIN, 0}};
+        for (;;) {
+            int64_t now = MonoClock_Now();
+            run_timers(&r, now);
+            drain_queue(&r, now);
+            if (!send_all(r.upstream, r.to_upstream.data(), r.to_upstream.size()) ||
+                !send_all(client, r.to_client.data(), r.to_client.size())) {
+                break;
+            }
+            r.to_upstream.clear();
+            r.to_client.clear();
+            if (poll(fds, 2, poll_timeout(&r, now)) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            now = MonoClock_Now();
+            if (fds[0].revents) {
+                ssize_t n = recv(client, buffer, sizeof(buffer), 0);
+                if (n <= 0) {
+                    break;
+                }
+                ClientHandler handler{&r, now};
+                parse(&r.in, buffer, (int) n, handler);
+            }
+            if (fds[1].revents) {
+                ssize_t n = recv(r.upstream, buffer, sizeof(buffer), 0);
+                if (n <= 0) {
+                    break;
+                }
+                ServerHandler handler{&r, now};
+                parse(&r.out, buffer, (int) n, handler);
+            }
+        }
+    }
+    if (r.upstream >= 0) {
+        close(r.upstream);
+    }
+    close(client);
+    if (r.accelerated) {
+        acceleratedCount.fetch_sub(1);
+    }
+    clientCount.fetch_sub(1);
+    LOG_INFO("esp accel: client left");
+}
+
+static void listen_run() {
+    for (;;) {
+        int fd = accept4(listenFd.load(), nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                LOG_ERROR("esp accel: accept failed: %s", strerror(errno));
+                return;
+            }
+            continue;
+        }
+        if (clientCount.fetch_add(1) >= ESP_ACCEL_MAX_CLIENTS) {
+            clientCount.fetch_sub(1);
+            LOG_WARN("esp accel: too many clients, refusing another");
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        std::thread(relay_run, fd).detach();
+    }
+}
+
+static char *esp_collect() {
+    EspAccelStats stats;
+    EspAccel_Stats(&stats);
+    char out[1024];
+    snprintf(out, sizeof(out),
+             "# TYPE serial_esp_accel_clients gauge\nserial_esp_accel_clients %d\n"
+             "# TYPE serial_esp_accel_accelerated_clients gauge\nserial_esp_accel_accelerated_clients %d\n"
+             "# TYPE serial_esp_accel_frames_total counter\nserial_esp_accel_frames_total %llu\n"
+             "# TYPE serial_esp_accel_pipelined_total counter\nserial_esp_accel_pipelined_total %llu\n"
+             "# TYPE serial_esp_accel_failures_total counter\nserial_esp_accel_failures_total %llu\n"
+             "# TYPE serial_esp_accel_resets_total counter\nserial_esp_accel_resets_total %llu\n"
+             "# TYPE serial_esp_accel_syncs_total counter\nserial_esp_accel_syncs_total %llu\n"
+             "# TYPE serial_esp_accel_sync_hits_total counter\nserial_esp_accel_sync_hits_total %llu\n",
+             stats.clients, stats.accelerated, (unsigned long long) stats.frames,
+             (unsigned long long) stats.pipelined, (unsigned long long) stats.failures,
+             (unsigned long long) stats.resets, (unsigned long long) stats.syncs,
+             (unsigned long long) stats.sync_hits);
+    return strdup(out);
+}
+
+extern "C" {
+
+int EspAccel_Start(int tcp_port, int upstream_port, int id) {
+    if (listenFd.load() >= 0) {
+        LOG_WARN("esp accel already running");
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t) tcp_port);
+    if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        listen(fd, ESP_ACCEL_MAX_CLIENTS) != 0) {
+        LOG_ERROR("esp accel: listen on %d failed: %s", tcp_port, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    upstreamPort = upstream_port;
+    portId = id;
+    listenFd.store(fd);
+    Metrics_AddCollector(esp_collect);
+    std::thread(listen_run).detach();
+    LOG_INFO("esp accel on tcp %d for the server on %d, port %d", tcp_port, upstream_port, id);
+    return 0;
+}
+
+void EspAccel_Stats(EspAccelStats *stats) {
+    stats->clients = clientCount.load(std::memory_order_relaxed);
+    stats->accelerated = acceleratedCount.load(std::memory_order_relaxed);
+    stats->frames = frameCount.load(std::memory_order_relaxed);
+    stats->pipelined = pipelinedCount.load(std::memory_order_relaxed);
+    stats->failures = failureCount.load(std::memory_order_relaxed);
+    stats->resets = resetCount.load(std::memory_order_relaxed);
+    stats->syncs = syncCount.load(std::memory_order_relaxed);
+    stats->sync_hits = syncHitCount.load(std::memory_order_relaxed);
+}
+
+}
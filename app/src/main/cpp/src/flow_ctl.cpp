@@ -0,0 +1,436 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "buffer_pool.h"
+#include "flow_ctl.h"
+#include "java_method.h"
+#include "metrics.h"
+#include "mono_clock.h"
+#include "rx_ring.h"
+#include "thread_sched.h"
+#include "trace.h"
+#include "tx_queue.h"
+#include "usb_engine.h"
+
+#define LOG_LEVEL LOG_LEVEL_INFO
+#include "log.h"
+
+#define FLOW_XONXOFF 1
+#define FLOW_RTSCTS 2
+
+struct FlowPort {
+    int id = -1;
+    std::atomic<int> mode{0};            // FLOW_* bits
+    std::atomic<bool> hardware{false};   // RTS/CTS done by the chip
+    std::atomic<bool> outputHeld{false}; // set_output_flow_control(False)
+    std::atomic<bool> throttled{false};  // ring above the high-water mark
+    std::atomic<int> chunk{INT32_MAX};
+    std::mutex lock;
+    MonoCondition changed;
+    bool peerStopped = false;            // last control character received was XOFF
+    bool inputHeld = false;              // set_input_flow_control(False)
+    bool signalled = false;              // receive side stopped towards the peer
+    int signalledMode = 0;               // how it was stopped: XON/XOFF and/or emulated RTS
+    bool resend = false;                 // send the receive state even if unchanged
+    bool ctsHigh = true;                 // emulated CTS, last poll
+    int64_t ctsAt = 0;
+    std::atomic<uint64_t> xoffRx{0};
+    std::atomic<uint64_t> xonRx{0};
+    std::atomic<uint64_t> xoffTx{0};
+    std::atomic<uint64_t> xonTx{0};
+    std::atomic<uint64_t> rtsDrops{0};
+    std::atomic<uint64_t> stalls{0};
+    std::atomic<uint64_t> stallNs{0};
+};
+
+static FlowPort *ports[RX_RING_MAX_PORTS];
+static std::mutex portsLock;
+static std::once_flag registered;
+// Set while the control thread writes, its XON/XOFF must pass a stopped gate.
+static thread_local bool sendingControl = false;
+
+static bool emulated_rtscts(FlowPort *p) {
+    return (p->mode.load(std::memory_order_relaxed) & FLOW_RTSCTS) && !p->hardware.load(std::memory_order_relaxed);
+}
+
+// Sends the receive state (XON/XOFF or RTS) whenever it differs from what the peer was told.
+static void control_run(FlowPort *p) {
+    ThreadSched_Enter(SCHED_ROLE_WRITER);
+    std::unique_lock<std::mutex> lock(p->lock);
+    for (;;) {
+        auto wanted = [p] {
+            int mode = p->mode.load(std::memory_order_relaxed);
+            bool active = (mode & FLOW_XONXOFF) || emulated_rtscts(p);
+            return active && (p->inputHeld || p->throttled.load(std::memory_order_relaxed));
+        };
+        while (!p->changed.wait_until(lock, MonoClock_Now() + 3600 * NS_PER_SEC,
+                                      [&] { return p->resend || wanted() != p->signalled; })) {
+        }
+        bool stop = wanted();
+        int mode = (p->mode.load(std::memory_order_relaxed) & FLOW_XONXOFF) | (emulated_rtscts(p) ? FLOW_RTSCTS : 0);
+        // Resuming goes out the way the stop went, even if the mode changed since.
+        if (!stop && p->signalled) {
+            mode = p->signalledMode;
+        }
+        p->signalled = stop;
+        p->signalledMode = mode;
+        p->resend = false;
+        lock.unlock();
+        TRACE_SCOPE("flow control");
+        if (mode & FLOW_XONXOFF) {
+            int8_t c = stop ? FLOW_CTL_XOFF : FLOW_CTL_XON;
+            sendingControl = true;
+            if (JavaMethod_WriteSerial(p->id, &c, 1, NS_PER_SEC) < 0) {
+                LOG_WARN("port %d: sending %s failed", p->id, stop ? "XOFF" : "XON");
+            }
+            sendingControl = false;
+            (stop ? p->xoffTx : p->xonTx).fetch_add(1, std::memory_order_relaxed);
+        }
+        if (mode & FLOW_RTSCTS) {
+            JavaMethod_RtsSerialSet(p->id, !stop);
+            if (stop) {
+                p->rtsDrops.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        LOG_DEBUG("port %d: receive side %s", p->id, stop ? "stopped" : "resumed");
+        lock.lock();
+    }
+}
+
+static char *flow_collect() {
+    std::string xoff = "# TYPE serial_flow_xoff_total counter\n";
+    std::string xon = "# TYPE serial_flow_xon_total counter\n";
+    std::string stalls = "# TYPE serial_flow_stalls_total counter\n";
+    std::string stallSeconds = "# TYPE serial_flow_stall_seconds_total counter\n";
+    std::string stopped = "# TYPE serial_flow_stopped gauge\n";
+    char line[160];
+    for (int id = 0; id < RX_RING_MAX_PORTS; id++) {
+        FlowCtlStats s;
+        {
+            std::lock_guard<std::mutex> guard(portsLock);
+            if (!ports[id]) {
+                continue;
+            }
+        }
+        FlowCtl_Stats(id, &s);
+        snprintf(line, sizeof(line), "serial_flow_xoff_total{port=\"%d\",dir=\"rx\"} %llu\n"
+                                     "serial_flow_xoff_total{port=\"%d\",dir=\"tx\"} %llu\n",
+                 id, (unsigned long long) s.xoff_rx, id, (unsigned long long) s.xoff_tx);
+        xoff += line;
+        snprintf(line, sizeof(line), "serial_flow_xon_total{port=\"%d\",dir=\"rx\"} %llu\n"
+                                     "serial_flow_xon_total{port=\"%d\",dir=\"tx\"} %llu\n",
+                 id, (unsigned long long) s.xon_rx, id, (unsigned long long) s.xon_tx);
+        xon += line;
+        snprintf(line, sizeof(line), "serial_flow_stalls_total{port=\"%d\"} %llu\n", id,
+                 (unsigned long long) s.stalls);
+        stalls += line;
+        snprintf(line, sizeof(line), "serial_flow_stall_seconds_total{port=\"%d\"} %.6f\n", id,
+                 (double) s.stall_ns / NS_PER_SEC);
+        stallSeconds += line;
+        snprintf(line, sizeof(line), "serial_flow_stopped{port=\"%d\",dir=\"tx\"} %d\n"
+                                     "serial_flow_stopped{port=\"%d\",dir=\"rx\"} %d\n",
+                 id, s.stopped, id, s.throttled);
+        stopped += line;
+    }
+    return strdup((xoff + xon + stalls + stallSeconds + stopped).c_str());
+}
+
+static int flow_filter(int id, const int8_t *data, int length, int8_t **kept);
+static void flow_level(int id, uint64_t used, uint64_t capacity);
+static const RxRingFlow hooks = {flow_filter, flow_level};
+
+// Creates the port and its control thread on first use; ports live as long as the process.
+static FlowPort *port_get(int id, bool create) {
+    if (id < 0 || id >= RX_RING_MAX_PORTS) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> guard(portsLock);
+    if (!ports[id] && create) {
+        FlowPort *p = new FlowPort();
+        p->id = id;
+        ports[id] = p;
+        std::thread(control_run, p).detach();
+        std::call_once(registered, [] {
+            RxRing_SetFlow(&hooks);
+            Metrics_AddCollector(flow_collect);
+        });
+    }
+    return ports[id];
+}
+
+// Drops XON/XOFF from received data; the last one decides whether we may send.
+static int flow_filter(int id, const int8_t *data, int length, int8_t **kept) {
+    FlowPort *p = port_get(id, false);
+    if (!p || !(p->mode.load(std::memory_order_relaxed) & FLOW_XONXOFF)) {
+        return length;
+    }
+    const uint8_t *in = (const uint8_t *) data;
+    int i = FlowCtl_Scan(in, length);
+    if (i == length) {
+        return length;
+    }
+    int8_t *out = (int8_t *) BufferPool_Get(length);
+    if (!out) {
+        return length;
+    }
+    int n = 0;
+    int start = 0;
+    uint8_t last = 0;
+    for (;;) {
+        memcpy(out + n, in + start, i - start);
+        n += i - start;
+        if (i == length) {
+            break;
+        }
+        last = in[i];
+        (last == FLOW_CTL_XOFF ? p->xoffRx : p->xonRx).fetch_add(1, std::memory_order_relaxed);
+        start = i + 1;
+        i = start + FlowCtl_Scan(in + start, length - start);
+    }
+    {
+        std::lock_guard<std::mutex> guard(p->lock);
+        p->peerStopped = last == FLOW_CTL_XOFF;
+    }
+    p->changed.notify_all();
+    LOG_DEBUG("port %d: %s received", id, last == FLOW_CTL_XOFF ? "XOFF" : "XON");
+    *kept = out;
+    return n;
+}
+
+// High and low water of the receive ring, with hysteresis.
+static void flow_level(int id, uint64_t used, uint64_t capacity) {
+    FlowPort *p = port_get(id, false);
+    if (!p || capacity == 0) {
+        return;
+    }
+    int mode = p->mode.load(std::memory_order_relaxed);
+    if (!(mode & FLOW_XONXOFF) && !emulated_rtscts(p)) {
+        return;
+    }
+    bool throttled = p->throttled.load(std::memory_order_relaxed);
+    bool high = used * 100 >= capacity * FLOW_CTL_HIGH_WATER;
+    bool low = used * 100 <= capacity * FLOW_CTL_LOW_WATER;
+    if ((high && !throttled) || (low && throttled)) {
+        {
+            std::lock_guard<std::mutex> guard(p->lock);
+            p->throttled.store(high, std::memory_order_relaxed);
+        }
+        p->changed.notify_all();
+    }
+}
+
+// Emulated CTS: the FTDI engine's last modem status when there is one, else asks the driver.
+static bool cts_get(int id) {
+    int modem = UsbEngine_Modem(id);
+    if (modem >= 0) {
+        return modem & USB_MODEM_CTS;
+    }
+    return JavaMethod_StatusSerial(id, "cts") != 0;
+}
+
+extern "C" {
+
+int FlowCtl_Configure(int id, int baudrate, bool xonxoff, bool rtscts) {
+    FlowPort *p = port_get(id, xonxoff || rtscts);
+    if (!p) {
+        return xonxoff || rtscts ? -1 : 0;
+    }
+    int mode = (xonxoff ? FLOW_XONXOFF : 0) | (rtscts ? FLOW_RTSCTS : 0);
+    int old = p->mode.load(std::memory_order_relaxed);
+    bool hardware = p->hardware.load(std::memory_order_relaxed);
+    if ((old & FLOW_RTSCTS) && !rtscts && hardware) {
+        JavaMethod_FlowControlSerial(id, false);
+        hardware = false;
+    } else if (!(old & FLOW_RTSCTS) && rtscts) {
+        int ret = JavaMethod_FlowControlSerial(id, true);
+        hardware = ret == 1;
+        if (ret < 0) {
+            LOG_WARN("port %d: chip RTS/CTS failed (%d), emulating it", id, ret);
+        } else if (!hardware) {
+            LOG_INFO("port %d: driver has no RTS/CTS, emulating it", id);
+        }
+    }
+    int chunk = INT32_MAX;
+    if (xonxoff || (rtscts && !hardware)) {
+        int64_t bytes = (int64_t) baudrate / 10 * FLOW_CTL_CHUNK_MS / 1000;
+        chunk = bytes < 16 ? 16 : bytes > TX_QUEUE_CHUNK ? TX_QUEUE_CHUNK : (int) bytes;
+    }
+    {
+        std::lock_guard<std::mutex> guard(p->lock);
+        p->hardware.store(hardware, std::memory_order_relaxed);
+        p->mode.store(mode, std::memory_order_relaxed);
+        p->chunk.store(chunk, std::memory_order_relaxed);
+        if (!xonxoff) {
+            p->peerStopped = false;
+        }
+        if (!mode) {
+            p->inputHeld = false;
+            p->throttled.store(false, std::memory_order_relaxed);
+        }
+        // Emulated RTS starts raised; the chip takes care of it otherwise.
+        if (rtscts && !(old & FLOW_RTSCTS) && !hardware) {
+            p->resend = true;
+        }
+        p->ctsAt = 0;
+    }
+    p->changed.notify_all();
+    if (mode != old) {
+        LOG_INFO("port %d: flow control%s%s%s", id, xonxoff ? " xonxoff" : "", rtscts ? " rtscts" : "",
+                 mode ? (hardware ? " (chip)" : "") : " off");
+    }
+    return 0;
+}
+
+void FlowCtl_SetInput(int id, bool enable) {
+    FlowPort *p = port_get(id, true);
+    if (!p) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(p->lock);
+        p->inputHeld = !enable;
+        p->resend = true;
+    }
+    p->changed.notify_all();
+}
+
+void FlowCtl_SetOutput(int id, bool enable) {
+    FlowPort *p = port_get(id, true);
+    if (!p) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(p->lock);
+        p->outputHeld.store(!enable, std::memory_order_relaxed);
+    }
+    p->changed.notify_all();
+}
+
+int FlowCtl_TxWait(int id, int64_t deadline) {
+    FlowPort *p = port_get(id, false);
+    if (!p || sendingControl ||
+        (!p->mode.load(std::memory_order_relaxed) && !p->outputHeld.load(std::memory_order_relaxed))) {
+        return INT32_MAX;
+    }
+    int64_t start = 0;
+    std::unique_lock<std::mutex> lock(p->lock);
+    for (;;) {
+        bool stopped = p->outputHeld.load(std::memory_order_relaxed) || p->peerStopped;
+        int64_t now = MonoClock_Now();
+        bool polling = false;
+        if (!stopped && emulated_rtscts(p)) {
+            if (!p->ctsHigh || now - p->ctsAt >= FLOW_CTL_CTS_POLL_MS * NS_PER_MS) {
+                lock.unlock();
+                bool cts = cts_get(id);
+                lock.lock();
+                p->ctsHigh = cts;
+                p->ctsAt = now;
+            }
+            stopped = !p->ctsHigh;
+            polling = stopped;
+        }
+        if (!stopped) {
+            break;
+        }
+        if (!start) {
+            start = now;
+            p->stalls.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (now >= deadline) {
+            p->stallNs.fetch_add(now - start, std::memory_order_relaxed);
+            return 0;
+        }
+        int64_t until = polling && now + FLOW_CTL_CTS_POLL_MS * NS_PER_MS < deadline
+                        ? now + FLOW_CTL_CTS_POLL_MS * NS_PER_MS : deadline;
+        p->changed.wait_until(lock, until);
+    }
+    if (start) {
+        p->stallNs.fetch_add(MonoClock_Now() - start, std::memory_order_relaxed);
+    }
+    return p->chunk.load(std::memory_order_relaxed);
+}
+
+// Eight bytes at a time: x | 0x02 maps exactly XON (0x11) and XOFF (0x13) to
+// 0x13, the xor turns those bytes to zero, and the usual zero-byte test finds
+// them. A borrow can only mark bytes above a real hit, so on a little-endian
+// word the lowest mark is the first control character.
+int FlowCtl_Scan(const uint8_t *data, int length) {
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t pattern = ones * FLOW_CTL_XOFF;
+    int i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint64_t a;
+        uint64_t b;
+        memcpy(&a, data + i, 8);
+        memcpy(&b, data + i + 8, 8);
+        a = (a | ones * 0x02) ^ pattern;
+        b = (b | ones * 0x02) ^ pattern;
+        uint64_t ha = (a - ones) & ~a & ones * 0x80;
+        uint64_t hb = (b - ones) & ~b & ones * 0x80;
+        if (ha | hb) {
+            return ha ? i + (__builtin_ctzll(ha) >> 3) : i + 8 + (__builtin_ctzll(hb) >> 3);
+        }
+    }
+    for (; i < length; i++) {
+        if ((data[i] | 0x02) == FLOW_CTL_XOFF) {
+            return i;
+        }
+    }
+    return length;
+}
+
+void FlowCtl_Stats(int id, FlowCtlStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    FlowPort *p = port_get(id, false);
+    if (!p) {
+        return;
+    }
+    int mode = p->mode.load(std::memory_order_relaxed);
+    stats->xonxoff = mode & FLOW_XONXOFF;
+    stats->rtscts = mode & FLOW_RTSCTS;
+    stats->hardware = p->hardware.load(std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> guard(p->lock);
+        stats->stopped = p->outputHeld.load(std::memory_order_relaxed) || p->peerStopped ||
+                         (emulated_rtscts(p) && !p->ctsHigh);
+        stats->throttled = p->signalled;
+    }
+    stats->xoff_rx = p->xoffRx.load(std::memory_order_relaxed);
+    stats->xon_rx = p->xonRx.load(std::memory_order_relaxed);
+    stats->xoff_tx = p->xoffTx.load(std::memory_order_relaxed);
+    stats->xon_tx = p->xonTx.load(std::memory_order_relaxed);
+    stats->rts_drops = p->rtsDrops.load(std::memory_order_relaxed);
+    stats->stalls = p->stalls.load(std::memory_order_relaxed);
+    stats->stall_ns = p->stallNs.load(std::memory_order_relaxed);
+}
+
+}
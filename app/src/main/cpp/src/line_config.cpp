@@ -0,0 +1,250 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#ifdef __ANDROID__
+#include <sys/system_properties.h>
+#endif
+
+#include "flow_ctl.h"
+#include "java_method.h"
+#include "line_config.h"
+#include "metrics.h"
+#include "mono_clock.h"
+#include "rx_ring.h"
+#include "trace.h"
+
+#define LOG_LEVEL LOG_LEVEL_INFO
+#include "log.h"
+
+struct LinePort {
+    std::mutex apply;          // one apply at a time, Flush waits for the timer's
+    bool known = false;        // `applied` is what the driver has
+    LineSettings applied{};
+    bool pending = false;
+    LineSettings wanted{};
+    int64_t deadline = 0;      // INT64_MAX: held until LineConfig_Flush()
+};
+
+static LinePort ports[RX_RING_MAX_PORTS];
+static std::mutex portsLock;   // pending, wanted, deadline
+// Never destroyed: the detached timer thread still waits on it at exit.
+static MonoCondition &due = *new MonoCondition();
+static std::once_flag started;
+static int64_t coalesceWindow = LINE_CONFIG_DEFAULT_WINDOW_MS * NS_PER_MS;
+static std::atomic<uint64_t> stages{0};
+static std::atomic<uint64_t> applies{0};
+static std::atomic<uint64_t> params{0};
+static std::atomic<uint64_t> flows{0};
+static std::atomic<uint64_t> failures{0};
+
+static bool same_flow(const LineSettings &a, const LineSettings &b) {
+    return a.xonxoff == b.xonxoff && a.rtscts == b.rtscts;
+}
+
+static int apply(int id) {
+    LinePort &p = ports[id];
+    std::lock_guard<std::mutex> serial(p.apply);
+    LineSettings want;
+    {
+        std::lock_guard<std::mutex> guard(portsLock);
+        if (!p.pending) {
+            return 0;
+        }
+        want = p.wanted;
+        p.pending = false;
+    }
+    TRACE_SCOPE("line config");
+    int ret = 0;
+    bool known = p.known;
+    // Unchanged baud rate, data bits, parity and stop bits are answered by SessionPool_SameConfig() in there.
+    params.fetch_add(1, std::memory_order_relaxed);
+    if (JavaMethod_ConfigureSerial(id, want.baudrate, want.bytesize, want.stopbits, want.parity) != 1) {
+        ret = -1;
+    }
+    // The flow control's piece size follows the baud rate.
+    bool flow = want.xonxoff || want.rtscts;
+    if (!known || !same_flow(want, p.applied) || (flow && want.baudrate != p.applied.baudrate)) {
+        flows.fetch_add(1, std::memory_order_relaxed);
+        if (FlowCtl_Configure(id, want.baudrate, want.xonxoff, want.rtscts) != 0) {
+            ret = -1;
+        }
+    }
+    applies.fetch_add(1, std::memory_order_relaxed);
+    p.known = ret == 0;
+    p.applied = want;
+    if (ret != 0) {
+        failures.fetch_add(1, std::memory_order_relaxed);
+        LOG_WARN("port %d: line settings %d %d%c%.1f not applied", id, want.baudrate, want.bytesize, want.parity,
+                 want.stopbits);
+    }
+    return ret;
+}
+
+// Applies staged settings whose window ran out.
+static void timer_run() {
+    std::unique_lock<std::mutex> lock(portsLock);
+    for (;;) {
+        int64_t now = MonoClock_Now();
+        int64_t next = now + 3600 * NS_PER_SEC;
+        for (int id = 0; id < RX_RING_MAX_PORTS; id++) {
+            LinePort &p = ports[id];
+            if (!p.pending || p.deadline == INT64_MAX) {
+                continue;
+            }
+            if (p.deadline <= now) {
+                lock.unlock();
+                apply(id);
+                lock.lock();
+                now = MonoClock_Now();
+            } else if (p.deadline < next) {
+                next = p.deadline;
+            }
+        }
+        due.wait_until(lock, next);
+    }
+}
+
+static char *config_collect() {
+    LineConfigStats s;
+    LineConfig_Stats(&s);
+    char out[640];
+    snprintf(out, sizeof(out),
+             "# TYPE serial_line_config_stages_total counter\n"
+             "serial_line_config_stages_total %llu\n"
+             "# TYPE serial_line_config_applies_total counter\n"
+             "serial_line_config_applies_total %llu\n"
+             "# TYPE serial_line_config_calls_total counter\n"
+             "serial_line_config_calls_total{what=\"params\"} %llu\n"
+             "serial_line_config_calls_total{what=\"flow\"} %llu\n"
+             "# TYPE serial_line_config_failures_total counter\n"
+             "serial_line_config_failures_total %llu\n",
+             (unsigned long long) s.stages, (unsigned long long) s.applies, (unsigned long long) s.params,
+             (unsigned long long) s.flows, (unsigned long long) s.failures);
+    return strdup(out);
+}
+
+static void configure(const char *value) {
+    char *end;
+    long ms = strtol(value, &end, 10);
+    if (*value && *end == '\0' && ms >= 0) {
+        coalesceWindow = ms * NS_PER_MS;
+        LOG_INFO("line settings coalesced over %ld ms", ms);
+    } else {
+        LOG_WARN("bad coalescing window \"%s\", keeping %lld ms", value, (long long) (coalesceWindow / NS_PER_MS));
+    }
+}
+
+static void start() {
+#ifdef __ANDROID__
+    char value[PROP_VALUE_MAX] = {0};
+    if (__system_property_get("debug.serialserver.coalesce", value) > 0) {
+        configure(value);
+    }
+#else
+    const char *value = getenv("SERIAL_COALESCE");
+    if (value) {
+        configure(value);
+    }
+#endif
+    Metrics_AddCollector(config_collect);
+    std::thread(timer_run).detach();
+}
+
+extern "C" {
+
+int LineConfig_Stage(int id, const LineSettings *settings, int64_t window) {
+    if (id < 0 || id >= RX_RING_MAX_PORTS) {
+        return -1;
+    }
+    std::call_once(started, start);
+    LinePort &p = ports[id];
+    {
+        std::lock_guard<std::mutex> guard(portsLock);
+        p.wanted = *settings;
+        p.pending = true;
+        if (window == LINE_CONFIG_COALESCE) {
+            window = coalesceWindow;
+        }
+        p.deadline = window == LINE_CONFIG_HOLD ? INT64_MAX : MonoClock_Now() + window;
+        stages.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (window == 0) {
+        return apply(id);
+    }
+    due.notify_all();
+    return 0;
+}
+
+int LineConfig_Flush(int id) {
+    if (id < 0 || id >= RX_RING_MAX_PORTS) {
+        return -1;
+    }
+    return apply(id);
+}
+
+int LineConfig_SetDtr(int id, bool state) {
+    LineConfig_Flush(id);
+    return JavaMethod_DtrSerialSet(id, state);
+}
+
+int LineConfig_SetRts(int id, bool state) {
+    LineConfig_Flush(id);
+    return JavaMethod_RtsSerialSet(id, state);
+}
+
+bool LineConfig_Pending(int id) {
+    if (id < 0 || id >= RX_RING_MAX_PORTS) {
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(portsLock);
+    return ports[id].pending;
+}
+
+void LineConfig_Reset(int id) {
+    if (id < 0 || id >= RX_RING_MAX_PORTS) {
+        return;
+    }
+    LinePort &p = ports[id];
+    std::lock_guard<std::mutex> serial(p.apply);
+    std::lock_guard<std::mutex> guard(portsLock);
+    p.pending = false;
+    p.known = false;
+}
+
+void LineConfig_Stats(LineConfigStats *stats) {
+    stats->stages = stages.load(std::memory_order_relaxed);
+    stats->applies = applies.load(std::memory_order_relaxed);
+    stats->params = params.load(std::memory_order_relaxed);
+    stats->flows = flows.load(std::memory_order_relaxed);
+    stats->failures = failures.load(std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,652 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __ANDROID__
+#include <sys/system_properties.h>
+#endif
+
+#include "log.h"
+
+#define LOG_RING_SIZE (16 * 1024)   // per thread, power of two
+#define LOG_RING_COUNT 64
+#define LOG_MAX_RECORD 1024
+#define LOG_MAX_STRING 256
+#define LOG_MODULE_COUNT 32
+#define LOG_MODULE_NAME 32
+#define LOG_WRAP 0x80000000u        // record size flag: skip to the start of the ring
+
+struct LogRecord {
+    uint32_t size;       // whole record incl. arguments, 8-byte aligned
+    uint32_t suppressed; // records of this site dropped by the rate limit before this one
+    LogSite *site;
+    uint64_t ns;
+};
+
+// Single producer (the owning thread), single consumer (the writer thread).
+struct LogRing {
+    alignas(64) std::atomic<uint32_t> head;
+    alignas(64) std::atomic<uint32_t> tail;
+    std::atomic<bool> owned;
+    std::atomic<uint32_t> dropped;
+    alignas(64) uint8_t data[LOG_RING_SIZE];
+};
+
+struct LogModule {
+    char name[LOG_MODULE_NAME];
+    int level;
+};
+
+static LogRing rings[LOG_RING_COUNT];
+static std::atomic<uint32_t> unowned_dropped{0};
+
+// Module levels only change on registration (once per call site) and in
+// Log_SetLevel(); the hot path reads them through LogSite::module_level.
+static LogModule modules[LOG_MODULE_COUNT];
+static int module_count;
+static LogModule pending[LOG_MODULE_COUNT]; // levels set before the module logged anything
+static int pending_count;
+static int default_level;
+static int overflow_level;                 // shared by modules beyond LOG_MODULE_COUNT
+static std::mutex modules_lock;
+
+static std::once_flag started;
+static std::mutex drain_lock;
+// The writer sleeps on wake_fd once it found nothing; the first record after that wakes it.
+static int wake_fd = -1;
+static std::atomic<bool> writer_idle{false};
+
+static void wake_writer() {
+    // Pairs with the fence in writer_run(): either the writer sees the record or we see it idle.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (writer_idle.load(std::memory_order_relaxed) && writer_idle.exchange(false, std::memory_order_relaxed)) {
+        uint64_t one = 1;
+        ssize_t r = write(wake_fd, &one, sizeof(one));
+        (void) r;
+    }
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static void module_name(const char *file, char *name) {
+    const char *base = strrchr(file, '/');
+    base = base ? base + 1 : file;
+    size_t n = strcspn(base, ".");
+    if (n >= LOG_MODULE_NAME) {
+        n = LOG_MODULE_NAME - 1;
+    }
+    memcpy(name, base, n);
+    name[n] = '\0';
+}
+
+static int *module_resolve(LogSite *site) {
+    char name[LOG_MODULE_NAME];
+    module_name(site->file, name);
+    std::lock_guard<std::mutex> guard(modules_lock);
+    int *level = nullptr;
+    for (int i = 0; i < module_count && !level; i++) {
+        if (strcmp(modules[i].name, name) == 0) {
+            level = &modules[i].level;
+        }
+    }
+    if (!level && module_count < LOG_MODULE_COUNT) {
+        LogModule &m = modules[module_count++];
+        strcpy(m.name, name);
+        m.level = default_level;
+        for (int i = 0; i < pending_count; i++) {
+            if (strcmp(pending[i].name, name) == 0) {
+                m.level = pending[i].level;
+            }
+        }
+        level = &m.level;
+    }
+    if (!level) {
+        level = &overflow_level;
+    }
+    __atomic_store_n(&site->module_level, level, __ATOMIC_RELEASE);
+    return level;
+}
+
+// Fixed one-second window per call site; races only blur the count a little.
+static bool rate_allow(LogSite *site, uint64_t now, uint32_t *suppressed) {
+    uint64_t start = __atomic_load_n(&site->window_start_ns, __ATOMIC_RELAXED);
+    if (now - start >= 1000000000ull &&
+        __atomic_compare_exchange_n(&site->window_start_ns, &start, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&site->window_count, 0, __ATOMIC_RELAXED);
+    }
+    if (__atomic_add_fetch(&site->window_count, 1, __ATOMIC_RELAXED) > LOG_RATE_LIMIT) {
+        __atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    *suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+    return true;
+}
+
+struct RingOwner {
+    LogRing *ring = nullptr;
+    bool tried = false;
+    ~RingOwner() {
+        if (ring) {
+            ring->owned.store(false, std::memory_order_release);
+        }
+    }
+};
+
+static LogRing *ring_local() {
+    static thread_local RingOwner owner;
+    if (!owner.ring && !owner.tried) {
+        owner.tried = true;
+        for (LogRing &ring : rings) {
+            bool expected = false;
+            if (!ring.owned.load(std::memory_order_relaxed) &&
+                ring.owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                owner.ring = &ring;
+                break;
+            }
+        }
+    }
+    return owner.ring;
+}
+
+static inline uint32_t align8(uint32_t n) {
+    return (n + 7) & ~7u;
+}
+
+// Argument encoding: integers as 8 bytes, floating point as double, strings as
+// a NUL-terminated copy (truncated to LOG_MAX_STRING), '*' widths as 8 bytes.
+struct ArgWriter {
+    uint8_t *out;
+    uint32_t size;
+    uint32_t capacity;
+    bool put(const void *value, uint32_t n) {
+        if (size + n > capacity) {
+            return false;
+        }
+        memcpy(out + size, value, n);
+        size += n;
+        return true;
+    }
+    bool put64(uint64_t value) {
+        return put(&value, sizeof(value));
+    }
+};
+
+static const char *spec_parse(const char *p, int *stars, char *length, char *conv) {
+    *stars = 0;
+    while (*p && strchr("-+ #0'", *p)) {
+        p++;
+    }
+    if (*p == '*') {
+        (*stars)++;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9') {
+        p++;
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            (*stars)++;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+    *length = 0;
+    if (*p == 'h' || *p == 'l') {
+        *length = *p++;
+        if (*p == *length) {
+            *length = (char) (*length == 'l' ? 'q' : 'H'); // ll / hh
+            p++;
+        }
+    } else if (*p && strchr("zjtL", *p)) {
+        *length = *p++;
+    }
+    *conv = *p;
+    return *p ? p + 1 : p;
+}
+
+static bool args_encode(const char *fmt, va_list args, ArgWriter *w) {
+    for (const char *p = fmt; *p;) {
+        if (*p++ != '%') {
+            continue;
+        }
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+        int stars;
+        char length, conv;
+        p = spec_parse(p, &stars, &length, &conv);
+        for (int i = 0; i < stars; i++) {
+            if (!w->put64((uint64_t) (int64_t) va_arg(args, int))) {
+                return false;
+            }
+        }
+        bool ok = true;
+        switch (conv) {
+            case 'd':
+            case 'i':
+                switch (length) {
+                    case 'l': ok = w->put64((uint64_t) va_arg(args, long)); break;
+                    case 'q': ok = w->put64((uint64_t) va_arg(args, long long)); break;
+                    case 'z': ok = w->put64((uint64_t) va_arg(args, ssize_t)); break;
+                    case 'j': ok = w->put64((uint64_t) va_arg(args, intmax_t)); break;
+                    case 't': ok = w->put64((uint64_t) va_arg(args, ptrdiff_t)); break;
+                    default: ok = w->put64((uint64_t) (int64_t) va_arg(args, int)); break;
+                }
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                switch (length) {
+                    case 'l': ok = w->put64(va_arg(args, unsigned long)); break;
+                    case 'q': ok = w->put64(va_arg(args, unsigned long long)); break;
+                    case 'z': ok = w->put64(va_arg(args, size_t)); break;
+                    case 'j': ok = w->put64(va_arg(args, uintmax_t)); break;
+                    case 't': ok = w->put64((uint64_t) va_arg(args, ptrdiff_t)); break;
+                    default: ok = w->put64(va_arg(args, unsigned int)); break;
+                }
+                break;
+            case 'c':
+                ok = w->put64((uint64_t) va_arg(args, int));
+                break;
+            case 'p':
+                ok = w->put64((uint64_t) (uintptr_t) va_arg(args, void *));
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+                double value = length == 'L' ? (double) va_arg(args, long double) : va_arg(args, double);
+                ok = w->put(&value, sizeof(value));
+                break;
+            }
+            case 's': {
+                const char *s = va_arg(args, const char *);
+                if (!s) {
+                    s = "(null)";
+                }
+                uint32_t n = (uint32_t) strnlen(s, LOG_MAX_STRING);
+                ok = w->put(s, n);
+                ok = ok && w->put("", 1);
+                break;
+            }
+            case 'n':
+                (void) va_arg(args, void *);
+                break;
+            default:
+                return true; // unknown conversion, stop decoding here
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Formats one spec with the decoded value, `spec` spans '%' .. conversion.
+template<typename T>
+static int spec_print(char *out, size_t size, const char *spec, const int64_t *stars, int nstars, T value) {
+    if (nstars == 2) {
+        return snprintf(out, size, spec, (int) stars[0], (int) stars[1], value);
+    }
+    if (nstars == 1) {
+        return snprintf(out, size, spec, (int) stars[0], value);
+    }
+    return snprintf(out, size, spec, value);
+}
+
+static void args_format(const char *fmt, const uint8_t *args, const uint8_t *end, char *out, size_t size) {
+    size_t n = 0;
+    auto take64 = [&](uint64_t *value) {
+        if (args + 8 > end) {
+            return false;
+        }
+        memcpy(value, args, 8);
+        args += 8;
+        return true;
+    };
+    const char *p = fmt;
+    while (*p && n + 1 < size) {
+        if (*p != '%') {
+            out[n++] = *p++;
+            continue;
+        }
+        const char *start = p++;
+        if (*p == '%') {
+            out[n++] = '%';
+            p++;
+            continue;
+        }
+        int stars;
+        char length, conv;
+        p = spec_parse(p, &stars, &length, &conv);
+        // Rebuild the spec without its length modifier, the value types are fixed now.
+        char spec[32];
+        size_t spec_len = 0;
+        for (const char *c = start; c < p - 1 && spec_len < sizeof(spec) - 4; c++) {
+            if (!strchr("hlzjtL", *c)) {
+                spec[spec_len++] = *c;
+            }
+        }
+        int64_t star_values[2] = {0, 0};
+        for (int i = 0; i < stars; i++) {
+            uint64_t v;
+            if (!take64(&v)) {
+                goto done;
+            }
+            star_values[i] = (int64_t) v;
+        }
+        int written = 0;
+        switch (conv) {
+            case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': {
+                uint64_t v;
+                if (!take64(&v)) {
+                    goto done;
+                }
+                spec[spec_len++] = 'l';
+                spec[spec_len++] = 'l';
+                spec[spec_len++] = conv;
+                spec[spec_len] = '\0';
+                written = spec_print(out + n, size - n, spec, star_values, stars, (long long) v);
+                break;
+            }
+            case 'c': case 'p': {
+                uint64_t v;
+                if (!take64(&v)) {
+                    goto done;
+                }
+                spec[spec_len++] = conv;
+                spec[spec_len] = '\0';
+                written = conv == 'c' ? spec_print(out + n, size - n, spec, star_values, stars, (int) v)
+                                      : spec_print(out + n, size - n, spec, star_values, stars, (void *) (uintptr_t) v);
+                break;
+            }
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+                double v;
+                if (args + 8 > end) {
+                    goto done;
+                }
+                memcpy(&v, args, 8);
+                args += 8;
+                spec[spec_len++] = conv;
+                spec[spec_len] = '\0';
+                written = spec_print(out + n, size - n, spec, star_values, stars, v);
+                break;
+            }
+            case 's': {
+                const char *s = (const char *) args;
+                size_t len = strnlen(s, end - args);
+                if (len == (size_t) (end - args)) {
+                    goto done;
+                }
+                args += len + 1;
+                spec[spec_len++] = 's';
+                spec[spec_len] = '\0';
+                written = spec_print(out + n, size - n, spec, star_values, stars, s);
+                break;
+            }
+            case 'n':
+                break;
+            default:
+                goto done;
+        }
+        if (written > 0) {
+            n += (size_t) written < size - n ? (size_t) written : size - n - 1;
+        }
+    }
+done:
+    out[n < size ? n : size - 1] = '\0';
+}
+
+static void emit(const LogSite *site, const char *message, uint32_t suppressed) {
+    char extra[48] = "";
+    if (suppressed) {
+        snprintf(extra, sizeof(extra), " (%u similar suppressed)", suppressed);
+    }
+#ifdef __ANDROID__
+    __android_log_print(site->level, "native", "[%-5s] %s:%d (%s) %s%s", site->name, site->file, site->line,
+                        site->function, message, extra);
+#else
+    printf("%s[%-5s] %s (%s #%d) %s%s" COLOR_RESET "\n", site->color, site->name, site->file, site->function,
+           site->line, message, extra);
+#endif
+}
+
+static void emit_dropped(uint32_t dropped, const char *why) {
+    static LogSite site = {LOG_LEVEL_WARN, "warn", COLOR_YELLOW, __FILE__, __FUNCTION__, __LINE__, "", 0, 0, 0, 0};
+    char message[96];
+    snprintf(message, sizeof(message), "%u log records dropped (%s)", dropped, why);
+    emit(&site, message, 0);
+}
+
+// Returns true if anything was written.
+static bool drain() {
+    std::lock_guard<std::mutex> guard(drain_lock);
+    bool any = false;
+    char message[LOG_MAX_RECORD];
+    for (LogRing &ring : rings) {
+        uint32_t head = ring.head.load(std::memory_order_acquire);
+        uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+        while (tail != head) {
+            uint32_t pos = tail & (LOG_RING_SIZE - 1);
+            auto *rec = reinterpret_cast<LogRecord *>(ring.data + pos);
+            if (rec->size & LOG_WRAP) {
+                tail += LOG_RING_SIZE - pos;
+                continue;
+            }
+            const uint8_t *args = ring.data + pos + sizeof(LogRecord);
+            args_format(rec->site->fmt, args, ring.data + pos + rec->size, message, sizeof(message));
+            emit(rec->site, message, rec->suppressed);
+            tail += rec->size;
+            any = true;
+        }
+        ring.tail.store(tail, std::memory_order_release);
+        uint32_t dropped = ring.dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped) {
+            emit_dropped(dropped, "ring full");
+            any = true;
+        }
+    }
+    uint32_t dropped = unowned_dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped) {
+        emit_dropped(dropped, "no free ring");
+        any = true;
+    }
+#ifndef __ANDROID__
+    if (any) {
+        fflush(stdout);
+    }
+#endif
+    return any;
+}
+
+static void writer_run() {
+    for (;;) {
+        if (drain()) {
+            continue;
+        }
+        writer_idle.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (drain()) {
+            writer_idle.store(false, std::memory_order_relaxed);
+            continue;
+        }
+        uint64_t count;
+        if (wake_fd < 0 || read(wake_fd, &count, sizeof(count)) < 0) {
+            usleep(10 * 1000); // no eventfd: fall back to polling
+        }
+    }
+}
+
+static int level_parse(const char *value) {
+    if (!strncmp(value, "debug", 5)) return LOG_LEVEL_DEBUG;
+    if (!strncmp(value, "info", 4)) return LOG_LEVEL_INFO;
+    if (!strncmp(value, "warn", 4)) return LOG_LEVEL_WARN;
+    if (!strncmp(value, "error", 5)) return LOG_LEVEL_ERROR;
+    if (!strncmp(value, "off", 3)) return LOG_LEVEL_ERROR + 1;
+    return atoi(value);
+}
+
+// "module=level,module=level,*=level"
+static void config_apply(const char *config) {
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", config);
+    char *save = nullptr;
+    for (char *item = strtok_r(copy, ",", &save); item; item = strtok_r(nullptr, ",", &save)) {
+        char *eq = strchr(item, '=');
+        if (eq) {
+            *eq = '\0';
+            Log_SetLevel(item, level_parse(eq + 1));
+        }
+    }
+}
+
+static void start() {
+#ifdef __ANDROID__
+    char value[PROP_VALUE_MAX] = {0};
+    if (__system_property_get("debug.serialserver.log", value) > 0) {
+        config_apply(value);
+    }
+#else
+    const char *value = getenv("SERIAL_LOG");
+    if (value) {
+        config_apply(value);
+    }
+    atexit(Log_Flush);
+#endif
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    std::thread(writer_run).detach();
+}
+
+extern "C" {
+
+void Log_Init(void) {
+    std::call_once(started, start);
+}
+
+void Log_Write(LogSite *site, ...) {
+    int *level = __atomic_load_n(&site->module_level, __ATOMIC_ACQUIRE);
+    if (!level) {
+        Log_Init();
+        level = module_resolve(site);
+    }
+    if (site->level < __atomic_load_n(level, __ATOMIC_RELAXED)) {
+        return;
+    }
+    uint64_t now = now_ns();
+    uint32_t suppressed = 0;
+    if (!rate_allow(site, now, &suppressed)) {
+        return;
+    }
+    LogRing *ring = ring_local();
+    if (!ring) {
+        unowned_dropped.fetch_add(1, std::memory_order_relaxed);
+        wake_writer();
+        return;
+    }
+
+    alignas(8) uint8_t record[LOG_MAX_RECORD];
+    ArgWriter writer{record + sizeof(LogRecord), 0, LOG_MAX_RECORD - (uint32_t) sizeof(LogRecord)};
+    va_list args;
+    va_start(args, site);
+    args_encode(site->fmt, args, &writer); // a truncated record still formats its prefix
+    va_end(args);
+    auto *rec = reinterpret_cast<LogRecord *>(record);
+    rec->size = align8((uint32_t) sizeof(LogRecord) + writer.size);
+    rec->suppressed = suppressed;
+    rec->site = site;
+    rec->ns = now;
+
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    uint32_t tail = ring->tail.load(std::memory_order_acquire);
+    uint32_t pos = head & (LOG_RING_SIZE - 1);
+    uint32_t skip = pos + rec->size > LOG_RING_SIZE ? LOG_RING_SIZE - pos : 0;
+    if (LOG_RING_SIZE - (head - tail) < skip + rec->size) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        wake_writer();
+        return;
+    }
+    if (skip) {
+        reinterpret_cast<LogRecord *>(ring->data + pos)->size = LOG_WRAP;
+        head += skip;
+        pos = 0;
+    }
+    memcpy(ring->data + pos, record, rec->size);
+    ring->head.store(head + rec->size, std::memory_order_release);
+    wake_writer();
+}
+
+void Log_SetLevel(const char *module, int level) {
+    std::lock_guard<std::mutex> guard(modules_lock);
+    if (strcmp(module, "*") == 0) {
+        default_level = level;
+        overflow_level = level;
+        for (int i = 0; i < module_count; i++) {
+            __atomic_store_n(&modules[i].level, level, __ATOMIC_RELAXED);
+        }
+        pending_count = 0;
+        return;
+    }
+    for (int i = 0; i < module_count; i++) {
+        if (strcmp(modules[i].name, module) == 0) {
+            __atomic_store_n(&modules[i].level, level, __ATOMIC_RELAXED);
+        }
+    }
+    for (int i = 0; i < pending_count; i++) {
+        if (strcmp(pending[i].name, module) == 0) {
+            pending[i].level = level;
+            return;
+        }
+    }
+    if (pending_count < LOG_MODULE_COUNT) {
+        LogModule &m = pending[pending_count++];
+        snprintf(m.name, sizeof(m.name), "%s", module);
+        m.level = level;
+    }
+}
+
+void Log_Flush(void) {
+    while (drain()) {
+    }
+}
+
+}
@@ -0,0 +1,321 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include "lz_stream.h"
+#include "metrics.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5     // a block ends with at least this many literals
+#define LZ_MATCH_LIMIT 12      // and no match starts in its last 12 bytes
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+#define LZ_BUFFER_SIZE (2 * LZ_STREAM_WINDOW)
+#define LZ_NO_POSITION (-(1 << 30))
+
+struct LzEncoder {
+    uint8_t buffer[LZ_BUFFER_SIZE];  // history followed by the block being compressed
+    int end = 0;
+    int32_t table[1 << LZ_HASH_BITS];
+};
+
+struct LzDecoder {
+    uint8_t buffer[LZ_BUFFER_SIZE];
+    int end = 0;
+    uint8_t block[LZ_STREAM_BOUND(LZ_STREAM_BLOCK_MAX)];
+    int have = 0;                    // bytes of `block` collected so far
+    bool corrupt = false;
+};
+
+static std::atomic<uint64_t> rawBytes{0};
+static std::atomic<uint64_t> wireBytes{0};
+static std::atomic<uint64_t> blocks{0};
+static std::once_flag collectorAdded;
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static int hash(uint32_t sequence) {
+    return (int) ((sequence * 2654435761u) >> (32 - LZ_HASH_BITS));
+}
+
+static uint8_t *put_length(uint8_t *op, int length) {
+    for (; length >= 255; length -= 255) {
+        *op++ = 255;
+    }
+    *op++ = (uint8_t) length;
+    return op;
+}
+
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *literals, int literal_length, int offset, int match_length) {
+    uint8_t *token = op++;
+    int extra = match_length - LZ_MIN_MATCH;
+    *token = (uint8_t) (std::min(literal_length, 15) << 4 | (offset ? std::min(extra, 15) : 0));
+    if (literal_length >= 15) {
+        op = put_length(op, literal_length - 15);
+    }
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+    if (offset) {
+        *op++ = (uint8_t) offset;
+        *op++ = (uint8_t) (offset >> 8);
+        if (extra >= 15) {
+            op = put_length(op, extra - 15);
+        }
+    }
+    return op;
+}
+
+// Keeps the last window of history and moves it to the front.
+static void slide(uint8_t *buffer, int *end, int32_t *table) {
+    int delta = *end - LZ_STREAM_WINDOW;
+    memmove(buffer, buffer + delta, LZ_STREAM_WINDOW);
+    *end = LZ_STREAM_WINDOW;
+    if (table) {
+        for (int i = 0; i < 1 << LZ_HASH_BITS; i++) {
+            table[i] = std::max(table[i] - delta, LZ_NO_POSITION);
+        }
+    }
+}
+
+static int decode_block(LzDecoder *d, const uint8_t *ip, int size, bool stored) {
+    if (d->end + LZ_STREAM_BLOCK_MAX > LZ_BUFFER_SIZE) {
+        slide(d->buffer, &d->end, nullptr);
+    }
+    uint8_t *start = d->buffer + d->end;
+    uint8_t *op = start;
+    uint8_t *oend = start + LZ_STREAM_BLOCK_MAX;
+    const uint8_t *iend = ip + size;
+    if (stored) {
+        if (size > LZ_STREAM_BLOCK_MAX) {
+            return -1;
+        }
+        memcpy(op, ip, size);
+        op += size;
+        ip = iend;
+    }
+    while (ip < iend) {
+        int token = *ip++;
+        int length = token >> 4;
+        if (length == 15) {
+            int more;
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                more = *ip++;
+                length += more;
+            } while (more == 255);
+        }
+        if (length > iend - ip || length > oend - op) {
+            return -1;
+        }
+        memcpy(op, ip, length);
+        ip += length;
+        op += length;
+        if (ip == iend) {
+            break;
+        }
+        if (iend - ip < 2) {
+            return -1;
+        }
+        int offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > op - d->buffer) {
+            return -1;
+        }
+        length = token & 15;
+        if (length == 15) {
+            int more;
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                more = *ip++;
+                length += more;
+            } while (more == 255);
+        }
+        length += LZ_MIN_MATCH;
+        if (length > oend - op) {
+            return -1;
+        }
+        // Byte by byte: the copy may overlap what it produces.
+        const uint8_t *match = op - offset;
+        for (int i = 0; i < length; i++) {
+            op[i] = match[i];
+        }
+        op += length;
+    }
+    int decoded = (int) (op - start);
+    d->end += decoded;
+    return decoded;
+}
+
+static char *lz_collect() {
+    LzStreamStats stats;
+    LzStream_Stats(&stats);
+    char out[512];
+    snprintf(out, sizeof(out),
+             "# TYPE serial_lz_raw_bytes_total counter\nserial_lz_raw_bytes_total %llu\n"
+             "# TYPE serial_lz_wire_bytes_total counter\nserial_lz_wire_bytes_total %llu\n"
+             "# TYPE serial_lz_blocks_total counter\nserial_lz_blocks_total %llu\n",
+             (unsigned long long) stats.raw_bytes, (unsigned long long) stats.wire_bytes,
+             (unsigned long long) stats.blocks);
+    return strdup(out);
+}
+
+extern "C" {
+
+LzEncoder *LzStream_EncoderNew(void) {
+    std::call_once(collectorAdded, [] { Metrics_AddCollector(lz_collect); });
+    auto *e = new LzEncoder();
+    std::fill(std::begin(e->table), std::end(e->table), LZ_NO_POSITION);
+    return e;
+}
+
+void LzStream_EncoderFree(LzEncoder *encoder) {
+    delete encoder;
+}
+
+int LzStream_Compress(LzEncoder *e, const uint8_t *data, int length, uint8_t *out) {
+    length = std::min(length, LZ_STREAM_BLOCK_MAX);
+    if (e->end + length > LZ_BUFFER_SIZE) {
+        slide(e->buffer, &e->end, e->table);
+    }
+    const uint8_t *base = e->buffer;
+    memcpy(e->buffer + e->end, data, length);
+    int ip = e->end;
+    int anchor = ip;
+    int limit = ip + length;
+    uint8_t *op = out + 2;
+    if (length > LZ_MATCH_LIMIT) {
+        int match_start_limit = limit - LZ_MATCH_LIMIT;
+        int match_end_limit = limit - LZ_LAST_LITERALS;
+        int misses = 0;
+        while (ip < match_start_limit) {
+            uint32_t sequence = read32(base + ip);
+            int h = hash(sequence);
+            int ref = e->table[h];
+            e->table[h] = ip;
+            if (ref < 0 || ip - ref > LZ_MAX_OFFSET || read32(base + ref) != sequence) {
+                // Incompressible stretches are skipped faster the longer they get.
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+            while (ip > anchor && ref > 0 && base[ip - 1] == base[ref - 1]) {
+                ip--;
+                ref--;
+            }
+            int match = LZ_MIN_MATCH;
+            while (ip + match < match_end_limit && base[ref + match] == base[ip + match]) {
+                match++;
+            }
+            op = put_sequence(op, base + anchor, ip - anchor, ip - ref, match);
+            ip += match;
+            anchor = ip;
+            if (ip < match_start_limit) {
+                e->table[hash(read32(base + ip - 2))] = ip - 2;
+            }
+        }
+    }
+    op = put_sequence(op, base + anchor, limit - anchor, 0, 0);
+    e->end = limit;
+    int size = (int) (op - out) - 2;
+    if (size >= length) {
+        memcpy(out + 2, data, length);
+        size = length | LZ_STREAM_STORED;
+    }
+    out[0] = (uint8_t) (size >> 8);
+    out[1] = (uint8_t) size;
+    size = 2 + (size & ~LZ_STREAM_STORED);
+    rawBytes.fetch_add(length, std::memory_order_relaxed);
+    wireBytes.fetch_add(size, std::memory_order_relaxed);
+    blocks.fetch_add(1, std::memory_order_relaxed);
+    return size;
+}
+
+LzDecoder *LzStream_DecoderNew(void) {
+    return new LzDecoder();
+}
+
+void LzStream_DecoderFree(LzDecoder *decoder) {
+    delete decoder;
+}
+
+int LzStream_Decompress(LzDecoder *d, const uint8_t *data, int length, LzSink sink, void *context) {
+    while (length > 0 && !d->corrupt) {
+        int take;
+        if (d->have < 2) {
+            take = std::min(2 - d->have, length);
+            memcpy(d->block + d->have, data, take);
+            d->have += take;
+            data += take;
+            length -= take;
+            if (d->have < 2) {
+                break;
+            }
+        }
+        int size = (d->block[0] << 8 | d->block[1]) & ~LZ_STREAM_STORED;
+        if (size > (int) sizeof(d->block) - 2) {
+            d->corrupt = true;
+            break;
+        }
+        int need = 2 + size;
+        take = std::min(need - d->have, length);
+        memcpy(d->block + d->have, data, take);
+        d->have += take;
+        data += take;
+        length -= take;
+        if (d->have < need) {
+            break;
+        }
+        bool stored = (d->block[0] << 8 & LZ_STREAM_STORED) != 0;
+        int decoded = decode_block(d, d->block + 2, need - 2, stored);
+        d->have = 0;
+        if (decoded < 0) {
+            d->corrupt = true;
+            break;
+        }
+        sink(context, d->buffer + d->end - decoded, decoded);
+    }
+    return d->corrupt ? -1 : 0;
+}
+
+void LzStream_Stats(LzStreamStats *stats) {
+    stats->raw_bytes = rawBytes.load(std::memory_order_relaxed);
+    stats->wire_bytes = wireBytes.load(std::memory_order_relaxed);
+    stats->blocks = blocks.load(std::memory_order_relaxed);
+}
+
+}
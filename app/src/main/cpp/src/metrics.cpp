@@ -0,0 +1,428 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+#define LOG_LEVEL LOG_LEVEL_WARN
+#include "log.h"
+
+// Bucket i < 8 holds the value i, above that every power of two is split into
+// 8 linear sub-buckets: index = (msb - 2) * 8 + next three bits.
+#define METRICS_SUB_BITS 3
+#define METRICS_SUB_COUNT (1 << METRICS_SUB_BITS)
+#define METRICS_BUCKETS ((64 - METRICS_SUB_BITS + 1) * METRICS_SUB_COUNT)
+
+// Prometheus buckets are the powers of two from ~1 us to ~17 s.
+#define METRICS_EXPORT_MIN_SHIFT 10
+#define METRICS_EXPORT_MAX_SHIFT 34
+
+struct Histogram {
+    std::atomic<uint64_t> buckets[METRICS_BUCKETS];
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+struct alignas(64) Shard {
+    std::atomic<int64_t> counters[METRICS_MAX_PORTS][METRIC_COUNTER_COUNT];
+    Histogram histograms[METRIC_LATENCY_COUNT];
+    std::atomic<bool> owned;
+    Shard *next;
+};
+
+// Shards are never freed: a thread that exits hands its shard to the next new
+// thread, so the totals keep counting up.
+static std::atomic<Shard *> shards{nullptr};
+
+static Shard *shard_acquire() {
+    for (Shard *s = shards.load(std::memory_order_acquire); s; s = s->next) {
+        bool expected = false;
+        if (!s->owned.load(std::memory_order_relaxed) &&
+            s->owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            return s;
+        }
+    }
+    Shard *s = new Shard();
+    s->owned.store(true, std::memory_order_relaxed);
+    s->next = shards.load(std::memory_order_relaxed);
+    while (!shards.compare_exchange_weak(s->next, s, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+    return s;
+}
+
+struct ShardOwner {
+    Shard *shard = nullptr;
+    ~ShardOwner() {
+        if (shard) {
+            shard->owned.store(false, std::memory_order_release);
+        }
+    }
+};
+
+static Shard *shard_local() {
+    static thread_local ShardOwner owner;
+    if (!owner.shard) {
+        owner.shard = shard_acquire();
+    }
+    return owner.shard;
+}
+
+// Only the owning thread writes a shard, a plain load + store is enough.
+template<typename T>
+static inline void bump(std::atomic<T> &value, T delta) {
+    value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+static inline int bucket_index(uint64_t value) {
+    if (value < METRICS_SUB_COUNT) {
+        return (int) value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - METRICS_SUB_BITS;
+    return (shift + 1) * METRICS_SUB_COUNT + (int) ((value >> shift) & (METRICS_SUB_COUNT - 1));
+}
+
+// Largest value that still falls into bucket `index`.
+static inline uint64_t bucket_upper(int index) {
+    if (index < METRICS_SUB_COUNT) {
+        return (uint64_t) index;
+    }
+    int shift = index / METRICS_SUB_COUNT - 1;
+    uint64_t sub = (uint64_t) (index % METRICS_SUB_COUNT);
+    return ((METRICS_SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+struct HistogramSnapshot {
+    uint64_t buckets[METRICS_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+};
+
+static void histogram_collect(MetricsLatency latency, HistogramSnapshot *snapshot) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    for (Shard *s = shards.load(std::memory_order_acquire); s; s = s->next) {
+        const Histogram &h = s->histograms[latency];
+        for (int i = 0; i < METRICS_BUCKETS; i++) {
+            snapshot->buckets[i] += h.buckets[i].load(std::memory_order_relaxed);
+        }
+        snapshot->sum += h.sum.load(std::memory_order_relaxed);
+        uint64_t max = h.max.load(std::memory_order_relaxed);
+        if (max > snapshot->max) {
+            snapshot->max = max;
+        }
+    }
+    // Derive the count from the buckets so quantiles never run past the end.
+    for (uint64_t bucket : snapshot->buckets) {
+        snapshot->count += bucket;
+    }
+}
+
+static uint64_t histogram_quantile(const HistogramSnapshot &snapshot, double q) {
+    if (snapshot.count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t) (q * (double) snapshot.count);
+    uint64_t seen = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        seen += snapshot.buckets[i];
+        if (seen > rank) {
+            uint64_t upper = bucket_upper(i);
+            return upper < snapshot.max ? upper : snapshot.max;
+        }
+    }
+    return snapshot.max;
+}
+
+static const char *counter_names[METRIC_COUNTER_COUNT] = {
+        "rx_bytes", "tx_bytes", "reads", "writes", "timeouts", "overflows", "reconnects", "clients",
+};
+
+static const char *counter_help[METRIC_COUNTER_COUNT] = {
+        "Bytes received from the serial device.",
+        "Bytes written to the serial device.",
+        "Read calls from the RFC2217 server.",
+        "Write calls from the RFC2217 server.",
+        "Reads that returned less than requested after waiting.",
+        "Received bytes dropped because the receive buffer was full.",
+        "Successful port opens after the first one.",
+        "Currently open serial handles.",
+};
+
+static const char *latency_names[METRIC_LATENCY_COUNT] = {
+        "open", "close", "configure", "read", "write", "rts_set", "rts_get",
+        "dtr_set", "dtr_get", "status", "in_waiting", "reset_input", "forward",
+        "sched_queue",
+};
+
+struct MetricsPage {
+    const char *path;
+    MetricsPageFunc func;
+};
+
+// Modules register from whichever thread starts them; readers copy the list under the lock.
+static std::mutex extensionsLock;
+static std::vector<MetricsPageFunc> collectors;
+static std::vector<MetricsPage> pages;
+
+static void appendf(std::string &out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void appendf(std::string &out, const char *fmt, ...) {
+    char line[256];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (n > 0) {
+        out.append(line, n < (int) sizeof(line) ? n : (int) sizeof(line) - 1);
+    }
+}
+
+static void format_histogram(std::string &out, const char *name, const std::string &label, MetricsLatency latency) {
+    HistogramSnapshot snapshot;
+    histogram_collect(latency, &snapshot);
+    std::string prefix = label.empty() ? label : label + ",";
+    uint64_t cumulative = 0;
+    int next = 0;
+    for (int shift = METRICS_EXPORT_MIN_SHIFT; shift <= METRICS_EXPORT_MAX_SHIFT; shift++) {
+        // Every value below 2^shift lives in a bucket before bucket_index(2^shift).
+        int end = bucket_index(1ull << shift);
+        for (; next < end; next++) {
+            cumulative += snapshot.buckets[next];
+        }
+        appendf(out, "%s_bucket{%sle=\"%.9g\"} %llu\n", name, prefix.c_str(), (double) (1ull << shift) / 1e9,
+                (unsigned long long) cumulative);
+    }
+    appendf(out, "%s_bucket{%sle=\"+Inf\"} %llu\n", name, prefix.c_str(), (unsigned long long) snapshot.count);
+    appendf(out, "%s_sum{%s} %.9f\n", name, label.c_str(), (double) snapshot.sum / 1e9);
+    appendf(out, "%s_count{%s} %llu\n", name, label.c_str(), (unsigned long long) snapshot.count);
+}
+
+static void serve_run(int server) {
+    for (;;) {
+        int client = accept(server, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            LOG_ERROR("metrics accept failed: %s", strerror(errno));
+            break;
+        }
+        struct timeval timeout = {2, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        char request[1024];
+        ssize_t n = recv(client, request, sizeof(request) - 1, 0);
+        if (n > 0) {
+            request[n] = '\0';
+            std::string response;
+            char *body = nullptr;
+            if (strncmp(request, "GET /metrics", 12) == 0 || strncmp(request, "GET / ", 6) == 0) {
+                body = Metrics_Format();
+            }
+            std::vector<MetricsPage> known;
+            {
+                std::lock_guard<std::mutex> guard(extensionsLock);
+                known = pages;
+            }
+            for (size_t i = 0; !body && i < known.size(); i++) {
+                size_t n = strlen(known[i].path);
+                if (strncmp(request, "GET ", 4) == 0 && strncmp(request + 4, known[i].path, n) == 0 &&
+                    (request[4 + n] == ' ' || request[4 + n] == '?')) {
+                    body = known[i].func();
+                }
+            }
+            if (body) {
+                appendf(response, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                  "Content-Length: %zu\r\nConnection: close\r\n\r\n", strlen(body));
+                response.append(body);
+                free(body);
+            } else {
+                response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            }
+            size_t sent = 0;
+            while (sent < response.size()) {
+                ssize_t w = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+                if (w <= 0) {
+                    break;
+                }
+                sent += (size_t) w;
+            }
+        }
+        close(client);
+    }
+    close(server);
+}
+
+extern "C" {
+
+uint64_t Metrics_Now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+void Metrics_Add(int port, MetricsCounter counter, int64_t value) {
+    if (port < 0 || port >= METRICS_MAX_PORTS || counter >= METRIC_COUNTER_COUNT) {
+        return;
+    }
+    bump(shard_local()->counters[port][counter], value);
+}
+
+void Metrics_Record(MetricsLatency latency, uint64_t ns) {
+    if (latency >= METRIC_LATENCY_COUNT) {
+        return;
+    }
+    Histogram &h = shard_local()->histograms[latency];
+    bump(h.buckets[bucket_index(ns)], (uint64_t) 1);
+    bump(h.sum, ns);
+    if (ns > h.max.load(std::memory_order_relaxed)) {
+        h.max.store(ns, std::memory_order_relaxed);
+    }
+}
+
+int64_t Metrics_Counter(int port, MetricsCounter counter) {
+    if (port < 0 || port >= METRICS_MAX_PORTS || counter >= METRIC_COUNTER_COUNT) {
+        return 0;
+    }
+    int64_t total = 0;
+    for (Shard *s = shards.load(std::memory_order_acquire); s; s = s->next) {
+        total += s->counters[port][counter].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void Metrics_Summary(MetricsLatency latency, MetricsSummary *summary) {
+    memset(summary, 0, sizeof(*summary));
+    if (latency >= METRIC_LATENCY_COUNT) {
+        return;
+    }
+    HistogramSnapshot snapshot;
+    histogram_collect(latency, &snapshot);
+    summary->count = snapshot.count;
+    summary->sum_ns = snapshot.sum;
+    summary->max_ns = snapshot.max;
+    summary->p50_ns = histogram_quantile(snapshot, 0.50);
+    summary->p90_ns = histogram_quantile(snapshot, 0.90);
+    summary->p99_ns = histogram_quantile(snapshot, 0.99);
+}
+
+const char *Metrics_CounterName(MetricsCounter counter) {
+    return counter < METRIC_COUNTER_COUNT ? counter_names[counter] : "unknown";
+}
+
+const char *Metrics_LatencyName(MetricsLatency latency) {
+    return latency < METRIC_LATENCY_COUNT ? latency_names[latency] : "unknown";
+}
+
+char *Metrics_Format(void) {
+    std::string out;
+    for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+        bool gauge = c == METRIC_CLIENTS;
+        appendf(out, "# HELP serial_%s%s %s\n", counter_names[c], gauge ? "" : "_total", counter_help[c]);
+        appendf(out, "# TYPE serial_%s%s %s\n", counter_names[c], gauge ? "" : "_total",
+                gauge ? "gauge" : "counter");
+        for (int port = 0; port < METRICS_MAX_PORTS; port++) {
+            int64_t value = Metrics_Counter(port, (MetricsCounter) c);
+            // Ports that were never used would only add noise.
+            if (value != 0 || port == 0) {
+                appendf(out, "serial_%s%s{port=\"%d\"} %lld\n", counter_names[c], gauge ? "" : "_total", port,
+                        (long long) value);
+            }
+        }
+    }
+    out.append("# HELP serial_call_duration_seconds Latency of the java_method.h calls.\n"
+               "# TYPE serial_call_duration_seconds histogram\n");
+    for (int l = 0; l < METRIC_FORWARD; l++) {
+        std::string label = std::string("call=\"") + latency_names[l] + "\"";
+        format_histogram(out, "serial_call_duration_seconds", label, (MetricsLatency) l);
+    }
+    out.append("# HELP serial_forward_delay_seconds Time from USB packet arrival until the server read it.\n"
+               "# TYPE serial_forward_delay_seconds histogram\n");
+    format_histogram(out, "serial_forward_delay_seconds", "", METRIC_FORWARD);
+    out.append("# HELP serial_sched_queue_delay_seconds Time a ready raw port waited for a scheduler worker.\n"
+               "# TYPE serial_sched_queue_delay_seconds histogram\n");
+    format_histogram(out, "serial_sched_queue_delay_seconds", "", METRIC_SCHED_QUEUE);
+    std::vector<MetricsPageFunc> extensions;
+    {
+        std::lock_guard<std::mutex> guard(extensionsLock);
+        extensions = collectors;
+    }
+    for (MetricsPageFunc collect : extensions) {
+        char *extra = collect();
+        if (extra) {
+            out.append(extra);
+            free(extra);
+        }
+    }
+    return strdup(out.c_str());
+}
+
+void Metrics_AddCollector(MetricsPageFunc collect) {
+    std::lock_guard<std::mutex> guard(extensionsLock);
+    collectors.push_back(collect);
+}
+
+void Metrics_AddPage(const char *path, MetricsPageFunc page) {
+    std::lock_guard<std::mutex> guard(extensionsLock);
+    pages.push_back(MetricsPage{path, page});
+}
+
+int Metrics_Serve(int tcp_port) {
+    int server = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server < 0) {
+        LOG_ERROR("metrics socket failed: %s", strerror(errno));
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t) tcp_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(server, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(server, 4) < 0) {
+        LOG_ERROR("metrics listen on %d failed: %s", tcp_port, strerror(errno));
+        close(server);
+        return -1;
+    }
+    std::thread(serve_run, server).detach();
+    return 0;
+}
+
+}
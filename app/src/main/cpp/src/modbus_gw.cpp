@@ -0,0 +1,644 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "java_method.h"
+#include "metrics.h"
+#include "modbus_gw.h"
+#include "mono_clock.h"
+#include "rx_ring.h"
+#include "thread_sched.h"
+#include "trace.h"
+
+#define LOG_LEVEL LOG_LEVEL_INFO
+#include "log.h"
+
+#define MODBUS_MAX_PDU 253
+#define MODBUS_MAX_RTU (1 + MODBUS_MAX_PDU + 2)
+#define MODBUS_MBAP_SIZE 7
+// Above 19200 baud the spec fixes the inter-frame silence instead of scaling it.
+#define MODBUS_FIXED_GAP (1750 * NS_PER_US)
+// USB adapters hand received bytes over in latency timer sized chunks, so the
+// end of a response of unknown length is detected with at least this silence.
+#define MODBUS_RX_GAP_MIN (20 * NS_PER_MS)
+#define MODBUS_CACHE_MAX 256
+
+#define MODBUS_EX_PATH_UNAVAILABLE 0x0A
+#define MODBUS_EX_TARGET_FAILED 0x0B
+
+struct Master {
+    int fd = -1;
+    std::mutex send_lock;            // replies from the bus thread vs. close
+    bool closed = false;
+};
+
+struct Request {
+    std::shared_ptr<Master> master;
+    uint16_t tid = 0;
+    uint8_t unit = 0;
+    uint8_t pdu[MODBUS_MAX_PDU];
+    int pdu_len = 0;
+    uint64_t key = 0;                // cache key of a read, 0 otherwise
+};
+
+struct CacheEntry {
+    int64_t expires;
+    std::vector<uint8_t> pdu;
+};
+
+struct ModbusGw {
+    int id = 0;
+    int tcp_port = 0;
+    int listen_fd = -1;
+    int baud_rate = 9600;
+    int data_bits = 8;
+    float stop_bits = 1;
+    char parity = 'E';
+    int64_t timeout = 1000 * NS_PER_MS;
+    int64_t ttl = 0;
+    int64_t char_ns = 0;             // one character on the wire
+    int64_t gap = 0;                 // t3.5
+
+    std::mutex lock;                 // queue and masters
+    std::condition_variable wake;    // bus thread: queue not empty or last master left
+    std::condition_variable room;    // master readers: queue below MODBUS_GW_MAX_QUEUED
+    std::deque<std::unique_ptr<Request>> queue;
+    int masters = 0;
+
+    // Bus thread only.
+    std::unordered_map<uint64_t, CacheEntry> cache;
+    bool opened = false;
+    int64_t idle_at = 0;             // earliest start of the next request frame
+
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> transactions{0};
+    std::atomic<uint64_t> cache_hits{0};
+    std::atomic<uint64_t> coalesced{0};
+    std::atomic<uint64_t> timeouts{0};
+    std::atomic<uint64_t> crc_errors{0};
+};
+
+static std::atomic<ModbusGw *> gateway{nullptr};
+
+struct Crc16Table {
+    uint16_t entries[256];
+
+    constexpr Crc16Table() : entries() {
+        for (int i = 0; i < 256; i++) {
+            uint16_t crc = (uint16_t) i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? (uint16_t) ((crc >> 1) ^ 0xA001) : (uint16_t) (crc >> 1);
+            }
+            entries[i] = crc;
+        }
+    }
+};
+
+static constexpr Crc16Table crcTable;
+
+static bool is_read(uint8_t function) {
+    return function >= 1 && function <= 4;
+}
+
+// Reads of a whole range are cacheable; the key packs unit, function, address and quantity.
+static uint64_t cache_key(uint8_t unit, const uint8_t *pdu, int pdu_len) {
+    if (unit == 0 || pdu_len != 5 || !is_read(pdu[0])) {
+        return 0;
+    }
+    return (uint64_t) unit << 40 | (uint64_t) pdu[0] << 32 | (uint64_t) pdu[1] << 24 | (uint64_t) pdu[2] << 16 |
+           (uint64_t) pdu[3] << 8 | pdu[4];
+}
+
+static int configure(ModbusGw *gw, const char *spec) {
+    char *copy = strdup(spec ? spec : "");
+    char *save = nullptr;
+    int ret = 0;
+    for (char *item = strtok_r(copy, ",", &save); item && ret == 0; item = strtok_r(nullptr, ",", &save)) {
+        char *value = strchr(item, '=');
+        char *end = nullptr;
+        if (!value) {
+            LOG_WARN("modbus: invalid setting \"%s\"", item);
+            ret = -1;
+            break;
+        }
+        *value++ = '\0';
+        if (strcmp(item, "parity") == 0) {
+            if (strlen(value) != 1 || !strchr("NEOMS", value[0])) {
+                ret = -1;
+            } else {
+                gw->parity = value[0];
+            }
+        } else if (strcmp(item, "stop") == 0) {
+            float stop = strtof(value, &end);
+            if (*end != '\0' || (stop != 1 && stop != 1.5f && stop != 2)) {
+                ret = -1;
+            } else {
+                gw->stop_bits = stop;
+            }
+        } else {
+            long number = strtol(value, &end, 10);
+            if (*end != '\0' || number < 0) {
+                ret = -1;
+            } else if (strcmp(item, "baud") == 0 && number > 0) {
+                gw->baud_rate = (int) number;
+            } else if (strcmp(item, "data") == 0 && number >= 5 && number <= 8) {
+                gw->data_bits = (int) number;
+            } else if (strcmp(item, "timeout") == 0 && number > 0) {
+                gw->timeout = number * NS_PER_MS;
+            } else if (strcmp(item, "ttl") == 0) {
+                gw->ttl = number * NS_PER_MS;
+            } else {
+                ret = -1;
+            }
+        }
+        if (ret < 0) {
+            LOG_WARN("modbus: invalid setting \"%s=%s\"", item, value);
+        }
+    }
+    free(copy);
+    // Start bit, data bits, parity bit and stop bits.
+    double bits = 1 + gw->data_bits + (gw->parity != 'N' ? 1 : 0) + gw->stop_bits;
+    gw->char_ns = (int64_t) (bits * NS_PER_SEC / gw->baud_rate);
+    gw->gap = gw->baud_rate > 19200 ? MODBUS_FIXED_GAP : gw->char_ns * 7 / 2;
+    return ret;
+}
+
+static bool recv_all(int fd, uint8_t *data, int length) {
+    while (length > 0) {
+        ssize_t n = recv(fd, data, length, 0);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        length -= (int) n;
+    }
+    return true;
+}
+
+static void reply(const Request *req, const uint8_t *pdu, int pdu_len) {
+    uint8_t adu[MODBUS_MBAP_SIZE + MODBUS_MAX_PDU];
+    adu[0] = (uint8_t) (req->tid >> 8);
+    adu[1] = (uint8_t) req->tid;
+    adu[2] = adu[3] = 0;
+    adu[4] = (uint8_t) ((pdu_len + 1) >> 8);
+    adu[5] = (uint8_t) (pdu_len + 1);
+    adu[6] = req->unit;
+    memcpy(adu + MODBUS_MBAP_SIZE, pdu, pdu_len);
+    Master *master = req->master.get();
+    std::lock_guard<std::mutex> guard(master->send_lock);
+    if (!master->closed) {
+        send(master->fd, adu, MODBUS_MBAP_SIZE + pdu_len, MSG_NOSIGNAL);
+    }
+}
+
+static void reply_exception(const Request *req, uint8_t code) {
+    uint8_t pdu[2] = {(uint8_t) (req->pdu[0] | 0x80), code};
+    reply(req, pdu, sizeof(pdu));
+}
+
+// Length of the RTU response frame from what arrived so far; 0 for functions
+// whose response length is not known up front.
+static int expected_length(const uint8_t *frame, int length) {
+    if (length < 2) {
+        return 2;
+    }
+    if (frame[1] & 0x80) {
+        return 5;
+    }
+    switch (frame[1]) {
+        case 1:
+        case 2:
+        case 3:
+        case 4:
+        case 23:
+            return length < 3 ? 3 : 5 + frame[2];
+        case 5:
+        case 6:
+        case 15:
+        case 16:
+            return 8;
+        case 22:
+            return 10;
+        default:
+            return 0;
+    }
+}
+
+// Returns the bytes read, or -1 when the port was closed underneath (device gone).
+static int read_response(ModbusGw *gw, uint8_t *frame, int64_t deadline) {
+    int length = 0;
+    for (;;) {
+        int want = expected_length(frame, length);
+        if (want == 0) {
+            int64_t silence = std::max<int64_t>(gw->gap, MODBUS_RX_GAP_MIN);
+            for (;;) {
+                int n = RxRing_Read(gw->id, (int8_t *) frame + length, MODBUS_MAX_RTU - length, silence);
+                if (n < 0) {
+                    return -1;
+                }
+                if (n == 0 || length + n >= MODBUS_MAX_RTU) {
+                    return length + n;
+                }
+                length += n;
+            }
+        }
+        if (length >= want) {
+            return want;
+        }
+        int64_t left = deadline - MonoClock_Now();
+        if (left <= 0) {
+            return length;
+        }
+        int n = RxRing_Read(gw->id, (int8_t *) frame + length, want - length, left);
+        if (n < 0) {
+            return -1;
+        }
+        length += n;
+    }
+}
+
+// Also after a failed write or read, so that the next request opens the port again.
+static void close_port(ModbusGw *gw) {
+    JavaMethod_CloseSerial(gw->id);
+    gw->opened = false;
+    gw->cache.clear();
+}
+
+// One request/response exchange on the bus. Returns the response PDU length,
+// 0 for a broadcast, or -exception code.
+static int transact(ModbusGw *gw, const Request *req, uint8_t *pdu) {
+    TRACE_SCOPE("modbus transaction");
+    uint8_t frame[MODBUS_MAX_RTU];
+    frame[0] = req->unit;
+    memcpy(frame + 1, req->pdu, req->pdu_len);
+    int length = 1 + req->pdu_len;
+    uint16_t crc = ModbusGw_Crc16(frame, length);
+    frame[length++] = (uint8_t) crc;
+    frame[length++] = (uint8_t) (crc >> 8);
+
+    if (gw->idle_at > MonoClock_Now()) {
+        struct timespec ts = {(time_t) (gw->idle_at / NS_PER_SEC), (long) (gw->idle_at % NS_PER_SEC)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+        }
+    }
+    // Whatever is left from a late or trailing response is not ours.
+    RxRing_Reset(gw->id);
+    gw->transactions.fetch_add(1, std::memory_order_relaxed);
+    if (JavaMethod_WriteSerial(gw->id, (int8_t *) frame, length, gw->timeout) < 0) {
+        LOG_WARN("modbus: port %d: write failed, closing it", gw->id);
+        close_port(gw);
+        return -MODBUS_EX_PATH_UNAVAILABLE;
+    }
+    int64_t sent = MonoClock_Now() + length * gw->char_ns;
+    if (req->unit == 0) {
+        gw->idle_at = sent + gw->gap;
+        return 0;
+    }
+    length = read_response(gw, frame, sent + gw->timeout);
+    if (length < 0) {
+        LOG_WARN("modbus: port %d: read failed, closing it", gw->id);
+        close_port(gw);
+        return -MODBUS_EX_PATH_UNAVAILABLE;
+    }
+    gw->idle_at = MonoClock_Now() + gw->gap;
+    if (length < 4) {
+        gw->timeouts.fetch_add(1, std::memory_order_relaxed);
+        LOG_DEBUG("modbus: unit %d function %d: no response", req->unit, req->pdu[0]);
+        return -MODBUS_EX_TARGET_FAILED;
+    }
+    crc = ModbusGw_Crc16(frame, length - 2);
+    if (frame[length - 2] != (uint8_t) crc || frame[length - 1] != (uint8_t) (crc >> 8) ||
+        frame[0] != req->unit || (frame[1] & 0x7f) != req->pdu[0]) {
+        gw->crc_errors.fetch_add(1, std::memory_order_relaxed);
+        LOG_WARN("modbus: unit %d function %d: bad response (%d bytes)", req->unit, req->pdu[0], length);
+        return -MODBUS_EX_TARGET_FAILED;
+    }
+    memcpy(pdu, frame + 1, length - 3);
+    return length - 3;
+}
+
+static bool ensure_open(ModbusGw *gw) {
+    if (gw->opened) {
+        return true;
+    }
+    if (JavaMethod_OpenSerial(gw->id) <= 0) {
+        LOG_WARN("modbus: port %d: open failed (no adapter mapped to it, or in use)", gw->id);
+        return false;
+    }
+    if (JavaMethod_ConfigureSerial(gw->id, gw->baud_rate, gw->data_bits, gw->stop_bits, gw->parity) != 1) {
+        LOG_WARN("modbus: port %d: configure failed", gw->id);
+        JavaMethod_CloseSerial(gw->id);
+        return false;
+    }
+    gw->opened = true;
+    gw->idle_at = MonoClock_Now() + gw->gap;
+    return true;
+}
+
+static void cache_store(ModbusGw *gw, uint64_t key, const uint8_t *pdu, int pdu_len) {
+    int64_t now = MonoClock_Now();
+    if (gw->cache.size() >= MODBUS_CACHE_MAX) {
+        for (auto it = gw->cache.begin(); it != gw->cache.end();) {
+            it = it->second.expires <= now ? gw->cache.erase(it) : std::next(it);
+        }
+        if (gw->cache.size() >= MODBUS_CACHE_MAX) {
+            gw->cache.clear();
+        }
+    }
+    CacheEntry &entry = gw->cache[key];
+    entry.expires = now + gw->ttl;
+    entry.pdu.assign(pdu, pdu + pdu_len);
+}
+
+static void cache_invalidate(ModbusGw *gw, uint8_t unit) {
+    for (auto it = gw->cache.begin(); it != gw->cache.end();) {
+        // A broadcast write reaches every unit.
+        it = unit == 0 || (uint8_t) (it->first >> 40) == unit ? gw->cache.erase(it) : std::next(it);
+    }
+}
+
+// Queued reads of the same range are answered with the response just read,
+// up to the first request that could change what they would read.
+static void answer_queued(ModbusGw *gw, const Request *req, const uint8_t *pdu, int pdu_len) {
+    std::vector<std::unique_ptr<Request>> same;
+    {
+        std::lock_guard<std::mutex> guard(gw->lock);
+        for (auto it = gw->queue.begin(); it != gw->queue.end();) {
+            Request *other = it->get();
+            if (other->key == req->key) {
+                same.push_back(std::move(*it));
+                it = gw->queue.erase(it);
+                continue;
+            }
+            if (!is_read(other->pdu[0]) && (other->unit == req->unit || other->unit == 0)) {
+                break;
+            }
+            ++it;
+        }
+    }
+    if (same.empty()) {
+        return;
+    }
+    gw->room.notify_all();
+    gw->coalesced.fetch_add(same.size(), std::memory_order_relaxed);
+    for (auto &other : same) {
+        reply(other.get(), pdu, pdu_len);
+    }
+}
+
+static void serve(ModbusGw *gw, const Request *req) {
+    if (req->key && gw->ttl > 0) {
+        auto it = gw->cache.find(req->key);
+        if (it != gw->cache.end() && it->second.expires > MonoClock_Now()) {
+            gw->cache_hits.fetch_add(1, std::memory_order_relaxed);
+            reply(req, it->second.pdu.data(), (int) it->second.pdu.size());
+            return;
+        }
+    }
+    if (!ensure_open(gw)) {
+        reply_exception(req, MODBUS_EX_PATH_UNAVAILABLE);
+        return;
+    }
+    if (!is_read(req->pdu[0])) {
+        cache_invalidate(gw, req->unit);
+    }
+    uint8_t pdu[MODBUS_MAX_PDU];
+    int pdu_len = transact(gw, req, pdu);
+    if (pdu_len < 0) {
+        reply_exception(req, (uint8_t) -pdu_len);
+        return;
+    }
+    if (req->unit == 0) {
+        return;
+    }
+    reply(req, pdu, pdu_len);
+    if (req->key && !(pdu[0] & 0x80)) {
+        if (gw->ttl > 0) {
+            cache_store(gw, req->key, pdu, pdu_len);
+        }
+        answer_queued(gw, req, pdu, pdu_len);
+    }
+}
+
+static void bus_run(ModbusGw *gw) {
+    ThreadSched_Enter(SCHED_ROLE_SERVER);
+    std::unique_lock<std::mutex> lock(gw->lock);
+    for (;;) {
+        gw->wake.wait(lock, [gw] { return !gw->queue.empty() || (gw->opened && gw->masters == 0); });
+        if (gw->queue.empty()) {
+            // The session pool keeps the port warm for a returning master.
+            lock.unlock();
+            close_port(gw);
+            lock.lock();
+            continue;
+        }
+        std::unique_ptr<Request> req = std::move(gw->queue.front());
+        gw->queue.pop_front();
+        lock.unlock();
+        gw->room.notify_one();
+        serve(gw, req.get());
+        req.reset();
+        lock.lock();
+    }
+}
+
+static void master_run(ModbusGw *gw, std::shared_ptr<Master> master) {
+    ThreadSched_Enter(SCHED_ROLE_SERVER);
+    uint8_t header[MODBUS_MBAP_SIZE];
+    while (recv_all(master->fd, header, sizeof(header))) {
+        int length = header[4] << 8 | header[5];
+        if (header[2] != 0 || header[3] != 0 || length < 2 || length > MODBUS_MAX_PDU + 1) {
+            LOG_WARN("modbus: bad MBAP header (protocol %d, length %d), dropping the master",
+                     header[2] << 8 | header[3], length);
+            break;
+        }
+        auto req = std::make_unique<Request>();
+        req->master = master;
+        req->tid = (uint16_t) (header[0] << 8 | header[1]);
+        req->unit = header[6];
+        req->pdu_len = length - 1;
+        if (!recv_all(master->fd, req->pdu, req->pdu_len)) {
+            break;
+        }
+        req->key = cache_key(req->unit, req->pdu, req->pdu_len);
+        gw->requests.fetch_add(1, std::memory_order_relaxed);
+        std::unique_lock<std::mutex> lock(gw->lock);
+        gw->room.wait(lock, [gw] { return gw->queue.size() < MODBUS_GW_MAX_QUEUED; });
+        gw->queue.push_back(std::move(req));
+        lock.unlock();
+        gw->wake.notify_one();
+    }
+    {
+        std::lock_guard<std::mutex> guard(master->send_lock);
+        master->closed = true;
+        close(master->fd);
+    }
+    LOG_INFO("modbus: master left");
+    std::lock_guard<std::mutex> guard(gw->lock);
+    gw->masters--;
+    gw->wake.notify_one();
+}
+
+static void listen_run(ModbusGw *gw) {
+    for (;;) {
+        int fd = accept4(gw->listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                LOG_ERROR("modbus: accept failed: %s", strerror(errno));
+                return;
+            }
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> guard(gw->lock);
+            if (gw->masters >= MODBUS_GW_MAX_MASTERS) {
+                LOG_WARN("modbus: %d masters connected, refusing another", gw->masters);
+                close(fd);
+                continue;
+            }
+            gw->masters++;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        auto master = std::make_shared<Master>();
+        master->fd = fd;
+        LOG_INFO("modbus: master connected");
+        std::thread(master_run, gw, std::move(master)).detach();
+    }
+}
+
+static char *modbus_collect() {
+    ModbusGwStats stats;
+    ModbusGw_Stats(&stats);
+    char out[1024];
+    snprintf(out, sizeof(out),
+             "# TYPE serial_modbus_masters gauge\nserial_modbus_masters %d\n"
+             "# TYPE serial_modbus_requests_total counter\nserial_modbus_requests_total %llu\n"
+             "# TYPE serial_modbus_transactions_total counter\nserial_modbus_transactions_total %llu\n"
+             "# TYPE serial_modbus_cache_hits_total counter\nserial_modbus_cache_hits_total %llu\n"
+             "# TYPE serial_modbus_coalesced_total counter\nserial_modbus_coalesced_total %llu\n"
+             "# TYPE serial_modbus_timeouts_total counter\nserial_modbus_timeouts_total %llu\n"
+             "# TYPE serial_modbus_crc_errors_total counter\nserial_modbus_crc_errors_total %llu\n",
+             stats.masters, (unsigned long long) stats.requests, (unsigned long long) stats.transactions,
+             (unsigned long long) stats.cache_hits, (unsigned long long) stats.coalesced,
+             (unsigned long long) stats.timeouts, (unsigned long long) stats.crc_errors);
+    return strdup(out);
+}
+
+extern "C" {
+
+int ModbusGw_Start(int tcp_port, int id, const char *spec) {
+    if (gateway.load()) {
+        LOG_WARN("modbus gateway already running");
+        return -1;
+    }
+    if (id < 1 || id >= RX_RING_MAX_PORTS) {
+        // Port 0 is the RFC2217 server's.
+        LOG_ERROR("modbus: invalid port %d", id);
+        return -1;
+    }
+    auto *gw = new ModbusGw();
+    gw->id = id;
+    gw->tcp_port = tcp_port;
+    if (configure(gw, spec) != 0) {
+        delete gw;
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t) tcp_port);
+    if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        listen(fd, MODBUS_GW_MAX_MASTERS) != 0) {
+        LOG_ERROR("modbus: listen on %d failed: %s", tcp_port, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        delete gw;
+        return -1;
+    }
+    gw->listen_fd = fd;
+    gateway.store(gw);
+    Metrics_AddCollector(modbus_collect);
+    std::thread(bus_run, gw).detach();
+    std::thread(listen_run, gw).detach();
+    LOG_INFO("modbus gateway: port %d on tcp %d, %d %d%c%g, t3.5 %lld us, ttl %lld ms", id, tcp_port,
+             gw->baud_rate, gw->data_bits, gw->parity, gw->stop_bits, (long long) (gw->gap / NS_PER_US),
+             (long long) (gw->ttl / NS_PER_MS));
+    return 0;
+}
+
+void ModbusGw_Stats(ModbusGwStats *stats) {
+    ModbusGw *gw = gateway.load(std::memory_order_acquire);
+    memset(stats, 0, sizeof(*stats));
+    if (!gw) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(gw->lock);
+        stats->masters = gw->masters;
+    }
+    stats->requests = gw->requests.load(std::memory_order_relaxed);
+    stats->transactions = gw->transactions.load(std::memory_order_relaxed);
+    stats->cache_hits = gw->cache_hits.load(std::memory_order_relaxed);
+    stats->coalesced = gw->coalesced.load(std::memory_order_relaxed);
+    stats->timeouts = gw->timeouts.load(std::memory_order_relaxed);
+    stats->crc_errors = gw->crc_errors.load(std::memory_order_relaxed);
+}
+
+uint16_t ModbusGw_Crc16(const uint8_t *data, int length) {
+    uint16_t crc = 0xFFFF;
+    for (int i = 0; i < length; i++) {
+        crc = (uint16_t) ((crc >> 8) ^ crcTable.entries[(crc ^ data[i]) & 0xff]);
+    }
+    return crc;
+}
+
+}
@@ -0,0 +1,561 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "java_method.h"
+#include "lz_stream.h"
+#include "metrics.h"
+#include "mux_server.h"
+#include "rx_ring.h"
+#include "thread_sched.h"
+#include "trace.h"
+#include "tx_queue.h"
+#include "usb_engine.h"
+
+#define LOG_LEVEL LOG_LEVEL_INFO
+#include "log.h"
+
+#define MUX_CHUNK 4096
+// Channels stop reading their rings while this much output is not sent yet.
+#define MUX_OUT_HIGH (64 * 1024)
+// Smaller grants are held back to keep CREDIT frames from dominating.
+#define MUX_CREDIT_MIN 1024
+
+enum EventTag {
+    TAG_SOCKET,
+    TAG_RX,
+    TAG_TX,
+    TAG_MODEM,
+};
+
+struct Channel {
+    bool open = false;
+    bool rx_ready = false;           // the ring may hold bytes
+    int64_t credit = 0;              // bytes the client still takes
+    int granted = 0;                 // bytes the client may still send
+    int rx_fd = -1;
+    int tx_fd = -1;
+    int modem_fd = -1;
+    LzEncoder *encoder = nullptr;    // data goes out as ZDATA
+};
+
+struct Connection {
+    int fd = -1;
+    int epoll_fd = -1;
+    bool broken = false;
+    bool want_out = false;
+    std::vector<uint8_t> in;
+    std::vector<uint8_t> out;
+    size_t out_off = 0;
+    Channel channels[RX_RING_MAX_PORTS];
+};
+
+struct MuxServer {
+    int listen_fd = -1;
+    std::mutex lock;
+    int connections = 0;
+    std::atomic<bool> claimed[RX_RING_MAX_PORTS];   // port open on some channel
+    std::atomic<int> channels{0};
+    std::atomic<uint64_t> frames_in{0};
+    std::atomic<uint64_t> frames_out{0};
+    std::atomic<uint64_t> segments{0};
+};
+
+static std::atomic<MuxServer *> server{nullptr};
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t) (value >> 24);
+    p[1] = (uint8_t) (value >> 16);
+    p[2] = (uint8_t) (value >> 8);
+    p[3] = (uint8_t) value;
+}
+
+// Appends a frame header and reserves the payload; returns the payload.
+static uint8_t *frame(MuxServer *s, Connection *c, uint8_t type, int id, int length) {
+    size_t at = c->out.size();
+    c->out.resize(at + MUX_HEADER_SIZE + length);
+    uint8_t *header = c->out.data() + at;
+    header[0] = type;
+    header[1] = (uint8_t) id;
+    header[2] = (uint8_t) (length >> 8);
+    header[3] = (uint8_t) length;
+    s->frames_out.fetch_add(1, std::memory_order_relaxed);
+    return header + MUX_HEADER_SIZE;
+}
+
+static void watch(Connection *c, int fd, EventTag tag, int id) {
+    if (fd < 0) {
+        return;
+    }
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = (uint64_t) tag << 8 | (uint64_t) id;
+    epoll_ctl(c->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void drain(int event_fd) {
+    uint64_t count;
+    ssize_t r = read(event_fd, &count, sizeof(count));
+    (void) r;
+}
+
+static int modem_state(int id) {
+    int state = 0;
+    if (JavaMethod_RtsSerialGet(id)) {
+        state |= MUX_MODEM_RTS;
+    }
+    if (JavaMethod_DtrSerialGet(id)) {
+        state |= MUX_MODEM_DTR;
+    }
+    int inputs = UsbEngine_Modem(id);
+    if (inputs >= 0) {
+        return state | (inputs & (MUX_MODEM_CTS | MUX_MODEM_DSR | MUX_MODEM_RI | MUX_MODEM_CD));
+    }
+    static const struct {
+        const char *name;
+        int bit;
+    } lines[] = {{"cts", MUX_MODEM_CTS}, {"dsr", MUX_MODEM_DSR}, {"ri", MUX_MODEM_RI}, {"cd", MUX_MODEM_CD}};
+    for (const auto &line : lines) {
+        if (JavaMethod_StatusSerial(id, line.name) > 0) {
+            state |= line.bit;
+        }
+    }
+    return state;
+}
+
+// Hands the client the transmit queue space it does not know about yet.
+static void grant(MuxServer *s, Connection *c, int id) {
+    Channel &ch = c->channels[id];
+    int free_space = TX_QUEUE_CAPACITY - TxQueue_Pending(id);
+    int more = free_space - ch.granted;
+    if (more >= MUX_CREDIT_MIN) {
+        put_u32(frame(s, c, MUX_CREDIT, id, 4), (uint32_t) more);
+        ch.granted += more;
+    }
+}
+
+static void close_channel(MuxServer *s, Connection *c, int id) {
+    Channel &ch = c->channels[id];
+    if (!ch.open) {
+        return;
+    }
+    for (int fd : {ch.rx_fd, ch.tx_fd, ch.modem_fd}) {
+        if (fd >= 0) {
+            epoll_ctl(c->epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        }
+    }
+    RxRing_Unsubscribe(id, ch.rx_fd);
+    TxQueue_Unsubscribe(id, ch.tx_fd);
+    UsbEngine_ModemUnsubscribe(id, ch.modem_fd);
+    TxQueue_Reset(id);
+    JavaMethod_CloseSerial(id);
+    LzStream_EncoderFree(ch.encoder);
+    ch = Channel();
+    s->claimed[id].store(false);
+    s->channels.fetch_sub(1, std::memory_order_relaxed);
+    LOG_INFO("mux: channel %d closed", id);
+}
+
+static bool open_port(MuxServer *s, Connection *c, int id) {
+    Channel &ch = c->channels[id];
+    if (id == 0) {
+        // Port 0 belongs to the RFC2217 server; sharing it would split its rx ring between the two.
+        LOG_WARN("mux: channel 0 is reserved for the RFC2217 server");
+        return false;
+    }
+    bool expected = false;
+    if (ch.open || !s->claimed[id].compare_exchange_strong(expected, true)) {
+        LOG_WARN("mux: port %d is already open", id);
+        return false;
+    }
+    if (JavaMethod_OpenSerial(id) <= 0) {
+        LOG_WARN("mux: port %d: open failed (no adapter mapped to it, or in use)", id);
+        s->claimed[id].store(false);
+        return false;
+    }
+    ch.open = true;
+    ch.rx_ready = true;
+    ch.rx_fd = RxRing_Subscribe(id);
+    ch.tx_fd = TxQueue_Subscribe(id);
+    ch.modem_fd = UsbEngine_ModemSubscribe(id);
+    watch(c, ch.rx_fd, TAG_RX, id);
+    watch(c, ch.tx_fd, TAG_TX, id);
+    watch(c, ch.modem_fd, TAG_MODEM, id);
+    ch.granted = TX_QUEUE_CAPACITY - TxQueue_Pending(id);
+    s->channels.fetch_add(1, std::memory_order_relaxed);
+    LOG_INFO("mux: channel %d open", id);
+    return true;
+}
+
+// Returns false on a protocol violation.
+static bool handle(MuxServer *s, Connection *c, uint8_t type, int id, const uint8_t *payload, int length) {
+    s->frames_in.fetch_add(1, std::memory_order_relaxed);
+    if (id >= RX_RING_MAX_PORTS) {
+        LOG_WARN("mux: channel %d out of range", id);
+        return false;
+    }
+    Channel &ch = c->channels[id];
+    switch (type) {
+        case MUX_OPEN: {
+            bool ok = open_port(s, c, id);
+            uint8_t *reply = frame(s, c, MUX_OPEN, id, 5);
+            reply[0] = (uint8_t) ok;
+            put_u32(reply + 1, ok ? (uint32_t) ch.granted : 0);
+            return true;
+        }
+        case MUX_CLOSE:
+            close_channel(s, c, id);
+            return true;
+        case MUX_DATA: {
+            if (!ch.open) {
+                // Crossed a CLOSE from our side.
+                return true;
+            }
+            if (length > ch.granted) {
+                LOG_WARN("mux: channel %d: %d bytes over a credit of %d", id, length, ch.granted);
+                return false;
+            }
+            ch.granted -= length;
+            if (TxQueue_Write(id, (const int8_t *) payload, length) < 0) {
+                close_channel(s, c, id);
+                frame(s, c, MUX_CLOSE, id, 0);
+            }
+            return true;
+        }
+        case MUX_CREDIT:
+            if (length != 4) {
+                return false;
+            }
+            ch.credit = std::min<int64_t>(ch.credit + get_u32(payload), INT32_MAX);
+            return true;
+        case MUX_CONFIGURE: {
+            if (length != 7) {
+                return false;
+            }
+            int ok = ch.open && JavaMethod_ConfigureSerial(id, (int) get_u32(payload), payload[4],
+                                                           payload[6] / 10.0f, (char) payload[5]) == 1;
+            *frame(s, c, MUX_CONFIGURE, id, 1) = (uint8_t) ok;
+            return true;
+        }
+        case MUX_MODEM:
+            if (length != 2) {
+                return false;
+            }
+            if (ch.open) {
+                if (payload[0] & MUX_MODEM_RTS) {
+                    JavaMethod_RtsSerialSet(id, (payload[1] & MUX_MODEM_RTS) != 0);
+                }
+                if (payload[0] & MUX_MODEM_DTR) {
+                    JavaMethod_DtrSerialSet(id, (payload[1] & MUX_MODEM_DTR) != 0);
+                }
+                *frame(s, c, MUX_MODEM, id, 1) = (uint8_t) modem_state(id);
+            }
+            return true;
+        case MUX_PURGE:
+            if (length != 1) {
+                return false;
+            }
+            if (ch.open && (payload[0] & MUX_PURGE_INPUT)) {
+                JavaMethod_ResetInputBufferSerial(id);
+            }
+            if (ch.open && (payload[0] & MUX_PURGE_OUTPUT)) {
+                TxQueue_Reset(id);
+                grant(s, c, id);
+            }
+            return true;
+        case MUX_COMPRESS:
+            if (ch.open && !ch.encoder) {
+                ch.encoder = LzStream_EncoderNew();
+            }
+            *frame(s, c, MUX_COMPRESS, id, 1) = (uint8_t) ch.open;
+            return true;
+        default:
+            // Unknown frames are skipped, newer clients may send them.
+            return true;
+    }
+}
+
+static void receive(MuxServer *s, Connection *c) {
+    uint8_t buffer[MUX_HEADER_SIZE + MUX_MAX_PAYLOAD];
+    for (;;) {
+        ssize_t n = recv(c->fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            c->broken = true;
+            return;
+        }
+        if (n < 0) {
+            break;
+        }
+        c->in.insert(c->in.end(), buffer, buffer + n);
+    }
+    size_t at = 0;
+    while (c->in.size() - at >= MUX_HEADER_SIZE) {
+        const uint8_t *header = c->in.data() + at;
+        int length = header[2] << 8 | header[3];
+        if (length > MUX_MAX_PAYLOAD) {
+            LOG_WARN("mux: frame of %d bytes", length);
+            c->broken = true;
+            return;
+        }
+        if (c->in.size() - at < (size_t) (MUX_HEADER_SIZE + length)) {
+            break;
+        }
+        if (!handle(s, c, header[0], header[1], header + MUX_HEADER_SIZE, length)) {
+            c->broken = true;
+            return;
+        }
+        at += MUX_HEADER_SIZE + length;
+    }
+    c->in.erase(c->in.begin(), c->in.begin() + (long) at);
+}
+
+// Moves ring bytes into DATA or ZDATA frames, a chunk per channel and round, as far
+// as the client's credit and the output high-water mark allow.
+static void pump(MuxServer *s, Connection *c) {
+    bool more = true;
+    while (more && c->out.size() - c->out_off < MUX_OUT_HIGH) {
+        more = false;
+        for (int id = 0; id < RX_RING_MAX_PORTS && c->out.size() - c->out_off < MUX_OUT_HIGH; id++) {
+            Channel &ch = c->channels[id];
+            if (!ch.open || !ch.rx_ready || ch.credit <= 0) {
+                continue;
+            }
+            int size = (int) std::min<int64_t>(ch.credit, MUX_CHUNK);
+            int8_t raw[MUX_CHUNK];
+            int n = RxRing_Read(id, raw, size, 0);
+            if (n < size) {
+                ch.rx_ready = false;
+            }
+            if (n <= 0) {
+                continue;
+            }
+            if (ch.encoder) {
+                uint8_t *payload = frame(s, c, MUX_ZDATA, id, LZ_STREAM_BOUND(n));
+                int block = LzStream_Compress(ch.encoder, (const uint8_t *) raw, n, payload);
+                c->out.resize(c->out.size() - (LZ_STREAM_BOUND(n) - block));
+                payload[-2] = (uint8_t) (block >> 8);
+                payload[-1] = (uint8_t) block;
+            } else {
+                memcpy(frame(s, c, MUX_DATA, id, n), raw, n);
+            }
+            ch.credit -= n;
+            more = more || ch.rx_ready;
+        }
+    }
+}
+
+static void transmit(MuxServer *s, Connection *c) {
+    while (c->out_off < c->out.size()) {
+        ssize_t n = send(c->fd, c->out.data() + c->out_off, c->out.size() - c->out_off,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n < 0) {
+            c->broken = errno != EINTR;
+            if (c->broken) {
+                return;
+            }
+            continue;
+        }
+        s->segments.fetch_add(1, std::memory_order_relaxed);
+        c->out_off += (size_t) n;
+    }
+    bool pending = c->out_off < c->out.size();
+    if (!pending) {
+        c->out.clear();
+        c->out_off = 0;
+    }
+    if (pending != c->want_out) {
+        c->want_out = pending;
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP | (pending ? EPOLLOUT : 0);
+        ev.data.u64 = (uint64_t) TAG_SOCKET << 8;
+        epoll_ctl(c->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    }
+}
+
+static void connection_run(MuxServer *s, int fd) {
+    ThreadSched_Enter(SCHED_ROLE_SERVER);
+    auto *c = new Connection();
+    c->fd = fd;
+    c->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.u64 = (uint64_t) TAG_SOCKET << 8;
+    epoll_ctl(c->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    struct epoll_event events[64];
+    while (!c->broken) {
+        int n = epoll_wait(c->epoll_fd, events, 64, -1);
+        TRACE_SCOPE("mux connection");
+        for (int i = 0; i < n && !c->broken; i++) {
+            int tag = (int) (events[i].data.u64 >> 8);
+            int id = (int) (events[i].data.u64 & 0xff);
+            Channel &ch = c->channels[id];
+            switch (tag) {
+                case TAG_SOCKET:
+                    if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                        receive(s, c);
+                    }
+                    break;
+                case TAG_RX:
+                    drain(ch.rx_fd);
+                    ch.rx_ready = true;
+                    break;
+                case TAG_TX:
+                    drain(ch.tx_fd);
+                    grant(s, c, id);
+                    break;
+                case TAG_MODEM:
+                    drain(ch.modem_fd);
+                    *frame(s, c, MUX_MODEM, id, 1) = (uint8_t) modem_state(id);
+                    break;
+            }
+        }
+        if (!c->broken) {
+            pump(s, c);
+            transmit(s, c);
+        }
+    }
+    for (int id = 0; id < RX_RING_MAX_PORTS; id++) {
+        close_channel(s, c, id);
+    }
+    close(c->epoll_fd);
+    close(fd);
+    delete c;
+    LOG_INFO("mux: client left");
+    std::lock_guard<std::mutex> guard(s->lock);
+    s->connections--;
+}
+
+static void listen_run(MuxServer *s) {
+    for (;;) {
+        int fd = accept4(s->listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                LOG_ERROR("mux: accept failed: %s", strerror(errno));
+                return;
+            }
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> guard(s->lock);
+            if (s->connections >= MUX_MAX_CONNECTIONS) {
+                LOG_WARN("mux: %d clients connected, refusing another", s->connections);
+                close(fd);
+                continue;
+            }
+            s->connections++;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        LOG_INFO("mux: client connected");
+        std::thread(connection_run, s, fd).detach();
+    }
+}
+
+static char *mux_collect() {
+    MuxServerStats stats;
+    MuxServer_Stats(&stats);
+    char out[768];
+    snprintf(out, sizeof(out),
+             "# TYPE serial_mux_connections gauge\nserial_mux_connections %d\n"
+             "# TYPE serial_mux_channels gauge\nserial_mux_channels %d\n"
+             "# TYPE serial_mux_frames_in_total counter\nserial_mux_frames_in_total %llu\n"
+             "# TYPE serial_mux_frames_out_total counter\nserial_mux_frames_out_total %llu\n"
+             "# TYPE serial_mux_segments_total counter\nserial_mux_segments_total %llu\n",
+             stats.connections, stats.channels, (unsigned long long) stats.frames_in,
+             (unsigned long long) stats.frames_out, (unsigned long long) stats.segments);
+    return strdup(out);
+}
+
+extern "C" {
+
+int MuxServer_Start(int tcp_port) {
+    if (server.load()) {
+        LOG_WARN("mux server already running");
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t) tcp_port);
+    if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        listen(fd, MUX_MAX_CONNECTIONS) != 0) {
+        LOG_ERROR("mux: listen on %d failed: %s", tcp_port, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    auto *s = new MuxServer();
+    for (auto &claim : s->claimed) {
+        claim.store(false);
+    }
+    s->listen_fd = fd;
+    server.store(s);
+    Metrics_AddCollector(mux_collect);
+    std::thread(listen_run, s).detach();
+    LOG_INFO("mux server on tcp %d", tcp_port);
+    return 0;
+}
+
+void MuxServer_Stats(MuxServerStats *stats) {
+    MuxServer *s = server.load(std::memory_order_acquire);
+    memset(stats, 0, sizeof(*stats));
+    if (!s) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(s->lock);
+        stats->connections = s->connections;
+    }
+    stats->channels = s->channels.load(std::memory_order_relaxed);
+    stats->frames_in = s->frames_in.load(std::memory_order_relaxed);
+    stats->frames_out = s->frames_out.load(std::memory_order_relaxed);
+    stats->segments = s->segments.load(std::memory_order_relaxed);
+}
+
+}
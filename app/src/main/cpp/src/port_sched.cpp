@@ -0,0 +1,688 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifdef __ANDROID__
+#include <sys/system_properties.h>
+#endif
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "java_method.h"
+#include "lz_stream.h"
+#include "metrics.h"
+#include "mono_clock.h"
+#include "port_sched.h"
+#include "rx_ring.h"
+#include "thread_sched.h"
+#include "trace.h"
+#include "tx_queue.h"
+
+#define LOG_LEVEL LOG_LEVEL_INFO
+#include "log.h"
+
+#define PORT_SCHED_CHUNK 4096
+// A capped port may send this much of its rate at once.
+#define PORT_SCHED_BURST_NS (100 * NS_PER_MS)
+
+enum TaskState {
+    TASK_IDLE,
+    TASK_QUEUED,
+    TASK_RUNNING,
+    TASK_NOTIFIED,   // became ready again while running
+};
+
+struct PortTask {
+    int id = -1;
+    std::atomic<int> state{TASK_IDLE};
+    int listen_fd = -1;
+    // Owned by whichever worker runs the task; the reactor only hands over a
+    // new client while client_fd is -1.
+    std::atomic<int> client_fd{-1};
+    bool opened = false;
+    bool want_out = false;
+    LzEncoder *encoder = nullptr;       // compressed endpoint: set while a client is connected
+    int8_t pending[LZ_STREAM_BOUND(PORT_SCHED_CHUNK)];   // bytes the socket did not take yet
+    int pending_off = 0;
+    int pending_len = 0;
+    int8_t incoming[PORT_SCHED_CHUNK];   // client bytes the tx queue did not take yet
+    int incoming_off = 0;
+    int incoming_len = 0;
+    bool draining = false;              // the client finished sending, close once the tx queue is empty
+    int tx_fd = -1;                     // tx_queue.h space eventfd while the port is open
+    int last_worker = 0;
+    int64_t deficit = 0;                // round robin credit, kept while the port has more
+    double tokens = 0;                  // rate cap bucket
+    int64_t tokens_at = 0;
+    int timer_fd = -1;                  // wakes a port sleeping on its rate cap
+    std::atomic<int64_t> queued_at{0};
+    std::atomic<uint64_t> queue_ns{0};
+    std::atomic<uint64_t> queue_waits{0};
+    std::atomic<uint64_t> queue_max_ns{0};   // since the last collection
+};
+
+struct Worker {
+    std::mutex lock;
+    std::deque<PortTask *> queue;   // the owner pops the front, thieves take the back
+    std::thread thread;
+};
+
+struct PortSched {
+    int tcp_base = 0;
+    bool compress = false;
+    int first_id = 0;
+    int count = 0;
+    int worker_count = 0;
+    PortTask tasks[RX_RING_MAX_PORTS];
+    Worker workers[PORT_SCHED_MAX_WORKERS];
+    int epoll_fd = -1;
+    std::atomic<int> queued{0};
+    std::atomic<int> sleeping{0};
+    std::mutex idle_lock;
+    std::condition_variable idle;
+    std::atomic<uint64_t> runs{0};
+    std::atomic<uint64_t> steals{0};
+    std::atomic<uint64_t> yields{0};
+    std::atomic<uint64_t> wakeups{0};
+    std::atomic<uint64_t> throttles{0};
+};
+
+static std::atomic<PortSched *> sched{nullptr};
+static bool compressNext = false;
+// 0 means weight 1 and no cap.
+static std::atomic<int> portWeight[RX_RING_MAX_PORTS];
+static std::atomic<int64_t> portRate[RX_RING_MAX_PORTS];
+
+// epoll data: listening sockets are tagged so the reactor can tell them apart.
+#define EPOLL_LISTEN_TAG (1ull << 32)
+#define EPOLL_TIMER_TAG (1ull << 33)
+#define EPOLL_TX_TAG (1ull << 34)
+
+static void enqueue(PortSched *s, PortTask *task) {
+    Worker &w = s->workers[task->last_worker];
+    {
+        std::lock_guard<std::mutex> guard(w.lock);
+        w.queue.push_back(task);
+    }
+    s->queued.fetch_add(1);
+    if (s->sleeping.load() > 0) {
+        std::lock_guard<std::mutex> guard(s->idle_lock);
+        s->idle.notify_one();
+    }
+}
+
+static void notify(PortSched *s, PortTask *task) {
+    s->wakeups.fetch_add(1, std::memory_order_relaxed);
+    int state = task->state.load(std::memory_order_acquire);
+    for (;;) {
+        if (state == TASK_QUEUED || state == TASK_NOTIFIED) {
+            return;
+        }
+        int next = state == TASK_IDLE ? TASK_QUEUED : TASK_NOTIFIED;
+        task->queued_at.store(MonoClock_Now(), std::memory_order_relaxed);
+        if (task->state.compare_exchange_weak(state, next, std::memory_order_acq_rel)) {
+            if (next == TASK_QUEUED) {
+                enqueue(s, task);
+            }
+            return;
+        }
+    }
+}
+
+// The socket is not read while the tx queue is full or the client is done sending.
+static void arm(PortSched *s, PortTask *task, int fd) {
+    bool want_in = task->incoming_off == task->incoming_len && !task->draining;
+    struct epoll_event ev = {};
+    ev.events = EPOLLRDHUP | EPOLLET | (want_in ? EPOLLIN : 0) | (task->want_out ? EPOLLOUT : 0);
+    ev.data.u64 = (uint64_t) task->id;
+    epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+static void disconnect(PortSched *s, PortTask *task) {
+    int fd = task->client_fd.load(std::memory_order_relaxed);
+    if (fd >= 0) {
+        epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+    }
+    if (task->tx_fd >= 0) {
+        epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, task->tx_fd, nullptr);
+        TxQueue_Unsubscribe(task->id, task->tx_fd);
+        task->tx_fd = -1;
+    }
+    if (task->opened) {
+        TxQueue_Reset(task->id);
+        JavaMethod_CloseSerial(task->id);
+        task->opened = false;
+    }
+    task->pending_off = task->pending_len = 0;
+    task->incoming_off = task->incoming_len = 0;
+    task->draining = false;
+    task->want_out = false;
+    LzStream_EncoderFree(task->encoder);
+    task->encoder = nullptr;
+    LOG_INFO("port %d: client left", task->id);
+    task->client_fd.store(-1, std::memory_order_release);
+}
+
+// Moves up to the budget in each direction; returns true when it stopped
+// because of the budget, i.e. the task should run again.
+static bool run_task(PortSched *s, PortTask *task) {
+    int fd = task->client_fd.load(std::memory_order_acquire);
+    if (fd < 0) {
+        return false;
+    }
+    TRACE_SCOPE("port task");
+    if (!task->opened) {
+        if (JavaMethod_OpenSerial(task->id) <= 0) {
+            LOG_WARN("port %d: open failed, dropping the client", task->id);
+            disconnect(s, task);
+            return false;
+        }
+        task->opened = true;
+        // A failure left by the previous client's close is not this one's.
+        TxQueue_Reset(task->id);
+        task->tx_fd = TxQueue_Subscribe(task->id);
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u64 = EPOLL_TX_TAG | (uint64_t) task->id;
+        epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, task->tx_fd, &ev);
+    }
+    bool more = false;
+
+    // Device -> client, as far as the round robin credit and the rate cap allow.
+    int weight = std::max(1, portWeight[task->id].load(std::memory_order_relaxed));
+    int64_t rate = portRate[task->id].load(std::memory_order_relaxed);
+    task->deficit += (int64_t) PORT_SCHED_QUANTUM * weight;
+    int64_t allowance = task->deficit;
+    if (rate > 0) {
+        int64_t now = MonoClock_Now();
+        double burst = std::max(rate * (double) PORT_SCHED_BURST_NS / NS_PER_SEC, 64.0);
+        task->tokens = std::min(burst, task->tokens + (double) (now - task->tokens_at) * rate / NS_PER_SEC);
+        task->tokens_at = now;
+        allowance = std::min(allowance, (int64_t) task->tokens);
+    }
+    int moved = 0;
+    bool stalled = false;    // ring empty or socket full
+    while (moved < allowance) {
+        if (task->pending_off == task->pending_len) {
+            task->pending_off = 0;
+            int size = (int) std::min<int64_t>(PORT_SCHED_CHUNK, allowance - moved);
+            if (task->encoder) {
+                int8_t raw[PORT_SCHED_CHUNK];
+                int n = RxRing_Read(task->id, raw, size, 0);
+                task->pending_len = n > 0 ? LzStream_Compress(task->encoder, (const uint8_t *) raw, n,
+                                                              (uint8_t *) task->pending) : 0;
+            } else {
+                task->pending_len = RxRing_Read(task->id, task->pending, size, 0);
+            }
+            if (task->pending_len <= 0) {
+                task->pending_len = 0;
+                stalled = true;
+                break;
+            }
+        }
+        ssize_t n = send(fd, task->pending + task->pending_off, task->pending_len - task->pending_off,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!task->want_out) {
+                task->want_out = true;
+                arm(s, task, fd);
+            }
+            stalled = true;
+            break;
+        }
+        if (n < 0) {
+            disconnect(s, task);
+            return false;
+        }
+        task->pending_off += (int) n;
+        moved += (int) n;
+    }
+    if (task->want_out && task->pending_off == task->pending_len) {
+        task->want_out = false;
+        arm(s, task, fd);
+    }
+    task->tokens -= rate > 0 ? moved : 0;
+    if (stalled) {
+        // Not backlogged: the credit does not carry over.
+        task->deficit = 0;
+    } else {
+        task->deficit -= moved;
+        if (rate > 0 && task->tokens < task->deficit) {
+            // Out of tokens rather than credit: sleep until a quantum's worth is back.
+            double need = std::min<double>(task->deficit, rate * (double) PORT_SCHED_BURST_NS / NS_PER_SEC);
+            int64_t wake = MonoClock_Now() + (int64_t) (std::max(need - task->tokens, 1.0) * NS_PER_SEC / rate);
+            struct itimerspec when = {};
+            when.it_value.tv_sec = (time_t) (wake / NS_PER_SEC);
+            when.it_value.tv_nsec = (long) (wake % NS_PER_SEC);
+            timerfd_settime(task->timer_fd, TFD_TIMER_ABSTIME, &when, nullptr);
+            task->deficit = std::min<int64_t>(task->deficit, (int64_t) PORT_SCHED_QUANTUM * weight);
+            s->throttles.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            more = true;
+        }
+    }
+
+    // Client -> device, into the tx queue without blocking. What it does not take stays in `incoming` and the
+    // socket is not read until the writer frees space (tx_fd), so TCP pushes back on the client.
+    uint64_t count;
+    ssize_t r = read(task->tx_fd, &count, sizeof(count));
+    (void) r;
+    bool was_held = task->incoming_off < task->incoming_len || task->draining;
+    moved = 0;
+    while (moved < PORT_SCHED_BUDGET) {
+        if (task->incoming_off == task->incoming_len) {
+            if (task->draining) {
+                break;
+            }
+            ssize_t n = recv(fd, task->incoming, sizeof(task->incoming), MSG_DONTWAIT);
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                disconnect(s, task);
+                return false;
+            }
+            if (n < 0) {
+                break;
+            }
+            if (n == 0) {
+                task->draining = true;
+                break;
+            }
+            task->incoming_off = 0;
+            task->incoming_len = (int) n;
+        }
+        int n = TxQueue_Write(task->id, task->incoming + task->incoming_off,
+                              task->incoming_len - task->incoming_off);
+        if (n < 0) {
+            LOG_WARN("port %d: write failed, dropping the client", task->id);
+            disconnect(s, task);
+            return false;
+        }
+        task->incoming_off += n;
+        moved += n;
+        if (task->incoming_off < task->incoming_len) {
+            break;
+        }
+    }
+    bool held = task->incoming_off < task->incoming_len || task->draining;
+    if (held != was_held) {
+        arm(s, task, fd);
+    }
+    if (task->draining && task->incoming_off == task->incoming_len && TxQueue_Pending(task->id) == 0) {
+        disconnect(s, task);
+        return false;
+    }
+    return more || moved >= PORT_SCHED_BUDGET;
+}
+
+static PortTask *take(PortSched *s, int self) {
+    Worker &own = s->workers[self];
+    {
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.queue.empty()) {
+            PortTask *task = own.queue.front();
+            own.queue.pop_front();
+            s->queued.fetch_sub(1);
+            return task;
+        }
+    }
+    for (int i = 1; i < s->worker_count; i++) {
+        Worker &victim = s->workers[(self + i) % s->worker_count];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.queue.empty()) {
+            PortTask *task = victim.queue.back();
+            victim.queue.pop_back();
+            s->queued.fetch_sub(1);
+            s->steals.fetch_add(1, std::memory_order_relaxed);
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+static void worker_run(PortSched *s, int self) {
+    ThreadSched_Enter(SCHED_ROLE_SERVER);
+    for (;;) {
+        PortTask *task = take(s, self);
+        if (!task) {
+            std::unique_lock<std::mutex> lock(s->idle_lock);
+            s->sleeping.fetch_add(1);
+            if (s->queued.load() == 0) {
+                s->idle.wait_for(lock, std::chrono::milliseconds(100));
+            }
+            s->sleeping.fetch_sub(1);
+            continue;
+        }
+        task->last_worker = self;
+        uint64_t waited = (uint64_t) std::max<int64_t>(
+                MonoClock_Now() - task->queued_at.load(std::memory_order_relaxed), 0);
+        Metrics_Record(METRIC_SCHED_QUEUE, waited);
+        task->queue_ns.fetch_add(waited, std::memory_order_relaxed);
+        task->queue_waits.fetch_add(1, std::memory_order_relaxed);
+        if (waited > task->queue_max_ns.load(std::memory_order_relaxed)) {
+            task->queue_max_ns.store(waited, std::memory_order_relaxed);
+        }
+        task->state.store(TASK_RUNNING, std::memory_order_release);
+        s->runs.fetch_add(1, std::memory_order_relaxed);
+        bool more = run_task(s, task);
+        if (more) {
+            s->yields.fetch_add(1, std::memory_order_relaxed);
+            task->queued_at.store(MonoClock_Now(), std::memory_order_relaxed);
+            task->state.store(TASK_QUEUED, std::memory_order_release);
+            enqueue(s, task);
+            continue;
+        }
+        int state = TASK_RUNNING;
+        if (!task->state.compare_exchange_strong(state, TASK_IDLE, std::memory_order_acq_rel)) {
+            // Notified while running.
+            task->state.store(TASK_QUEUED, std::memory_order_release);
+            enqueue(s, task);
+        }
+    }
+}
+
+static void accept_client(PortSched *s, PortTask *task) {
+    for (;;) {
+        int fd = accept4(task->listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        if (task->client_fd.load(std::memory_order_acquire) != -1) {
+            LOG_WARN("port %d: already has a client, refusing another", task->id);
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef TCP_NOTSENT_LOWAT
+        int lowat = PORT_SCHED_NOTSENT_LOWAT;
+        setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+#endif
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        ev.data.u64 = (uint64_t) task->id;
+        epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        if (s->compress) {
+            task->encoder = LzStream_EncoderNew();
+        }
+        task->client_fd.store(fd, std::memory_order_release);
+        LOG_INFO("port %d: client connected", task->id);
+        notify(s, task);
+    }
+}
+
+static void reactor_run(PortSched *s) {
+    struct epoll_event events[64];
+    for (;;) {
+        int n = epoll_wait(s->epoll_fd, events, 64, -1);
+        for (int i = 0; i < n; i++) {
+            uint64_t data = events[i].data.u64;
+            PortTask *task = &s->tasks[data & 0xffff];
+            if (data & EPOLL_LISTEN_TAG) {
+                accept_client(s, task);
+            } else if (data & EPOLL_TIMER_TAG) {
+                uint64_t expirations;
+                ssize_t r = read(task->timer_fd, &expirations, sizeof(expirations));
+                (void) r;
+                notify(s, task);
+            } else if (data & EPOLL_TX_TAG) {
+                // Edge triggered, the worker drains tx_fd: it may close it at any time.
+                notify(s, task);
+            } else {
+                notify(s, task);
+            }
+        }
+    }
+}
+
+static void rx_ready(int id) {
+    PortSched_Notify(id);
+}
+
+static char *sched_collect() {
+    PortSchedStats stats;
+    PortSched_Stats(&stats);
+    std::string out;
+    char line[256];
+    snprintf(line, sizeof(line),
+             "# TYPE serial_port_sched_workers gauge\nserial_port_sched_workers %d\n"
+             "# TYPE serial_port_sched_runs_total counter\nserial_port_sched_runs_total %llu\n"
+             "# TYPE serial_port_sched_steals_total counter\nserial_port_sched_steals_total %llu\n",
+             stats.workers, (unsigned long long) stats.runs, (unsigned long long) stats.steals);
+    out += line;
+    snprintf(line, sizeof(line),
+             "# TYPE serial_port_sched_yields_total counter\nserial_port_sched_yields_total %llu\n"
+             "# TYPE serial_port_sched_wakeups_total counter\nserial_port_sched_wakeups_total %llu\n"
+             "# TYPE serial_port_sched_throttles_total counter\nserial_port_sched_throttles_total %llu\n",
+             (unsigned long long) stats.yields, (unsigned long long) stats.wakeups,
+             (unsigned long long) stats.throttles);
+    out += line;
+    PortSched *s = sched.load(std::memory_order_acquire);
+    if (!s) {
+        return strdup(out.c_str());
+    }
+    out += "# HELP serial_port_sched_queue_delay_seconds Time each raw port waited for a worker.\n"
+           "# TYPE serial_port_sched_queue_delay_seconds summary\n";
+    std::string max_lines = "# TYPE serial_port_sched_queue_delay_max_seconds gauge\n";
+    for (int id = s->first_id; id < s->first_id + s->count; id++) {
+        PortTask &task = s->tasks[id];
+        uint64_t waits = task.queue_waits.load(std::memory_order_relaxed);
+        if (waits == 0) {
+            continue;
+        }
+        snprintf(line, sizeof(line),
+                 "serial_port_sched_queue_delay_seconds_sum{port=\"%d\"} %.9f\n"
+                 "serial_port_sched_queue_delay_seconds_count{port=\"%d\"} %llu\n",
+                 id, (double) task.queue_ns.load(std::memory_order_relaxed) / 1e9, id, (unsigned long long) waits);
+        out += line;
+        // Longest wait since the previous scrape.
+        snprintf(line, sizeof(line), "serial_port_sched_queue_delay_max_seconds{port=\"%d\"} %.9f\n", id,
+                 (double) task.queue_max_ns.exchange(0, std::memory_order_relaxed) / 1e9);
+        max_lines += line;
+    }
+    out += max_lines;
+    return strdup(out.c_str());
+}
+
+static int configure(const char *spec) {
+    int weights[RX_RING_MAX_PORTS];
+    int64_t rates[RX_RING_MAX_PORTS];
+    for (int id = 0; id < RX_RING_MAX_PORTS; id++) {
+        weights[id] = portWeight[id].load();
+        rates[id] = portRate[id].load();
+    }
+    char *copy = strdup(spec);
+    char *save = nullptr;
+    int ret = 0;
+    for (char *item = strtok_r(copy, ",", &save); item; item = strtok_r(nullptr, ",", &save)) {
+        while (*item == ' ') {
+            item++;
+        }
+        char *dot = strchr(item, '.');
+        char *eq = strchr(item, '=');
+        if (!dot || !eq || eq < dot) {
+            LOG_WARN("port sched: invalid setting \"%s\"", item);
+            ret = -1;
+            break;
+        }
+        *dot = '\0';
+        *eq = '\0';
+        const char *key = dot + 1;
+        char *end = nullptr;
+        int first = 0;
+        int last = RX_RING_MAX_PORTS - 1;
+        if (strcmp(item, "*") != 0) {
+            first = last = (int) strtol(item, &end, 10);
+            if (*end != '\0' || first < 0 || first >= RX_RING_MAX_PORTS) {
+                ret = -1;
+            }
+        }
+        long long value = strtoll(eq + 1, &end, 10);
+        if (*end != '\0') {
+            ret = -1;
+        } else if (strcmp(key, "weight") == 0 && value >= 1 && value <= PORT_SCHED_MAX_WEIGHT) {
+            std::fill(weights + first, weights + last + 1, (int) value);
+        } else if (strcmp(key, "rate") == 0 && value >= 0) {
+            std::fill(rates + first, rates + last + 1, (int64_t) value);
+        } else {
+            ret = -1;
+        }
+        if (ret < 0) {
+            LOG_WARN("port sched: invalid setting \"%s.%s=%s\"", item, key, eq + 1);
+            break;
+        }
+    }
+    free(copy);
+    if (ret == 0) {
+        for (int id = 0; id < RX_RING_MAX_PORTS; id++) {
+            portWeight[id].store(weights[id], std::memory_order_relaxed);
+            portRate[id].store(rates[id], std::memory_order_relaxed);
+        }
+    }
+    return ret;
+}
+
+extern "C" {
+
+int PortSched_Start(int tcp_base, int first_id, int count, int workers) {
+    if (sched.load()) {
+        LOG_WARN("port scheduler already running");
+        return -1;
+    }
+    if (first_id < 0 || count <= 0 || first_id + count > RX_RING_MAX_PORTS) {
+        LOG_ERROR("invalid port range %d+%d", first_id, count);
+        return -1;
+    }
+    if (workers <= 0) {
+        workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    workers = std::max(1, std::min(std::min(workers, count), PORT_SCHED_MAX_WORKERS));
+#ifdef __ANDROID__
+    char value[PROP_VALUE_MAX] = {0};
+    if (__system_property_get("debug.serialserver.portsched", value) > 0) {
+        configure(value);
+    }
+#else
+    const char *value = getenv("SERIAL_PORTSCHED");
+    if (value) {
+        configure(value);
+    }
+#endif
+    auto *s = new PortSched();
+    s->tcp_base = tcp_base;
+    s->compress = compressNext;
+    s->first_id = first_id;
+    s->count = count;
+    s->worker_count = workers;
+    s->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    for (int id = first_id; id < first_id + count; id++) {
+        PortTask &task = s->tasks[id];
+        task.id = id;
+        task.last_worker = id % workers;
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons((uint16_t) (tcp_base + id));
+        if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 1) != 0) {
+            LOG_ERROR("port %d: listen on %d failed: %s", id, tcp_base + id, strerror(errno));
+            if (fd >= 0) {
+                close(fd);
+            }
+            continue;
+        }
+        task.listen_fd = fd;
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u64 = EPOLL_LISTEN_TAG | (uint64_t) id;
+        epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        task.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        ev.data.u64 = EPOLL_TIMER_TAG | (uint64_t) id;
+        epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, task.timer_fd, &ev);
+    }
+    sched.store(s);
+    RxRing_SetNotify(rx_ready);
+    Metrics_AddCollector(sched_collect);
+    for (int i = 0; i < workers; i++) {
+        s->workers[i].thread = std::thread(worker_run, s, i);
+        s->workers[i].thread.detach();
+    }
+    std::thread(reactor_run, s).detach();
+    LOG_INFO("port scheduler: ports %d-%d on tcp %d+id, %d workers%s", first_id, first_id + count - 1, tcp_base,
+             workers, s->compress ? ", compressed" : "");
+    return 0;
+}
+
+int PortSched_Configure(const char *spec) {
+    return configure(spec);
+}
+
+void PortSched_SetCompress(bool compress) {
+    compressNext = compress;
+}
+
+void PortSched_Notify(int id) {
+    PortSched *s = sched.load(std::memory_order_acquire);
+    if (!s || id < s->first_id || id >= s->first_id + s->count) {
+        return;
+    }
+    PortTask *task = &s->tasks[id];
+    if (task->client_fd.load(std::memory_order_relaxed) >= 0) {
+        notify(s, task);
+    }
+}
+
+void PortSched_Stats(PortSchedStats *stats) {
+    PortSched *s = sched.load(std::memory_order_acquire);
+    memset(stats, 0, sizeof(*stats));
+    if (!s) {
+        return;
+    }
+    stats->workers = s->worker_count;
+    stats->runs = s->runs.load(std::memory_order_relaxed);
+    stats->steals = s->steals.load(std::memory_order_relaxed);
+    stats->yields = s->yields.load(std::memory_order_relaxed);
+    stats->wakeups = s->wakeups.load(std::memory_order_relaxed);
+    stats->throttles = s->throttles.load(std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,406 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <sys/mman.h>
+
+#ifdef __ANDROID__
+#include <sys/system_properties.h>
+#endif
+
+#include "metrics.h"
+#include "py_alloc.h"
+#include "serial.h"
+
+#define LOG_LEVEL LOG_LEVEL_INFO
+#include "log.h"
+
+#define PY_ALLOC_MAGIC 0x5041u
+#define PY_ALLOC_DELEGATED 0xffffu
+#define PY_ALLOC_SMALL 512              // pymalloc's own limit, left to it
+#define PY_ALLOC_ARENA_SIZE (64 * 1024)
+
+// Precedes every block; 16 bytes keep the 16 byte alignment of the result.
+struct BlockHeader {
+    uint64_t size;    // requested size
+    uint16_t cls;     // size class, PY_ALLOC_DELEGATED for the wrapped allocator
+    uint16_t magic;
+    uint32_t reserved;
+};
+static_assert(sizeof(BlockHeader) == 16, "header must keep malloc alignment");
+
+struct FreeBlock {
+    FreeBlock *next;
+};
+
+// A bytes object of 4 KiB, the chunk the read path hands out, with its object and block headers.
+#define PY_ALLOC_BYTES_4K ((offsetof(PyBytesObject, ob_sval) + 1 + 4096 + sizeof(BlockHeader) + 15) & ~(size_t) 15)
+
+// Block sizes include the header.
+static const uint32_t class_sizes[PY_ALLOC_CLASS_COUNT] = {768, 1024, 2048, PY_ALLOC_BYTES_4K, 8192, 16384};
+
+struct SizeClass {
+    FreeBlock *free_list;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> free;
+};
+
+struct Domain {
+    PyMemAllocatorEx wrapped;
+    PyAllocDomain domain;
+    bool shared;          // RAW: no GIL, counters need read-modify-write
+    std::atomic<uint64_t> allocs;
+    std::atomic<uint64_t> reallocs;
+    std::atomic<uint64_t> frees;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> in_use;
+    std::atomic<uint64_t> peak;
+};
+
+static Domain domains[PY_ALLOC_DOMAIN_COUNT];
+static SizeClass classes[PY_ALLOC_CLASS_COUNT];
+static std::atomic<int> mode{PY_ALLOC_OFF};
+// Current arena of the OBJ domain, only touched under the GIL.
+static char *arena_next;
+static size_t arena_left;
+
+static inline void add(Domain *d, std::atomic<uint64_t> &counter, uint64_t value) {
+    if (d->shared) {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    } else {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+}
+
+static inline void sub(Domain *d, std::atomic<uint64_t> &counter, uint64_t value) {
+    if (d->shared) {
+        counter.fetch_sub(value, std::memory_order_relaxed);
+    } else {
+        counter.store(counter.load(std::memory_order_relaxed) - value, std::memory_order_relaxed);
+    }
+}
+
+static inline void update_peak(Domain *d) {
+    uint64_t in_use = d->in_use.load(std::memory_order_relaxed);
+    // A lost update under contention only makes the RAW peak slightly low.
+    if (in_use > d->peak.load(std::memory_order_relaxed)) {
+        d->peak.store(in_use, std::memory_order_relaxed);
+    }
+}
+
+static inline void account_alloc(Domain *d, size_t size) {
+    add(d, d->allocs, 1);
+    add(d, d->bytes, size);
+    add(d, d->in_use, size);
+    update_peak(d);
+}
+
+// Whatever the header pushes past pymalloc's limit is taken here, not left to malloc.
+static inline int class_of(size_t size) {
+    if (size + sizeof(BlockHeader) <= PY_ALLOC_SMALL) {
+        return -1;
+    }
+    for (int i = 0; i < PY_ALLOC_CLASS_COUNT; i++) {
+        if (size + sizeof(BlockHeader) <= class_sizes[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void *class_alloc(int cls) {
+    SizeClass &c = classes[cls];
+    FreeBlock *block = c.free_list;
+    if (block) {
+        c.free_list = block->next;
+        c.free.store(c.free.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+        c.hits.store(c.hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return block;
+    }
+    uint32_t size = class_sizes[cls];
+    if (arena_left < size) {
+        // The tail of the old arena is dropped; arenas live as long as the process.
+        void *arena = mmap(nullptr, PY_ALLOC_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (arena == MAP_FAILED) {
+            return nullptr;
+        }
+        arena_next = (char *) arena;
+        arena_left = PY_ALLOC_ARENA_SIZE;
+    }
+    void *p = arena_next;
+    arena_next += size;
+    arena_left -= size;
+    c.misses.store(c.misses.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return p;
+}
+
+static void class_free(int cls, void *p) {
+    SizeClass &c = classes[cls];
+    FreeBlock *block = (FreeBlock *) p;
+    block->next = c.free_list;
+    c.free_list = block;
+    c.free.store(c.free.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+static void *block_alloc(Domain *d, size_t size, bool zero) {
+    if (size > (size_t) PY_SSIZE_T_MAX - sizeof(BlockHeader)) {
+        return nullptr;
+    }
+    int cls = d->domain == PY_ALLOC_OBJ && mode.load(std::memory_order_relaxed) == PY_ALLOC_ARENA ? class_of(size) : -1;
+    BlockHeader *h;
+    if (cls >= 0) {
+        h = (BlockHeader *) class_alloc(cls);
+        if (h && zero) {
+            memset(h + 1, 0, size);
+        }
+    } else if (zero) {
+        h = (BlockHeader *) d->wrapped.calloc(d->wrapped.ctx, 1, size + sizeof(BlockHeader));
+    } else {
+        h = (BlockHeader *) d->wrapped.malloc(d->wrapped.ctx, size + sizeof(BlockHeader));
+    }
+    if (!h) {
+        return nullptr;
+    }
+    h->size = size;
+    h->cls = cls >= 0 ? (uint16_t) cls : PY_ALLOC_DELEGATED;
+    h->magic = PY_ALLOC_MAGIC;
+    account_alloc(d, size);
+    return h + 1;
+}
+
+static void *domain_malloc(void *ctx, size_t size) {
+    return block_alloc((Domain *) ctx, size, false);
+}
+
+static void *domain_calloc(void *ctx, size_t nelem, size_t elsize) {
+    if (elsize && nelem > (size_t) PY_SSIZE_T_MAX / elsize) {
+        return nullptr;
+    }
+    return block_alloc((Domain *) ctx, nelem * elsize, true);
+}
+
+static void domain_free(void *ctx, void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    Domain *d = (Domain *) ctx;
+    BlockHeader *h = (BlockHeader *) ptr - 1;
+    add(d, d->frees, 1);
+    sub(d, d->in_use, h->size);
+    h->magic = 0;
+    if (h->cls != PY_ALLOC_DELEGATED) {
+        class_free(h->cls, h);
+    } else {
+        d->wrapped.free(d->wrapped.ctx, h);
+    }
+}
+
+static void *domain_realloc(void *ctx, void *ptr, size_t size) {
+    if (!ptr) {
+        return domain_malloc(ctx, size);
+    }
+    Domain *d = (Domain *) ctx;
+    BlockHeader *h = (BlockHeader *) ptr - 1;
+    size_t old_size = h->size;
+    if (size > (size_t) PY_SSIZE_T_MAX - sizeof(BlockHeader)) {
+        return nullptr;
+    }
+    if (h->cls != PY_ALLOC_DELEGATED) {
+        if (size + sizeof(BlockHeader) > PY_ALLOC_SMALL && size + sizeof(BlockHeader) <= class_sizes[h->cls]) {
+            h->size = size; // still fits its class
+        } else {
+            void *p = block_alloc(d, size, false);
+            if (!p) {
+                return nullptr;
+            }
+            memcpy(p, ptr, old_size < size ? old_size : size);
+            domain_free(ctx, ptr);
+            // block_alloc and domain_free counted an alloc and a free.
+            sub(d, d->allocs, 1);
+            sub(d, d->frees, 1);
+            sub(d, d->bytes, size);
+            add(d, d->reallocs, 1);
+            add(d, d->bytes, size > old_size ? size - old_size : 0);
+            return p;
+        }
+    } else {
+        h = (BlockHeader *) d->wrapped.realloc(d->wrapped.ctx, h, size + sizeof(BlockHeader));
+        if (!h) {
+            return nullptr;
+        }
+        h->size = size;
+    }
+    add(d, d->reallocs, 1);
+    if (size > old_size) {
+        add(d, d->bytes, size - old_size);
+        add(d, d->in_use, size - old_size);
+        update_peak(d);
+    } else {
+        sub(d, d->in_use, old_size - size);
+    }
+    return h + 1;
+}
+
+static char *pymem_collect() {
+    std::string out;
+    char line[160];
+    static const char *help[][2] = {
+        {"serial_pymem_allocations_total", "counter"},
+        {"serial_pymem_bytes_total", "counter"},
+        {"serial_pymem_bytes", "gauge"},
+        {"serial_pymem_peak_bytes", "gauge"},
+    };
+    for (int m = 0; m < 4; m++) {
+        snprintf(line, sizeof(line), "# TYPE %s %s\n", help[m][0], help[m][1]);
+        out += line;
+        for (int i = 0; i < PY_ALLOC_DOMAIN_COUNT; i++) {
+            PyAllocStats stats;
+            PyAlloc_Stats((PyAllocDomain) i, &stats);
+            uint64_t value = m == 0 ? stats.allocs : m == 1 ? stats.bytes : m == 2 ? stats.in_use : stats.peak;
+            snprintf(line, sizeof(line), "%s{domain=\"%s\"} %llu\n", help[m][0],
+                     PyAlloc_DomainName((PyAllocDomain) i), (unsigned long long) value);
+            out += line;
+        }
+    }
+    return strdup(out.c_str());
+}
+
+static int mode_parse(const char *value) {
+    if (strcmp(value, "off") == 0) {
+        return PY_ALLOC_OFF;
+    }
+    if (strcmp(value, "arena") == 0) {
+        return PY_ALLOC_ARENA;
+    }
+    return PY_ALLOC_STATS;
+}
+
+extern "C" {
+
+void PyAlloc_Install(int requested) {
+    static bool installed = false;
+    if (installed) {
+        return;
+    }
+    installed = true;
+    if (requested < 0) {
+        requested = PY_ALLOC_OFF;
+#ifdef __ANDROID__
+        char value[PROP_VALUE_MAX] = {0};
+        if (__system_property_get("debug.serialserver.pymem", value) > 0) {
+            requested = mode_parse(value);
+        }
+#else
+        const char *value = getenv("SERIAL_PYMEM");
+        if (value) {
+            requested = mode_parse(value);
+        }
+#endif
+    }
+    if (requested == PY_ALLOC_OFF) {
+        return;
+    }
+    static const PyMemAllocatorDomain py_domains[PY_ALLOC_DOMAIN_COUNT] = {
+        PYMEM_DOMAIN_RAW, PYMEM_DOMAIN_MEM, PYMEM_DOMAIN_OBJ};
+    for (int i = 0; i < PY_ALLOC_DOMAIN_COUNT; i++) {
+        Domain &d = domains[i];
+        d.domain = (PyAllocDomain) i;
+        d.shared = i == PY_ALLOC_RAW;
+        PyMem_GetAllocator(py_domains[i], &d.wrapped);
+        PyMemAllocatorEx alloc = {&d, domain_malloc, domain_calloc, domain_realloc, domain_free};
+        PyMem_SetAllocator(py_domains[i], &alloc);
+    }
+    mode.store(requested, std::memory_order_relaxed);
+    Metrics_AddCollector(pymem_collect);
+    LOG_INFO("python allocators: %s", requested == PY_ALLOC_ARENA ? "arena" : "stats");
+}
+
+PyAllocMode PyAlloc_Mode(void) {
+    return (PyAllocMode) mode.load(std::memory_order_relaxed);
+}
+
+void PyAlloc_Stats(PyAllocDomain domain, PyAllocStats *stats) {
+    const Domain &d = domains[domain];
+    stats->allocs = d.allocs.load(std::memory_order_relaxed);
+    stats->reallocs = d.reallocs.load(std::memory_order_relaxed);
+    stats->frees = d.frees.load(std::memory_order_relaxed);
+    stats->bytes = d.bytes.load(std::memory_order_relaxed);
+    stats->in_use = d.in_use.load(std::memory_order_relaxed);
+    stats->peak = d.peak.load(std::memory_order_relaxed);
+}
+
+int PyAlloc_Classes(PyAllocClass *out, int max) {
+    if (mode.load(std::memory_order_relaxed) != PY_ALLOC_ARENA) {
+        return 0;
+    }
+    int n = max < PY_ALLOC_CLASS_COUNT ? max : PY_ALLOC_CLASS_COUNT;
+    for (int i = 0; i < n; i++) {
+        out[i].size = class_sizes[i];
+        out[i].hits = classes[i].hits.load(std::memory_order_relaxed);
+        out[i].misses = classes[i].misses.load(std::memory_order_relaxed);
+        out[i].free = classes[i].free.load(std::memory_order_relaxed);
+    }
+    return n;
+}
+
+const char *PyAlloc_DomainName(PyAllocDomain domain) {
+    static const char *names[PY_ALLOC_DOMAIN_COUNT] = {"raw", "mem", "obj"};
+    return names[domain];
+}
+
+void PyAlloc_Log(void) {
+    if (mode.load(std::memory_order_relaxed) == PY_ALLOC_OFF) {
+        return;
+    }
+    uint64_t forwarded = 0;
+    for (int port = 0; port < METRICS_MAX_PORTS; port++) {
+        forwarded += Metrics_Counter(port, METRIC_RX_BYTES) + Metrics_Counter(port, METRIC_TX_BYTES);
+    }
+    double mb = forwarded / 1048576.0;
+    for (int i = 0; i < PY_ALLOC_DOMAIN_COUNT; i++) {
+        PyAllocStats s;
+        PyAlloc_Stats((PyAllocDomain) i, &s);
+        LOG_INFO("pymem %s: %llu allocs, %llu reallocs, %llu KiB churn (%.0f KiB/MB forwarded), "
+                 "%llu KiB in use, peak %llu KiB",
+                 PyAlloc_DomainName((PyAllocDomain) i), (unsigned long long) s.allocs,
+                 (unsigned long long) s.reallocs, (unsigned long long) (s.bytes / 1024),
+                 mb > 0 ? s.bytes / 1024.0 / mb : 0.0, (unsigned long long) (s.in_use / 1024),
+                 (unsigned long long) (s.peak / 1024));
+    }
+    PyAllocClass c[PY_ALLOC_CLASS_COUNT];
+    int n = PyAlloc_Classes(c, PY_ALLOC_CLASS_COUNT);
+    for (int i = 0; i < n; i++) {
+        LOG_INFO("pymem arena %u: %llu hits, %llu misses, %llu free", c[i].size, (unsigned long long) c[i].hits,
+                 (unsigned long long) c[i].misses, (unsigned long long) c[i].free);
+    }
+}
+
+}
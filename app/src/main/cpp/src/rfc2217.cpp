@@ -48,6 +48,9 @@ exit 0
 
 #include "serial.h"
 #include "log.h"
+#include "py_alloc.h"
+#include "trace.h"
+#include "watchdog.h"
 
 extern "C" {
 extern int init_start(const char* binary_filename, const int verbose);
@@ -56,6 +59,11 @@ extern void init_exit();
 }
 
 int librfc2217_init(const char* binary_filename, const int verbose) {
+    Trace_Init();
+    Watchdog_Start(WATCHDOG_DEFAULT_THRESHOLD_MS);
+    TRACE_SCOPE("librfc2217_init");
+    // Has to precede the first allocation of the interpreter.
+    PyAlloc_Install(-1);
     int ret = init_start(binary_filename, verbose);
     LOG_DEBUG("init_start %d\n", ret);
     return ret;
@@ -112,8 +120,13 @@ static void print_backtrace() {
     Py_XDECREF(ptraceback);
 }
 
+// Called again after every server exit (SerialService restarts it in a loop),
+// so every reference taken here is dropped on every path: PyTuple_SetItem
+// steals, PyObject_SetAttrString and PyDict_SetItemString do not.
 int librfc2217_start(const int port, const int tcpPort, const int verbose = 2) {
+    TRACE_BEGIN("import librfc2217");
     PyObject *pModule = (PyObject *)init_import_module("librfc2217");
+    TRACE_END();
     LOG_DEBUG("module %p\n", pModule);
     if (!pModule || PyErr_Occurred()) {
 #ifdef __LINUX__
@@ -133,6 +146,19 @@ int librfc2217_start(const int port, const int tcpPort, const int verbose = 2) {
     PyObject *dict = PyModule_GetDict(pModule);
     LOG_DEBUG("dict %p\n", dict);
 
+    int ret = -1;
+    PyObject *platform = nullptr;
+    PyObject *serial = nullptr;
+    PyObject *server = nullptr;
+    PyObject *platformInstance = nullptr;
+    PyObject *serialInstance = nullptr;
+    PyObject *serverInstance = nullptr;
+    PyObject *pArgs = nullptr;
+    PyObject *pKwargs = nullptr;
+    PyObject *value = nullptr;
+    PyObject *result = nullptr;
+    std::string portStr;
+
     PyObject *platformModule = PyInit_android();
     if (!platformModule) {
         PyErr_Print();
@@ -140,16 +166,15 @@ int librfc2217_start(const int port, const int tcpPort, const int verbose = 2) {
         return -1;
     }
 
-    PyObject *platform = PyObject_GetAttrString(platformModule, "Serial");
-    PyObject *serial = PyObject_GetAttrString(pModule, "SerialAndroid");
-    PyObject *server = PyObject_GetAttrString(pModule, "RFC2217Server");
+    platform = PyObject_GetAttrString(platformModule, "Serial");
+    serial = PyObject_GetAttrString(pModule, "SerialAndroid");
+    server = PyObject_GetAttrString(pModule, "RFC2217Server");
 
     if (!platform || !serial || !server || PyErr_Occurred()) {
         print_backtrace();
         PyErr_Print();
         PyErr_Clear();
-        Py_XDECREF(platformModule);
-        return -1;
+        goto done;
     }
 
     LOG_DEBUG("platform %p type %s\n", platform, type_name);
@@ -158,98 +183,88 @@ int librfc2217_start(const int port, const int tcpPort, const int verbose = 2) {
 
     if (!PyCallable_Check(platform)) {
         LOG_ERROR("platform is not callable\n");
-        Py_XDECREF(platformModule);
-        return -1;
+        goto done;
     }
 
-    PyObject *platformInstance = PyObject_CallNoArgs(platform);
+    platformInstance = PyObject_CallNoArgs(platform);
     if (!platformInstance || PyErr_Occurred()) {
         print_backtrace();
         PyErr_Print();
         PyErr_Clear();
-        Py_XDECREF(platformModule);
-        return -1;
+        goto done;
     }
 
     LOG_DEBUG("platformInstance %p type %s\n", platformInstance, Py_TYPE(platformInstance)->tp_name);
 
-    PyObject* pArgs = PyTuple_New(1);
-    PyObject* pKwargs = PyDict_New();
-    PyTuple_SetItem(pArgs, 0, platformInstance);
-
-    if (!pArgs || !pKwargs || PyErr_Occurred()) {
-        print_backtrace();
-        PyErr_Print();
-        PyErr_Clear();
-        Py_XDECREF(platformInstance);
-        Py_XDECREF(platformModule);
-        return -1;
-    }
-
     if (!PyCallable_Check(serial)) {
         LOG_ERROR("serial is not callable\n");
-        Py_XDECREF(pArgs);
-        Py_XDECREF(pKwargs);
-        Py_XDECREF(platformInstance);
-        Py_XDECREF(platformModule);
-        return -1;
+        goto done;
     }
 
-    PyObject *serialInstance = PyObject_Call(serial, pArgs, pKwargs);
+    // PyObject_CallOneArg instead of a tuple: the tuple would steal platformInstance.
+    serialInstance = PyObject_CallOneArg(serial, platformInstance);
     if (!serialInstance || PyErr_Occurred()) {
         print_backtrace();
         PyErr_Print();
         PyErr_Clear();
-        Py_XDECREF(pArgs);
-        Py_XDECREF(pKwargs);
-        Py_XDECREF(platformInstance);
-        Py_XDECREF(platformModule);
-        return -1;
+        goto done;
     }
 
     LOG_DEBUG("serialInstance %p type %s\n", serialInstance, Py_TYPE(serialInstance)->tp_name);
 
-    std::string portStr = "rfc2217:///dev/ttyUSB" + std::to_string(port);
-    PyObject_SetAttrString(serialInstance, "port", PyUnicode_FromString(portStr.c_str()));
-
-    PyObject* pArgs2 = PyTuple_New(1);
-    PyObject* pKwargs2 = PyDict_New();
-    PyTuple_SetItem(pArgs2, 0, serialInstance);
-
-    PyDict_SetItemString(pKwargs2, "local_port", PyLong_FromLong(tcpPort));
-    PyDict_SetItemString(pKwargs2, "verbosity", PyLong_FromLong(verbose));
-    PyDict_SetItemString(pKwargs2, "r0", PyBool_FromLong(0));
+    portStr = "rfc2217:///dev/ttyUSB" + std::to_string(port);
+    value = PyUnicode_FromString(portStr.c_str());
+    if (!value || PyObject_SetAttrString(serialInstance, "port", value) < 0) {
+        print_backtrace();
+        PyErr_Clear();
+        goto done;
+    }
+    Py_CLEAR(value);
 
-    PyObject *serverInstance = PyObject_Call(server, pArgs2, pKwargs2);
-    LOG_DEBUG("serverInstance %p type %s\n", serverInstance, Py_TYPE(serverInstance)->tp_name);
+    pArgs = PyTuple_Pack(1, serialInstance);
+    pKwargs = Py_BuildValue("{s:i,s:i,s:O}", "local_port", tcpPort, "verbosity", verbose, "r0", Py_False);
+    if (!pArgs || !pKwargs) {
+        print_backtrace();
+        PyErr_Clear();
+        goto done;
+    }
 
+    serverInstance = PyObject_Call(server, pArgs, pKwargs);
     if (!serverInstance || PyErr_Occurred()) {
         print_backtrace();
         PyErr_Print();
         PyErr_Clear();
-        Py_XDECREF(pArgs2);
-        Py_XDECREF(pKwargs2);
-        Py_XDECREF(serialInstance);
-        Py_XDECREF(platformInstance);
-        Py_XDECREF(platformModule);
-        return -1;
+        goto done;
     }
+    LOG_DEBUG("serverInstance %p type %s\n", serverInstance, Py_TYPE(serverInstance)->tp_name);
 
-    PyObject_CallMethod(serverInstance, "start_server", nullptr);
+    // The server loop runs inside the prebuilt module; its serial I/O shows up
+    // as the Serial.read / Serial.write sections nested under this one.
+    TRACE_BEGIN("RFC2217Server.start_server");
+    result = PyObject_CallMethod(serverInstance, "start_server", nullptr);
+    TRACE_END();
     if (PyErr_Occurred()) {
         print_backtrace();
         PyErr_Print();
         PyErr_Clear();
     }
-
-    Py_XDECREF(pArgs2);
-    Py_XDECREF(pKwargs2);
+    PyAlloc_Log();
+    ret = 0;
+
+done:
+    Py_XDECREF(result);
+    Py_XDECREF(value);
+    Py_XDECREF(pArgs);
+    Py_XDECREF(pKwargs);
     Py_XDECREF(serverInstance);
     Py_XDECREF(serialInstance);
     Py_XDECREF(platformInstance);
+    Py_XDECREF(server);
+    Py_XDECREF(serial);
+    Py_XDECREF(platform);
     Py_XDECREF(platformModule);
 
-    return 0;
+    return ret;
 }
 
 extern "C" {
@@ -0,0 +1,489 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifdef __ANDROID__
+#include <android/sharedmem.h>
+#endif
+
+#include "buffer_pool.h"
+#include "capture.h"
+#include "java_method.h"
+#include "metrics.h"
+#include "mono_clock.h"
+#include "rx_ring.h"
+#include "shm_ring.h"
+#include "trace.h"
+#include "watchdog.h"
+
+#define LOG_LEVEL LOG_LEVEL_WARN
+#include "log.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+
+#define RX_RING_MARKS 64
+
+// Arrival time of a pushed chunk, kept until the primary reader passes `end`.
+struct RxMark {
+    uint64_t end;
+    uint64_t ns;
+    int32_t cookie; // async trace slice "rx chunk"
+};
+
+struct RxRing {
+    int id = -1;
+    int fd = -1;
+    bool opened = false;
+    ShmRingHeader *header = nullptr;
+    uint8_t *data = nullptr; // data area, mapped twice back to back
+    uint64_t capacity = 0;
+    uint64_t tail = 0;       // primary reader position, guarded by lock
+    int subscribers[RX_RING_MAX_SUBSCRIBERS];   // guarded by subscribersLock
+    std::mutex subscribersLock;                 // not lock: a push signals them after releasing it
+    RxMark marks[RX_RING_MARKS];
+    unsigned mark_first = 0;  // guarded by lock, like tail
+    unsigned mark_count = 0;
+    uint32_t mark_seq = 0;
+    std::mutex lock;
+    MonoCondition notEmpty;
+};
+
+// Rings are created on first open and kept for the lifetime of the process,
+// so a push racing with RxRing_Close() never touches unmapped memory.
+static RxRing *rings[RX_RING_MAX_PORTS];
+static std::mutex ringsLock;
+static std::atomic<void (*)(int)> pushNotify{nullptr};
+static std::atomic<const RxRingFlow *> flowHooks{nullptr};
+
+static RxRing *ring_get(int id) {
+    if (id < 0 || id >= RX_RING_MAX_PORTS) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> guard(ringsLock);
+    return rings[id];
+}
+
+static int ring_memfd(const char *name, size_t size) {
+    int fd = (int) syscall(__NR_memfd_create, name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd >= 0) {
+        if (ftruncate(fd, (off_t) size) < 0) {
+            close(fd);
+            return -1;
+        }
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW);
+        return fd;
+    }
+#ifdef __ANDROID__
+    // memfd_create is filtered on some older kernels, ashmem works everywhere.
+    return ASharedMemory_create(name, size);
+#else
+    return -1;
+#endif
+}
+
+// The data area must start on a page boundary to be mapped twice; devices with
+// 16 KiB pages therefore get a larger header slot than SHM_RING_HEADER_SIZE.
+static uint64_t page_size() {
+    long size = sysconf(_SC_PAGESIZE);
+    return size > SHM_RING_HEADER_SIZE ? (uint64_t) size : SHM_RING_HEADER_SIZE;
+}
+
+static bool ring_map(RxRing *ring, int id, uint64_t capacity) {
+    char name[32];
+    snprintf(name, sizeof(name), "serial-rx-%d", id);
+    uint64_t offset = page_size();
+    int fd = ring_memfd(name, offset + capacity);
+    if (fd < 0) {
+        LOG_ERROR("memfd for port %d failed: %s", id, strerror(errno));
+        return false;
+    }
+    void *h = mmap(nullptr, SHM_RING_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    void *area = mmap(nullptr, capacity * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (h == MAP_FAILED || area == MAP_FAILED) {
+        LOG_ERROR("mmap for port %d failed: %s", id, strerror(errno));
+        if (h != MAP_FAILED) munmap(h, SHM_RING_HEADER_SIZE);
+        if (area != MAP_FAILED) munmap(area, capacity * 2);
+        close(fd);
+        return false;
+    }
+    char *base = static_cast<char *>(area);
+    if (mmap(base, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, (off_t) offset) == MAP_FAILED ||
+        mmap(base + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, (off_t) offset) == MAP_FAILED) {
+        LOG_ERROR("mirror mmap for port %d failed: %s", id, strerror(errno));
+        munmap(h, SHM_RING_HEADER_SIZE);
+        munmap(area, capacity * 2);
+        close(fd);
+        return false;
+    }
+    ShmRingHeader *header = new(h) ShmRingHeader();
+    header->magic = SHM_RING_MAGIC;
+    header->version = SHM_RING_VERSION;
+    header->capacity = capacity;
+    header->data_offset = offset;
+    header->port_id = id;
+    header->head.store(0, std::memory_order_relaxed);
+    header->reserve.store(0, std::memory_order_relaxed);
+    header->overflow.store(0, std::memory_order_relaxed);
+
+    ring->id = id;
+    ring->fd = fd;
+    ring->header = header;
+    ring->data = reinterpret_cast<uint8_t *>(base);
+    ring->capacity = capacity;
+    for (int &s : ring->subscribers) {
+        s = -1;
+    }
+    return true;
+}
+
+static uint64_t round_capacity(int capacity) {
+    uint64_t cap = page_size();
+    while (cap < (uint64_t) capacity) {
+        cap <<= 1;
+    }
+    return cap;
+}
+
+// When the mark queue is full the newest mark absorbs the chunk, so its
+// delay is measured from the earlier arrival (an overestimate, never under).
+static void mark_push(RxRing *ring, uint64_t end, uint64_t ns) {
+    if (ring->mark_count == RX_RING_MARKS) {
+        ring->marks[(ring->mark_first + ring->mark_count - 1) % RX_RING_MARKS].end = end;
+        return;
+    }
+    int32_t cookie = (int32_t) (((uint32_t) ring->id << 24) | (ring->mark_seq++ & 0xffffff));
+    ring->marks[(ring->mark_first + ring->mark_count) % RX_RING_MARKS] = RxMark{end, ns, cookie};
+    ring->mark_count++;
+    TRACE_ASYNC_BEGIN("rx chunk", cookie);
+}
+
+// Records the forwarding delay of every chunk the reader has now fully consumed.
+static void mark_consume(RxRing *ring, uint64_t tail) {
+    uint64_t now = 0;
+    while (ring->mark_count > 0 && ring->marks[ring->mark_first].end <= tail) {
+        if (!now) {
+            now = Metrics_Now();
+        }
+        Metrics_Record(METRIC_FORWARD, now - ring->marks[ring->mark_first].ns);
+        TRACE_ASYNC_END("rx chunk", ring->marks[ring->mark_first].cookie);
+        ring->mark_first = (ring->mark_first + 1) % RX_RING_MARKS;
+        ring->mark_count--;
+    }
+}
+
+// Discarded data never reaches the reader, close its slices without a delay sample.
+static void mark_drop(RxRing *ring) {
+    while (ring->mark_count > 0) {
+        TRACE_ASYNC_END("rx chunk", ring->marks[ring->mark_first].cookie);
+        ring->mark_first = (ring->mark_first + 1) % RX_RING_MARKS;
+        ring->mark_count--;
+    }
+}
+
+extern "C" {
+
+int RxRing_Open(int id, int capacity) {
+    if (id < 0 || id >= RX_RING_MAX_PORTS) {
+        LOG_ERROR("invalid port id %d", id);
+        return -1;
+    }
+    std::lock_guard<std::mutex> guard(ringsLock);
+    RxRing *ring = rings[id];
+    if (!ring) {
+        ring = new RxRing();
+        if (!ring_map(ring, id, round_capacity(capacity > 0 ? capacity : RX_RING_DEFAULT_CAPACITY))) {
+            delete ring;
+            return -1;
+        }
+        rings[id] = ring;
+    }
+    std::lock_guard<std::mutex> lock(ring->lock);
+    ring->opened = true;
+    ring->tail = ring->header->head.load(std::memory_order_relaxed);
+    mark_drop(ring);
+    return 0;
+}
+
+void RxRing_Close(int id) {
+    RxRing *ring = ring_get(id);
+    if (!ring) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(ring->lock);
+    ring->opened = false;
+    ring->tail = ring->header->head.load(std::memory_order_relaxed);
+    mark_drop(ring);
+    ring->notEmpty.notify_all();
+}
+
+int RxRing_Push(int id, const int8_t *data, int length) {
+    RxRing *ring = ring_get(id);
+    if (!ring || length <= 0) {
+        return 0;
+    }
+    Capture_Record(id, CAPTURE_DIR_RX, data, length);
+    const RxRingFlow *flow = flowHooks.load(std::memory_order_acquire);
+    int8_t *kept = nullptr;
+    if (flow) {
+        length = flow->filter(id, data, length, &kept);
+        if (kept) {
+            data = kept;
+        }
+    }
+    uint64_t now = Metrics_Now();
+    std::unique_lock<std::mutex> lock(ring->lock);
+    if (!ring->opened || length <= 0) {
+        lock.unlock();
+        BufferPool_Put(kept);
+        return 0;
+    }
+    ShmRingHeader *header = ring->header;
+    uint64_t head = header->head.load(std::memory_order_relaxed);
+    uint64_t space = ring->capacity - (head - ring->tail);
+    uint64_t n = (uint64_t) length < space ? (uint64_t) length : space;
+    if (n < (uint64_t) length) {
+        header->overflow.fetch_add(length - n, std::memory_order_relaxed);
+        Metrics_Add(id, METRIC_OVERFLOWS, length - n);
+        LOG_WARN("port %d rx overflow, dropped %d bytes", id, (int) (length - n));
+    }
+    if (n > 0) {
+        header->reserve.store(head + n, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(ring->data + (head & (ring->capacity - 1)), data, n);
+        header->head.store(head + n, std::memory_order_release);
+        Metrics_Add(id, METRIC_RX_BYTES, n);
+        mark_push(ring, head + n, now);
+        ring->notEmpty.notify_all();
+        uint64_t used = head + n - ring->tail;
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> guard(ring->subscribersLock);
+            uint64_t one = 1;
+            for (int fd : ring->subscribers) {
+                if (fd >= 0) {
+                    ssize_t r = write(fd, &one, sizeof(one));
+                    (void) r;
+                }
+            }
+        }
+        void (*notify)(int) = pushNotify.load(std::memory_order_acquire);
+        if (notify) {
+            notify(id);
+        }
+        if (flow) {
+            flow->level(id, used, ring->capacity);
+        }
+    }
+    BufferPool_Put(kept);
+    return (int) n;
+}
+
+int RxRing_Read(int id, int8_t *data, int size, int64_t timeout) {
+    int64_t deadline = MonoClock_Now() + timeout;
+    RxRing *ring = ring_get(id);
+    if (!ring || size < 0) {
+        return -1;
+    }
+    std::unique_lock<std::mutex> lock(ring->lock);
+    if (!ring->opened) {
+        return -1;
+    }
+    auto available = [ring]() {
+        return ring->header->head.load(std::memory_order_relaxed) - ring->tail;
+    };
+    if (available() < (uint64_t) size && timeout > 0) {
+        TRACE_SCOPE("RxRing wait");
+        ring->notEmpty.wait_until(lock, deadline, [&]() {
+            return !ring->opened || available() >= (uint64_t) size;
+        });
+    }
+    uint64_t n = available();
+    if (n > (uint64_t) size) {
+        n = size;
+    }
+    memcpy(data, ring->data + (ring->tail & (ring->capacity - 1)), n);
+    ring->tail += n;
+    mark_consume(ring, ring->tail);
+    uint64_t used = available();
+    lock.unlock();
+    const RxRingFlow *flow = flowHooks.load(std::memory_order_acquire);
+    if (flow && n > 0) {
+        flow->level(id, used, ring->capacity);
+    }
+    Metrics_Add(id, METRIC_READS, 1);
+    if (n < (uint64_t) size && timeout > 0) {
+        Metrics_Add(id, METRIC_TIMEOUTS, 1);
+    }
+    return (int) n;
+}
+
+int RxRing_Available(int id) {
+    RxRing *ring = ring_get(id);
+    if (!ring) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(ring->lock);
+    return (int) (ring->header->head.load(std::memory_order_relaxed) - ring->tail);
+}
+
+int RxRing_Reset(int id) {
+    RxRing *ring = ring_get(id);
+    if (!ring) {
+        return -1;
+    }
+    {
+        std::lock_guard<std::mutex> lock(ring->lock);
+        uint64_t head = ring->header->head.load(std::memory_order_relaxed);
+        LOG_DEBUG("port %d dropping %d bytes", id, (int) (head - ring->tail));
+        ring->tail = head;
+        mark_drop(ring);
+    }
+    const RxRingFlow *flow = flowHooks.load(std::memory_order_acquire);
+    if (flow) {
+        flow->level(id, 0, ring->capacity);
+    }
+    return 0;
+}
+
+int RxRing_ShareFd(int id) {
+    RxRing *ring = ring_get(id);
+    if (!ring) {
+        return -1;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", ring->fd);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        return fd;
+    }
+#ifdef __ANDROID__
+    // ashmem cannot be reopened through procfs. A duplicate shares the region's protection, so the region is made
+    // read-only first; that only limits later mmaps, the ring's own writable mappings stay as they are.
+    if (ASharedMemory_setProt(ring->fd, PROT_READ) == 0) {
+        return fcntl(ring->fd, F_DUPFD_CLOEXEC, 0);
+    }
+#endif
+    LOG_WARN("port %d: no read-only fd of the ring: %s", id, strerror(errno));
+    return -1;
+}
+
+int RxRing_Subscribe(int id) {
+    RxRing *ring = ring_get(id);
+    if (!ring) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> guard(ring->subscribersLock);
+    for (int &s : ring->subscribers) {
+        if (s < 0) {
+            s = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+            return s;
+        }
+    }
+    LOG_WARN("port %d has too many subscribers", id);
+    return -1;
+}
+
+void RxRing_Unsubscribe(int id, int event_fd) {
+    RxRing *ring = ring_get(id);
+    if (!ring || event_fd < 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(ring->subscribersLock);
+    for (int &s : ring->subscribers) {
+        if (s == event_fd) {
+            close(s);
+            s = -1;
+        }
+    }
+}
+
+void RxRing_SetNotify(void (*notify)(int id)) {
+    pushNotify.store(notify, std::memory_order_release);
+}
+
+void RxRing_SetFlow(const RxRingFlow *flow) {
+    flowHooks.store(flow, std::memory_order_release);
+}
+
+// Received data never goes back through Java: these members of the
+// java_method.h interface are shared by the JNI bridge and the host stand-ins.
+int JavaMethod_ReadSerial(int id, int size, int64_t timeout, int8_t **data) {
+    MetricsTimer timer(METRIC_READ);
+    TRACE_SCOPE(__func__);
+    WatchdogScope watchdog(__func__, id, MonoClock_ToMs(timeout));
+    LOG_DEBUG("size: %d, timeout: %lld ns", size, (long long) timeout);
+    *data = nullptr;
+    if (size <= 0) {
+        return 0;
+    }
+    *data = (int8_t *) BufferPool_Get(size);
+    if (*data == nullptr) {
+        return -1;
+    }
+    int length = RxRing_Read(id, *data, size, timeout);
+    if (length < 0) {
+        LOG_ERROR("Failed to read serial with id %d", id);
+        BufferPool_Put(*data);
+        *data = nullptr;
+    }
+    return length;
+}
+
+int JavaMethod_InWaitingSerial(int id) {
+    MetricsTimer timer(METRIC_IN_WAITING);
+    TRACE_SCOPE(__func__);
+    WatchdogScope watchdog(__func__, id);
+    LOG_DEBUG("");
+    return RxRing_Available(id);
+}
+
+bool JavaMethod_ResetInputBufferSerial(int id) {
+    MetricsTimer timer(METRIC_RESET_INPUT);
+    TRACE_SCOPE(__func__);
+    WatchdogScope watchdog(__func__, id);
+    LOG_DEBUG("");
+    return RxRing_Reset(id) == 0;
+}
+
+}
@@ -0,0 +1,214 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// android.RxRingReader: read-only follower of a port's receive ring.
+//
+//   reader = android.RxRingReader(0)
+//   selector.register(reader, selectors.EVENT_READ)
+//   data = reader.read()
+//
+// reader.fds() returns (ring_fd, event_fd) so the ring can be handed to another
+// local process with socket.send_fds() and attached there with ShmRingClient.
+
+#define PY_SSIZE_T_CLEAN
+#include <unistd.h>
+
+#include "serial.h"
+#include "rx_ring.h"
+#include "shm_ring.h"
+
+#define LOG_LEVEL LOG_LEVEL_WARN
+#include "log.h"
+
+typedef struct {
+    PyObject_HEAD
+    int port;
+    int ring_fd;
+    int event_fd;
+    ShmRingClient *client;
+} RxRingReaderObject;
+
+static void RxRingReader_release(RxRingReaderObject *self) {
+    delete self->client;
+    self->client = nullptr;
+    if (self->event_fd >= 0) {
+        RxRing_Unsubscribe(self->port, self->event_fd);
+        self->event_fd = -1;
+    }
+    if (self->ring_fd >= 0) {
+        close(self->ring_fd);
+        self->ring_fd = -1;
+    }
+}
+
+static PyObject *RxRingReader_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+    RxRingReaderObject *self = (RxRingReaderObject *) type->tp_alloc(type, 0);
+    if (self) {
+        self->port = 0;
+        self->ring_fd = -1;
+        self->event_fd = -1;
+        self->client = nullptr;
+    }
+    return (PyObject *) self;
+}
+
+static int RxRingReader_init(RxRingReaderObject *self, PyObject *args, PyObject *kwds) {
+    int port = 0;
+    static const char *kwlist[] = {"port", nullptr};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i", (char **) kwlist, &port)) {
+        return -1;
+    }
+    RxRingReader_release(self);
+    self->port = port;
+    self->ring_fd = RxRing_ShareFd(port);
+    if (self->ring_fd < 0) {
+        PyErr_Format(PyExc_RuntimeError, "No receive ring for port %d, open the port first", port);
+        return -1;
+    }
+    self->event_fd = RxRing_Subscribe(port);
+    self->client = new ShmRingClient();
+    if (!self->client->attach(self->ring_fd, self->event_fd)) {
+        RxRingReader_release(self);
+        PyErr_SetString(PyExc_RuntimeError, "Failed to map receive ring");
+        return -1;
+    }
+    LOG_DEBUG("port %d ring fd %d event fd %d", port, self->ring_fd, self->event_fd);
+    return 0;
+}
+
+static void RxRingReader_dealloc(RxRingReaderObject *self) {
+    RxRingReader_release(self);
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static bool RxRingReader_check(RxRingReaderObject *self) {
+    if (!self->client) {
+        PyErr_SetString(PyExc_ValueError, "Reader is closed");
+        return false;
+    }
+    return true;
+}
+
+// def read(self, size=-1, timeout=0.0) -> bytes
+static PyObject *RxRingReader_read(RxRingReaderObject *self, PyObject *args, PyObject *kwds) {
+    Py_ssize_t size = -1;
+    double timeout = 0.0;
+    static const char *kwlist[] = {"size", "timeout", nullptr};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|nd", (char **) kwlist, &size, &timeout)) {
+        return nullptr;
+    }
+    if (!RxRingReader_check(self)) {
+        return nullptr;
+    }
+    ShmRingClient *client = self->client;
+    if (client->available() == 0 && timeout != 0.0) {
+        Py_BEGIN_ALLOW_THREADS
+        client->wait(timeout < 0 ? -1 : (int) (timeout * 1000));
+        Py_END_ALLOW_THREADS
+    }
+    const uint8_t *src = nullptr;
+    size_t max = size < 0 ? (size_t) client->capacity() : (size_t) size;
+    size_t n = client->peek(&src, max);
+    PyObject *res = PyBytes_FromStringAndSize((const char *) src, (Py_ssize_t) n);
+    if (res && !client->consume(n)) {
+        // The producer lapped us while copying, the bytes are not trustworthy.
+        Py_DECREF(res);
+        res = PyBytes_FromStringAndSize("", 0);
+    }
+    return res;
+}
+
+static PyObject *RxRingReader_fileno(RxRingReaderObject *self, PyObject *Py_UNUSED(args)) {
+    if (!RxRingReader_check(self)) {
+        return nullptr;
+    }
+    return PyLong_FromLong(self->event_fd);
+}
+
+static PyObject *RxRingReader_fds(RxRingReaderObject *self, PyObject *Py_UNUSED(args)) {
+    if (!RxRingReader_check(self)) {
+        return nullptr;
+    }
+    return Py_BuildValue("(ii)", self->ring_fd, self->event_fd);
+}
+
+static PyObject *RxRingReader_close(RxRingReaderObject *self, PyObject *Py_UNUSED(args)) {
+    RxRingReader_release(self);
+    Py_RETURN_NONE;
+}
+
+static PyObject *RxRingReader_get_available(RxRingReaderObject *self, void *closure) {
+    return PyLong_FromUnsignedLongLong(self->client ? self->client->available() : 0);
+}
+
+static PyObject *RxRingReader_get_lost(RxRingReaderObject *self, void *closure) {
+    return PyLong_FromUnsignedLongLong(self->client ? self->client->lost() : 0);
+}
+
+static PyObject *RxRingReader_get_position(RxRingReaderObject *self, void *closure) {
+    return PyLong_FromUnsignedLongLong(self->client ? self->client->position() : 0);
+}
+
+static PyObject *RxRingReader_get_head(RxRingReaderObject *self, void *closure) {
+    return PyLong_FromUnsignedLongLong(self->client ? self->client->head() : 0);
+}
+
+static PyGetSetDef RxRingReader_getsetters[] = {
+    {"available", (getter) RxRingReader_get_available, nullptr, "Unread bytes", nullptr},
+    {"lost", (getter) RxRingReader_get_lost, nullptr, "Bytes overwritten before they were read", nullptr},
+    {"position", (getter) RxRingReader_get_position, nullptr, "Stream offset of the next byte", nullptr},
+    {"head", (getter) RxRingReader_get_head, nullptr, "Stream offset published by the producer", nullptr},
+    {nullptr}};
+
+static PyMethodDef RxRingReader_methods[] = {
+    {"read", (PyCFunction) (void (*)(void)) RxRingReader_read, METH_VARARGS | METH_KEYWORDS, "Read received data"},
+    {"fileno", (PyCFunction) RxRingReader_fileno, METH_NOARGS, "Eventfd signalled when data arrives"},
+    {"fds", (PyCFunction) RxRingReader_fds, METH_NOARGS, "Return (ring_fd, event_fd)"},
+    {"close", (PyCFunction) RxRingReader_close, METH_NOARGS, "Detach from the ring"},
+    {nullptr}};
+
+static PyTypeObject RxRingReaderType = {
+    PyVarObject_HEAD_INIT(nullptr, 0)
+};
+
+extern "C" int RxRingReader_AddType(PyObject *module) {
+    RxRingReaderType.tp_name = "android.RxRingReader";
+    RxRingReaderType.tp_doc = "Read-only follower of a serial receive ring";
+    RxRingReaderType.tp_basicsize = sizeof(RxRingReaderObject);
+    RxRingReaderType.tp_flags = Py_TPFLAGS_DEFAULT;
+    RxRingReaderType.tp_new = RxRingReader_new;
+    RxRingReaderType.tp_init = (initproc) RxRingReader_init;
+    RxRingReaderType.tp_dealloc = (destructor) RxRingReader_dealloc;
+    RxRingReaderType.tp_methods = RxRingReader_methods;
+    RxRingReaderType.tp_getset = RxRingReader_getsetters;
+    if (PyType_Ready(&RxRingReaderType) < 0) {
+        return -1;
+    }
+    Py_INCREF(&RxRingReaderType);
+    if (PyModule_AddObject(module, "RxRingReader", (PyObject *) &RxRingReaderType) < 0) {
+        Py_DECREF(&RxRingReaderType);
+        return -1;
+    }
+    return 0;
+}
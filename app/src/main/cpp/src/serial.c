@@ -23,19 +23,32 @@
  */
 
 #define PY_SSIZE_T_CLEAN
+#include <errno.h>
+#include <sched.h>
 #include <stdbool.h>
-#include <jni.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
 #include "serial.h"
 #include "log.h"
+#include "buffer_pool.h"
+#include "flow_ctl.h"
 #include "java_method.h"
+#include "line_config.h"
+#include "metrics.h"
+#include "mono_clock.h"
+#include "py_alloc.h"
+#include "rx_ring.h"
+#include "thread_sched.h"
+#include "trace.h"
+#include "tx_queue.h"
+#include "usb_engine.h"
+#include "watchdog.h"
 
-typedef struct 
-{
-    int baudrate;
-    char parity;
-    int bytesize;
-    int stopbits;
-} SerialParams;
+// fileno() 事件位, 由 events() 返回
+#define SERIAL_EVENT_RX 1       // 有接收数据
+#define SERIAL_EVENT_TX 2       // 发送队列有空间
+#define SERIAL_EVENT_MODEM 4    // 状态线变化 (FTDI + usb_engine)
 
 typedef struct
 {
@@ -43,7 +56,14 @@ typedef struct
     bool opened; // 是否已打开
     int rts_state;        // RTS状态
     int dtr_state;        // DTR状态
-    SerialParams params;
+    LineSettings params;  // 最后一次 reconfigure() 要求的设置, 由 line_config.h 合并后下发
+    bool batching;        // begin_config() 之后, commit() 之前
+    int rts_staged;       // 批量设置中暂存的 RTS/DTR, -1 表示没有
+    int dtr_staged;
+    int poll_fd;          // fileno(): epoll, 包含下面三个 eventfd
+    int rx_fd;
+    int tx_fd;
+    int modem_fd;
 } SerialObject;
 
 // 类方法定义 TODO:
@@ -56,16 +76,54 @@ static PyObject *Serial_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
         self->opened = false;
         self->rts_state = 0;
         self->dtr_state = 0;
-        memset(&self->params, 0, sizeof(SerialParams));
+        memset(&self->params, 0, sizeof(LineSettings));
+        self->batching = false;
+        self->rts_staged = -1;
+        self->dtr_staged = -1;
+        self->poll_fd = -1;
+        self->rx_fd = -1;
+        self->tx_fd = -1;
+        self->modem_fd = -1;
     }
     LOG_DEBUG("self:%p %p %p", self, args, kwds);
     return (PyObject *)self;
 }
 
+static void Serial_release_events(SerialObject *self)
+{
+    if (self->poll_fd >= 0) {
+        close(self->poll_fd);
+        self->poll_fd = -1;
+    }
+    RxRing_Unsubscribe(0, self->rx_fd);
+    TxQueue_Unsubscribe(0, self->tx_fd);
+    UsbEngine_ModemUnsubscribe(0, self->modem_fd);
+    self->rx_fd = -1;
+    self->tx_fd = -1;
+    self->modem_fd = -1;
+}
+
+// 端口没打开时抛 pyserial 的 SerialException (导入不了时用 RuntimeError), 返回 false
+static bool Serial_check_open(SerialObject *self)
+{
+    if (self->opened) {
+        return true;
+    }
+    LOG_WARN("Serial port not open");
+    PyObject *module = PyImport_ImportModule("serial");
+    PyObject *exc = module ? PyObject_GetAttrString(module, "SerialException") : NULL;
+    PyErr_Clear();
+    PyErr_SetString(exc ? exc : PyExc_RuntimeError, "Serial port not open");
+    Py_XDECREF(exc);
+    Py_XDECREF(module);
+    return false;
+}
+
 // TODO: 析构函数
 static void Serial_dealloc(SerialObject *self)
 {
     LOG_DEBUG("self:%p", self);
+    Serial_release_events(self);
     Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
@@ -91,47 +149,159 @@ static PyObject *Serial_open(SerialObject *self, PyObject *args)
 //    }
 
     self->opened = success == 1;
+    // 新打开的端口按驱动的实际设置为准, 下一次 reconfigure() 全部重新下发
+    LineConfig_Reset(0);
+    TxQueue_Reset(0); // 上一次连接留下的写失败不算这次的
+    memset(&self->params, 0, sizeof(LineSettings));
+    self->batching = false;
+    self->rts_staged = -1;
+    self->dtr_staged = -1;
 
-    // 构造并返回元组 (bool, str)
-    PyObject* result = PyTuple_Pack(2, PyBool_FromLong(self->opened), PyUnicode_FromString(message));
-    return result;
+    // 构造并返回元组 (bool, str), PyTuple_Pack 不接管引用, 用 Py_BuildValue 免得每次连接泄漏一个字符串
+    return Py_BuildValue("(Os)", self->opened ? Py_True : Py_False, message);
 }
 
 static PyObject *Serial_close(SerialObject *self, PyObject *args)
 {
     LOG_DEBUG("%p", args);
+    Serial_release_events(self);
+    LineConfig_Reset(0); // 未下发的设置丢弃
+    FlowCtl_Configure(0, 0, false, false); // 放开被 XOFF/CTS 挡住的写
     JavaMethod_CloseSerial(0); // 关闭串口
     self->opened = false;
     Py_RETURN_NONE;
 }
 
-// def reconfigure(baudrate:int, parity:str, bytesize:int, stopbits:int, xonxoff:bool, rtscts:bool, timeout:float):
+// def reconfigure(baudrate:int, parity:str, bytesize:int, stopbits:float, xonxoff:bool, rtscts:bool, timeout:float):
 static PyObject* Serial_reconfigure(SerialObject* self, PyObject* args) {
     const char* parity;
+    double stopbits;
     int xonxoff;
     int rtscts;
     float timeout;
-    SerialParams params = {0};
+    LineSettings params;
+    memset(&params, 0, sizeof(params)); // 填充字节也清零, 下面要 memcmp
     
-    if (!PyArg_ParseTuple(args, "isiiiif", &params.baudrate, &parity, &params.bytesize, &params.stopbits,
+    // stopbits 可能是 1.5 (STOPBITS_ONE_POINT_FIVE), 按浮点数解析
+    if (!PyArg_ParseTuple(args, "isidiif", &params.baudrate, &parity, &params.bytesize, &stopbits,
                           &xonxoff, &rtscts, &timeout)) {
         PyErr_SetString(PyExc_TypeError, "Invalid input parameters");
         return NULL;
     }
+    if (stopbits != 1 && stopbits != 1.5 && stopbits != 2) {
+        PyErr_SetString(PyExc_ValueError, "Invalid stopbits");
+        return NULL;
+    }
     params.parity = parity[0]; // 取第一个字符作为串行端口奇偶校验
+    params.stopbits = (float) stopbits;
+    params.xonxoff = xonxoff != 0;
+    params.rtscts = rtscts != 0;
 
-    LOG_DEBUG("%p, baudrate: %d, parity: %s, bytesize: %d, stopbits: %d, xonxoff: %d, rtscts: %d, timeout: %f",
+    LOG_DEBUG("%p, baudrate: %d, parity: %s, bytesize: %d, stopbits: %.1f, xonxoff: %d, rtscts: %d, timeout: %f",
               self, params.baudrate, parity, params.bytesize, params.stopbits, xonxoff, rtscts, timeout);
 
-    // Add your reconfiguration logic here
-    if(memcmp((const void*)&self->params, (const void*)&params, sizeof(SerialParams)) != 0) {
-        JavaMethod_ConfigureSerial(0, params.baudrate, params.bytesize, 1, params.parity); // xonxoff, rtscts, timeout
+    // RFC2217 客户端逐项发送设置, 每项都会调到这里: 只暂存, 合并后一次下发 (line_config.h)
+    if(memcmp((const void*)&self->params, (const void*)&params, sizeof(LineSettings)) != 0) {
+        LineConfig_Stage(0, &params, self->batching ? LINE_CONFIG_HOLD : LINE_CONFIG_COALESCE);
         self->params = params;
     }
 
     Py_RETURN_NONE;
 }
 
+// def begin_config(self): 之后的 reconfigure() 和 rts/dtr 只暂存, 由 commit() 一起下发
+static PyObject *Serial_begin_config(SerialObject *self, PyObject *Py_UNUSED(args))
+{
+    LOG_DEBUG("%p", self);
+    self->batching = true;
+    Py_RETURN_NONE;
+}
+
+// def commit(self) -> bool: 下发暂存的设置, 只有变化的项才会调到 Java
+static PyObject *Serial_commit(SerialObject *self, PyObject *Py_UNUSED(args))
+{
+    LOG_DEBUG("%p", self);
+    int rts = self->rts_staged;
+    int dtr = self->dtr_staged;
+    self->batching = false;
+    self->rts_staged = -1;
+    self->dtr_staged = -1;
+    int ret;
+    Py_BEGIN_ALLOW_THREADS
+    ret = LineConfig_Flush(0);
+    // 与 pyserial 打开端口时的顺序一致: 先 DTR 后 RTS
+    if (dtr >= 0 && LineConfig_SetDtr(0, dtr) < 0) {
+        ret = -1;
+    }
+    if (rts >= 0 && LineConfig_SetRts(0, rts) < 0) {
+        ret = -1;
+    }
+    Py_END_ALLOW_THREADS
+    return PyBool_FromLong(ret == 0);
+}
+
+// def apply(self, *, baudrate, parity, bytesize, stopbits, xonxoff, rtscts, rts, dtr) -> bool:
+// 只给要改的项, 相当于 begin_config(), 逐项设置, 再 commit()
+static PyObject *Serial_apply(SerialObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"baudrate", "parity", "bytesize", "stopbits", "xonxoff", "rtscts", "rts", "dtr", NULL};
+    PyObject *baudrate = NULL, *parity = NULL, *bytesize = NULL, *stopbits = NULL;
+    PyObject *xonxoff = NULL, *rtscts = NULL, *rts = NULL, *dtr = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$OOOOOOOO", kwlist, &baudrate, &parity, &bytesize, &stopbits,
+                                     &xonxoff, &rtscts, &rts, &dtr)) {
+        return NULL;
+    }
+    LineSettings params = self->params;
+    if (baudrate) {
+        params.baudrate = (int) PyLong_AsLong(baudrate);
+    }
+    if (parity) {
+        const char *value = PyUnicode_AsUTF8(parity);
+        if (value == NULL) {
+            return NULL;
+        }
+        params.parity = value[0];
+    }
+    if (bytesize) {
+        params.bytesize = (int) PyLong_AsLong(bytesize);
+    }
+    if (stopbits) {
+        params.stopbits = (float) PyFloat_AsDouble(stopbits);
+    }
+    if (xonxoff) {
+        params.xonxoff = PyObject_IsTrue(xonxoff) == 1;
+    }
+    if (rtscts) {
+        params.rtscts = PyObject_IsTrue(rtscts) == 1;
+    }
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    if (params.baudrate <= 0 || params.bytesize <= 0 || params.parity == 0) {
+        PyErr_SetString(PyExc_ValueError, "baudrate, bytesize and parity are needed before the first reconfigure()");
+        return NULL;
+    }
+    if (params.stopbits != 1 && params.stopbits != 1.5f && params.stopbits != 2) {
+        PyErr_SetString(PyExc_ValueError, "Invalid stopbits");
+        return NULL;
+    }
+    LOG_DEBUG("%p, baudrate: %d, parity: %c, bytesize: %d, stopbits: %.1f, xonxoff: %d, rtscts: %d",
+              self, params.baudrate, params.parity, params.bytesize, params.stopbits, params.xonxoff, params.rtscts);
+    if (memcmp((const void*)&self->params, (const void*)&params, sizeof(LineSettings)) != 0) {
+        LineConfig_Stage(0, &params, LINE_CONFIG_HOLD);
+        self->params = params;
+    }
+    if (rts) {
+        self->rts_state = PyObject_IsTrue(rts);
+        self->rts_staged = self->rts_state;
+    }
+    if (dtr) {
+        self->dtr_state = PyObject_IsTrue(dtr);
+        self->dtr_staged = self->dtr_state;
+    }
+    return Serial_commit(self, NULL);
+}
+
 // RTS属性
 static PyObject *Serial_get_rts_state(SerialObject *self, void *closure)
 {
@@ -149,7 +319,15 @@ static int Serial_set_rts_state(SerialObject *self, PyObject *value, void *closu
     }
     self->rts_state = PyObject_IsTrue(value);
     LOG_DEBUG("%p %d", closure, self->rts_state);
-    JavaMethod_RtsSerialSet(0, self->rts_state);
+    if (self->batching) {
+        self->rts_staged = self->rts_state;
+        return 0;
+    }
+    int state = self->rts_state;
+    // 先下发暂存的设置再改 RTS, 见 line_config.h
+    Py_BEGIN_ALLOW_THREADS
+    LineConfig_SetRts(0, state);
+    Py_END_ALLOW_THREADS
     return 0;
 }
 
@@ -170,7 +348,15 @@ static int Serial_set_dtr_state(SerialObject *self, PyObject *value, void *closu
     }
     self->dtr_state = PyObject_IsTrue(value);
     LOG_DEBUG("%p %d", closure, self->dtr_state);
-    JavaMethod_DtrSerialSet(0, self->dtr_state);
+    if (self->batching) {
+        self->dtr_staged = self->dtr_state;
+        return 0;
+    }
+    int state = self->dtr_state;
+    // 先下发暂存的设置再改 DTR, 见 line_config.h
+    Py_BEGIN_ALLOW_THREADS
+    LineConfig_SetDtr(0, state);
+    Py_END_ALLOW_THREADS
     return 0;
 }
 
@@ -182,11 +368,12 @@ static PyObject *Serial_get_in_waiting(SerialObject *self, void *closure)
     return PyLong_FromLong(size);
 }
 
-// TODO: out_waiting属性
+// out_waiting属性: write_nowait() 排队未发出的字节
 static PyObject *Serial_get_out_waiting(SerialObject *self, void *closure)
 {
-    LOG_DEBUG("%p size: %d", closure, 0);
-    return PyLong_FromLong(0);
+    int size = TxQueue_Pending(0);
+    LOG_DEBUG("%p size: %d", closure, size);
+    return PyLong_FromLong(size);
 }
 
 // 状态线属性
@@ -239,13 +426,11 @@ static PyObject *Serial_get_cd(SerialObject *self, void *closure)
 }
 
 // 读写方法
-static PyObject *Serial_read(SerialObject *self, PyObject *args, PyObject *kwds)
+static PyObject *Serial_read_impl(SerialObject *self, PyObject *args, PyObject *kwds)
 {
     int size = 1;
     PyObject *timeout_obj = Py_None;
-    if (!self->opened) {
-        LOG_WARN("Serial port not open");
-        PyErr_SetString(PyExc_RuntimeError, "Serial port not open");
+    if (!Serial_check_open(self)) {
         return NULL;
     }
     LOG_DEBUG("enter");
@@ -255,12 +440,12 @@ static PyObject *Serial_read(SerialObject *self, PyObject *args, PyObject *kwds)
         PyErr_SetString(PyExc_TypeError, "Invalid input parameters, size is not an int");
         return NULL;
     }
-    float timeout = 0.0f;
+    double timeout = 0.0;
     if (timeout_obj != Py_None) {
         if(PyFloat_Check(timeout_obj)) {
-            timeout = (float)PyFloat_AsDouble(timeout_obj);
+            timeout = PyFloat_AsDouble(timeout_obj);
         } else if(PyLong_Check(timeout_obj)) {
-            timeout = (float)PyLong_AsLong(timeout_obj);
+            timeout = (double)PyLong_AsLong(timeout_obj);
         } else {
             LOG_WARN("Invalid input parameters, timeout type: %s", Py_TYPE(timeout_obj)->tp_name);
             PyErr_SetString(PyExc_TypeError, "Invalid input parameters");
@@ -270,9 +455,18 @@ static PyObject *Serial_read(SerialObject *self, PyObject *args, PyObject *kwds)
     PyObject* res = NULL;
     int8_t *data = NULL;
     int read_size = 0;
+    ThreadSched_Enter(SCHED_ROLE_SERVER);
+    // 纳秒传递, 0.5 ms 不会被截断成非阻塞读
+    int64_t timeout_ns = MonoClock_FromSeconds(timeout);
+    Watchdog_Enter("Serial.read", 0, MonoClock_ToMs(timeout_ns), PyThreadState_Get());
     Py_BEGIN_ALLOW_THREADS
-    read_size = JavaMethod_ReadSerial(0, size, (int)(timeout * 1000), &data);
+    read_size = JavaMethod_ReadSerial(0, size, timeout_ns, &data);
+    TRACE_BEGIN(WATCHDOG_GIL_SITE);
+    Watchdog_Enter(WATCHDOG_GIL_SITE, 0, 0, NULL);
     Py_END_ALLOW_THREADS
+    Watchdog_Leave();
+    TRACE_END();
+    Watchdog_Leave();
     if (read_size < 0) {
         LOG_WARN("Read error");
         PyErr_SetString(PyExc_RuntimeError, "Read error");
@@ -280,7 +474,7 @@ static PyObject *Serial_read(SerialObject *self, PyObject *args, PyObject *kwds)
     }
     res = PyBytes_FromStringAndSize((const char*)data, read_size);
     if (data) {
-        free(data);
+        BufferPool_Put(data);
         data = NULL;
     }
 #if 0
@@ -307,12 +501,23 @@ static PyObject *Serial_read(SerialObject *self, PyObject *args, PyObject *kwds)
     return res;
 }
 
+static PyObject *Serial_read(SerialObject *self, PyObject *args, PyObject *kwds)
+{
+    TRACE_BEGIN("Serial.read");
+    PyObject *res = Serial_read_impl(self, args, kwds);
+    TRACE_END();
+    return res;
+}
+
 // def write(self, data, timeout=None):
-static PyObject *Serial_write(SerialObject *self, PyObject *args, PyObject *kwds)
+static PyObject *Serial_write_impl(SerialObject *self, PyObject *args, PyObject *kwds)
 {
     PyObject *data;
     PyObject *timeout_obj = Py_None;
 
+    if (!Serial_check_open(self)) {
+        return NULL;
+    }
     static char *kwlist[] = {"data", "timeout", NULL};
     if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &data, &timeout_obj)) {
         PyErr_SetString(PyExc_TypeError, "Invalid input parameters");
@@ -322,12 +527,12 @@ static PyObject *Serial_write(SerialObject *self, PyObject *args, PyObject *kwds
         PyErr_SetString(PyExc_TypeError, "Data must be bytes");
         return NULL;
     }
-    float timeout = 0.0f;
+    double timeout = 0.0;
     if (timeout_obj != Py_None) {
         if(PyFloat_Check(timeout_obj)) {
-            timeout = (float)PyFloat_AsDouble(timeout_obj);
+            timeout = PyFloat_AsDouble(timeout_obj);
         } else if(PyLong_Check(timeout_obj)) {
-            timeout = (float)PyLong_AsLong(timeout_obj);
+            timeout = (double)PyLong_AsLong(timeout_obj);
         } else {
             LOG_WARN("Invalid input parameters, timeout type: %s", Py_TYPE(timeout_obj)->tp_name);
             PyErr_SetString(PyExc_TypeError, "Timeout must be float or int");
@@ -335,12 +540,38 @@ static PyObject *Serial_write(SerialObject *self, PyObject *args, PyObject *kwds
         }
     }
     int size = (int)PyBytes_Size(data);
+    int queued = 0;
     if (size > 0) {
         void *data_ptr = PyBytes_AsString(data);
-        LOG_DEBUG("%p data:%p size: %d, timeout: %.2f", self, data_ptr, size, timeout);
+        LOG_DEBUG("%p data:%p size: %d, timeout: %.6f", self, data_ptr, size, timeout);
+        ThreadSched_Enter(SCHED_ROLE_SERVER);
+        int64_t timeout_ns = MonoClock_FromSeconds(timeout);
+        Watchdog_Enter("Serial.write", 0, MonoClock_ToMs(timeout_ns), PyThreadState_Get());
         Py_BEGIN_ALLOW_THREADS
-        size = JavaMethod_WriteSerial(0, data_ptr, size, (int)(timeout * 1000));
+        // 暂存的设置和 write_nowait() 排队的数据先发出, 保持顺序
+        LineConfig_Flush(0);
+        // 没有超时 (None) 时一直等到队列写完
+        queued = TxQueue_Flush(0, timeout_ns > 0 ? timeout_ns : -1);
+        if (queued == 0) {
+            size = JavaMethod_WriteSerial(0, data_ptr, size, timeout_ns);
+        }
+        TRACE_BEGIN(WATCHDOG_GIL_SITE);
+        Watchdog_Enter(WATCHDOG_GIL_SITE, 0, 0, NULL);
         Py_END_ALLOW_THREADS
+        Watchdog_Leave();
+        TRACE_END();
+        Watchdog_Leave();
+    }
+    if (queued == TX_QUEUE_TIMEOUT) {
+        // write_nowait() 排队的数据在超时内没写完, 这次的数据没有发出
+        LOG_WARN("Write timeout: output queue not drained");
+        PyErr_SetString(PyExc_TimeoutError, "Write timeout: output queue not drained");
+        return NULL;
+    }
+    if (queued == TX_QUEUE_FAILED) {
+        LOG_WARN("Write error: queued data not sent");
+        PyErr_SetString(PyExc_RuntimeError, "Write error: queued data not sent");
+        return NULL;
     }
     if (size < 0) {
         LOG_WARN("Write error");
@@ -357,6 +588,131 @@ static PyObject *Serial_write(SerialObject *self, PyObject *args, PyObject *kwds
     return PyLong_FromLong(size);
 }
 
+static PyObject *Serial_write(SerialObject *self, PyObject *args, PyObject *kwds)
+{
+    TRACE_BEGIN("Serial.write");
+    PyObject *res = Serial_write_impl(self, args, kwds);
+    TRACE_END();
+    return res;
+}
+
+// def fileno(self): 返回可 select/epoll 的 fd, 有事件时可读, 再用 events() 取事件
+static PyObject *Serial_fileno(SerialObject *self, PyObject *Py_UNUSED(args))
+{
+    if (self->poll_fd >= 0) {
+        return PyLong_FromLong(self->poll_fd);
+    }
+    if (!self->opened) {
+        PyErr_SetString(PyExc_ValueError, "Port not open");
+        return NULL;
+    }
+    self->poll_fd = epoll_create1(EPOLL_CLOEXEC);
+    self->rx_fd = RxRing_Subscribe(0);
+    self->tx_fd = TxQueue_Subscribe(0);
+    self->modem_fd = UsbEngine_ModemSubscribe(0); // 非 usb_engine 时为 -1
+    int fds[] = {self->rx_fd, self->tx_fd, self->modem_fd};
+    uint32_t bits[] = {SERIAL_EVENT_RX, SERIAL_EVENT_TX, SERIAL_EVENT_MODEM};
+    bool ok = self->poll_fd >= 0 && self->rx_fd >= 0 && self->tx_fd >= 0;
+    for (int i = 0; ok && i < 3; ++i) {
+        if (fds[i] < 0) {
+            continue;
+        }
+        struct epoll_event ev = {.events = EPOLLIN, .data.u32 = bits[i]};
+        ok = epoll_ctl(self->poll_fd, EPOLL_CTL_ADD, fds[i], &ev) == 0;
+    }
+    if (!ok) {
+        LOG_WARN("fileno failed: %s", strerror(errno));
+        PyErr_SetFromErrno(PyExc_OSError);
+        Serial_release_events(self);
+        return NULL;
+    }
+    // 订阅前已收到的数据也要让 fd 可读
+    if (RxRing_Available(0) > 0) {
+        uint64_t one = 1;
+        write(self->rx_fd, &one, sizeof(one));
+    }
+    LOG_INFO("fileno: %d", self->poll_fd);
+    return PyLong_FromLong(self->poll_fd);
+}
+
+// def events(self): 取走并返回待处理的事件位 (EVENT_RX | EVENT_TX | EVENT_MODEM)
+static PyObject *Serial_events(SerialObject *self, PyObject *Py_UNUSED(args))
+{
+    long mask = 0;
+    if (self->poll_fd >= 0) {
+        struct epoll_event evs[3];
+        int n = epoll_wait(self->poll_fd, evs, 3, 0);
+        for (int i = 0; i < n; ++i) {
+            mask |= evs[i].data.u32;
+        }
+        uint64_t count;
+        if (mask & SERIAL_EVENT_RX) {
+            read(self->rx_fd, &count, sizeof(count));
+        }
+        if (mask & SERIAL_EVENT_TX) {
+            read(self->tx_fd, &count, sizeof(count));
+        }
+        if (mask & SERIAL_EVENT_MODEM) {
+            read(self->modem_fd, &count, sizeof(count));
+        }
+    }
+    if (RxRing_Available(0) > 0) {
+        mask |= SERIAL_EVENT_RX;
+    }
+    return PyLong_FromLong(mask);
+}
+
+// def read_nowait(self, size): 只取已收到的数据, 不等待
+static PyObject *Serial_read_nowait(SerialObject *self, PyObject *args)
+{
+    int size = 0;
+    if (!Serial_check_open(self) || !PyArg_ParseTuple(args, "i", &size)) {
+        return NULL;
+    }
+    if (size <= 0) {
+        return PyBytes_FromStringAndSize(NULL, 0);
+    }
+    int8_t *data = NULL;
+    size = JavaMethod_ReadSerial(0, size, 0, &data);
+    if (size < 0) {
+        LOG_WARN("Read error");
+        PyErr_SetString(PyExc_RuntimeError, "Read error");
+        return NULL;
+    }
+    PyObject *res = PyBytes_FromStringAndSize((const char *)data, size);
+    if (data) {
+        BufferPool_Put(data);
+    }
+    // 还有剩余时让 fd 保持可读, 和水平触发一样
+    if (self->rx_fd >= 0 && RxRing_Available(0) > 0) {
+        uint64_t one = 1;
+        write(self->rx_fd, &one, sizeof(one));
+    }
+    return res;
+}
+
+// def write_nowait(self, data): 放入发送队列, 返回接受的字节数 (队列满时为 0)
+static PyObject *Serial_write_nowait(SerialObject *self, PyObject *args)
+{
+    Py_buffer buf;
+    if (!Serial_check_open(self) || !PyArg_ParseTuple(args, "y*", &buf)) {
+        return NULL;
+    }
+    int len = buf.len > INT32_MAX ? INT32_MAX : (int)buf.len;
+    if (len > 0 && LineConfig_Pending(0)) {
+        Py_BEGIN_ALLOW_THREADS
+        LineConfig_Flush(0);
+        Py_END_ALLOW_THREADS
+    }
+    int size = TxQueue_Write(0, (const int8_t *)buf.buf, len);
+    PyBuffer_Release(&buf);
+    if (size < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "Write error");
+        return NULL;
+    }
+    return PyLong_FromLong(size);
+}
+
 // TODO: 其他控制方法
 static PyObject *Serial_cancel_read(SerialObject *self, PyObject *Py_UNUSED(args))
 {
@@ -371,10 +727,22 @@ static PyObject *Serial_cancel_write(SerialObject *self, PyObject *Py_UNUSED(arg
     Py_RETURN_NONE;
 }
 
-// TODO: 其他控制方法
+// 等待发送队列写完
 static PyObject *Serial_flush(SerialObject *self, PyObject *Py_UNUSED(args))
 {
     LOG_DEBUG("%p", self);
+    int ret;
+    Py_BEGIN_ALLOW_THREADS
+    ret = TxQueue_Flush(0, 60 * NS_PER_SEC);
+    Py_END_ALLOW_THREADS
+    if (ret == TX_QUEUE_FAILED) {
+        PyErr_SetString(PyExc_RuntimeError, "Write error: queued data not sent");
+        return NULL;
+    }
+    if (ret != 0) {
+        PyErr_SetString(PyExc_TimeoutError, "Output queue not drained");
+        return NULL;
+    }
     Py_RETURN_NONE;
 }
 
@@ -390,6 +758,7 @@ static PyObject *Serial_reset_input_buffer(SerialObject *self, PyObject *Py_UNUS
 static PyObject *Serial_reset_output_buffer(SerialObject *self, PyObject *Py_UNUSED(args))
 {
     LOG_DEBUG("%p", self);
+    TxQueue_Reset(0);
 #if 0
     self->buffer = "hello\n"; // 模拟数据
     self->position = 0;
@@ -408,23 +777,31 @@ static PyObject * Serial_send_break(SerialObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
-// TODO: 其他控制方法
+// 发送 XON (True) / XOFF (False), 或者设置模拟的 RTS
 static PyObject * Serial_set_input_flow_control(SerialObject *self, PyObject *args)
 {
     LOG_DEBUG("%p", self);
     int enable = 1;
     if (!PyArg_ParseTuple(args, "|p", &enable))
         return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    LineConfig_Flush(0);
+    FlowCtl_SetInput(0, enable);
+    Py_END_ALLOW_THREADS
     Py_RETURN_NONE;
 }
 
-// TODO: 其他控制方法
+// 暂停 (False) / 恢复 (True) 本端发送
 static PyObject * Serial_set_output_flow_control(SerialObject *self, PyObject *args)
 {
     LOG_DEBUG("%p", self);
     int enable = 1;
     if (!PyArg_ParseTuple(args, "|p", &enable))
         return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    LineConfig_Flush(0);
+    FlowCtl_SetOutput(0, enable);
+    Py_END_ALLOW_THREADS
     Py_RETURN_NONE;
 }
 
@@ -435,7 +812,211 @@ static PyObject * Serial_log_print(SerialObject *self, PyObject *args)
         PyErr_SetString(PyExc_TypeError, "Invalid input parameters");
         return NULL;
     }
+#ifdef __ANDROID__
     __android_log_print(ANDROID_LOG_INFO, "python", "%s", msg);
+#else
+    printf("[python] %s\n", msg);
+#endif
+    Py_RETURN_NONE;
+}
+
+// 统计信息: {"ports": {id: {counter: value}}, "latency": {call: {count, sum_ns, max_ns, p50_ns, ...}},
+//           "stalls": [{time_ns, duration_ns, expected_ns, tid, port, resolved, sites, python}, ...]}
+static PyObject *Serial_get_metrics(SerialObject *self, void *closure)
+{
+    PyObject *result = PyDict_New();
+    PyObject *ports = PyDict_New();
+    PyObject *latency = PyDict_New();
+    PyObject *stalls = PyList_New(0);
+    WatchdogEvent *events = NULL;
+    if (result == NULL || ports == NULL || latency == NULL || stalls == NULL) {
+        goto error;
+    }
+    for (int port = 0; port < METRICS_MAX_PORTS; port++) {
+        int64_t values[METRIC_COUNTER_COUNT];
+        bool used = port == 0;
+        for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+            values[c] = Metrics_Counter(port, (MetricsCounter)c);
+            used = used || values[c] != 0;
+        }
+        if (!used) {
+            continue; // 没用过的端口不输出
+        }
+        PyObject *key = PyLong_FromLong(port);
+        PyObject *counters = PyDict_New();
+        if (key == NULL || counters == NULL || PyDict_SetItem(ports, key, counters) < 0) {
+            Py_XDECREF(key);
+            Py_XDECREF(counters);
+            goto error;
+        }
+        Py_DECREF(key);
+        Py_DECREF(counters);
+        for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+            PyObject *item = PyLong_FromLongLong(values[c]);
+            if (item == NULL || PyDict_SetItemString(counters, Metrics_CounterName((MetricsCounter)c), item) < 0) {
+                Py_XDECREF(item);
+                goto error;
+            }
+            Py_DECREF(item);
+        }
+    }
+    for (int l = 0; l < METRIC_LATENCY_COUNT; l++) {
+        MetricsSummary summary;
+        Metrics_Summary((MetricsLatency)l, &summary);
+        PyObject *item = Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K}",
+                                       "count", (unsigned long long)summary.count,
+                                       "sum_ns", (unsigned long long)summary.sum_ns,
+                                       "max_ns", (unsigned long long)summary.max_ns,
+                                       "p50_ns", (unsigned long long)summary.p50_ns,
+                                       "p90_ns", (unsigned long long)summary.p90_ns,
+                                       "p99_ns", (unsigned long long)summary.p99_ns);
+        if (item == NULL || PyDict_SetItemString(latency, Metrics_LatencyName((MetricsLatency)l), item) < 0) {
+            Py_XDECREF(item);
+            goto error;
+        }
+        Py_DECREF(item);
+    }
+    // 事件较大, 不放在栈上
+    events = (WatchdogEvent *)PyMem_Malloc(sizeof(WatchdogEvent) * WATCHDOG_MAX_EVENTS);
+    if (events == NULL) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    int count = Watchdog_Events(events, WATCHDOG_MAX_EVENTS);
+    for (int i = 0; i < count; i++) {
+        PyObject *item = Py_BuildValue("{s:K,s:K,s:K,s:i,s:i,s:O,s:s,s:s}",
+                                       "time_ns", (unsigned long long)events[i].realtime_ns,
+                                       "duration_ns", (unsigned long long)events[i].duration_ns,
+                                       "expected_ns", (unsigned long long)events[i].expected_ns,
+                                       "tid", events[i].tid,
+                                       "port", events[i].port,
+                                       "resolved", events[i].resolved ? Py_True : Py_False,
+                                       "sites", events[i].sites,
+                                       "python", events[i].python);
+        if (item == NULL || PyList_Append(stalls, item) < 0) {
+            Py_XDECREF(item);
+            goto error;
+        }
+        Py_DECREF(item);
+    }
+    PyMem_Free(events);
+    events = NULL;
+    if (PyDict_SetItemString(result, "ports", ports) < 0 || PyDict_SetItemString(result, "latency", latency) < 0 ||
+        PyDict_SetItemString(result, "stalls", stalls) < 0) {
+        goto error;
+    }
+    Py_DECREF(ports);
+    Py_DECREF(latency);
+    Py_DECREF(stalls);
+    LOG_DEBUG("%p %p", self, closure);
+    return result;
+error:
+    PyMem_Free(events);
+    Py_XDECREF(ports);
+    Py_XDECREF(latency);
+    Py_XDECREF(stalls);
+    Py_XDECREF(result);
+    return NULL;
+}
+
+// 解释器内存统计: {"mode": str, "raw"/"mem"/"obj": {allocs, reallocs, frees, bytes, in_use, peak},
+//                 "arena": [{size, hits, misses, free}, ...]}
+static PyObject *Serial_get_pymem(SerialObject *self, void *closure)
+{
+    static const char *modes[] = {"off", "stats", "arena"};
+    PyObject *result = Py_BuildValue("{s:s}", "mode", modes[PyAlloc_Mode()]);
+    PyObject *arena = PyList_New(0);
+    if (result == NULL || arena == NULL) {
+        goto error;
+    }
+    for (int d = 0; d < PY_ALLOC_DOMAIN_COUNT; d++) {
+        PyAllocStats stats;
+        PyAlloc_Stats((PyAllocDomain)d, &stats);
+        PyObject *item = Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K}",
+                                       "allocs", (unsigned long long)stats.allocs,
+                                       "reallocs", (unsigned long long)stats.reallocs,
+                                       "frees", (unsigned long long)stats.frees,
+                                       "bytes", (unsigned long long)stats.bytes,
+                                       "in_use", (unsigned long long)stats.in_use,
+                                       "peak", (unsigned long long)stats.peak);
+        if (item == NULL || PyDict_SetItemString(result, PyAlloc_DomainName((PyAllocDomain)d), item) < 0) {
+            Py_XDECREF(item);
+            goto error;
+        }
+        Py_DECREF(item);
+    }
+    PyAllocClass classes[PY_ALLOC_CLASS_COUNT];
+    int count = PyAlloc_Classes(classes, PY_ALLOC_CLASS_COUNT);
+    for (int i = 0; i < count; i++) {
+        PyObject *item = Py_BuildValue("{s:I,s:K,s:K,s:K}",
+                                       "size", (unsigned int)classes[i].size,
+                                       "hits", (unsigned long long)classes[i].hits,
+                                       "misses", (unsigned long long)classes[i].misses,
+                                       "free", (unsigned long long)classes[i].free);
+        if (item == NULL || PyList_Append(arena, item) < 0) {
+            Py_XDECREF(item);
+            goto error;
+        }
+        Py_DECREF(item);
+    }
+    if (PyDict_SetItemString(result, "arena", arena) < 0) {
+        goto error;
+    }
+    Py_DECREF(arena);
+    LOG_DEBUG("%p %p", self, closure);
+    return result;
+error:
+    Py_XDECREF(arena);
+    Py_XDECREF(result);
+    return NULL;
+}
+
+// 线程调度: {"config": "usb.nice=-8,...", "threads": [{tid, role, policy, priority, nice, cpus, error}, ...]}
+static PyObject *Serial_get_sched(SerialObject *self, void *closure)
+{
+    char *config = ThreadSched_Config();
+    PyObject *threads = PyList_New(0);
+    PyObject *result = NULL;
+    if (threads == NULL) {
+        goto done;
+    }
+    SchedThread list[THREAD_SCHED_MAX_THREADS];
+    int count = ThreadSched_Threads(list, THREAD_SCHED_MAX_THREADS);
+    for (int i = 0; i < count; i++) {
+        PyObject *item = Py_BuildValue("{s:i,s:s,s:s,s:i,s:i,s:K,s:s}",
+                                       "tid", list[i].tid,
+                                       "role", ThreadSched_RoleName(list[i].role),
+                                       "policy", list[i].policy == SCHED_FIFO ? "fifo" : "other",
+                                       "priority", list[i].priority,
+                                       "nice", list[i].nice,
+                                       "cpus", (unsigned long long)list[i].cpus,
+                                       "error", list[i].error ? strerror(list[i].error) : "");
+        if (item == NULL || PyList_Append(threads, item) < 0) {
+            Py_XDECREF(item);
+            goto done;
+        }
+        Py_DECREF(item);
+    }
+    result = Py_BuildValue("{s:s,s:O}", "config", config, "threads", threads);
+done:
+    free(config);
+    Py_XDECREF(threads);
+    LOG_DEBUG("%p %p", self, closure);
+    return result;
+}
+
+// def set_sched(spec: str)
+static PyObject *Serial_set_sched(SerialObject *self, PyObject *args)
+{
+    const char *spec;
+    if (!PyArg_ParseTuple(args, "s", &spec)) {
+        return NULL;
+    }
+    if (ThreadSched_Configure(spec) != 0) {
+        PyErr_Format(PyExc_ValueError, "invalid scheduling setting: %s", spec);
+        return NULL;
+    }
+    LOG_INFO("%p sched: %s", self, spec);
     Py_RETURN_NONE;
 }
 
@@ -449,6 +1030,9 @@ static PyGetSetDef Serial_getsetters[] = {
     {"dsr", (getter)Serial_get_dsr, NULL, "DSR state", NULL},
     {"ri", (getter)Serial_get_ri, NULL, "RI state", NULL},
     {"cd", (getter)Serial_get_cd, NULL, "CD state", NULL},
+    {"metrics", (getter)Serial_get_metrics, NULL, "Bridge counters and call latencies", NULL},
+    {"pymem", (getter)Serial_get_pymem, NULL, "Interpreter allocator statistics", NULL},
+    {"sched", (getter)Serial_get_sched, NULL, "Scheduling of the bridge threads", NULL},
     {NULL}};
 
 // 方法定义
@@ -456,8 +1040,15 @@ static PyMethodDef Serial_methods[] = {
     {"open", (PyCFunction)Serial_open, METH_VARARGS, "Open a port and return a tuple (bool, str)."},
     {"close", (PyCFunction)Serial_close, METH_NOARGS, "Close port"},
     {"reconfigure", (PyCFunction)Serial_reconfigure, METH_VARARGS, "Reconfigure port"},
+    {"begin_config", (PyCFunction)Serial_begin_config, METH_NOARGS, "Stage settings until commit()"},
+    {"commit", (PyCFunction)Serial_commit, METH_NOARGS, "Apply the staged settings that changed"},
+    {"apply", (PyCFunction)Serial_apply, METH_VARARGS | METH_KEYWORDS, "Change several settings at once"},
     {"read", (PyCFunction)Serial_read, METH_VARARGS | METH_KEYWORDS, "Read data"},
     {"write", (PyCFunction)Serial_write, METH_VARARGS | METH_KEYWORDS, "Write data"},
+    {"fileno", (PyCFunction)Serial_fileno, METH_NOARGS, "Pollable fd, readable when events() has something"},
+    {"events", (PyCFunction)Serial_events, METH_NOARGS, "Take the pending EVENT_* bits"},
+    {"read_nowait", (PyCFunction)Serial_read_nowait, METH_VARARGS, "Read what has arrived, without waiting"},
+    {"write_nowait", (PyCFunction)Serial_write_nowait, METH_VARARGS, "Queue data, return the count accepted"},
     {"cancel_read", (PyCFunction)Serial_cancel_read, METH_NOARGS, "Cancel read"},
     {"cancel_write", (PyCFunction)Serial_cancel_write, METH_NOARGS, "Cancel write"},
     {"flush", (PyCFunction)Serial_flush, METH_NOARGS, "Flush buffers"},
@@ -467,6 +1058,7 @@ static PyMethodDef Serial_methods[] = {
     {"set_input_flow_control", (PyCFunction)Serial_set_input_flow_control, METH_VARARGS, "Set input flow control"},
     {"set_output_flow_control", (PyCFunction)Serial_set_output_flow_control, METH_VARARGS, "Set output flow control"},
     {"log_print", (PyCFunction)Serial_log_print, METH_VARARGS, "Log print"},
+    {"set_sched", (PyCFunction)Serial_set_sched, METH_VARARGS, "Configure the scheduling of the bridge threads"},
     {NULL}};
 
 // 类型定义
@@ -511,5 +1103,15 @@ PyMODINIT_FUNC PyInit_android(void)
         return NULL;
     }
 
+    if (RxRingReader_AddType(m) < 0)
+    {
+        Py_DECREF(m);
+        return NULL;
+    }
+
+    PyModule_AddIntConstant(m, "EVENT_RX", SERIAL_EVENT_RX);
+    PyModule_AddIntConstant(m, "EVENT_TX", SERIAL_EVENT_TX);
+    PyModule_AddIntConstant(m, "EVENT_MODEM", SERIAL_EVENT_MODEM);
+
     return m;
 }
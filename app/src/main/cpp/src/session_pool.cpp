@@ -0,0 +1,343 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifdef __ANDROID__
+#include <sys/system_properties.h>
+#endif
+
+#include "metrics.h"
+#include "mono_clock.h"
+#include "rx_ring.h"
+#include "session_pool.h"
+#include "trace.h"
+
+#define LOG_LEVEL LOG_LEVEL_INFO
+#include "log.h"
+
+enum SessionState {
+    SESSION_CLOSED,
+    SESSION_OPEN,
+    SESSION_LINGER,
+};
+
+struct Session {
+    std::mutex op;                   // held across the Java open/close of this port
+    SessionState state = SESSION_CLOSED;
+    int clients = 0;
+    int64_t expires = 0;
+    SessionCloseFunc close = nullptr;
+    bool configured = false;
+    int baudRate = 0;
+    int dataBits = 0;
+    float stopBits = 0;
+    char parity = 0;
+};
+
+static Session sessions[RX_RING_MAX_PORTS];
+static std::mutex poolLock;          // state, clients, expires, config of all sessions
+// Never destroyed: the detached reaper still waits on it while statics go away at exit.
+static MonoCondition &reaperWake = *new MonoCondition();
+static std::once_flag started;
+static int64_t linger = SESSION_POOL_DEFAULT_LINGER_MS * NS_PER_MS;
+static bool keepRx = false;
+static std::atomic<uint64_t> warmOpens{0};
+static std::atomic<uint64_t> coldOpens{0};
+static std::atomic<uint64_t> expired{0};
+static std::atomic<uint64_t> configSkips{0};
+
+static Session *session_get(int id) {
+    return id >= 0 && id < RX_RING_MAX_PORTS ? &sessions[id] : nullptr;
+}
+
+static int configure(const char *spec) {
+    int64_t next_linger = linger;
+    bool next_keep = keepRx;
+    char *copy = strdup(spec);
+    char *save = nullptr;
+    int ret = 0;
+    for (char *item = strtok_r(copy, ",", &save); item && ret == 0; item = strtok_r(nullptr, ",", &save)) {
+        char *end = nullptr;
+        if (strncmp(item, "linger=", 7) == 0) {
+            long ms = strtol(item + 7, &end, 10);
+            if (*end != '\0' || ms < 0) {
+                ret = -1;
+            } else {
+                next_linger = ms * NS_PER_MS;
+            }
+        } else if (strcmp(item, "rx=keep") == 0) {
+            next_keep = true;
+        } else if (strcmp(item, "rx=purge") == 0) {
+            next_keep = false;
+        } else {
+            ret = -1;
+        }
+        if (ret < 0) {
+            LOG_WARN("session: invalid setting \"%s\"", item);
+        }
+    }
+    free(copy);
+    if (ret == 0) {
+        linger = next_linger;
+        keepRx = next_keep;
+    }
+    return ret;
+}
+
+static void close_expired(int id) {
+    Session &s = sessions[id];
+    std::lock_guard<std::mutex> op(s.op);
+    SessionCloseFunc close;
+    {
+        std::lock_guard<std::mutex> guard(poolLock);
+        // A client may have attached while we waited for the port.
+        if (s.state != SESSION_LINGER || s.expires > MonoClock_Now()) {
+            return;
+        }
+        s.state = SESSION_CLOSED;
+        s.configured = false;
+        close = s.close;
+    }
+    TRACE_SCOPE("session expire");
+    LOG_INFO("session: port %d closed after linger", id);
+    expired.fetch_add(1, std::memory_order_relaxed);
+    close(id);
+}
+
+static void reaper_run() {
+    std::unique_lock<std::mutex> lock(poolLock);
+    for (;;) {
+        int64_t now = MonoClock_Now();
+        int64_t next = INT64_MAX;
+        int due = -1;
+        for (int id = 0; id < RX_RING_MAX_PORTS; id++) {
+            Session &s = sessions[id];
+            if (s.state != SESSION_LINGER) {
+                continue;
+            }
+            if (s.expires <= now) {
+                due = id;
+                break;
+            }
+            next = s.expires < next ? s.expires : next;
+        }
+        if (due >= 0) {
+            lock.unlock();
+            close_expired(due);
+            lock.lock();
+            continue;
+        }
+        // Woken early by every new linger, so the earliest deadline is always current.
+        reaperWake.wait_until(lock, next == INT64_MAX ? now + 3600 * NS_PER_SEC : next);
+    }
+}
+
+static char *session_collect() {
+    SessionPoolStats s;
+    SessionPool_Stats(&s);
+    char out[640];
+    snprintf(out, sizeof(out),
+             "# TYPE serial_session_opens_total counter\n"
+             "serial_session_opens_total{kind=\"warm\"} %llu\n"
+             "serial_session_opens_total{kind=\"cold\"} %llu\n"
+             "# TYPE serial_session_expired_total counter\n"
+             "serial_session_expired_total %llu\n"
+             "# TYPE serial_session_config_skips_total counter\n"
+             "serial_session_config_skips_total %llu\n"
+             "# TYPE serial_session_lingering gauge\n"
+             "serial_session_lingering %d\n",
+             (unsigned long long) s.warm_opens, (unsigned long long) s.cold_opens, (unsigned long long) s.expired,
+             (unsigned long long) s.config_skips, s.lingering);
+    return strdup(out);
+}
+
+static void start() {
+    {
+        std::lock_guard<std::mutex> guard(poolLock);
+#ifdef __ANDROID__
+        char value[PROP_VALUE_MAX] = {0};
+        if (__system_property_get("debug.serialserver.session", value) > 0) {
+            configure(value);
+        }
+#else
+        const char *value = getenv("SERIAL_SESSION");
+        if (value) {
+            configure(value);
+        }
+#endif
+    }
+    Metrics_AddCollector(session_collect);
+    std::thread(reaper_run).detach();
+}
+
+extern "C" {
+
+int SessionPool_Configure(const char *spec) {
+    std::call_once(started, start);
+    std::lock_guard<std::mutex> guard(poolLock);
+    int ret = configure(spec);
+    if (ret == 0) {
+        LOG_INFO("session: linger %lld ms, rx %s", (long long) (linger / NS_PER_MS), keepRx ? "keep" : "purge");
+    }
+    return ret;
+}
+
+int SessionPool_Open(int id, SessionOpenFunc open) {
+    Session *s = session_get(id);
+    if (!s) {
+        return open(id);
+    }
+    std::call_once(started, start);
+    std::lock_guard<std::mutex> op(s->op);
+    bool warm = false;
+    bool purge = false;
+    {
+        std::lock_guard<std::mutex> guard(poolLock);
+        if (s->state != SESSION_CLOSED) {
+            warm = true;
+            purge = s->state == SESSION_LINGER && !keepRx;
+            s->state = SESSION_OPEN;
+            s->clients++;
+            warmOpens.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    if (warm) {
+        if (purge) {
+            RxRing_Reset(id);
+        }
+        LOG_DEBUG("session: port %d attached warm%s", id, purge ? ", rx purged" : "");
+        return 1;
+    }
+    int ret = open(id);
+    if (ret == 1) {
+        coldOpens.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> guard(poolLock);
+        s->state = SESSION_OPEN;
+        s->clients = 1;
+        s->configured = false;
+    }
+    return ret;
+}
+
+int SessionPool_Close(int id, SessionCloseFunc close) {
+    Session *s = session_get(id);
+    if (!s) {
+        return close(id);
+    }
+    std::call_once(started, start);
+    std::lock_guard<std::mutex> op(s->op);
+    {
+        std::lock_guard<std::mutex> guard(poolLock);
+        if (s->state != SESSION_OPEN) {
+            return 0;
+        }
+        if (--s->clients > 0) {
+            return 1;
+        }
+        if (linger > 0) {
+            s->state = SESSION_LINGER;
+            s->expires = MonoClock_Now() + linger;
+            s->close = close;
+            reaperWake.notify_one();
+            return 1;
+        }
+        s->state = SESSION_CLOSED;
+        s->configured = false;
+    }
+    return close(id);
+}
+
+void SessionPool_Drop(int id) {
+    Session *s = session_get(id);
+    if (!s) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(poolLock);
+    if (s->state == SESSION_LINGER) {
+        s->expires = 0;
+        reaperWake.notify_one();
+    }
+    s->configured = false;
+}
+
+void SessionPool_Flush(void) {
+    for (int id = 0; id < RX_RING_MAX_PORTS; id++) {
+        {
+            std::lock_guard<std::mutex> guard(poolLock);
+            if (sessions[id].state != SESSION_LINGER) {
+                continue;
+            }
+            sessions[id].expires = 0;
+        }
+        close_expired(id);
+    }
+}
+
+int SessionPool_SameConfig(int id, int baudRate, int dataBits, float stopBits, char parity) {
+    Session *s = session_get(id);
+    if (!s) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> guard(poolLock);
+    bool same = s->state == SESSION_OPEN && s->configured && s->baudRate == baudRate && s->dataBits == dataBits &&
+                s->stopBits == stopBits && s->parity == parity;
+    if (same) {
+        configSkips.fetch_add(1, std::memory_order_relaxed);
+    }
+    return same;
+}
+
+void SessionPool_SetConfig(int id, int baudRate, int dataBits, float stopBits, char parity) {
+    Session *s = session_get(id);
+    if (!s) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(poolLock);
+    s->configured = s->state == SESSION_OPEN;
+    s->baudRate = baudRate;
+    s->dataBits = dataBits;
+    s->stopBits = stopBits;
+    s->parity = parity;
+}
+
+void SessionPool_Stats(SessionPoolStats *stats) {
+    stats->warm_opens = warmOpens.load(std::memory_order_relaxed);
+    stats->cold_opens = coldOpens.load(std::memory_order_relaxed);
+    stats->expired = expired.load(std::memory_order_relaxed);
+    stats->config_skips = configSkips.load(std::memory_order_relaxed);
+    stats->lingering = 0;
+    std::lock_guard<std::mutex> guard(poolLock);
+    for (Session &s : sessions) {
+        stats->lingering += s.state == SESSION_LINGER;
+    }
+}
+
+}
@@ -0,0 +1,249 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "lz_stream.h"
+#include "telnet_zip.h"
+#include "thread_sched.h"
+
+#define LOG_LEVEL LOG_LEVEL_INFO
+#include "log.h"
+
+#define TELNET_IAC 255
+#define TELNET_DONT 254
+#define TELNET_DO 253
+#define TELNET_WONT 252
+#define TELNET_WILL 251
+#define TELNET_SB 250
+#define TELNET_SE 240
+
+enum FilterState {
+    FILTER_DATA,
+    FILTER_IAC,
+    FILTER_VERB,
+};
+
+struct Relay {
+    int client = -1;
+    int upstream = -1;
+    FilterState state = FILTER_DATA;
+    uint8_t verb = 0;
+    LzEncoder *encoder = nullptr;    // set once the client agreed
+};
+
+static std::atomic<int> listenFd{-1};
+static std::atomic<int> clients{0};
+static int upstreamPort = 0;
+
+static bool send_all(int fd, const uint8_t *data, int length) {
+    while (length > 0) {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= (int) n;
+    }
+    return true;
+}
+
+// Removes the negotiation of our option from client bytes and acts on it;
+// returns false when the client went away.
+static bool filter(Relay *r, const uint8_t *data, int length, std::vector<uint8_t> &out) {
+    for (int i = 0; i < length; i++) {
+        uint8_t b = data[i];
+        switch (r->state) {
+            case FILTER_DATA:
+                if (b == TELNET_IAC) {
+                    r->state = FILTER_IAC;
+                } else {
+                    out.push_back(b);
+                }
+                break;
+            case FILTER_IAC:
+                if (b >= TELNET_WILL && b <= TELNET_DONT) {
+                    r->verb = b;
+                    r->state = FILTER_VERB;
+                } else {
+                    out.push_back(TELNET_IAC);
+                    out.push_back(b);
+                    r->state = FILTER_DATA;
+                }
+                break;
+            case FILTER_VERB:
+                r->state = FILTER_DATA;
+                if (b != TELNET_ZIP_OPTION) {
+                    out.insert(out.end(), {TELNET_IAC, r->verb, b});
+                } else if (r->verb == TELNET_DO && !r->encoder) {
+                    static const uint8_t start[] = {TELNET_IAC, TELNET_SB, TELNET_ZIP_OPTION, TELNET_IAC, TELNET_SE};
+                    if (!send_all(r->client, start, sizeof(start))) {
+                        return false;
+                    }
+                    r->encoder = LzStream_EncoderNew();
+                    LOG_INFO("telnet zip: client takes compression");
+                } else if (r->verb == TELNET_WILL) {
+                    const uint8_t refuse[] = {TELNET_IAC, TELNET_DONT, TELNET_ZIP_OPTION};
+                    if (!send_all(r->client, refuse, sizeof(refuse))) {
+                        return false;
+                    }
+                }
+                break;
+        }
+    }
+    return true;
+}
+
+static int connect_upstream() {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t) upstreamPort);
+    if (fd >= 0 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static void relay_run(int client) {
+    ThreadSched_Enter(SCHED_ROLE_SERVER);
+    Relay r;
+    r.client = client;
+    r.upstream = connect_upstream();
+    static const uint8_t offer[] = {TELNET_IAC, TELNET_WILL, TELNET_ZIP_OPTION};
+    if (r.upstream < 0) {
+        LOG_WARN("telnet zip: server on %d not reachable: %s", upstreamPort, strerror(errno));
+    } else if (send_all(client, offer, sizeof(offer))) {
+        int one = 1;
+        setsockopt(r.upstream, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        uint8_t buffer[LZ_STREAM_BLOCK_MAX];
+        uint8_t block[LZ_STREAM_BOUND(LZ_STREAM_BLOCK_MAX)];
+        std::vector<uint8_t> filtered;
+        struct pollfd fds[2] = {{client, POLLIN, 0}, {r.upstream, POLLIN, 0}};
+        for (;;) {
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            if (fds[0].revents) {
+                ssize_t n = recv(client, buffer, sizeof(buffer), 0);
+                filtered.clear();
+                if (n <= 0 || !filter(&r, buffer, (int) n, filtered) ||
+                    !send_all(r.upstream, filtered.data(), (int) filtered.size())) {
+                    break;
+                }
+            }
+            if (fds[1].revents) {
+                // One read is one block: it holds what the server wrote for
+                // one serial read, which is as much as arrived together.
+                ssize_t n = recv(r.upstream, buffer, sizeof(buffer), 0);
+                if (n <= 0) {
+                    break;
+                }
+                bool sent = r.encoder ? send_all(client, block, LzStream_Compress(r.encoder, buffer, (int) n, block))
+                                      : send_all(client, buffer, (int) n);
+                if (!sent) {
+                    break;
+                }
+            }
+        }
+    }
+    if (r.upstream >= 0) {
+        close(r.upstream);
+    }
+    close(client);
+    LzStream_EncoderFree(r.encoder);
+    clients.fetch_sub(1);
+    LOG_INFO("telnet zip: client left");
+}
+
+static void listen_run() {
+    for (;;) {
+        int fd = accept4(listenFd.load(), nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                LOG_ERROR("telnet zip: accept failed: %s", strerror(errno));
+                return;
+            }
+            continue;
+        }
+        if (clients.fetch_add(1) >= TELNET_ZIP_MAX_CLIENTS) {
+            clients.fetch_sub(1);
+            LOG_WARN("telnet zip: too many clients, refusing another");
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        std::thread(relay_run, fd).detach();
+    }
+}
+
+extern "C" {
+
+int TelnetZip_Start(int tcp_port, int upstream_port) {
+    if (listenFd.load() >= 0) {
+        LOG_WARN("telnet zip already running");
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t) tcp_port);
+    if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        listen(fd, TELNET_ZIP_MAX_CLIENTS) != 0) {
+        LOG_ERROR("telnet zip: listen on %d failed: %s", tcp_port, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    upstreamPort = upstream_port;
+    listenFd.store(fd);
+    std::thread(listen_run).detach();
+    LOG_INFO("telnet zip on tcp %d for the server on %d", tcp_port, upstream_port);
+    return 0;
+}
+
+}
@@ -0,0 +1,417 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifdef __ANDROID__
+#include <sys/system_properties.h>
+#endif
+
+#include "metrics.h"
+#include "thread_sched.h"
+
+#define LOG_LEVEL LOG_LEVEL_INFO
+#include "log.h"
+
+#define THREAD_SCHED_MAX_CPUS 64
+
+struct RolePolicy {
+    int nice;
+    int fifo;            // SCHED_FIFO priority, 0 = SCHED_OTHER
+    char cpus[16];       // as configured: "all", "big", "little", "4-7", "0xf0"
+    int slack;           // timer slack in us, 0 = leave as is
+};
+
+// Defaults follow android.os.Process: the reader as THREAD_PRIORITY_URGENT_DISPLAY,
+// the server slightly below it, writers at THREAD_PRIORITY_DISPLAY. The timer
+// slack is pinned to the Linux default, a service the system moves to the
+// background otherwise gets 40 ms and every sub-ms timeout with it.
+static RolePolicy policies[SCHED_ROLE_COUNT] = {
+        {-8, 0, "all", 50},
+        {-6, 0, "all", 50},
+        {-4, 0, "all", 50},
+};
+static std::mutex config_lock;
+static std::atomic<uint32_t> generation{1};
+static std::once_flag started;
+
+struct ThreadSlot {
+    std::atomic<int> tid;
+    std::atomic<int> role;
+    std::atomic<int> policy;
+    std::atomic<int> priority;
+    std::atomic<int> nice;
+    std::atomic<uint64_t> cpus;
+    std::atomic<int> error;
+};
+
+static ThreadSlot slots[THREAD_SCHED_MAX_THREADS];
+
+struct Topology {
+    uint64_t all;
+    uint64_t big;
+    uint64_t little;
+};
+
+// big = the cores with the highest cpuinfo_max_freq, little = the lowest;
+// without cpufreq (emulator, host) both are all cores.
+static const Topology &topology() {
+    static Topology topo = [] {
+        Topology t = {0, 0, 0};
+        long count = sysconf(_SC_NPROCESSORS_CONF);
+        long max_freq[THREAD_SCHED_MAX_CPUS] = {0};
+        long highest = 0, lowest = 0;
+        for (long cpu = 0; cpu < count && cpu < THREAD_SCHED_MAX_CPUS; cpu++) {
+            t.all |= 1ull << cpu;
+            char path[96];
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/cpufreq/cpuinfo_max_freq", cpu);
+            FILE *f = fopen(path, "r");
+            if (f) {
+                if (fscanf(f, "%ld", &max_freq[cpu]) != 1) {
+                    max_freq[cpu] = 0;
+                }
+                fclose(f);
+            }
+            if (max_freq[cpu] > highest) {
+                highest = max_freq[cpu];
+            }
+            if (max_freq[cpu] > 0 && (lowest == 0 || max_freq[cpu] < lowest)) {
+                lowest = max_freq[cpu];
+            }
+        }
+        for (long cpu = 0; cpu < count && cpu < THREAD_SCHED_MAX_CPUS; cpu++) {
+            if (max_freq[cpu] == highest) {
+                t.big |= 1ull << cpu;
+            }
+            if (max_freq[cpu] == lowest) {
+                t.little |= 1ull << cpu;
+            }
+        }
+        if (highest == 0) {
+            t.big = t.little = t.all;
+        }
+        return t;
+    }();
+    return topo;
+}
+
+// Returns 0 for an unknown spec.
+static uint64_t cpus_parse(const char *spec) {
+    const Topology &t = topology();
+    if (strcmp(spec, "all") == 0) {
+        return t.all;
+    }
+    if (strcmp(spec, "big") == 0) {
+        return t.big;
+    }
+    if (strcmp(spec, "little") == 0) {
+        return t.little;
+    }
+    char *end = nullptr;
+    if (strncmp(spec, "0x", 2) == 0) {
+        uint64_t mask = strtoull(spec + 2, &end, 16);
+        return *end == '\0' ? mask & t.all : 0;
+    }
+    long first = strtol(spec, &end, 10);
+    long last = first;
+    if (end != spec && *end == '-') {
+        last = strtol(end + 1, &end, 10);
+    }
+    if (end == spec || *end != '\0' || first < 0 || last < first || last >= THREAD_SCHED_MAX_CPUS) {
+        return 0;
+    }
+    uint64_t mask = 0;
+    for (long cpu = first; cpu <= last; cpu++) {
+        mask |= 1ull << cpu;
+    }
+    return mask & t.all;
+}
+
+static int role_parse(const char *name) {
+    for (int role = 0; role < SCHED_ROLE_COUNT; role++) {
+        if (strcmp(name, ThreadSched_RoleName((SchedRole) role)) == 0) {
+            return role;
+        }
+    }
+    return -1;
+}
+
+static char *sched_collect() {
+    std::string out = "# HELP serial_thread_sched_info Effective scheduling of the bridge threads.\n"
+                      "# TYPE serial_thread_sched_info gauge\n";
+    SchedThread threads[THREAD_SCHED_MAX_THREADS];
+    int n = ThreadSched_Threads(threads, THREAD_SCHED_MAX_THREADS);
+    char line[256];
+    for (int i = 0; i < n; i++) {
+        const SchedThread &t = threads[i];
+        snprintf(line, sizeof(line),
+                 "serial_thread_sched_info{role=\"%s\",tid=\"%d\",policy=\"%s\",priority=\"%d\",nice=\"%d\","
+                 "cpus=\"0x%llx\",error=\"%s\"} 1\n",
+                 ThreadSched_RoleName(t.role), t.tid, t.policy == SCHED_FIFO ? "fifo" : "other", t.priority, t.nice,
+                 (unsigned long long) t.cpus, t.error ? strerror(t.error) : "");
+        out += line;
+    }
+    return strdup(out.c_str());
+}
+
+static int configure(const char *spec) {
+    RolePolicy next[SCHED_ROLE_COUNT];
+    memcpy(next, policies, sizeof(next));
+    char *copy = strdup(spec);
+    char *save = nullptr;
+    int ret = 0;
+    for (char *item = strtok_r(copy, ",", &save); item; item = strtok_r(nullptr, ",", &save)) {
+        while (*item == ' ') {
+            item++;
+        }
+        char *dot = strchr(item, '.');
+        char *eq = strchr(item, '=');
+        if (!dot || !eq || eq < dot) {
+            ret = -1;
+            break;
+        }
+        *dot = '\0';
+        *eq = '\0';
+        int role = role_parse(item);
+        const char *key = dot + 1;
+        const char *value = eq + 1;
+        char *end = nullptr;
+        if (role < 0) {
+            ret = -1;
+        } else if (strcmp(key, "nice") == 0) {
+            long nice = strtol(value, &end, 10);
+            if (*end != '\0' || nice < -20 || nice > 19) {
+                ret = -1;
+            } else {
+                next[role].nice = (int) nice;
+            }
+        } else if (strcmp(key, "fifo") == 0) {
+            long priority = strtol(value, &end, 10);
+            if (*end != '\0' || priority < 0 || priority > sched_get_priority_max(SCHED_FIFO)) {
+                ret = -1;
+            } else {
+                next[role].fifo = (int) priority;
+            }
+        } else if (strcmp(key, "slack") == 0) {
+            long slack = strtol(value, &end, 10);
+            if (*end != '\0' || slack < 0 || slack > 1000000) {
+                ret = -1;
+            } else {
+                next[role].slack = (int) slack;
+            }
+        } else if (strcmp(key, "cpus") == 0 && strlen(value) < sizeof(next[role].cpus) && cpus_parse(value)) {
+            snprintf(next[role].cpus, sizeof(next[role].cpus), "%s", value);
+        } else {
+            ret = -1;
+        }
+        if (ret < 0) {
+            LOG_WARN("sched: invalid setting \"%s.%s=%s\"", item, key, value);
+            break;
+        }
+    }
+    free(copy);
+    if (ret == 0) {
+        memcpy(policies, next, sizeof(next));
+        generation.fetch_add(1, std::memory_order_release);
+    }
+    return ret;
+}
+
+static void start() {
+    std::lock_guard<std::mutex> guard(config_lock);
+#ifdef __ANDROID__
+    char value[PROP_VALUE_MAX] = {0};
+    if (__system_property_get("debug.serialserver.sched", value) > 0) {
+        configure(value);
+    }
+#else
+    const char *value = getenv("SERIAL_SCHED");
+    if (value) {
+        configure(value);
+    }
+#endif
+    Metrics_AddCollector(sched_collect);
+}
+
+struct ThreadState {
+    uint32_t generation = 0;
+    int role = -1;
+    ThreadSlot *slot = nullptr;
+    ~ThreadState() {
+        if (slot) {
+            slot->tid.store(0, std::memory_order_release);
+        }
+    }
+};
+
+static thread_local ThreadState state;
+
+static void apply(SchedRole role) {
+    RolePolicy policy;
+    {
+        std::lock_guard<std::mutex> guard(config_lock);
+        policy = policies[role];
+        state.generation = generation.load(std::memory_order_acquire);
+    }
+    int tid = (int) syscall(SYS_gettid);
+    int error = 0;
+
+    struct sched_param param = {};
+    param.sched_priority = policy.fifo;
+    if (policy.fifo > 0) {
+        if (sched_setscheduler(0, SCHED_FIFO, &param) != 0) {
+            error = errno;
+        }
+    } else if (sched_getscheduler(0) == SCHED_FIFO) {
+        sched_setscheduler(0, SCHED_OTHER, &param);
+    }
+    if (setpriority(PRIO_PROCESS, tid, policy.nice) != 0) {
+        error = errno;
+    }
+    if (policy.slack > 0 && prctl(PR_SET_TIMERSLACK, (unsigned long) policy.slack * 1000) != 0) {
+        error = errno;
+    }
+    uint64_t mask = cpus_parse(policy.cpus);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu = 0; cpu < THREAD_SCHED_MAX_CPUS; cpu++) {
+        if (mask & (1ull << cpu)) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    if (mask && sched_setaffinity(0, sizeof(set), &set) != 0) {
+        error = errno;
+    }
+
+    if (!state.slot) {
+        for (ThreadSlot &slot : slots) {
+            int expected = 0;
+            if (slot.tid.compare_exchange_strong(expected, tid, std::memory_order_acquire)) {
+                state.slot = &slot;
+                break;
+            }
+        }
+    }
+    int effective_policy = sched_getscheduler(0);
+    struct sched_param effective_param = {};
+    sched_getparam(0, &effective_param);
+    errno = 0;
+    int effective_nice = getpriority(PRIO_PROCESS, tid);
+    uint64_t effective_cpus = 0;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < THREAD_SCHED_MAX_CPUS; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                effective_cpus |= 1ull << cpu;
+            }
+        }
+    }
+    if (state.slot) {
+        ThreadSlot &slot = *state.slot;
+        slot.role.store(role, std::memory_order_relaxed);
+        slot.policy.store(effective_policy, std::memory_order_relaxed);
+        slot.priority.store(effective_param.sched_priority, std::memory_order_relaxed);
+        slot.nice.store(effective_nice, std::memory_order_relaxed);
+        slot.cpus.store(effective_cpus, std::memory_order_relaxed);
+        slot.error.store(error, std::memory_order_relaxed);
+    }
+    state.role = role;
+    if (error) {
+        LOG_WARN("sched: %s thread %d: %s, running %s nice %d cpus 0x%llx", ThreadSched_RoleName(role), tid,
+                 strerror(error), effective_policy == SCHED_FIFO ? "fifo" : "other", effective_nice,
+                 (unsigned long long) effective_cpus);
+    } else {
+        LOG_INFO("sched: %s thread %d: %s %d nice %d cpus 0x%llx", ThreadSched_RoleName(role), tid,
+                 effective_policy == SCHED_FIFO ? "fifo" : "other", effective_param.sched_priority, effective_nice,
+                 (unsigned long long) effective_cpus);
+    }
+}
+
+extern "C" {
+
+int ThreadSched_Configure(const char *spec) {
+    std::call_once(started, start);
+    std::lock_guard<std::mutex> guard(config_lock);
+    return configure(spec);
+}
+
+void ThreadSched_Enter(SchedRole role) {
+    if (state.generation == generation.load(std::memory_order_relaxed) && state.role == role) {
+        return;
+    }
+    std::call_once(started, start);
+    apply(role);
+}
+
+int ThreadSched_Threads(SchedThread *threads, int max) {
+    int n = 0;
+    for (ThreadSlot &slot : slots) {
+        int tid = slot.tid.load(std::memory_order_acquire);
+        if (!tid || n >= max) {
+            continue;
+        }
+        SchedThread &t = threads[n++];
+        t.tid = tid;
+        t.role = (SchedRole) slot.role.load(std::memory_order_relaxed);
+        t.policy = slot.policy.load(std::memory_order_relaxed);
+        t.priority = slot.priority.load(std::memory_order_relaxed);
+        t.nice = slot.nice.load(std::memory_order_relaxed);
+        t.cpus = slot.cpus.load(std::memory_order_relaxed);
+        t.error = slot.error.load(std::memory_order_relaxed);
+    }
+    return n;
+}
+
+char *ThreadSched_Config(void) {
+    std::call_once(started, start);
+    std::lock_guard<std::mutex> guard(config_lock);
+    std::string out;
+    char item[128];
+    for (int role = 0; role < SCHED_ROLE_COUNT; role++) {
+        const char *name = ThreadSched_RoleName((SchedRole) role);
+        snprintf(item, sizeof(item), "%s%s.nice=%d,%s.fifo=%d,%s.cpus=%s,%s.slack=%d", role ? "," : "", name,
+                 policies[role].nice, name, policies[role].fifo, name, policies[role].cpus, name,
+                 policies[role].slack);
+        out += item;
+    }
+    return strdup(out.c_str());
+}
+
+const char *ThreadSched_RoleName(SchedRole role) {
+    static const char *names[SCHED_ROLE_COUNT] = {"usb", "server", "writer"};
+    return names[role];
+}
+
+}
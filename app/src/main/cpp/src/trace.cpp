@@ -0,0 +1,174 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include <unistd.h>
+
+#ifdef __ANDROID__
+#include <android/trace.h>
+#include <dlfcn.h>
+#include <sys/system_properties.h>
+#else
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+#include "trace.h"
+
+#define LOG_LEVEL LOG_LEVEL_WARN
+#include "log.h"
+
+int Trace_enabled = 0;
+
+#ifdef __ANDROID__
+
+// The async variants arrived in API 29, minSdk is 28.
+typedef void (*AsyncSectionFunc)(const char *name, int32_t cookie);
+static AsyncSectionFunc asyncBegin;
+static AsyncSectionFunc asyncEnd;
+
+extern "C" {
+
+void Trace_Init(void) {
+    char value[PROP_VALUE_MAX] = {0};
+    __system_property_get("debug.serialserver.trace", value);
+    asyncBegin = (AsyncSectionFunc) dlsym(RTLD_DEFAULT, "ATrace_beginAsyncSection");
+    asyncEnd = (AsyncSectionFunc) dlsym(RTLD_DEFAULT, "ATrace_endAsyncSection");
+    Trace_Enable(atoi(value) != 0);
+}
+
+void Trace_Enable(int enabled) {
+    __atomic_store_n(&Trace_enabled, enabled ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+void Trace_Begin(const char *name) {
+    ATrace_beginSection(name);
+}
+
+void Trace_End(void) {
+    ATrace_endSection();
+}
+
+void Trace_AsyncBegin(const char *name, int32_t cookie) {
+    if (asyncBegin) {
+        asyncBegin(name, cookie);
+    }
+}
+
+void Trace_AsyncEnd(const char *name, int32_t cookie) {
+    if (asyncEnd) {
+        asyncEnd(name, cookie);
+    }
+}
+
+}
+
+#else
+
+// Chrome JSON array format; a missing closing bracket is accepted by the
+// viewers, so a crashed run still leaves a readable trace.
+static FILE *traceFile;
+static std::mutex traceLock;
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e6 + (double) ts.tv_nsec / 1e3;
+}
+
+static void trace_write(const char *name, char phase, const int32_t *cookie) {
+    static thread_local long tid = syscall(SYS_gettid);
+    double ts = now_us();
+    std::lock_guard<std::mutex> guard(traceLock);
+    if (!traceFile) {
+        return;
+    }
+    if (cookie) {
+        fprintf(traceFile, "{\"name\":\"%s\",\"cat\":\"serial\",\"ph\":\"%c\",\"id\":%d,\"ts\":%.3f,\"pid\":%d,\"tid\":%ld},\n",
+                name ? name : "", phase, *cookie, ts, (int) getpid(), tid);
+    } else {
+        fprintf(traceFile, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%ld},\n",
+                name ? name : "", phase, ts, (int) getpid(), tid);
+    }
+}
+
+static void trace_close() {
+    std::lock_guard<std::mutex> guard(traceLock);
+    if (traceFile) {
+        fprintf(traceFile, "{}]\n");
+        fclose(traceFile);
+        traceFile = nullptr;
+    }
+}
+
+extern "C" {
+
+void Trace_Init(void) {
+    const char *path = getenv("SERIAL_TRACE_FILE");
+    if (!path || !*path) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(traceLock);
+        if (traceFile) {
+            return;
+        }
+        traceFile = fopen(path, "w");
+        if (!traceFile) {
+            LOG_ERROR("cannot open trace file %s", path);
+            return;
+        }
+        fprintf(traceFile, "[\n");
+    }
+    atexit(trace_close);
+    Trace_Enable(1);
+}
+
+void Trace_Enable(int enabled) {
+    __atomic_store_n(&Trace_enabled, enabled ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+void Trace_Begin(const char *name) {
+    trace_write(name, 'B', nullptr);
+}
+
+void Trace_End(void) {
+    trace_write(nullptr, 'E', nullptr);
+}
+
+void Trace_AsyncBegin(const char *name, int32_t cookie) {
+    trace_write(name, 'b', &cookie);
+}
+
+void Trace_AsyncEnd(const char *name, int32_t cookie) {
+    trace_write(name, 'e', &cookie);
+}
+
+}
+
+#endif
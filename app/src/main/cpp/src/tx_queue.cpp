@@ -0,0 +1,231 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "buffer_pool.h"
+#include "event_set.h"
+#include "flow_ctl.h"
+#include "java_method.h"
+#include "metrics.h"
+#include "mono_clock.h"
+#include "rx_ring.h"
+#include "thread_sched.h"
+#include "trace.h"
+#include "tx_queue.h"
+
+#define LOG_LEVEL LOG_LEVEL_INFO
+#include "log.h"
+
+struct TxQueue {
+    int id = -1;
+    std::mutex lock;
+    MonoCondition changed;
+    uint8_t data[TX_QUEUE_CAPACITY];
+    uint64_t head = 0;       // next byte written by TxQueue_Write
+    uint64_t tail = 0;       // next byte taken by the writer
+    int inflight = 0;        // taken, JavaMethod_WriteSerial not returned yet
+    bool failed = false;     // a write failed, not reported yet
+    EventSet space;
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> errors{0};
+};
+
+static TxQueue *queues[RX_RING_MAX_PORTS];
+static std::mutex queuesLock;
+static std::once_flag registered;
+
+static void writer_run(TxQueue *q) {
+    ThreadSched_Enter(SCHED_ROLE_WRITER);
+    int8_t *chunk = (int8_t *) BufferPool_Get(TX_QUEUE_CHUNK);
+    std::unique_lock<std::mutex> lock(q->lock);
+    for (;;) {
+        while (!q->changed.wait_until(lock, MonoClock_Now() + 3600 * NS_PER_SEC, [q] { return q->head != q->tail; })) {
+        }
+        // Waits out a stop from the peer without holding the queue.
+        lock.unlock();
+        uint64_t allowed = (uint64_t) FlowCtl_TxWait(q->id, INT64_MAX);
+        lock.lock();
+        if (q->head == q->tail) {
+            continue;
+        }
+        uint64_t offset = q->tail % TX_QUEUE_CAPACITY;
+        uint64_t n = q->head - q->tail;
+        n = n < TX_QUEUE_CHUNK ? n : TX_QUEUE_CHUNK;
+        n = n < allowed ? n : allowed;
+        n = n < TX_QUEUE_CAPACITY - offset ? n : TX_QUEUE_CAPACITY - offset;
+        memcpy(chunk, q->data + offset, n);
+        q->tail += n;
+        q->inflight = (int) n;
+        lock.unlock();
+        int ret;
+        {
+            // No timeout: a chunk takes seconds below 9600 baud, and a timed out chunk would be half sent.
+            TRACE_SCOPE("tx queue write");
+            ret = JavaMethod_WriteSerial(q->id, chunk, (int) n, 0);
+        }
+        if (ret >= 0) {
+            q->bytes.fetch_add(n, std::memory_order_relaxed);
+        }
+        lock.lock();
+        q->inflight = 0;
+        if (ret < 0) {
+            q->errors.fetch_add(1, std::memory_order_relaxed);
+            LOG_WARN("port %d: queued write of %d bytes failed, dropping %d queued bytes", q->id, (int) n,
+                     (int) (q->head - q->tail));
+            q->tail = q->head;
+            q->failed = true;
+        }
+        q->changed.notify_all();
+        // After inflight is cleared: a subscriber waiting for an empty queue sees it on this signal.
+        lock.unlock();
+        q->space.signal();
+        lock.lock();
+    }
+}
+
+static char *queue_collect() {
+    std::string out = "# TYPE serial_tx_queue_bytes_total counter\n";
+    std::string errors = "# TYPE serial_tx_queue_errors_total counter\n";
+    std::string pending = "# TYPE serial_tx_queue_pending gauge\n";
+    char line[128];
+    for (int id = 0; id < RX_RING_MAX_PORTS; id++) {
+        TxQueue *q;
+        {
+            std::lock_guard<std::mutex> guard(queuesLock);
+            q = queues[id];
+        }
+        if (!q) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "serial_tx_queue_bytes_total{port=\"%d\"} %llu\n", id,
+                 (unsigned long long) q->bytes.load(std::memory_order_relaxed));
+        out += line;
+        snprintf(line, sizeof(line), "serial_tx_queue_errors_total{port=\"%d\"} %llu\n", id,
+                 (unsigned long long) q->errors.load(std::memory_order_relaxed));
+        errors += line;
+        snprintf(line, sizeof(line), "serial_tx_queue_pending{port=\"%d\"} %d\n", id, TxQueue_Pending(id));
+        pending += line;
+    }
+    return strdup((out + errors + pending).c_str());
+}
+
+// Creates the queue and its writer on first use; queues live as long as the process.
+static TxQueue *queue_get(int id, bool create) {
+    if (id < 0 || id >= RX_RING_MAX_PORTS) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> guard(queuesLock);
+    if (!queues[id] && create) {
+        TxQueue *q = new TxQueue();
+        q->id = id;
+        queues[id] = q;
+        std::thread(writer_run, q).detach();
+        std::call_once(registered, [] { Metrics_AddCollector(queue_collect); });
+    }
+    return queues[id];
+}
+
+extern "C" {
+
+int TxQueue_Write(int id, const int8_t *data, int length) {
+    TxQueue *q = queue_get(id, true);
+    if (!q || length < 0) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> guard(q->lock);
+    if (q->failed) {
+        return -1;
+    }
+    uint64_t space = TX_QUEUE_CAPACITY - (q->head - q->tail);
+    uint64_t n = (uint64_t) length < space ? (uint64_t) length : space;
+    uint64_t offset = q->head % TX_QUEUE_CAPACITY;
+    uint64_t first = n < TX_QUEUE_CAPACITY - offset ? n : TX_QUEUE_CAPACITY - offset;
+    memcpy(q->data + offset, data, first);
+    memcpy(q->data, data + first, n - first);
+    q->head += n;
+    if (n > 0) {
+        q->changed.notify_all();
+    }
+    return (int) n;
+}
+
+int TxQueue_Pending(int id) {
+    TxQueue *q = queue_get(id, false);
+    if (!q) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> guard(q->lock);
+    return (int) (q->head - q->tail) + q->inflight;
+}
+
+int TxQueue_Flush(int id, int64_t timeout) {
+    TxQueue *q = queue_get(id, false);
+    if (!q) {
+        return 0;
+    }
+    std::unique_lock<std::mutex> lock(q->lock);
+    auto drained = [q] { return q->head == q->tail && q->inflight == 0; };
+    if (!q->changed.wait_until(lock, timeout < 0 ? INT64_MAX : MonoClock_Now() + timeout, drained)) {
+        return TX_QUEUE_TIMEOUT;
+    }
+    if (q->failed) {
+        q->failed = false;
+        return TX_QUEUE_FAILED;
+    }
+    return 0;
+}
+
+void TxQueue_Reset(int id) {
+    TxQueue *q = queue_get(id, false);
+    if (!q) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(q->lock);
+        q->tail = q->head;
+        q->failed = false;
+        q->changed.notify_all();
+    }
+    q->space.signal();
+}
+
+int TxQueue_Subscribe(int id) {
+    TxQueue *q = queue_get(id, true);
+    return q ? q->space.add() : -1;
+}
+
+void TxQueue_Unsubscribe(int id, int event_fd) {
+    TxQueue *q = queue_get(id, false);
+    if (q) {
+        q->space.remove(event_fd);
+    }
+}
+
+}
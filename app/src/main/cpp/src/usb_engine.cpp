@@ -0,0 +1,429 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <linux/usbdevice_fs.h>
+#include <sys/ioctl.h>
+
+#include "buffer_pool.h"
+#include "event_set.h"
+#include "metrics.h"
+#include "mono_clock.h"
+#include "rx_ring.h"
+#include "thread_sched.h"
+#include "trace.h"
+#include "usb_engine.h"
+
+#define LOG_LEVEL LOG_LEVEL_INFO
+#include "log.h"
+
+#define FTDI_STATUS_BYTES 2
+#define FTDI_LINE_ERRORS 0x1e   // overrun, parity, framing, break
+#define FTDI_MODEM_MASK (USB_MODEM_CTS | USB_MODEM_DSR | USB_MODEM_RI | USB_MODEM_CD)
+
+struct Urb {
+    bool in;
+    int index;
+    bool submitted;
+    struct usbdevfs_urb urb;    // last: ends in the iso frame array
+};
+
+struct Engine {
+    int id = -1;
+    int fd = -1;
+    UsbFraming framing = USB_FRAMING_RAW;
+    int max_packet = 64;
+    int urb_count = USB_ENGINE_DEFAULT_URBS;
+    int urb_size = USB_ENGINE_DEFAULT_URB_SIZE;
+    // Allocated one by one: struct usbdevfs_urb ends in a flexible array.
+    std::unique_ptr<Urb> in[USB_ENGINE_MAX_URBS];
+    std::unique_ptr<Urb> out[USB_ENGINE_MAX_URBS];
+    std::mutex lock;                 // out URB state, in_flight
+    MonoCondition changed;
+    std::mutex write_lock;           // one write at a time
+    int in_flight = 0;
+    int out_pending = 0;
+    int out_status = 0;
+    bool stopping = false;
+    bool gone = false;
+    std::thread reaper;
+    std::atomic<uint64_t> in_urbs{0};
+    std::atomic<uint64_t> out_urbs{0};
+    std::atomic<uint64_t> in_bytes{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> line_errors{0};
+
+    ~Engine() {
+        for (int i = 0; i < urb_count; i++) {
+            BufferPool_Put(in[i]->urb.buffer);
+            BufferPool_Put(out[i]->urb.buffer);
+        }
+    }
+};
+
+static int sys_ioctl(int fd, unsigned long request, void *arg) {
+    return ioctl(fd, request, arg);
+}
+
+static const UsbOps sys_ops = {sys_ioctl};
+static std::atomic<const UsbOps *> ops{&sys_ops};
+static std::shared_ptr<Engine> engines[RX_RING_MAX_PORTS];
+// Per port rather than per engine, subscriptions outlive a restart.
+static EventSet modemEvents[RX_RING_MAX_PORTS];
+static std::atomic<int> modemStatus[RX_RING_MAX_PORTS];
+static std::mutex enginesLock;
+static std::once_flag registered;
+
+static std::shared_ptr<Engine> engine_get(int id) {
+    if (id < 0 || id >= RX_RING_MAX_PORTS) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> guard(enginesLock);
+    return engines[id];
+}
+
+static int submit(Engine *e, Urb *u, int length) {
+    u->urb.status = 0;
+    u->urb.actual_length = 0;
+    u->urb.buffer_length = length;
+    if (ops.load(std::memory_order_relaxed)->ioctl(e->fd, USBDEVFS_SUBMITURB, &u->urb) != 0) {
+        return -errno;
+    }
+    u->submitted = true;
+    return 0;
+}
+
+// Strips the FTDI status bytes in place; returns the payload length.
+static int deframe_ftdi(Engine *e, int8_t *data, int length) {
+    int out = 0;
+    for (int offset = 0; offset < length; offset += e->max_packet) {
+        int chunk = length - offset < e->max_packet ? length - offset : e->max_packet;
+        if (chunk < FTDI_STATUS_BYTES) {
+            break;
+        }
+        if (data[offset + 1] & FTDI_LINE_ERRORS) {
+            e->line_errors.fetch_add(1, std::memory_order_relaxed);
+        }
+        int modem = data[offset] & FTDI_MODEM_MASK;
+        if (modemStatus[e->id].exchange(modem, std::memory_order_relaxed) != modem) {
+            modemEvents[e->id].signal();
+        }
+        memmove(data + out, data + offset + FTDI_STATUS_BYTES, chunk - FTDI_STATUS_BYTES);
+        out += chunk - FTDI_STATUS_BYTES;
+    }
+    return out;
+}
+
+static void complete_in(Engine *e, Urb *u) {
+    int status = u->urb.status;
+    e->in_urbs.fetch_add(1, std::memory_order_relaxed);
+    if (status == 0 && u->urb.actual_length > 0) {
+        TRACE_SCOPE("urb in");
+        int8_t *data = (int8_t *) u->urb.buffer;
+        int length = u->urb.actual_length;
+        if (e->framing == USB_FRAMING_FTDI) {
+            length = deframe_ftdi(e, data, length);
+        }
+        if (length > 0) {
+            RxRing_Push(e->id, data, length);
+            e->in_bytes.fetch_add(length, std::memory_order_relaxed);
+        }
+    } else if (status == -ENODEV || status == -ESHUTDOWN || status == -EPROTO) {
+        std::lock_guard<std::mutex> guard(e->lock);
+        if (!e->gone) {
+            LOG_WARN("port %d: usb device gone (%s)", e->id, strerror(-status));
+        }
+        e->gone = true;
+    } else if (status != 0 && status != -ENOENT && status != -ECONNRESET) {
+        e->errors.fetch_add(1, std::memory_order_relaxed);
+        LOG_WARN("port %d: bulk-in urb failed: %s", e->id, strerror(-status));
+    }
+    std::lock_guard<std::mutex> guard(e->lock);
+    if (e->stopping || e->gone) {
+        return;
+    }
+    int ret = submit(e, u, e->urb_size);
+    if (ret != 0) {
+        e->errors.fetch_add(1, std::memory_order_relaxed);
+        LOG_ERROR("port %d: resubmit failed: %s", e->id, strerror(-ret));
+        e->gone = ret == -ENODEV;
+        return;
+    }
+    e->in_flight++;
+}
+
+static void complete_out(Engine *e, Urb *u) {
+    e->out_urbs.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> guard(e->lock);
+    u->submitted = false;
+    if (u->urb.status != 0) {
+        e->errors.fetch_add(1, std::memory_order_relaxed);
+        if (e->out_status == 0) {
+            e->out_status = u->urb.status;
+        }
+    }
+    e->out_pending--;
+    e->changed.notify_all();
+}
+
+static void reaper_run(Engine *e) {
+    ThreadSched_Enter(SCHED_ROLE_USB);
+    const UsbOps *o = ops.load(std::memory_order_relaxed);
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> guard(e->lock);
+            if ((e->stopping || e->gone) && e->in_flight == 0 && e->out_pending == 0) {
+                break;
+            }
+        }
+        struct usbdevfs_urb *done = nullptr;
+        if (o->ioctl(e->fd, USBDEVFS_REAPURB, &done) != 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            LOG_WARN("port %d: reap failed: %s", e->id, strerror(errno));
+            std::lock_guard<std::mutex> guard(e->lock);
+            // Nothing more will complete: forget what is still outstanding.
+            e->gone = true;
+            e->in_flight = 0;
+            e->out_pending = 0;
+            e->out_status = -ENODEV;
+            e->changed.notify_all();
+            break;
+        }
+        Urb *u = (Urb *) done->usercontext;
+        if (u->in) {
+            {
+                std::lock_guard<std::mutex> guard(e->lock);
+                u->submitted = false;
+                e->in_flight--;
+            }
+            complete_in(e, u);
+        } else {
+            complete_out(e, u);
+        }
+    }
+    LOG_INFO("port %d: usb engine stopped", e->id);
+}
+
+static char *engine_collect() {
+    std::string out;
+    char line[160];
+    static const char *names[] = {"serial_usb_in_urbs_total", "serial_usb_out_urbs_total", "serial_usb_in_bytes_total",
+                                  "serial_usb_urb_errors_total", "serial_usb_line_errors_total"};
+    for (int m = 0; m < 5; m++) {
+        snprintf(line, sizeof(line), "# TYPE %s counter\n", names[m]);
+        out += line;
+        for (int id = 0; id < RX_RING_MAX_PORTS; id++) {
+            if (!UsbEngine_Active(id)) {
+                continue;
+            }
+            UsbEngineStats s;
+            UsbEngine_Stats(id, &s);
+            uint64_t values[] = {s.in_urbs, s.out_urbs, s.in_bytes, s.errors, s.line_errors};
+            snprintf(line, sizeof(line), "%s{port=\"%d\"} %llu\n", names[m], id, (unsigned long long) values[m]);
+            out += line;
+        }
+    }
+    return strdup(out.c_str());
+}
+
+extern "C" {
+
+void UsbEngine_SetOps(const UsbOps *o) {
+    ops.store(o ? o : &sys_ops, std::memory_order_relaxed);
+}
+
+int UsbEngine_Start(int id, int fd, UsbFraming framing, int ep_in, int ep_out, int max_packet, int urbs,
+                    int urb_size) {
+    if (id < 0 || id >= RX_RING_MAX_PORTS || fd < 0) {
+        return -1;
+    }
+    UsbEngine_Stop(id);
+    auto e = std::make_shared<Engine>();
+    e->id = id;
+    e->fd = fd;
+    e->framing = framing;
+    e->max_packet = max_packet > FTDI_STATUS_BYTES ? max_packet : 64;
+    e->urb_count = urbs > 0 ? (urbs < USB_ENGINE_MAX_URBS ? urbs : USB_ENGINE_MAX_URBS) : USB_ENGINE_DEFAULT_URBS;
+    // Whole packets only, otherwise a transfer may end inside one.
+    urb_size = urb_size > 0 ? urb_size : USB_ENGINE_DEFAULT_URB_SIZE;
+    modemStatus[id].store(-1, std::memory_order_relaxed);
+    e->urb_size = urb_size < e->max_packet ? e->max_packet : urb_size - urb_size % e->max_packet;
+    for (int i = 0; i < e->urb_count; i++) {
+        e->in[i].reset(new Urb());
+        e->out[i].reset(new Urb());
+        for (Urb *u : {e->in[i].get(), e->out[i].get()}) {
+            u->in = u == e->in[i].get();
+            u->index = i;
+            u->urb.type = USBDEVFS_URB_TYPE_BULK;
+            u->urb.endpoint = (unsigned char) (u->in ? ep_in : ep_out);
+            u->urb.usercontext = u;
+            u->urb.buffer = BufferPool_Get(e->urb_size);
+        }
+    }
+    int submitted;
+    {
+        std::lock_guard<std::mutex> guard(e->lock);
+        for (int i = 0; i < e->urb_count; i++) {
+            int ret = submit(e.get(), e->in[i].get(), e->urb_size);
+            if (ret != 0) {
+                LOG_ERROR("port %d: submit failed: %s", id, strerror(-ret));
+                break;
+            }
+            e->in_flight++;
+        }
+        submitted = e->in_flight;
+    }
+    if (submitted == 0) {
+        return -1;
+    }
+    std::call_once(registered, [] { Metrics_AddCollector(engine_collect); });
+    e->reaper = std::thread(reaper_run, e.get());
+    {
+        std::lock_guard<std::mutex> guard(enginesLock);
+        engines[id] = e;
+    }
+    LOG_INFO("port %d: usb engine on fd %d, ep 0x%02x/0x%02x, %d x %d byte urbs%s", id, fd, ep_in, ep_out,
+             submitted, e->urb_size, framing == USB_FRAMING_FTDI ? ", ftdi framing" : "");
+    return 0;
+}
+
+void UsbEngine_Stop(int id) {
+    std::shared_ptr<Engine> e;
+    {
+        std::lock_guard<std::mutex> guard(enginesLock);
+        if (id < 0 || id >= RX_RING_MAX_PORTS || !engines[id]) {
+            return;
+        }
+        e.swap(engines[id]);
+    }
+    const UsbOps *o = ops.load(std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> guard(e->lock);
+        e->stopping = true;
+        for (int i = 0; i < e->urb_count; i++) {
+            for (Urb *u : {e->in[i].get(), e->out[i].get()}) {
+                if (u->submitted) {
+                    o->ioctl(e->fd, USBDEVFS_DISCARDURB, &u->urb);
+                }
+            }
+        }
+        e->changed.notify_all();
+    }
+    e->reaper.join();
+}
+
+int UsbEngine_Active(int id) {
+    std::shared_ptr<Engine> e = engine_get(id);
+    return e && !e->gone;
+}
+
+int UsbEngine_Write(int id, const int8_t *data, int length, int64_t timeout) {
+    std::shared_ptr<Engine> e = engine_get(id);
+    if (!e) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> writer(e->write_lock);
+    std::unique_lock<std::mutex> lock(e->lock);
+    int64_t deadline = MonoClock_Now() + (timeout > 0 ? timeout : NS_PER_SEC);
+    e->out_status = 0;
+    int offset = 0;
+    int next = 0;
+    while (offset < length && !e->stopping && !e->gone) {
+        // URBs are used round robin; wait until the next one has been reaped.
+        Urb *u = e->out[next].get();
+        if (!e->changed.wait_until(lock, deadline, [&] { return !u->submitted || e->stopping || e->gone; })) {
+            break;
+        }
+        if (e->stopping || e->gone) {
+            break;
+        }
+        int chunk = length - offset < e->urb_size ? length - offset : e->urb_size;
+        memcpy(u->urb.buffer, data + offset, chunk);
+        int ret = submit(e.get(), u, chunk);
+        if (ret != 0) {
+            e->out_status = ret;
+            break;
+        }
+        e->out_pending++;
+        offset += chunk;
+        next = (next + 1) % e->urb_count;
+    }
+    bool done = e->changed.wait_until(lock, deadline, [&] { return e->out_pending == 0 || e->gone; });
+    if (!done) {
+        const UsbOps *o = ops.load(std::memory_order_relaxed);
+        for (int i = 0; i < e->urb_count; i++) {
+            if (e->out[i]->submitted) {
+                o->ioctl(e->fd, USBDEVFS_DISCARDURB, &e->out[i]->urb);
+            }
+        }
+        e->changed.wait_for(lock, 100 * NS_PER_MS, [&] { return e->out_pending == 0; });
+        LOG_WARN("port %d: write timed out after %lld us", id, (long long) (timeout / NS_PER_US));
+        return -1;
+    }
+    return offset == length && e->out_status == 0 && !e->gone ? 0 : -1;
+}
+
+void UsbEngine_Stats(int id, UsbEngineStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    std::shared_ptr<Engine> e = engine_get(id);
+    if (!e) {
+        return;
+    }
+    stats->in_urbs = e->in_urbs.load(std::memory_order_relaxed);
+    stats->out_urbs = e->out_urbs.load(std::memory_order_relaxed);
+    stats->in_bytes = e->in_bytes.load(std::memory_order_relaxed);
+    stats->errors = e->errors.load(std::memory_order_relaxed);
+    stats->line_errors = e->line_errors.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> guard(e->lock);
+    stats->in_flight = e->in_flight;
+}
+
+int UsbEngine_ModemSubscribe(int id) {
+    return id >= 0 && id < RX_RING_MAX_PORTS ? modemEvents[id].add() : -1;
+}
+
+void UsbEngine_ModemUnsubscribe(int id, int event_fd) {
+    if (id >= 0 && id < RX_RING_MAX_PORTS) {
+        modemEvents[id].remove(event_fd);
+    }
+}
+
+int UsbEngine_Modem(int id) {
+    if (id < 0 || id >= RX_RING_MAX_PORTS || !UsbEngine_Active(id)) {
+        return -1;
+    }
+    return modemStatus[id].load(std::memory_order_relaxed);
+}
+
+}
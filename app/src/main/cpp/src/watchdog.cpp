@@ -0,0 +1,406 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "serial.h"
+#include "watchdog.h"
+
+#define LOG_LEVEL LOG_LEVEL_INFO
+#include "log.h"
+
+// faulthandler's dumper: reads the frames without the GIL and is signal safe,
+// which is what makes it usable on a thread that is stuck somewhere else.
+// Weak so that host tools without libpython (farm_bench) can link the watchdog.
+extern "C" {
+void _Py_DumpTraceback(int fd, PyThreadState *tstate) __attribute__((weak));
+const char *_Py_DumpTracebackThreads(int fd, PyInterpreterState *interp, PyThreadState *current_tstate)
+    __attribute__((weak));
+}
+#pragma weak Py_IsInitialized
+
+#define WATCHDOG_MAX_THREADS 64
+#define WATCHDOG_MAX_DEPTH 4
+#define WATCHDOG_MAX_SITES 16
+
+// Written only by its thread, read by the watchdog under a sequence lock.
+struct WatchdogSlot {
+    std::atomic<bool> owned;
+    std::atomic<uint32_t> seq;       // odd while the owner is updating
+    std::atomic<int> depth;
+    std::atomic<uint64_t> section;   // incremented per outermost section
+    std::atomic<uint64_t> start_ns;
+    std::atomic<uint64_t> deadline_ns;
+    std::atomic<uint64_t> expected_ns;
+    std::atomic<int> port;
+    std::atomic<void *> tstate;
+    std::atomic<const char *> sites[WATCHDOG_MAX_DEPTH];
+    int tid;
+};
+
+struct SiteCount {
+    const char *site;
+    uint64_t count;
+};
+
+struct Watchdog {
+    std::atomic<uint64_t> threshold_ns{WATCHDOG_DEFAULT_THRESHOLD_MS * 1000000ull};
+    WatchdogSlot slots[WATCHDOG_MAX_THREADS];
+    // Watchdog thread state, event log guarded by lock.
+    uint64_t reported[WATCHDOG_MAX_THREADS];
+    int open_event[WATCHDOG_MAX_THREADS];
+    std::mutex lock;
+    WatchdogEvent events[WATCHDOG_MAX_EVENTS];
+    uint64_t event_ids[WATCHDOG_MAX_EVENTS];
+    uint64_t next_event = 0;
+    SiteCount sites[WATCHDOG_MAX_SITES];
+    uint64_t total = 0;
+    int pipe_fds[2] = {-1, -1};
+};
+
+static Watchdog &watchdog() {
+    static Watchdog instance;
+    return instance;
+}
+
+static std::once_flag started;
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+struct SlotOwner {
+    WatchdogSlot *slot = nullptr;
+    bool tried = false;
+    ~SlotOwner() {
+        if (slot) {
+            slot->owned.store(false, std::memory_order_release);
+        }
+    }
+};
+
+static WatchdogSlot *slot_local() {
+    static thread_local SlotOwner owner;
+    if (!owner.slot && !owner.tried) {
+        owner.tried = true;
+        for (WatchdogSlot &slot : watchdog().slots) {
+            bool expected = false;
+            if (!slot.owned.load(std::memory_order_relaxed) &&
+                slot.owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                slot.tid = (int) syscall(SYS_gettid);
+                slot.depth.store(0, std::memory_order_relaxed);
+                owner.slot = &slot;
+                break;
+            }
+        }
+    }
+    return owner.slot;
+}
+
+static inline void write_begin(WatchdogSlot *slot) {
+    slot->seq.store(slot->seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+static inline void write_end(WatchdogSlot *slot) {
+    slot->seq.store(slot->seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// Captures the Python traceback through a pipe, the dumper only writes to fds.
+static void python_traceback(void *tstate, bool all_threads, char *out, size_t size) {
+    Watchdog &w = watchdog();
+    out[0] = '\0';
+    if (w.pipe_fds[0] < 0 || !Py_IsInitialized || !_Py_DumpTraceback || !Py_IsInitialized() ||
+        (!tstate && !all_threads)) {
+        return;
+    }
+    if (all_threads) {
+        _Py_DumpTracebackThreads(w.pipe_fds[1], nullptr, nullptr);
+    } else {
+        _Py_DumpTraceback(w.pipe_fds[1], (PyThreadState *) tstate);
+    }
+    size_t n = 0;
+    char drain[512];
+    for (;;) {
+        ssize_t r = read(w.pipe_fds[0], n + 1 < size ? out + n : drain,
+                         n + 1 < size ? size - 1 - n : sizeof(drain));
+        if (r <= 0) {
+            break;
+        }
+        if (n + 1 < size) {
+            n += (size_t) r;
+        }
+    }
+    out[n] = '\0';
+}
+
+static void site_count(Watchdog &w, const char *site) {
+    w.total++;
+    for (SiteCount &s : w.sites) {
+        if (s.site == site || !s.site) {
+            s.site = site;
+            s.count++;
+            return;
+        }
+    }
+}
+
+static void check_slot(Watchdog &w, int index, uint64_t now) {
+    WatchdogSlot &slot = w.slots[index];
+    uint32_t seq = slot.seq.load(std::memory_order_acquire);
+    if (seq & 1) {
+        return;
+    }
+    int depth = slot.depth.load(std::memory_order_relaxed);
+    uint64_t section = slot.section.load(std::memory_order_relaxed);
+    uint64_t start = slot.start_ns.load(std::memory_order_relaxed);
+    uint64_t deadline = slot.deadline_ns.load(std::memory_order_relaxed);
+    uint64_t expected = slot.expected_ns.load(std::memory_order_relaxed);
+    int port = slot.port.load(std::memory_order_relaxed);
+    void *tstate = slot.tstate.load(std::memory_order_relaxed);
+    const char *sites[WATCHDOG_MAX_DEPTH] = {nullptr};
+    for (int i = 0; i < depth && i < WATCHDOG_MAX_DEPTH; i++) {
+        sites[i] = slot.sites[i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != seq) {
+        return;
+    }
+
+    int open = w.open_event[index];
+    if (open >= 0 && (depth == 0 || section != w.reported[index])) {
+        std::lock_guard<std::mutex> guard(w.lock);
+        if (w.event_ids[open % WATCHDOG_MAX_EVENTS] == (uint64_t) open) {
+            WatchdogEvent &e = w.events[open % WATCHDOG_MAX_EVENTS];
+            e.resolved = true;
+            LOG_WARN("stall resolved: tid %d %s after %llu ms", e.tid, e.sites,
+                     (unsigned long long) (e.duration_ns / 1000000));
+        }
+        w.open_event[index] = -1;
+        open = -1;
+    }
+    if (depth == 0 || now < deadline) {
+        return;
+    }
+    if (open >= 0) {
+        std::lock_guard<std::mutex> guard(w.lock);
+        if (w.event_ids[open % WATCHDOG_MAX_EVENTS] == (uint64_t) open) {
+            w.events[open % WATCHDOG_MAX_EVENTS].duration_ns = now - start;
+        }
+        return;
+    }
+    if (w.reported[index] == section) {
+        return; // already reported and its event was overwritten
+    }
+
+    // A new stall: capture outside the lock, the traceback may take a while.
+    WatchdogEvent e = {};
+    e.realtime_ns = clock_ns(CLOCK_REALTIME);
+    e.duration_ns = now - start;
+    e.expected_ns = expected;
+    e.tid = slot.tid;
+    e.port = port;
+    std::string stack;
+    int shown = depth < WATCHDOG_MAX_DEPTH ? depth : WATCHDOG_MAX_DEPTH;
+    for (int i = 0; i < shown; i++) {
+        if (i) {
+            stack += " > ";
+        }
+        stack += sites[i] ? sites[i] : "?";
+    }
+    snprintf(e.sites, sizeof(e.sites), "%s", stack.c_str());
+    const char *innermost = shown ? sites[shown - 1] : nullptr;
+    bool gil = innermost && strcmp(innermost, WATCHDOG_GIL_SITE) == 0;
+    python_traceback(tstate, gil, e.python, sizeof(e.python));
+    LOG_WARN("stall: tid %d port %d %s for %llu ms (allowed %llu ms)", e.tid, e.port, e.sites,
+             (unsigned long long) (e.duration_ns / 1000000), (unsigned long long) (expected / 1000000));
+
+    std::lock_guard<std::mutex> guard(w.lock);
+    uint64_t id = w.next_event++;
+    w.events[id % WATCHDOG_MAX_EVENTS] = e;
+    w.event_ids[id % WATCHDOG_MAX_EVENTS] = id;
+    w.open_event[index] = (int) id;
+    w.reported[index] = section;
+    site_count(w, innermost ? innermost : "?");
+}
+
+static void watchdog_run() {
+    Watchdog &w = watchdog();
+    for (;;) {
+        uint64_t threshold = w.threshold_ns.load(std::memory_order_relaxed);
+        struct timespec ts = {(time_t) (threshold / 4 / 1000000000ull), (long) (threshold / 4 % 1000000000ull)};
+        nanosleep(&ts, nullptr);
+        uint64_t now = clock_ns(CLOCK_MONOTONIC);
+        for (int i = 0; i < WATCHDOG_MAX_THREADS; i++) {
+            if (w.slots[i].owned.load(std::memory_order_acquire) || w.open_event[i] >= 0) {
+                check_slot(w, i, now);
+            }
+        }
+    }
+}
+
+static char *stalls_page() {
+    WatchdogEvent *events = (WatchdogEvent *) malloc(sizeof(WatchdogEvent) * WATCHDOG_MAX_EVENTS);
+    int n = Watchdog_Events(events, WATCHDOG_MAX_EVENTS);
+    std::string out;
+    char line[256];
+    for (int i = 0; i < n; i++) {
+        const WatchdogEvent &e = events[i];
+        time_t seconds = (time_t) (e.realtime_ns / 1000000000ull);
+        struct tm tm;
+        localtime_r(&seconds, &tm);
+        char when[32];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+        snprintf(line, sizeof(line), "%s.%03d tid %d port %d %s: %llu ms (allowed %llu ms)%s\n", when,
+                 (int) (e.realtime_ns / 1000000 % 1000), e.tid, e.port, e.sites,
+                 (unsigned long long) (e.duration_ns / 1000000), (unsigned long long) (e.expected_ns / 1000000),
+                 e.resolved ? "" : " still stuck");
+        out += line;
+        out += e.python;
+        out += "\n";
+    }
+    free(events);
+    return strdup(out.c_str());
+}
+
+static char *stalls_collect() {
+    Watchdog &w = watchdog();
+    std::string out = "# HELP serial_stalls_total Sections that overran their allowed time, by innermost call site.\n"
+                      "# TYPE serial_stalls_total counter\n";
+    char line[160];
+    std::lock_guard<std::mutex> guard(w.lock);
+    for (const SiteCount &s : w.sites) {
+        if (s.site) {
+            snprintf(line, sizeof(line), "serial_stalls_total{site=\"%s\"} %llu\n", s.site,
+                     (unsigned long long) s.count);
+            out += line;
+        }
+    }
+    return strdup(out.c_str());
+}
+
+static void watchdog_init() {
+    Watchdog &w = watchdog();
+    for (int i = 0; i < WATCHDOG_MAX_THREADS; i++) {
+        w.reported[i] = 0;
+        w.open_event[i] = -1;
+    }
+    for (uint64_t &id : w.event_ids) {
+        id = UINT64_MAX;
+    }
+    if (pipe2(w.pipe_fds, O_CLOEXEC | O_NONBLOCK) == 0) {
+        fcntl(w.pipe_fds[1], F_SETPIPE_SZ, 1 << 16);
+    } else {
+        LOG_ERROR("watchdog pipe failed: %s", strerror(errno));
+    }
+    Metrics_AddCollector(stalls_collect);
+    Metrics_AddPage("/stalls", stalls_page);
+    std::thread(watchdog_run).detach();
+}
+
+extern "C" {
+
+void Watchdog_Start(int threshold_ms) {
+    if (threshold_ms > 0) {
+        watchdog().threshold_ns.store((uint64_t) threshold_ms * 1000000ull, std::memory_order_relaxed);
+    }
+    std::call_once(started, watchdog_init);
+}
+
+void Watchdog_Enter(const char *site, int port, int expected_ms, void *tstate) {
+    WatchdogSlot *slot = slot_local();
+    if (!slot) {
+        return;
+    }
+    int depth = slot->depth.load(std::memory_order_relaxed);
+    uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    uint64_t deadline = now + watchdog().threshold_ns.load(std::memory_order_relaxed);
+    write_begin(slot);
+    if (depth == 0) {
+        uint64_t expected = expected_ms > 0 ? (uint64_t) expected_ms * 1000000ull : 0;
+        slot->section.store(slot->section.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        slot->start_ns.store(now, std::memory_order_relaxed);
+        slot->expected_ns.store(expected, std::memory_order_relaxed);
+        slot->deadline_ns.store(deadline + expected, std::memory_order_relaxed);
+        slot->port.store(port, std::memory_order_relaxed);
+        slot->tstate.store(tstate, std::memory_order_relaxed);
+    } else {
+        if (deadline > slot->deadline_ns.load(std::memory_order_relaxed)) {
+            slot->deadline_ns.store(deadline, std::memory_order_relaxed);
+        }
+        if (tstate) {
+            slot->tstate.store(tstate, std::memory_order_relaxed);
+        }
+    }
+    if (depth < WATCHDOG_MAX_DEPTH) {
+        slot->sites[depth].store(site, std::memory_order_relaxed);
+    }
+    slot->depth.store(depth + 1, std::memory_order_relaxed);
+    write_end(slot);
+}
+
+void Watchdog_Leave(void) {
+    WatchdogSlot *slot = slot_local();
+    if (!slot) {
+        return;
+    }
+    int depth = slot->depth.load(std::memory_order_relaxed);
+    if (depth <= 0) {
+        return;
+    }
+    write_begin(slot);
+    slot->depth.store(depth - 1, std::memory_order_relaxed);
+    write_end(slot);
+}
+
+int Watchdog_Events(WatchdogEvent *events, int max) {
+    Watchdog &w = watchdog();
+    std::lock_guard<std::mutex> guard(w.lock);
+    int n = 0;
+    for (uint64_t id = w.next_event; id > 0 && n < max; id--) {
+        uint64_t index = (id - 1) % WATCHDOG_MAX_EVENTS;
+        if (w.event_ids[index] != id - 1) {
+            break;
+        }
+        events[n++] = w.events[index];
+    }
+    return n;
+}
+
+}
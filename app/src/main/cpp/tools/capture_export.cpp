@@ -0,0 +1,154 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if 0
+#!/bin/bash
+# adb pull /data/data/cc.axyz.serialserver/files/capture.bin
+# bash capture_export.cpp capture.bin capture.pcapng
+set -e
+g++ -std=c++17 -O2 -Wall -I"$(dirname $0)/../include" -I"$(dirname $0)" -o /tmp/capture_export $0
+/tmp/capture_export "$@"
+exit 0
+#endif
+
+// Converts a capture file written by capture.cpp into pcapng.
+//
+// Every serial port becomes one interface ("ttyUSB<port>", LINKTYPE_USER0,
+// nanosecond timestamps) and every TX/RX chunk one Enhanced Packet Block whose
+// epb_flags carry the direction (inbound = RX, outbound = TX). Wireshark shows
+// the payload as raw data; decode it with "Decode As..." or a Lua dissector.
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "capture_reader.h"
+
+#define LINKTYPE_USER0 147
+
+static void put32(std::vector<uint8_t> &out, uint32_t v) {
+    out.insert(out.end(), reinterpret_cast<uint8_t *>(&v), reinterpret_cast<uint8_t *>(&v) + 4);
+}
+
+static void put16(std::vector<uint8_t> &out, uint16_t v) {
+    out.insert(out.end(), reinterpret_cast<uint8_t *>(&v), reinterpret_cast<uint8_t *>(&v) + 2);
+}
+
+static void pad4(std::vector<uint8_t> &out) {
+    while (out.size() % 4) {
+        out.push_back(0);
+    }
+}
+
+static void option(std::vector<uint8_t> &out, uint16_t code, const void *value, uint16_t length) {
+    put16(out, code);
+    put16(out, length);
+    out.insert(out.end(), static_cast<const uint8_t *>(value), static_cast<const uint8_t *>(value) + length);
+    pad4(out);
+}
+
+static void block(FILE *fp, uint32_t type, const std::vector<uint8_t> &body) {
+    uint32_t total = (uint32_t) (12 + body.size());
+    fwrite(&type, 4, 1, fp);
+    fwrite(&total, 4, 1, fp);
+    fwrite(body.data(), 1, body.size(), fp);
+    fwrite(&total, 4, 1, fp);
+}
+
+static void section_header(FILE *fp) {
+    std::vector<uint8_t> body;
+    put32(body, 0x1A2B3C4D);
+    put16(body, 1);
+    put16(body, 0);
+    put32(body, 0xFFFFFFFF); // section length unknown
+    put32(body, 0xFFFFFFFF);
+    const char *app = "AndroidOTGSerialRemote capture_export";
+    option(body, 4, app, (uint16_t) strlen(app)); // shb_userappl
+    option(body, 0, nullptr, 0);
+    block(fp, 0x0A0D0D0A, body);
+}
+
+static void interface_description(FILE *fp, int port) {
+    std::vector<uint8_t> body;
+    put16(body, LINKTYPE_USER0);
+    put16(body, 0);
+    put32(body, 0);
+    std::string name = "ttyUSB" + std::to_string(port);
+    option(body, 2, name.c_str(), (uint16_t) name.size()); // if_name
+    uint8_t tsresol = 9;
+    option(body, 9, &tsresol, 1); // if_tsresol: nanoseconds
+    option(body, 0, nullptr, 0);
+    block(fp, 1, body);
+}
+
+static void enhanced_packet(FILE *fp, uint32_t interface, uint64_t ts, const CaptureRecord &rec,
+                            const uint8_t *payload) {
+    std::vector<uint8_t> body;
+    put32(body, interface);
+    put32(body, (uint32_t) (ts >> 32));
+    put32(body, (uint32_t) ts);
+    put32(body, rec.length);
+    put32(body, rec.original_length);
+    body.insert(body.end(), payload, payload + rec.length);
+    pad4(body);
+    uint32_t flags = rec.direction == CAPTURE_DIR_RX ? 1 : 2; // inbound / outbound
+    option(body, 2, &flags, 4); // epb_flags
+    option(body, 0, nullptr, 0);
+    block(fp, 6, body);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s capture.bin out.pcapng\n", argv[0]);
+        return 2;
+    }
+    CaptureFile capture;
+    if (!capture.load(argv[1])) {
+        return 1;
+    }
+
+    FILE *out = fopen(argv[2], "wb");
+    if (!out) {
+        perror(argv[2]);
+        return 1;
+    }
+    section_header(out);
+
+    std::map<int, uint32_t> interfaces;
+    const CaptureFileHeader &header = capture.header;
+    size_t records = 0;
+    size_t skipped = capture.for_each([&](const CaptureRecord &rec, const uint8_t *payload) {
+        auto it = interfaces.find(rec.port);
+        if (it == interfaces.end()) {
+            it = interfaces.emplace(rec.port, (uint32_t) interfaces.size()).first;
+            interface_description(out, rec.port);
+        }
+        uint64_t ts = header.realtime_base_ns + (rec.timestamp_ns - header.monotonic_base_ns);
+        enhanced_packet(out, it->second, ts, rec, payload);
+        records++;
+    });
+    fclose(out);
+    fprintf(stderr, "%zu records, %zu words skipped, %zu ports\n", records, skipped, interfaces.size());
+    return 0;
+}
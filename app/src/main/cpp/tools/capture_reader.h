@@ -0,0 +1,70 @@
+//
+// Host-side reader for capture files written by capture.cpp.
+//
+
+#ifndef SERIALSERVER_CAPTURE_READER_H
+#define SERIALSERVER_CAPTURE_READER_H
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "capture.h"
+
+struct CaptureFile {
+    CaptureFileHeader header;
+    std::vector<uint8_t> data;
+
+    bool load(const char *path) {
+        FILE *in = fopen(path, "rb");
+        if (!in) {
+            perror(path);
+            return false;
+        }
+        bool ok = fread(&header, sizeof(header), 1, in) == 1 &&
+                  memcmp(header.magic, CAPTURE_FILE_MAGIC, sizeof(header.magic)) == 0 &&
+                  header.version == CAPTURE_VERSION && header.data_size != 0;
+        if (ok) {
+            data.resize(header.data_size);
+            ok = fseek(in, header.header_size, SEEK_SET) == 0 &&
+                 fread(data.data(), 1, data.size(), in) == data.size();
+        }
+        fclose(in);
+        if (!ok) {
+            fprintf(stderr, "%s: not a capture file\n", path);
+        }
+        return ok;
+    }
+
+    // Calls f(const CaptureRecord &, const uint8_t *payload) for every complete
+    // non-padding record, oldest first. Returns the number of 8-byte words
+    // skipped while resynchronising over stale or torn records.
+    template<typename F>
+    size_t for_each(F f) const {
+        uint64_t end = header.write_pos;
+        uint64_t pos = end > header.data_size ? end - header.data_size : 0;
+        size_t skipped = 0;
+        while (pos + sizeof(CaptureRecord) <= end) {
+            uint64_t offset = pos % header.data_size;
+            if (header.data_size - offset < sizeof(CaptureRecord)) {
+                pos += header.data_size - offset; // tail too small for a record
+                continue;
+            }
+            CaptureRecord rec;
+            memcpy(&rec, data.data() + offset, sizeof(rec));
+            uint64_t size = (sizeof(CaptureRecord) + rec.length + 7) & ~7ull;
+            if (rec.magic != CAPTURE_RECORD_MAGIC || rec.pos != pos || offset + size > header.data_size) {
+                pos += 8; // stale, torn or lapped: resynchronise
+                skipped++;
+                continue;
+            }
+            if (!(rec.flags & CAPTURE_FLAG_PAD)) {
+                f(rec, data.data() + offset + sizeof(CaptureRecord));
+            }
+            pos += size;
+        }
+        return skipped;
+    }
+};
+
+#endif //SERIALSERVER_CAPTURE_READER_H
@@ -0,0 +1,526 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if 0
+#!/bin/bash
+# Client side bridge for the esptool accelerator (Linux, macOS or termux).
+# bash esp_bridge.cpp <phone> <esp_port> [local_port] [window]
+# then flash through it: esptool.py --port rfc2217://localhost:2217 write_flash ...
+set -e
+src="$(dirname $0)/.."
+g++ -std=c++17 -D__LINUX__ -O2 -g -Wall -I${src}/include -o /tmp/esp_bridge $0 -lpthread
+/tmp/esp_bridge "$@"
+exit 0
+#endif
+
+// Hides the network round trip of esptool's block writes (esp_accel.h).
+//
+// The bridge relays a local RFC2217 client to the accelerator and takes its
+// offer of ESP_ACCEL_OPTION. Then FLASH_DATA, FLASH_DEFL_DATA, MEM_DATA and
+// FLASH_ENCRYPT_DATA commands are answered here at once, with a copy of the
+// chip's response to the first command of the same kind, and sent on marked;
+// up to `window` of them may be unconfirmed by the phone before the answer
+// waits for ESP_ACCEL_DONE. A failure reported by the phone is given to
+// esptool as the response to its next command.
+//
+// DTR, RTS and purge requests are acknowledged here; purges go no further.
+// After a reset into the bootloader esptool's SYNCs are held until the phone
+// reports its own sync, then answered here, which works at any round trip.
+// Without the option everything passes unchanged.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "esp_accel.h"
+
+#define TELNET_IAC 255
+#define TELNET_DO 253
+#define TELNET_WILL 251
+#define TELNET_SB 250
+#define TELNET_SE 240
+
+#define COM_PORT_OPTION 44
+#define SET_CONTROL 5
+#define PURGE_DATA 12
+#define SERVER_REPLY 100
+#define CONTROL_DTR_ON 8
+#define CONTROL_DTR_OFF 9
+#define CONTROL_RTS_ON 11
+#define CONTROL_RTS_OFF 12
+
+#define ESP_SYNC 0x08
+
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+enum TelnetState {
+    TELNET_STATE_DATA,
+    TELNET_STATE_IAC,
+    TELNET_STATE_VERB,
+    TELNET_STATE_SB,
+    TELNET_STATE_SB_IAC,
+};
+
+struct Stream {
+    TelnetState telnet = TELNET_STATE_DATA;
+    uint8_t verb = 0;
+    std::vector<uint8_t> sub;
+    bool in_frame = false;
+    bool escaped = false;
+    std::vector<uint8_t> wire;     // the frame as received, telnet escaping included
+    std::vector<uint8_t> frame;    // the frame decoded
+};
+
+struct Session {
+    int local = -1;
+    int remote = -1;
+    Stream from_local;
+    Stream from_remote;
+    std::vector<uint8_t> to_local;
+    std::vector<uint8_t> to_remote;
+    bool accelerated = false;
+    std::map<uint8_t, std::vector<uint8_t>> answers;   // first response per command
+    int learning = -1;
+    int unconfirmed = 0;           // marked frames without DONE or FAIL yet
+    int held = 0;                  // of them, not answered to esptool yet
+    uint8_t held_op = 0;
+    bool failed = false;
+    std::vector<uint8_t> failure;  // the chip's response, empty when it gave none
+    bool dtr = false;              // as requested by esptool
+    bool rts = false;
+    bool sync_expected = false;    // reset into the bootloader, phone syncing
+    bool sync_asked = false;       // a SYNC of esptool is held for it
+    std::vector<uint8_t> synced;   // the chip's answer to the phone's sync
+    uint64_t answered = 0;
+    uint64_t waits = 0;
+    uint64_t failures = 0;
+    uint64_t syncs = 0;
+};
+
+static const char *remoteHost;
+static const char *remotePort;
+static int window = ESP_ACCEL_WINDOW;
+
+static bool send_all(int fd, const uint8_t *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= (size_t) n;
+    }
+    return true;
+}
+
+static bool pipelined_op(uint8_t op) {
+    return op == 0x03 || op == 0x07 || op == 0x11 || op == 0xD4;
+}
+
+static void put_byte(std::vector<uint8_t> &out, uint8_t b) {
+    out.push_back(b);
+    if (b == TELNET_IAC) {
+        out.push_back(b);
+    }
+}
+
+static void put_sub(std::vector<uint8_t> &out, const std::vector<uint8_t> &sub) {
+    out.insert(out.end(), {TELNET_IAC, TELNET_SB});
+    for (uint8_t b : sub) {
+        put_byte(out, b);
+    }
+    out.insert(out.end(), {TELNET_IAC, TELNET_SE});
+}
+
+// A response frame for esptool, answering command `op`.
+static void put_response(std::vector<uint8_t> &out, std::vector<uint8_t> response, uint8_t op) {
+    response[1] = op;
+    out.push_back(SLIP_END);
+    for (uint8_t b : response) {
+        if (b == SLIP_END) {
+            out.insert(out.end(), {SLIP_ESC, SLIP_ESC_END});
+        } else if (b == SLIP_ESC) {
+            out.insert(out.end(), {SLIP_ESC, SLIP_ESC_ESC});
+        } else {
+            put_byte(out, b);
+        }
+    }
+    out.push_back(SLIP_END);
+}
+
+static void put_sync(Session *s) {
+    for (int i = 0; i < ESP_ACCEL_SYNC_RESPONSES; i++) {
+        put_response(s->to_local, s->synced, ESP_SYNC);
+    }
+    s->syncs++;
+}
+
+static void control(Session *s, uint8_t value) {
+    if (value == CONTROL_DTR_ON && !s->dtr && s->rts) {
+        // esptool's bootloader entry; esp_accel.cpp takes over from here.
+        s->sync_expected = true;
+        s->synced.clear();
+    }
+    if (value == CONTROL_DTR_ON || value == CONTROL_DTR_OFF) {
+        s->dtr = value == CONTROL_DTR_ON;
+    } else {
+        s->rts = value == CONTROL_RTS_ON;
+    }
+}
+
+// Same split as esp_accel.cpp: telnet negotiation, subnegotiation, SLIP
+// frames and bytes to relay unchanged.
+template<typename Handler>
+static void parse(Stream *s, const uint8_t *data, int length, Handler &h) {
+    for (int i = 0; i < length; i++) {
+        uint8_t b = data[i];
+        bool is_data = false;
+        switch (s->telnet) {
+            case TELNET_STATE_DATA:
+                if (b == TELNET_IAC) {
+                    s->telnet = TELNET_STATE_IAC;
+                } else {
+                    is_data = true;
+                }
+                break;
+            case TELNET_STATE_IAC:
+                s->telnet = TELNET_STATE_DATA;
+                if (b == TELNET_IAC) {
+                    is_data = true;
+                } else if (b >= TELNET_WILL) {
+                    s->verb = b;
+                    s->telnet = TELNET_STATE_VERB;
+                } else if (b == TELNET_SB) {
+                    s->sub.clear();
+                    s->telnet = TELNET_STATE_SB;
+                } else {
+                    const uint8_t command[] = {TELNET_IAC, b};
+                    h.pass(command, sizeof(command));
+                }
+                break;
+            case TELNET_STATE_VERB:
+                s->telnet = TELNET_STATE_DATA;
+                h.command(s->verb, b);
+                break;
+            case TELNET_STATE_SB:
+                if (b == TELNET_IAC) {
+                    s->telnet = TELNET_STATE_SB_IAC;
+                } else {
+                    s->sub.push_back(b);
+                }
+                break;
+            case TELNET_STATE_SB_IAC:
+                if (b == TELNET_SE) {
+                    s->telnet = TELNET_STATE_DATA;
+                    h.sub(s->sub);
+                } else {
+                    s->sub.push_back(b);
+                    s->telnet = TELNET_STATE_SB;
+                }
+                break;
+        }
+        if (!is_data) {
+            continue;
+        }
+        if (!s->in_frame) {
+            if (b == SLIP_END) {
+                s->in_frame = true;
+                s->escaped = false;
+                s->wire.assign(1, SLIP_END);
+                s->frame.clear();
+            } else {
+                const uint8_t plain[] = {b, b};
+                h.pass(plain, b == TELNET_IAC ? 2 : 1);
+            }
+            continue;
+        }
+        put_byte(s->wire, b);
+        if (b == SLIP_END) {
+            if (s->frame.empty()) {
+                h.pass(s->wire.data(), 1);
+                s->wire.assign(1, SLIP_END);
+                continue;
+            }
+            s->in_frame = false;
+            h.frame(s);
+        } else if (s->escaped) {
+            s->escaped = false;
+            s->frame.push_back(b == SLIP_ESC_END ? SLIP_END : b == SLIP_ESC_ESC ? SLIP_ESC : b);
+        } else if (b == SLIP_ESC) {
+            s->escaped = true;
+        } else {
+            s->frame.push_back(b);
+        }
+    }
+}
+
+struct LocalHandler {
+    Session *s;
+
+    void pass(const uint8_t *data, size_t length) {
+        s->to_remote.insert(s->to_remote.end(), data, data + length);
+    }
+
+    void command(uint8_t verb, uint8_t option) {
+        s->to_remote.insert(s->to_remote.end(), {TELNET_IAC, verb, option});
+    }
+
+    void sub(const std::vector<uint8_t> &sub) {
+        if (s->accelerated && sub.size() == 3 && sub[0] == COM_PORT_OPTION && sub[1] == PURGE_DATA) {
+            put_sub(s->to_local, {COM_PORT_OPTION, PURGE_DATA + SERVER_REPLY, sub[2]});
+            return;
+        }
+        if (s->accelerated && sub.size() == 3 && sub[0] == COM_PORT_OPTION && sub[1] == SET_CONTROL &&
+            (sub[2] == CONTROL_DTR_ON || sub[2] == CONTROL_DTR_OFF || sub[2] == CONTROL_RTS_ON ||
+             sub[2] == CONTROL_RTS_OFF)) {
+            put_sub(s->to_local, {COM_PORT_OPTION, SET_CONTROL + SERVER_REPLY, sub[2]});
+            control(s, sub[2]);
+        }
+        put_sub(s->to_remote, sub);
+    }
+
+    void frame(Stream *in) {
+        const std::vector<uint8_t> &f = in->frame;
+        if (s->accelerated && f.size() >= 8 && f[0] == 0x00) {
+            uint8_t op = f[1];
+            if (s->failed) {
+                // Whatever esptool asks next is answered with the failure.
+                s->failed = false;
+                if (!s->failure.empty()) {
+                    put_response(s->to_local, s->failure, op);
+                }
+                return;
+            }
+            if (op == ESP_SYNC && !s->synced.empty()) {
+                put_sync(s);
+                return;
+            }
+            if (op == ESP_SYNC && s->sync_expected) {
+                s->sync_asked = true;
+                return;
+            }
+            s->sync_expected = false;
+            s->synced.clear();
+            auto answer = s->answers.find(op);
+            if (pipelined_op(op) && answer != s->answers.end()) {
+                put_sub(s->to_remote, {ESP_ACCEL_OPTION, ESP_ACCEL_MARK});
+                s->to_remote.insert(s->to_remote.end(), in->wire.begin(), in->wire.end());
+                if (++s->unconfirmed - s->held > window) {
+                    s->held++;
+                    s->held_op = op;
+                    s->waits++;
+                } else {
+                    put_response(s->to_local, answer->second, op);
+                }
+                s->answered++;
+                return;
+            }
+            if (pipelined_op(op)) {
+                s->learning = op;
+            }
+        }
+        s->to_remote.insert(s->to_remote.end(), in->wire.begin(), in->wire.end());
+    }
+};
+
+struct RemoteHandler {
+    Session *s;
+
+    void pass(const uint8_t *data, size_t length) {
+        s->to_local.insert(s->to_local.end(), data, data + length);
+    }
+
+    void command(uint8_t verb, uint8_t option) {
+        if (option != ESP_ACCEL_OPTION) {
+            s->to_local.insert(s->to_local.end(), {TELNET_IAC, verb, option});
+        } else if (verb == TELNET_WILL && !s->accelerated) {
+            s->accelerated = true;
+            s->to_remote.insert(s->to_remote.end(), {TELNET_IAC, TELNET_DO, ESP_ACCEL_OPTION});
+        }
+    }
+
+    void sub(const std::vector<uint8_t> &sub) {
+        if (sub.empty() || sub[0] != ESP_ACCEL_OPTION) {
+            put_sub(s->to_local, sub);
+            return;
+        }
+        if (sub.size() >= 2 && sub[1] == ESP_ACCEL_SYNCED) {
+            s->sync_expected = false;
+            s->synced.assign(sub.begin() + 2, sub.end());
+            if (s->sync_asked && !s->synced.empty()) {
+                put_sync(s);
+            }
+            s->sync_asked = false;
+            return;
+        }
+        if (sub.size() < 2 || (sub[1] != ESP_ACCEL_DONE && sub[1] != ESP_ACCEL_FAIL)) {
+            return;
+        }
+        s->unconfirmed--;
+        if (sub[1] == ESP_ACCEL_FAIL) {
+            s->failures++;
+            s->failure.assign(sub.begin() + 2, sub.end());
+            // Learn again; the phone drops marked frames until an unmarked one.
+            s->answers.clear();
+            if (s->held) {
+                // esptool is waiting for exactly this.
+                s->held--;
+                if (!s->failure.empty()) {
+                    put_response(s->to_local, s->failure, s->held_op);
+                }
+            } else {
+                s->failed = true;
+            }
+        } else if (s->held && s->unconfirmed - s->held < window) {
+            s->held--;
+            put_response(s->to_local, s->answers[s->held_op], s->held_op);
+        }
+    }
+
+    void frame(Stream *in) {
+        const std::vector<uint8_t> &f = in->frame;
+        if (s->learning >= 0 && f.size() >= 8 && f[0] == 0x01 && f[1] == s->learning) {
+            // Only a success is worth repeating.
+            int size = f[2] | f[3] << 8;
+            if (size < 2 || f.size() <= 8 || f[8] == 0) {
+                s->answers[f[1]] = f;
+            }
+            s->learning = -1;
+        }
+        s->to_local.insert(s->to_local.end(), in->wire.begin(), in->wire.end());
+    }
+};
+
+static int connect_remote() {
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *result = nullptr;
+    if (getaddrinfo(remoteHost, remotePort, &hints, &result) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = result; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+static void session_run(int local) {
+    Session s;
+    s.local = local;
+    s.remote = connect_remote();
+    if (s.remote < 0) {
+        fprintf(stderr, "esp_bridge: cannot reach %s:%s\n", remoteHost, remotePort);
+        close(local);
+        return;
+    }
+    int one = 1;
+    setsockopt(s.remote, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    uint8_t buffer[16384];
+    struct pollfd fds[2] = {{local, POLLIN, 0}, {s.remote, POLLIN, 0}};
+    LocalHandler from_local{&s};
+    RemoteHandler from_remote{&s};
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            break;
+        }
+        if (fds[0].revents) {
+            ssize_t n = recv(local, buffer, sizeof(buffer), 0);
+            if (n <= 0) {
+                break;
+            }
+            parse(&s.from_local, buffer, (int) n, from_local);
+        }
+        if (fds[1].revents) {
+            ssize_t n = recv(s.remote, buffer, sizeof(buffer), 0);
+            if (n <= 0) {
+                break;
+            }
+            parse(&s.from_remote, buffer, (int) n, from_remote);
+        }
+        if (!send_all(s.remote, s.to_remote.data(), s.to_remote.size()) ||
+            !send_all(local, s.to_local.data(), s.to_local.size())) {
+            break;
+        }
+        s.to_remote.clear();
+        s.to_local.clear();
+    }
+    fprintf(stderr, "esp_bridge: session ended, %llu syncs and %llu writes answered here, %llu waited for the "
+                    "window, %llu failed%s\n", (unsigned long long) s.syncs, (unsigned long long) s.answered,
+            (unsigned long long) s.waits, (unsigned long long) s.failures, s.accelerated ? "" : ", not accelerated");
+    close(s.remote);
+    close(local);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <phone> <port> [local_port] [window]\n", argv[0]);
+        return 2;
+    }
+    remoteHost = argv[1];
+    remotePort = argv[2];
+    int local_port = argc > 3 ? atoi(argv[3]) : 2217;
+    if (argc > 4) {
+        window = atoi(argv[4]) > 0 ? atoi(argv[4]) : 1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t) local_port);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+        perror("esp_bridge: listen");
+        return 1;
+    }
+    fprintf(stderr, "esp_bridge: localhost:%d -> %s:%s, window %d\n", local_port, remoteHost, remotePort, window);
+    for (;;) {
+        int local = accept(fd, nullptr, nullptr);
+        if (local < 0) {
+            continue;
+        }
+        setsockopt(local, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        std::thread(session_run, local).detach();
+    }
+}
@@ -0,0 +1,192 @@
+//
+// Host stand-in for the NDK's <jni.h>, covering what native-lib.cpp uses.
+//
+// The layout is the NDK's: JNIEnv and JavaVM hold a pointer to a function
+// table and their C++ members are inline wrappers that go through it, with
+// the variadic Call*Method wrappers passing a va_list on to Call*MethodV. A
+// bridge built against this header therefore pays the same indirections and
+// argument marshalling as on a device; fake_jvm.cpp fills in the tables.
+//
+
+#ifndef SERIALSERVER_FAKE_JNI_H
+#define SERIALSERVER_FAKE_JNI_H
+
+#include <stdarg.h>
+#include <stdint.h>
+
+typedef uint8_t jboolean;
+typedef int8_t jbyte;
+typedef uint16_t jchar;
+typedef int16_t jshort;
+typedef int32_t jint;
+typedef int64_t jlong;
+typedef float jfloat;
+typedef double jdouble;
+typedef jint jsize;
+
+#define JNI_FALSE 0
+#define JNI_TRUE 1
+
+#define JNI_VERSION_1_4 0x00010004
+#define JNI_VERSION_1_6 0x00010006
+
+#define JNI_OK 0
+#define JNI_ERR (-1)
+#define JNI_EDETACHED (-2)
+#define JNI_EVERSION (-3)
+
+#define JNI_COMMIT 1
+#define JNI_ABORT 2
+
+#define JNIEXPORT __attribute__((visibility("default")))
+#define JNICALL
+
+class _jobject {};
+class _jclass : public _jobject {};
+class _jstring : public _jobject {};
+class _jarray : public _jobject {};
+class _jbyteArray : public _jarray {};
+
+typedef _jobject *jobject;
+typedef _jclass *jclass;
+typedef _jstring *jstring;
+typedef _jarray *jarray;
+typedef _jbyteArray *jbyteArray;
+
+struct _jmethodID;
+typedef struct _jmethodID *jmethodID;
+
+typedef union jvalue {
+    jboolean z;
+    jbyte b;
+    jchar c;
+    jshort s;
+    jint i;
+    jlong j;
+    jfloat f;
+    jdouble d;
+    jobject l;
+} jvalue;
+
+struct _JNIEnv;
+struct _JavaVM;
+typedef _JNIEnv JNIEnv;
+typedef _JavaVM JavaVM;
+
+struct JNINativeInterface {
+    jclass (*FindClass)(JNIEnv *, const char *);
+    jobject (*NewGlobalRef)(JNIEnv *, jobject);
+    void (*DeleteGlobalRef)(JNIEnv *, jobject);
+    void (*DeleteLocalRef)(JNIEnv *, jobject);
+    jmethodID (*GetStaticMethodID)(JNIEnv *, jclass, const char *, const char *);
+    jobject (*CallStaticObjectMethodV)(JNIEnv *, jclass, jmethodID, va_list);
+    jboolean (*CallStaticBooleanMethodV)(JNIEnv *, jclass, jmethodID, va_list);
+    jint (*CallStaticIntMethodV)(JNIEnv *, jclass, jmethodID, va_list);
+    void (*CallStaticVoidMethodV)(JNIEnv *, jclass, jmethodID, va_list);
+    jstring (*NewStringUTF)(JNIEnv *, const char *);
+    const char *(*GetStringUTFChars)(JNIEnv *, jstring, jboolean *);
+    void (*ReleaseStringUTFChars)(JNIEnv *, jstring, const char *);
+    jsize (*GetArrayLength)(JNIEnv *, jarray);
+    jbyteArray (*NewByteArray)(JNIEnv *, jsize);
+    void (*GetByteArrayRegion)(JNIEnv *, jbyteArray, jsize, jsize, jbyte *);
+    void (*SetByteArrayRegion)(JNIEnv *, jbyteArray, jsize, jsize, const jbyte *);
+    void *(*GetPrimitiveArrayCritical)(JNIEnv *, jarray, jboolean *);
+    void (*ReleasePrimitiveArrayCritical)(JNIEnv *, jarray, void *, jint);
+};
+
+struct _JNIEnv {
+    const struct JNINativeInterface *functions;
+
+    jclass FindClass(const char *name) { return functions->FindClass(this, name); }
+    jobject NewGlobalRef(jobject obj) { return functions->NewGlobalRef(this, obj); }
+    void DeleteGlobalRef(jobject ref) { functions->DeleteGlobalRef(this, ref); }
+    void DeleteLocalRef(jobject ref) { functions->DeleteLocalRef(this, ref); }
+
+    jmethodID GetStaticMethodID(jclass clazz, const char *name, const char *sig) {
+        return functions->GetStaticMethodID(this, clazz, name, sig);
+    }
+
+    jobject CallStaticObjectMethod(jclass clazz, jmethodID methodID, ...) {
+        va_list args;
+        va_start(args, methodID);
+        jobject result = functions->CallStaticObjectMethodV(this, clazz, methodID, args);
+        va_end(args);
+        return result;
+    }
+
+    jboolean CallStaticBooleanMethod(jclass clazz, jmethodID methodID, ...) {
+        va_list args;
+        va_start(args, methodID);
+        jboolean result = functions->CallStaticBooleanMethodV(this, clazz, methodID, args);
+        va_end(args);
+        return result;
+    }
+
+    jint CallStaticIntMethod(jclass clazz, jmethodID methodID, ...) {
+        va_list args;
+        va_start(args, methodID);
+        jint result = functions->CallStaticIntMethodV(this, clazz, methodID, args);
+        va_end(args);
+        return result;
+    }
+
+    void CallStaticVoidMethod(jclass clazz, jmethodID methodID, ...) {
+        va_list args;
+        va_start(args, methodID);
+        functions->CallStaticVoidMethodV(this, clazz, methodID, args);
+        va_end(args);
+    }
+
+    jstring NewStringUTF(const char *bytes) { return functions->NewStringUTF(this, bytes); }
+
+    const char *GetStringUTFChars(jstring string, jboolean *isCopy) {
+        return functions->GetStringUTFChars(this, string, isCopy);
+    }
+
+    void ReleaseStringUTFChars(jstring string, const char *utf) {
+        functions->ReleaseStringUTFChars(this, string, utf);
+    }
+
+    jsize GetArrayLength(jarray array) { return functions->GetArrayLength(this, array); }
+    jbyteArray NewByteArray(jsize length) { return functions->NewByteArray(this, length); }
+
+    void GetByteArrayRegion(jbyteArray array, jsize start, jsize len, jbyte *buf) {
+        functions->GetByteArrayRegion(this, array, start, len, buf);
+    }
+
+    void SetByteArrayRegion(jbyteArray array, jsize start, jsize len, const jbyte *buf) {
+        functions->SetByteArrayRegion(this, array, start, len, buf);
+    }
+
+    void *GetPrimitiveArrayCritical(jarray array, jboolean *isCopy) {
+        return functions->GetPrimitiveArrayCritical(this, array, isCopy);
+    }
+
+    void ReleasePrimitiveArrayCritical(jarray array, void *carray, jint mode) {
+        functions->ReleasePrimitiveArrayCritical(this, array, carray, mode);
+    }
+};
+
+struct JNIInvokeInterface {
+    jint (*DestroyJavaVM)(JavaVM *);
+    jint (*AttachCurrentThread)(JavaVM *, JNIEnv **, void *);
+    jint (*DetachCurrentThread)(JavaVM *);
+    jint (*GetEnv)(JavaVM *, void **, jint);
+};
+
+struct _JavaVM {
+    const struct JNIInvokeInterface *functions;
+
+    jint DestroyJavaVM() { return functions->DestroyJavaVM(this); }
+    jint AttachCurrentThread(JNIEnv **p_env, void *thr_args) {
+        return functions->AttachCurrentThread(this, p_env, thr_args);
+    }
+    jint DetachCurrentThread() { return functions->DetachCurrentThread(this); }
+    jint GetEnv(void **env, jint version) { return functions->GetEnv(this, env, version); }
+};
+
+extern "C" {
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved);
+}
+
+#endif //SERIALSERVER_FAKE_JNI_H
@@ -0,0 +1,363 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Objects are reference counted: a new array or string starts with a local
+// reference of the creating thread, NewGlobalRef adds one and Delete*Ref
+// drops one. Local references still held when a thread detaches are dropped
+// then, as the VM does; `live` in the stats shows references the bridge
+// forgot to delete on a thread that stays attached. Classes live forever.
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "fake_jvm.h"
+#include "mono_clock.h"
+
+enum ObjectKind { OBJECT_CLASS, OBJECT_ARRAY, OBJECT_STRING, OBJECT_OTHER };
+
+struct FakeObject : _jbyteArray {
+    ObjectKind kind;
+    std::atomic<int> refs{1};
+    std::vector<int8_t> bytes;
+    std::string text;
+};
+
+struct _jmethodID {
+    std::string name;
+    std::string sig;
+    FakeJvmMethod method;
+};
+
+static FakeJvmConfig config;
+static std::mutex methodsLock;
+static std::vector<_jmethodID *> methods;
+static FakeObject serialClass;
+static std::atomic<uint64_t> lookups{0};
+static std::atomic<uint64_t> attaches{0};
+static std::atomic<uint64_t> detaches{0};
+static std::atomic<uint64_t> calls{0};
+static std::atomic<uint64_t> objects{0};
+static std::atomic<int64_t> live{0};
+static std::atomic<int64_t> globals{0};
+
+static void busy(int64_t ns) {
+    if (ns > 0) {
+        int64_t until = MonoClock_Now() + ns;
+        while (MonoClock_Now() < until) {
+        }
+    }
+}
+
+static thread_local std::vector<FakeObject *> locals;
+
+static FakeObject *object_new(ObjectKind kind) {
+    auto *obj = new FakeObject();
+    obj->kind = kind;
+    objects.fetch_add(1, std::memory_order_relaxed);
+    live.fetch_add(1, std::memory_order_relaxed);
+    locals.push_back(obj);
+    return obj;
+}
+
+static FakeObject *object_of(jobject obj) {
+    return static_cast<FakeObject *>(reinterpret_cast<_jbyteArray *>(obj));
+}
+
+static void object_release(FakeObject *obj) {
+    live.fetch_sub(1, std::memory_order_relaxed);
+    if (obj->refs.fetch_sub(1) == 1) {
+        delete obj;
+    }
+}
+
+// Pulls the arguments off the va_list the way the VM does, by the signature:
+// everything narrower than int arrives promoted to int, float as double.
+static _jmethodID *call_begin(jmethodID mid, va_list args, jvalue *values) {
+    if (!mid) {
+        fprintf(stderr, "fake_jvm: call through a null jmethodID\n");
+        abort();
+    }
+    calls.fetch_add(1, std::memory_order_relaxed);
+    busy(config.call_ns);
+    const char *p = mid->sig.c_str() + 1;
+    for (int n = 0; *p && *p != ')'; n++, p++) {
+        switch (*p) {
+            case 'Z': values[n].z = (jboolean) va_arg(args, int); break;
+            case 'B': values[n].b = (jbyte) va_arg(args, int); break;
+            case 'C': values[n].c = (jchar) va_arg(args, int); break;
+            case 'S': values[n].s = (jshort) va_arg(args, int); break;
+            case 'I': values[n].i = va_arg(args, jint); break;
+            case 'J': values[n].j = va_arg(args, jlong); break;
+            case 'F': values[n].f = (jfloat) va_arg(args, double); break;
+            case 'D': values[n].d = va_arg(args, double); break;
+            default:
+                while (*p == '[') {
+                    p++;
+                }
+                if (*p == 'L') {
+                    p = strchr(p, ';');
+                }
+                values[n].l = va_arg(args, jobject);
+                break;
+        }
+    }
+    return mid;
+}
+
+static jclass env_FindClass(JNIEnv *, const char *) {
+    lookups.fetch_add(1, std::memory_order_relaxed);
+    busy(config.lookup_ns);
+    return reinterpret_cast<jclass>(static_cast<_jobject *>(&serialClass));
+}
+
+static jobject env_NewGlobalRef(JNIEnv *, jobject obj) {
+    FakeObject *o = object_of(obj);
+    if (o && o->kind != OBJECT_CLASS) {
+        o->refs.fetch_add(1);
+        live.fetch_add(1, std::memory_order_relaxed);
+    }
+    globals.fetch_add(1, std::memory_order_relaxed);
+    return obj;
+}
+
+static void env_DeleteGlobalRef(JNIEnv *, jobject ref) {
+    FakeObject *obj = object_of(ref);
+    if (obj) {
+        globals.fetch_sub(1, std::memory_order_relaxed);
+    }
+    if (obj && obj->kind != OBJECT_CLASS) {
+        object_release(obj);
+    }
+}
+
+static void env_DeleteLocalRef(JNIEnv *, jobject ref) {
+    FakeObject *obj = object_of(ref);
+    for (size_t i = locals.size(); i-- > 0;) {
+        if (locals[i] == obj) {
+            locals.erase(locals.begin() + (long) i);
+            object_release(obj);
+            return;
+        }
+    }
+}
+
+static jmethodID env_GetStaticMethodID(JNIEnv *, jclass, const char *name, const char *sig) {
+    lookups.fetch_add(1, std::memory_order_relaxed);
+    busy(config.lookup_ns);
+    std::lock_guard<std::mutex> guard(methodsLock);
+    for (_jmethodID *m : methods) {
+        if (m->name == name && m->sig == sig) {
+            return m;
+        }
+    }
+    return nullptr;
+}
+
+static jobject env_CallStaticObjectMethodV(JNIEnv *, jclass, jmethodID mid, va_list args) {
+    jvalue values[16];
+    return call_begin(mid, args, values)->method(values).l;
+}
+
+static jboolean env_CallStaticBooleanMethodV(JNIEnv *, jclass, jmethodID mid, va_list args) {
+    jvalue values[16];
+    return call_begin(mid, args, values)->method(values).z;
+}
+
+static jint env_CallStaticIntMethodV(JNIEnv *, jclass, jmethodID mid, va_list args) {
+    jvalue values[16];
+    return call_begin(mid, args, values)->method(values).i;
+}
+
+static void env_CallStaticVoidMethodV(JNIEnv *, jclass, jmethodID mid, va_list args) {
+    jvalue values[16];
+    call_begin(mid, args, values)->method(values);
+}
+
+static jstring env_NewStringUTF(JNIEnv *, const char *bytes) {
+    FakeObject *obj = object_new(OBJECT_STRING);
+    obj->text = bytes;
+    return reinterpret_cast<jstring>(static_cast<_jobject *>(obj));
+}
+
+static const char *env_GetStringUTFChars(JNIEnv *, jstring string, jboolean *isCopy) {
+    if (isCopy) {
+        *isCopy = JNI_FALSE;
+    }
+    return object_of(string)->text.c_str();
+}
+
+static void env_ReleaseStringUTFChars(JNIEnv *, jstring, const char *) {
+}
+
+static jsize env_GetArrayLength(JNIEnv *, jarray array) {
+    return (jsize) object_of(array)->bytes.size();
+}
+
+static jbyteArray env_NewByteArray(JNIEnv *, jsize length) {
+    FakeObject *obj = object_new(OBJECT_ARRAY);
+    obj->bytes.resize(length);
+    return obj;
+}
+
+static void env_GetByteArrayRegion(JNIEnv *, jbyteArray array, jsize start, jsize len, jbyte *buf) {
+    memcpy(buf, object_of(array)->bytes.data() + start, len);
+}
+
+static void env_SetByteArrayRegion(JNIEnv *, jbyteArray array, jsize start, jsize len, const jbyte *buf) {
+    memcpy(object_of(array)->bytes.data() + start, buf, len);
+}
+
+static void *env_GetPrimitiveArrayCritical(JNIEnv *, jarray array, jboolean *isCopy) {
+    if (isCopy) {
+        *isCopy = JNI_FALSE;
+    }
+    return object_of(array)->bytes.data();
+}
+
+static void env_ReleasePrimitiveArrayCritical(JNIEnv *, jarray, void *, jint) {
+}
+
+static const JNINativeInterface nativeInterface = {
+        env_FindClass,
+        env_NewGlobalRef,
+        env_DeleteGlobalRef,
+        env_DeleteLocalRef,
+        env_GetStaticMethodID,
+        env_CallStaticObjectMethodV,
+        env_CallStaticBooleanMethodV,
+        env_CallStaticIntMethodV,
+        env_CallStaticVoidMethodV,
+        env_NewStringUTF,
+        env_GetStringUTFChars,
+        env_ReleaseStringUTFChars,
+        env_GetArrayLength,
+        env_NewByteArray,
+        env_GetByteArrayRegion,
+        env_SetByteArrayRegion,
+        env_GetPrimitiveArrayCritical,
+        env_ReleasePrimitiveArrayCritical,
+};
+
+static thread_local JNIEnv threadEnv = {&nativeInterface};
+static thread_local bool threadAttached;
+
+static jint vm_DestroyJavaVM(JavaVM *) {
+    return JNI_OK;
+}
+
+static jint vm_AttachCurrentThread(JavaVM *, JNIEnv **p_env, void *) {
+    if (!threadAttached) {
+        attaches.fetch_add(1, std::memory_order_relaxed);
+        busy(config.attach_ns);
+        threadAttached = true;
+    }
+    *p_env = &threadEnv;
+    return JNI_OK;
+}
+
+static jint vm_DetachCurrentThread(JavaVM *) {
+    if (threadAttached) {
+        detaches.fetch_add(1, std::memory_order_relaxed);
+        busy(config.attach_ns);
+        threadAttached = false;
+        for (FakeObject *obj : locals) {
+            object_release(obj);
+        }
+        locals.clear();
+    }
+    return JNI_OK;
+}
+
+static jint vm_GetEnv(JavaVM *, void **env, jint) {
+    if (!threadAttached) {
+        *env = nullptr;
+        return JNI_EDETACHED;
+    }
+    *env = &threadEnv;
+    return JNI_OK;
+}
+
+static const JNIInvokeInterface invokeInterface = {
+        vm_DestroyJavaVM,
+        vm_AttachCurrentThread,
+        vm_DetachCurrentThread,
+        vm_GetEnv,
+};
+
+static JavaVM vm = {&invokeInterface};
+
+static jvalue get_class_loader(const jvalue *) {
+    jvalue ret;
+    ret.l = object_new(OBJECT_OTHER);
+    return ret;
+}
+
+JavaVM *FakeJvm_Create(const FakeJvmConfig *cfg) {
+    config = *cfg;
+    serialClass.kind = OBJECT_CLASS;
+    FakeJvm_Define("getClassLoader", "()Ljava/lang/ClassLoader;", get_class_loader);
+    return &vm;
+}
+
+void FakeJvm_Define(const char *name, const char *sig, FakeJvmMethod method) {
+    std::lock_guard<std::mutex> guard(methodsLock);
+    for (_jmethodID *m : methods) {
+        if (m->name == name && m->sig == sig) {
+            m->method = method;
+            return;
+        }
+    }
+    methods.push_back(new _jmethodID{name, sig, method});
+}
+
+JNIEnv *FakeJvm_AttachPermanently(void) {
+    JNIEnv *env = nullptr;
+    vm.AttachCurrentThread(&env, nullptr);
+    return env;
+}
+
+void FakeJvm_Stats(FakeJvmStats *stats) {
+    stats->lookups = lookups.load(std::memory_order_relaxed);
+    stats->attaches = attaches.load(std::memory_order_relaxed);
+    stats->detaches = detaches.load(std::memory_order_relaxed);
+    stats->calls = calls.load(std::memory_order_relaxed);
+    stats->objects = objects.load(std::memory_order_relaxed);
+    stats->live = live.load(std::memory_order_relaxed);
+    stats->globals = globals.load(std::memory_order_relaxed);
+}
+
+const int8_t *FakeJvm_ArrayData(jobject array, int *length) {
+    FakeObject *obj = object_of(array);
+    *length = (int) obj->bytes.size();
+    return obj->bytes.data();
+}
+
+const char *FakeJvm_StringData(jobject string) {
+    return object_of(string)->text.c_str();
+}
@@ -0,0 +1,48 @@
+//
+// Programmable fake Java VM behind tools/fake_jni/jni.h (fake_jvm.cpp), for
+// running native-lib.cpp on the host.
+//
+// Static methods of cc.axyz.serialserver.Serial are plain functions defined
+// with FakeJvm_Define(); they get the call's arguments decoded from the
+// va_list by the method signature, as the VM would. The lookup, attach and
+// call costs of a real VM can be added as busy time (FakeJvmConfig); with
+// all of them 0 what is measured is the bridge itself.
+//
+
+#ifndef SERIALSERVER_FAKE_JVM_H
+#define SERIALSERVER_FAKE_JVM_H
+
+#include <stdint.h>
+
+#include "fake_jni/jni.h"
+
+typedef jvalue (*FakeJvmMethod)(const jvalue *args);
+
+typedef struct {
+    int64_t lookup_ns;    // added to every FindClass / GetStaticMethodID
+    int64_t attach_ns;    // added to every AttachCurrentThread / DetachCurrentThread
+    int64_t call_ns;      // added to every Call*Method
+} FakeJvmConfig;
+
+typedef struct {
+    uint64_t lookups;     // FindClass + GetStaticMethodID
+    uint64_t attaches;
+    uint64_t detaches;
+    uint64_t calls;       // Call*Method
+    uint64_t objects;     // arrays and strings allocated
+    int64_t live;         // objects still referenced (local or global)
+    int64_t globals;      // global references not deleted yet
+} FakeJvmStats;
+
+// Creates the VM; cc.axyz.serialserver.Serial.getClassLoader() is predefined.
+JavaVM *FakeJvm_Create(const FakeJvmConfig *config);
+// Defines (or replaces) static method `name` with JNI signature `sig`.
+void FakeJvm_Define(const char *name, const char *sig, FakeJvmMethod method);
+// Attaches the calling thread for good, like a thread started from Java.
+JNIEnv *FakeJvm_AttachPermanently(void);
+void FakeJvm_Stats(FakeJvmStats *stats);
+// Contents of a byte[] or String passed to a method.
+const int8_t *FakeJvm_ArrayData(jobject array, int *length);
+const char *FakeJvm_StringData(jobject string);
+
+#endif //SERIALSERVER_FAKE_JVM_H
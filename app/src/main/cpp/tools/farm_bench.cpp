@@ -0,0 +1,323 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if 0
+#!/bin/bash
+# SIM_PORTS=32 SIM_PROFILE=echo,telemetry,burst,reqresp bash farm_bench.cpp [seconds] [baud]
+# FARM_TRANSPORT=tcp FARM_WORKERS=4: clients go through the port scheduler (port_sched.h) on tcp 24000+id
+# FARM_RECONNECT=1 SIM_OPEN_MS=300: every request is a new session, latency is the time to the first answer
+set -e
+src="$(dirname $0)/.."
+flags="-std=c++17 -D__LINUX__ -O2 -g -Wall -I${src}/include -I${src}/tools"
+g++ $flags -o /tmp/farm_bench $0 ${src}/tools/serial_sim.cpp ${src}/src/rx_ring.cpp ${src}/src/capture.cpp ${src}/src/metrics.cpp ${src}/src/trace.cpp ${src}/src/log.cpp ${src}/src/watchdog.cpp ${src}/src/buffer_pool.cpp \
+    ${src}/src/port_sched.cpp ${src}/src/lz_stream.cpp ${src}/src/session_pool.cpp ${src}/src/thread_sched.cpp \
+    ${src}/src/tx_queue.cpp ${src}/src/flow_ctl.cpp ${src}/src/usb_engine.cpp -lpthread
+/tmp/farm_bench "$@"
+exit 0
+#endif
+
+// Multi-port scale driver for the virtual device farm (serial_sim.cpp).
+//
+// One client thread per virtual port drives the java_method.h interface the
+// way the RFC2217 server does: echo and reqresp ports get timestamped request
+// lines and measure the round trip, telemetry and burst ports are drained
+// continuously. At the end it reports aggregate throughput, per-port latency
+// percentiles and the CPU utilisation of every core during the run.
+//
+// With FARM_TRANSPORT=tcp the clients talk to the port scheduler over TCP
+// instead, so N ports are served by FARM_WORKERS threads (default: cores).
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "buffer_pool.h"
+#include "java_method.h"
+#include "metrics.h"
+#include "mono_clock.h"
+#include "port_sched.h"
+#include "serial_sim.h"
+#include "session_pool.h"
+#include "trace.h"
+
+using Clock = std::chrono::steady_clock;
+
+#define FARM_TCP_BASE 24000
+
+static bool reconnect = false;
+
+struct ClientStats {
+    uint64_t rx_bytes = 0;
+    uint64_t tx_bytes = 0;
+    std::vector<double> latency_us;
+};
+
+struct CpuTimes {
+    std::vector<std::pair<uint64_t, uint64_t>> cores; // busy, total jiffies
+};
+
+static CpuTimes read_cpu() {
+    CpuTimes times;
+    FILE *fp = fopen("/proc/stat", "r");
+    if (!fp) {
+        return times;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, "cpu", 3) != 0 || line[3] == ' ') {
+            continue;
+        }
+        unsigned long long v[10] = {0};
+        sscanf(line, "%*s %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+               &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9]);
+        uint64_t idle = v[3] + v[4];
+        uint64_t total = 0;
+        for (unsigned long long x : v) {
+            total += x;
+        }
+        times.cores.emplace_back(total - idle, total);
+    }
+    fclose(fp);
+    return times;
+}
+
+static double percentile(std::vector<double> &values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    size_t index = std::min(values.size() - 1, (size_t) (p * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static const char *profile_name(SimProfile profile) {
+    switch (profile) {
+        case SIM_PROFILE_TELEMETRY: return "telemetry";
+        case SIM_PROFILE_BURST: return "burst";
+        case SIM_PROFILE_REQRESP: return "reqresp";
+        default: return "echo";
+    }
+}
+
+static void client_run(int id, int baud, Clock::time_point deadline, ClientStats *stats) {
+    if (JavaMethod_OpenSerial(id) != 1) {
+        fprintf(stderr, "port %d: open failed\n", id);
+        return;
+    }
+    JavaMethod_ConfigureSerial(id, baud, 8, 1, 'N');
+    JavaMethod_DtrSerialSet(id, true);
+    JavaMethod_RtsSerialSet(id, true);
+    SimProfile profile = SimPort_Profile(id);
+    bool interactive = profile == SIM_PROFILE_ECHO || profile == SIM_PROFILE_REQRESP;
+    std::string pending;
+    uint64_t sequence = 0;
+    while (Clock::now() < deadline) {
+        Clock::time_point sent = Clock::now();
+        if (reconnect) {
+            JavaMethod_CloseSerial(id);
+            if (JavaMethod_OpenSerial(id) != 1) {
+                break;
+            }
+            JavaMethod_ConfigureSerial(id, baud, 8, 1, 'N');
+        }
+        if (interactive) {
+            char request[64];
+            int n = snprintf(request, sizeof(request), "REQ %d %llu ................\n", id,
+                             (unsigned long long) sequence++);
+            JavaMethod_WriteSerial(id, (int8_t *) request, n, NS_PER_SEC);
+            stats->tx_bytes += n;
+        }
+        // Drain until the echoed line is back (interactive) or for a while (streaming).
+        bool answered = !interactive;
+        auto until = interactive ? sent + std::chrono::seconds(2) : Clock::now() + std::chrono::milliseconds(50);
+        while (Clock::now() < until) {
+            int8_t *data = nullptr;
+            int n = JavaMethod_ReadSerial(id, 4096, 10 * NS_PER_MS, &data);
+            if (n > 0) {
+                stats->rx_bytes += n;
+                if (interactive) {
+                    pending.append((const char *) data, n);
+                    size_t eol = pending.find('\n');
+                    if (eol != std::string::npos) {
+                        pending.erase(0, eol + 1);
+                        answered = true;
+                    }
+                }
+            }
+            BufferPool_Put(data);
+            if (interactive && answered) {
+                break;
+            }
+        }
+        if (interactive && answered) {
+            stats->latency_us.push_back(
+                    std::chrono::duration<double, std::micro>(Clock::now() - sent).count());
+        }
+    }
+    JavaMethod_CloseSerial(id);
+}
+
+// Same traffic as client_run(), through the raw TCP endpoint of the port scheduler.
+static void client_tcp_run(int id, int baud, Clock::time_point deadline, ClientStats *stats) {
+    JavaMethod_ConfigureSerial(id, baud, 8, 1, 'N');
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(FARM_TCP_BASE + id);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "port %d: connect failed\n", id);
+        close(fd);
+        return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    SimProfile profile = SimPort_Profile(id);
+    bool interactive = profile == SIM_PROFILE_ECHO || profile == SIM_PROFILE_REQRESP;
+    std::string pending;
+    uint64_t sequence = 0;
+    char data[4096];
+    while (Clock::now() < deadline) {
+        Clock::time_point sent = Clock::now();
+        if (interactive) {
+            char request[64];
+            int n = snprintf(request, sizeof(request), "REQ %d %llu ................\n", id,
+                             (unsigned long long) sequence++);
+            if (send(fd, request, n, MSG_NOSIGNAL) != n) {
+                break;
+            }
+            stats->tx_bytes += n;
+        }
+        bool answered = !interactive;
+        auto until = interactive ? sent + std::chrono::seconds(2) : Clock::now() + std::chrono::milliseconds(50);
+        while (Clock::now() < until) {
+            struct pollfd pfd = {fd, POLLIN, 0};
+            if (poll(&pfd, 1, 10) <= 0) {
+                continue;
+            }
+            ssize_t n = recv(fd, data, sizeof(data), 0);
+            if (n <= 0) {
+                break;
+            }
+            stats->rx_bytes += n;
+            if (interactive) {
+                pending.append(data, n);
+                size_t eol = pending.find('\n');
+                if (eol != std::string::npos) {
+                    pending.erase(0, eol + 1);
+                    answered = true;
+                    break;
+                }
+            }
+        }
+        if (interactive && answered) {
+            stats->latency_us.push_back(
+                    std::chrono::duration<double, std::micro>(Clock::now() - sent).count());
+        }
+    }
+    close(fd);
+}
+
+int main(int argc, char **argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 10;
+    int baud = argc > 2 ? atoi(argv[2]) : 921600;
+    int ports = SimPort_Count();
+    Trace_Init();
+    const char *transport = getenv("FARM_TRANSPORT");
+    bool tcp = transport && strcmp(transport, "tcp") == 0;
+    reconnect = getenv("FARM_RECONNECT") && atoi(getenv("FARM_RECONNECT"));
+    if (tcp) {
+        const char *workers = getenv("FARM_WORKERS");
+        if (PortSched_Start(FARM_TCP_BASE, 0, ports, workers ? atoi(workers) : 0) != 0) {
+            return 1;
+        }
+    }
+    printf("%d ports at %d baud for %d s%s\n", ports, baud, seconds, tcp ? " over the port scheduler" : "");
+
+    std::vector<ClientStats> stats(ports);
+    std::vector<std::thread> clients;
+    CpuTimes before = read_cpu();
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + std::chrono::seconds(seconds);
+    for (int id = 0; id < ports; id++) {
+        clients.emplace_back(tcp ? client_tcp_run : client_run, id, baud, deadline, &stats[id]);
+    }
+    for (auto &client : clients) {
+        client.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    CpuTimes after = read_cpu();
+    SessionPool_Flush();
+
+    uint64_t rx = 0, tx = 0;
+    printf("%-5s %-10s %12s %12s %10s %10s %10s\n", "port", "profile", "rx B/s", "tx B/s", "p50 us", "p99 us", "max us");
+    for (int id = 0; id < ports; id++) {
+        ClientStats &s = stats[id];
+        rx += s.rx_bytes;
+        tx += s.tx_bytes;
+        double p50 = percentile(s.latency_us, 0.50);
+        double p99 = percentile(s.latency_us, 0.99);
+        double max = percentile(s.latency_us, 1.0);
+        printf("%-5d %-10s %12.0f %12.0f %10.0f %10.0f %10.0f\n", id, profile_name(SimPort_Profile(id)),
+               s.rx_bytes / elapsed, s.tx_bytes / elapsed, p50, p99, max);
+    }
+    printf("aggregate: rx %.0f B/s, tx %.0f B/s\n", rx / elapsed, tx / elapsed);
+    MetricsSummary forward;
+    Metrics_Summary(METRIC_FORWARD, &forward);
+    printf("rx forward delay: p50 %.0f us, p99 %.0f us, max %.0f us over %llu chunks\n", forward.p50_ns / 1e3,
+           forward.p99_ns / 1e3, forward.max_ns / 1e3, (unsigned long long) forward.count);
+    if (reconnect) {
+        SessionPoolStats sessions;
+        SessionPool_Stats(&sessions);
+        printf("sessions: %llu warm, %llu cold opens, %llu config calls skipped\n",
+               (unsigned long long) sessions.warm_opens, (unsigned long long) sessions.cold_opens,
+               (unsigned long long) sessions.config_skips);
+    }
+    if (tcp) {
+        PortSchedStats sched;
+        PortSched_Stats(&sched);
+        printf("scheduler: %d workers, %llu runs, %llu steals, %llu yields, %llu wakeups\n", sched.workers,
+               (unsigned long long) sched.runs, (unsigned long long) sched.steals, (unsigned long long) sched.yields,
+               (unsigned long long) sched.wakeups);
+    }
+    for (size_t core = 0; core < after.cores.size() && core < before.cores.size(); core++) {
+        uint64_t busy = after.cores[core].first - before.cores[core].first;
+        uint64_t total = after.cores[core].second - before.cores[core].second;
+        printf("cpu%-3zu %5.1f%%\n", core, total ? 100.0 * busy / total : 0.0);
+    }
+    return 0;
+}
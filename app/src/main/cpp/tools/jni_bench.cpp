@@ -0,0 +1,495 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if 0
+#!/bin/bash
+# bash jni_bench.cpp [--benchmark_filter=<substring>] [--benchmark_min_time=<seconds>]
+# Environment: JNI_LOOKUP_NS, JNI_ATTACH_NS, JNI_CALL_NS (VM costs added by the fake, default 0)
+set -e
+src="$(dirname $0)/.."
+flags="-std=c++17 -D__LINUX__ -O2 -g -Wall -I${src}/include -I${src}/tools -I${src}/tools/fake_jni"
+g++ $flags -o /tmp/jni_bench $0 ${src}/tools/fake_jvm.cpp ${src}/src/rx_ring.cpp ${src}/src/buffer_pool.cpp \
+    ${src}/src/capture.cpp ${src}/src/metrics.cpp ${src}/src/trace.cpp ${src}/src/log.cpp ${src}/src/watchdog.cpp \
+    ${src}/src/port_sched.cpp ${src}/src/session_pool.cpp ${src}/src/thread_sched.cpp ${src}/src/usb_engine.cpp \
+    ${src}/src/tx_queue.cpp ${src}/src/modbus_gw.cpp ${src}/src/mux_server.cpp ${src}/src/telnet_zip.cpp \
+    ${src}/src/lz_stream.cpp ${src}/src/esp_accel.cpp ${src}/src/flow_ctl.cpp ${src}/src/line_config.cpp -lpthread
+/tmp/jni_bench "$@"
+exit 0
+#endif
+
+// Microbenchmarks of the JNI bridge (native-lib.cpp) against the fake VM in
+// fake_jvm.cpp, in the manner of Google Benchmark: every case runs for at
+// least --benchmark_min_time and reports wall and CPU time per call. The
+// counters are per call as well: `lookups` (FindClass/GetStaticMethodID),
+// `attach` (AttachCurrentThread) and `jcalls` (calls into Java), plus `live`,
+// the object references left over after the whole run.
+//
+// Cases run on a thread that is not attached to the VM, like the Python
+// server threads, unless their name ends in /java. native-lib.cpp is included
+// below so its static helpers (get_env, callMethod) can be measured alone.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fake_jvm.h"
+#include "../native-lib.cpp"
+
+extern "C" {
+int librfc2217_init_c(const char *binary_filename) {
+    return 0;
+}
+
+int librfc2217_start_c(const int port, const int tcpPort, const int verbose) {
+    return 0;
+}
+}
+
+#define BENCH_PORT 0
+
+// --- runner ------------------------------------------------------------------
+
+class BenchState {
+public:
+    BenchState(int64_t iterations, int64_t arg) : iterations(iterations), arg(arg) {}
+
+    struct Value {
+        ~Value() {}
+    };
+
+    struct Iterator {
+        BenchState *state;
+        int64_t left;
+        bool operator!=(const Iterator &) {
+            if (left == 0) {
+                state->stop();
+                return false;
+            }
+            return true;
+        }
+        void operator++() { --left; }
+        Value operator*() const { return {}; }
+    };
+
+    Iterator begin() {
+        FakeJvm_Stats(&before);
+        wall = MonoClock_Now();
+        cpu = cpu_now();
+        return {this, iterations};
+    }
+
+    Iterator end() { return {this, 0}; }
+
+    int64_t range() const { return arg; }
+    void SetBytesProcessed(int64_t n) { bytes = n; }
+
+    int64_t iterations;
+    int64_t arg;
+    int64_t bytes = 0;
+    int64_t wall = 0;
+    int64_t cpu = 0;
+    FakeJvmStats before = {};
+    FakeJvmStats after = {};
+
+private:
+    static int64_t cpu_now() {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return (int64_t) ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+    }
+
+    void stop() {
+        wall = MonoClock_Now() - wall;
+        cpu = cpu_now() - cpu;
+        FakeJvm_Stats(&after);
+    }
+};
+
+typedef void (*BenchFunc)(BenchState &state);
+
+struct Bench {
+    std::string name;
+    BenchFunc func;
+    std::vector<int64_t> args;
+    bool java = false;
+
+    Bench *Arg(int64_t arg) {
+        args.push_back(arg);
+        return this;
+    }
+
+    // Runs on a thread attached to the VM, like the USB reader.
+    Bench *Java() {
+        java = true;
+        return this;
+    }
+};
+
+static std::vector<Bench *> &benches() {
+    static std::vector<Bench *> list;
+    return list;
+}
+
+static Bench *bench_register(const char *name, BenchFunc func) {
+    auto *bench = new Bench{name, func};
+    benches().push_back(bench);
+    return bench;
+}
+
+#define BENCH_NAME2(line) bench_##line
+#define BENCH_NAME(line) BENCH_NAME2(line)
+#define BENCHMARK(func) static Bench *BENCH_NAME(__LINE__) = bench_register(#func, func)
+
+static void bench_run(const Bench &bench, int64_t arg, const std::string &name, double min_time) {
+    int64_t iterations = 1;
+    BenchState *result = nullptr;
+    for (;;) {
+        auto *state = new BenchState(iterations, arg);
+        std::thread runner([&bench, state] {
+            if (bench.java) {
+                FakeJvm_AttachPermanently();
+            }
+            bench.func(*state);
+            // References still held once the case has cleaned up, before detaching frees its locals.
+            FakeJvmStats done;
+            FakeJvm_Stats(&done);
+            state->after.live = done.live;
+            g_vm->DetachCurrentThread();
+        });
+        runner.join();
+        delete result;
+        result = state;
+        double seconds = (double) state->wall / NS_PER_SEC;
+        if (seconds >= min_time || iterations >= 1000000000) {
+            break;
+        }
+        // Aim past the minimum like Google Benchmark, growing at most tenfold per round.
+        double grow = seconds > 0 ? min_time * 1.4 / seconds : 10;
+        grow = grow < 10 ? grow : 10;
+        int64_t next = (int64_t) (iterations * grow);
+        iterations = next > iterations ? next : iterations + 1;
+    }
+    double n = (double) result->iterations;
+    const FakeJvmStats &a = result->before;
+    const FakeJvmStats &b = result->after;
+    char counters[160];
+    int len = snprintf(counters, sizeof(counters), "lookups=%.2f attach=%.2f jcalls=%.2f live=%lld",
+                       (double) (b.lookups - a.lookups) / n, (double) (b.attaches - a.attaches) / n,
+                       (double) (b.calls - a.calls) / n, (long long) b.live);
+    if (result->bytes > 0 && result->wall > 0) {
+        snprintf(counters + len, sizeof(counters) - len, " bytes_per_second=%.1fMi/s",
+                 (double) result->bytes / ((double) result->wall / NS_PER_SEC) / (1024 * 1024));
+    }
+    printf("%-32s %10.0f ns %10.0f ns %12lld %s\n", name.c_str(), (double) result->wall / n,
+           (double) result->cpu / n, (long long) result->iterations, counters);
+    fflush(stdout);
+    delete result;
+}
+
+// --- Java side ---------------------------------------------------------------
+
+static jvalue java_int(jint value) {
+    jvalue ret;
+    ret.i = value;
+    return ret;
+}
+
+static jvalue java_open(const jvalue *args) {
+    return java_int(1);
+}
+
+static jvalue java_close(const jvalue *args) {
+    return java_int(1);
+}
+
+static jvalue java_configure(const jvalue *args) {
+    return java_int(args[1].i > 0 ? 1 : 0);
+}
+
+static jvalue java_write(const jvalue *args) {
+    int length = 0;
+    FakeJvm_ArrayData(args[1].l, &length);
+    return java_int(args[2].i <= length ? args[2].i : -1);
+}
+
+static jvalue java_set(const jvalue *args) {
+    return java_int(1);
+}
+
+static jvalue java_get(const jvalue *args) {
+    jvalue ret;
+    ret.z = JNI_TRUE;
+    return ret;
+}
+
+static jvalue java_status(const jvalue *args) {
+    return java_int((jint) strlen(FakeJvm_StringData(args[1].l)));
+}
+
+// --- bridge internals --------------------------------------------------------
+
+static void BM_GetEnv(BenchState &state) {
+    for (auto _ : state) {
+        JNIEnv *env = nullptr;
+        if (get_env(&env)) {
+            g_vm->DetachCurrentThread();
+        }
+    }
+}
+BENCHMARK(BM_GetEnv);
+BENCHMARK(BM_GetEnv)->Java();
+
+static void BM_GetStaticMethodID(BenchState &state) {
+    JNIEnv *env = FakeJvm_AttachPermanently();
+    for (auto _ : state) {
+        jmethodID mid = env->GetStaticMethodID(serialClass, "rtsSerialGet", "(I)Z");
+        if (!mid) {
+            abort();
+        }
+    }
+}
+BENCHMARK(BM_GetStaticMethodID);
+
+// What every callMethod() caller builds before the call.
+static void BM_StdFunction(BenchState &state) {
+    JNIEnv *env = FakeJvm_AttachPermanently();
+    jmethodID mid = env->GetStaticMethodID(serialClass, "rtsSerialGet", "(I)Z");
+    int id = BENCH_PORT;
+    for (auto _ : state) {
+        std::function<jboolean(JNIEnv *, jclass, jmethodID)> call_func = [&](
+                JNIEnv *env, jclass cls, jmethodID mid) -> jboolean {
+            return env->CallStaticBooleanMethod(cls, mid, id);
+        };
+        call_func(env, serialClass, mid);
+    }
+}
+BENCHMARK(BM_StdFunction);
+
+// The same call without callMethod(): cached method ID, plain lambda.
+static void BM_DirectCall(BenchState &state) {
+    JNIEnv *env = FakeJvm_AttachPermanently();
+    jmethodID mid = env->GetStaticMethodID(serialClass, "rtsSerialGet", "(I)Z");
+    int id = BENCH_PORT;
+    for (auto _ : state) {
+        env->CallStaticBooleanMethod(serialClass, mid, id);
+    }
+}
+BENCHMARK(BM_DirectCall);
+
+static void BM_CallMethod(BenchState &state) {
+    int id = BENCH_PORT;
+    std::function<jboolean(JNIEnv *, jclass, jmethodID)> call_func = [&](
+            JNIEnv *env, jclass cls, jmethodID mid) -> jboolean {
+        return env->CallStaticBooleanMethod(cls, mid, id);
+    };
+    for (auto _ : state) {
+        callMethod((jboolean) JNI_FALSE, "rtsSerialGet", "(I)Z", call_func);
+    }
+}
+BENCHMARK(BM_CallMethod);
+BENCHMARK(BM_CallMethod)->Java();
+
+// --- JavaMethod_* --------------------------------------------------------------
+
+// Arg 0: every open goes through Java (linger=0); 1: attaches to the warm port.
+static void BM_OpenClose(BenchState &state) {
+    JavaMethod_CloseSerial(BENCH_PORT);
+    SessionPool_Configure(state.range() ? "linger=30000" : "linger=0");
+    for (auto _ : state) {
+        JavaMethod_OpenSerial(BENCH_PORT);
+        JavaMethod_CloseSerial(BENCH_PORT);
+    }
+    SessionPool_Configure("linger=0");
+    SessionPool_Flush();
+    JavaMethod_OpenSerial(BENCH_PORT);
+}
+BENCHMARK(BM_OpenClose)->Arg(0)->Arg(1);
+
+// Arg 0: the settings the port already has; 1: a new baud rate every call.
+static void BM_Configure(BenchState &state) {
+    int baud = 115200;
+    JavaMethod_ConfigureSerial(BENCH_PORT, baud, 8, 1, 'N');
+    for (auto _ : state) {
+        if (state.range()) {
+            baud = baud == 115200 ? 9600 : 115200;
+        }
+        JavaMethod_ConfigureSerial(BENCH_PORT, baud, 8, 1, 'N');
+    }
+}
+BENCHMARK(BM_Configure)->Arg(0)->Arg(1);
+
+// A packet pushed into the receive ring and read back; Arg is the size.
+static void BM_Read(BenchState &state) {
+    int size = (int) state.range();
+    std::vector<int8_t> packet(size, 0x55);
+    for (auto _ : state) {
+        RxRing_Push(BENCH_PORT, packet.data(), size);
+        int8_t *data = nullptr;
+        JavaMethod_ReadSerial(BENCH_PORT, size, 0, &data);
+        if (data) {
+            BufferPool_Put(data);
+        }
+    }
+    state.SetBytesProcessed(state.iterations * size);
+}
+BENCHMARK(BM_Read)->Arg(1)->Arg(64)->Arg(512)->Arg(4096);
+
+// The USB reader's side: one packet through Serial.rxPush, then drained.
+static void BM_RxPush(BenchState &state) {
+    int size = (int) state.range();
+    JNIEnv *env = FakeJvm_AttachPermanently();
+    jbyteArray packet = env->NewByteArray(size);
+    for (auto _ : state) {
+        Java_cc_axyz_serialserver_Serial_rxPush(env, nullptr, BENCH_PORT, packet);
+        RxRing_Reset(BENCH_PORT);
+    }
+    env->DeleteLocalRef(packet);
+    state.SetBytesProcessed(state.iterations * size);
+}
+BENCHMARK(BM_RxPush)->Arg(64)->Arg(512)->Java();
+
+static void BM_Write(BenchState &state) {
+    int size = (int) state.range();
+    std::vector<int8_t> data(size, 0x55);
+    for (auto _ : state) {
+        JavaMethod_WriteSerial(BENCH_PORT, data.data(), size, NS_PER_SEC);
+    }
+    state.SetBytesProcessed(state.iterations * size);
+}
+BENCHMARK(BM_Write)->Arg(1)->Arg(64)->Arg(512)->Arg(4096);
+
+static void BM_RtsSet(BenchState &state) {
+    bool on = false;
+    for (auto _ : state) {
+        JavaMethod_RtsSerialSet(BENCH_PORT, on = !on);
+    }
+}
+BENCHMARK(BM_RtsSet);
+
+static void BM_RtsGet(BenchState &state) {
+    for (auto _ : state) {
+        JavaMethod_RtsSerialGet(BENCH_PORT);
+    }
+}
+BENCHMARK(BM_RtsGet);
+
+static void BM_DtrSet(BenchState &state) {
+    bool on = false;
+    for (auto _ : state) {
+        JavaMethod_DtrSerialSet(BENCH_PORT, on = !on);
+    }
+}
+BENCHMARK(BM_DtrSet);
+
+static void BM_DtrGet(BenchState &state) {
+    for (auto _ : state) {
+        JavaMethod_DtrSerialGet(BENCH_PORT);
+    }
+}
+BENCHMARK(BM_DtrGet);
+
+static void BM_Status(BenchState &state) {
+    for (auto _ : state) {
+        JavaMethod_StatusSerial(BENCH_PORT, "cts");
+    }
+}
+BENCHMARK(BM_Status);
+BENCHMARK(BM_Status)->Java();
+
+static int64_t env_ns(const char *name) {
+    const char *value = getenv(name);
+    return value ? atoll(value) : 0;
+}
+
+int main(int argc, char **argv) {
+    const char *filter = "";
+    double min_time = 0.2;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--benchmark_filter=", 19) == 0) {
+            filter = argv[i] + 19;
+        } else if (strncmp(argv[i], "--benchmark_min_time=", 21) == 0) {
+            min_time = atof(argv[i] + 21);
+        } else {
+            fprintf(stderr, "usage: %s [--benchmark_filter=<substring>] [--benchmark_min_time=<seconds>]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    // Every calibration round reconfigures the session pool and starts threads; keep that out of the table.
+    if (!getenv("SERIAL_LOG")) {
+        Log_SetLevel("*", LOG_LEVEL_WARN);
+    }
+
+    FakeJvmConfig config = {env_ns("JNI_LOOKUP_NS"), env_ns("JNI_ATTACH_NS"), env_ns("JNI_CALL_NS")};
+    JavaVM *vm = FakeJvm_Create(&config);
+    FakeJvm_Define("openSerial", "(I)I", java_open);
+    FakeJvm_Define("closeSerial", "(I)I", java_close);
+    FakeJvm_Define("configureSerial", "(IIIFC)I", java_configure);
+    FakeJvm_Define("writeSerial", "(I[BIJ)I", java_write);
+    FakeJvm_Define("rtsSerialSet", "(IZ)I", java_set);
+    FakeJvm_Define("rtsSerialGet", "(I)Z", java_get);
+    FakeJvm_Define("dtrSerialSet", "(IZ)I", java_set);
+    FakeJvm_Define("dtrSerialGet", "(I)Z", java_get);
+    FakeJvm_Define("statusSerial", "(ILjava/lang/String;)I", java_status);
+
+    // The library is loaded from a Java thread.
+    std::thread([vm] {
+        FakeJvm_AttachPermanently();
+        JNI_OnLoad(vm, nullptr);
+    }).join();
+
+    // The port stays open underneath the cases that do not open it themselves.
+    SessionPool_Configure("linger=0");
+    JavaMethod_OpenSerial(BENCH_PORT);
+
+    printf("VM costs: lookup %lld ns, attach %lld ns, call %lld ns\n", (long long) config.lookup_ns,
+           (long long) config.attach_ns, (long long) config.call_ns);
+    printf("%-32s %13s %13s %12s\n", "Benchmark", "Time", "CPU", "Iterations");
+    printf("%s\n", std::string(96, '-').c_str());
+    for (const Bench *bench : benches()) {
+        std::vector<int64_t> args = bench->args;
+        if (args.empty()) {
+            args.push_back(-1);
+        }
+        for (int64_t arg : args) {
+            std::string name = bench->name;
+            if (arg >= 0) {
+                name += "/" + std::to_string(arg);
+            }
+            if (bench->java) {
+                name += "/java";
+            }
+            if (name.find(filter) != std::string::npos) {
+                bench_run(*bench, arg, name, min_time);
+            }
+        }
+    }
+
+    JavaMethod_CloseSerial(BENCH_PORT);
+    return 0;
+}
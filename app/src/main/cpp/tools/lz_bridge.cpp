@@ -0,0 +1,280 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if 0
+#!/bin/bash
+# Client side bridge for compressed endpoints (Linux, macOS or termux).
+# bash lz_bridge.cpp <phone> <zip_port> [local_port] [telnet|raw]
+# then point any RFC2217 tool at the bridge: miniterm.py rfc2217://localhost:2217
+set -e
+src="$(dirname $0)/.."
+g++ -std=c++17 -D__LINUX__ -O2 -g -Wall -I${src}/include -o /tmp/lz_bridge $0 ${src}/src/lz_stream.cpp \
+    ${src}/src/metrics.cpp ${src}/src/trace.cpp ${src}/src/log.cpp -lpthread
+/tmp/lz_bridge "$@"
+exit 0
+#endif
+
+// Serves the plain protocol of a compressed endpoint on a local port.
+//
+// telnet (default): for the RFC2217 front (telnet_zip.h). The bridge answers
+// the server's offer of TELNET_ZIP_OPTION with DO, hides that negotiation
+// from the local client and decompresses everything after the server's
+// IAC SB TELNET_ZIP_OPTION IAC SE. A server without the option passes through
+// unchanged.
+// raw: for raw ports started with PortSched_SetCompress(); everything from the
+// phone is decompressed.
+//
+// Local to phone traffic is never compressed. Every session prints its
+// byte counts when it ends.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "lz_stream.h"
+#include "telnet_zip.h"
+
+#define TELNET_IAC 255
+#define TELNET_DO 253
+#define TELNET_WILL 251
+#define TELNET_SB 250
+#define TELNET_SE 240
+
+enum BridgeState {
+    BRIDGE_DATA,
+    BRIDGE_IAC,
+    BRIDGE_VERB,
+    BRIDGE_SB,
+    BRIDGE_SB_OPTION,
+    BRIDGE_SB_IAC,
+    BRIDGE_COMPRESSED,
+};
+
+struct Session {
+    int local = -1;
+    int remote = -1;
+    BridgeState state = BRIDGE_DATA;
+    uint8_t verb = 0;
+    LzDecoder *decoder = nullptr;
+    std::vector<uint8_t> out;        // plain bytes for the local client
+    uint64_t wire = 0;
+    uint64_t plain = 0;
+};
+
+static const char *remoteHost;
+static const char *remotePort;
+static bool rawMode = false;
+
+static bool send_all(int fd, const uint8_t *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= (size_t) n;
+    }
+    return true;
+}
+
+static void decoded(void *context, const uint8_t *data, int length) {
+    auto *session = (Session *) context;
+    session->out.insert(session->out.end(), data, data + length);
+}
+
+// Splits phone bytes into telnet negotiation of our option, which is
+// answered here, plain bytes and, once switched, the compressed stream.
+static bool from_remote(Session *s, const uint8_t *data, int length) {
+    for (int i = 0; i < length; i++) {
+        uint8_t b = data[i];
+        switch (s->state) {
+            case BRIDGE_COMPRESSED:
+                return LzStream_Decompress(s->decoder, data + i, length - i, decoded, s) == 0;
+            case BRIDGE_DATA:
+                if (b == TELNET_IAC) {
+                    s->state = BRIDGE_IAC;
+                } else {
+                    s->out.push_back(b);
+                }
+                break;
+            case BRIDGE_IAC:
+                if (b >= TELNET_WILL && b != TELNET_IAC) {
+                    s->verb = b;
+                    s->state = BRIDGE_VERB;
+                } else if (b == TELNET_SB) {
+                    s->state = BRIDGE_SB;
+                } else {
+                    s->out.insert(s->out.end(), {TELNET_IAC, b});
+                    s->state = BRIDGE_DATA;
+                }
+                break;
+            case BRIDGE_VERB:
+                s->state = BRIDGE_DATA;
+                if (b != TELNET_ZIP_OPTION) {
+                    s->out.insert(s->out.end(), {TELNET_IAC, s->verb, b});
+                } else if (s->verb == TELNET_WILL) {
+                    const uint8_t accept[] = {TELNET_IAC, TELNET_DO, TELNET_ZIP_OPTION};
+                    if (!send_all(s->remote, accept, sizeof(accept))) {
+                        return false;
+                    }
+                }
+                break;
+            case BRIDGE_SB:
+                if (b == TELNET_ZIP_OPTION) {
+                    s->state = BRIDGE_SB_OPTION;
+                } else {
+                    s->out.insert(s->out.end(), {TELNET_IAC, TELNET_SB, b});
+                    s->state = BRIDGE_DATA;
+                }
+                break;
+            case BRIDGE_SB_OPTION:
+                s->state = b == TELNET_IAC ? BRIDGE_SB_IAC : BRIDGE_DATA;
+                break;
+            case BRIDGE_SB_IAC:
+                if (b == TELNET_SE) {
+                    s->state = BRIDGE_COMPRESSED;
+                    s->decoder = LzStream_DecoderNew();
+                } else {
+                    s->state = BRIDGE_DATA;
+                }
+                break;
+        }
+    }
+    return true;
+}
+
+static int connect_remote() {
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *result = nullptr;
+    if (getaddrinfo(remoteHost, remotePort, &hints, &result) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = result; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+static void session_run(int local) {
+    Session s;
+    s.local = local;
+    s.remote = connect_remote();
+    if (s.remote < 0) {
+        fprintf(stderr, "lz_bridge: cannot reach %s:%s\n", remoteHost, remotePort);
+        close(local);
+        return;
+    }
+    int one = 1;
+    setsockopt(s.remote, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (rawMode) {
+        s.state = BRIDGE_COMPRESSED;
+        s.decoder = LzStream_DecoderNew();
+    }
+    uint8_t buffer[LZ_STREAM_BOUND(LZ_STREAM_BLOCK_MAX)];
+    struct pollfd fds[2] = {{local, POLLIN, 0}, {s.remote, POLLIN, 0}};
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            break;
+        }
+        if (fds[0].revents) {
+            ssize_t n = recv(local, buffer, sizeof(buffer), 0);
+            if (n <= 0 || !send_all(s.remote, buffer, (size_t) n)) {
+                break;
+            }
+        }
+        if (fds[1].revents) {
+            ssize_t n = recv(s.remote, buffer, sizeof(buffer), 0);
+            if (n <= 0) {
+                break;
+            }
+            s.wire += (uint64_t) n;
+            s.out.clear();
+            if (!from_remote(&s, buffer, (int) n)) {
+                fprintf(stderr, "lz_bridge: corrupt stream from the phone\n");
+                break;
+            }
+            s.plain += s.out.size();
+            if (!send_all(local, s.out.data(), s.out.size())) {
+                break;
+            }
+        }
+    }
+    fprintf(stderr, "lz_bridge: session ended, %llu bytes received for %llu (%.1fx)%s\n",
+            (unsigned long long) s.wire, (unsigned long long) s.plain, s.wire ? (double) s.plain / s.wire : 0.0,
+            s.decoder ? "" : ", not compressed");
+    LzStream_DecoderFree(s.decoder);
+    close(s.remote);
+    close(local);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <phone> <port> [local_port] [telnet|raw]\n", argv[0]);
+        return 2;
+    }
+    Log_SetLevel("*", LOG_LEVEL_WARN);
+    remoteHost = argv[1];
+    remotePort = argv[2];
+    int local_port = argc > 3 ? atoi(argv[3]) : 2217;
+    rawMode = argc > 4 && strcmp(argv[4], "raw") == 0;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t) local_port);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+        perror("lz_bridge: listen");
+        return 1;
+    }
+    fprintf(stderr, "lz_bridge: localhost:%d -> %s:%s (%s)\n", local_port, remoteHost, remotePort,
+            rawMode ? "raw" : "telnet");
+    for (;;) {
+        int local = accept(fd, nullptr, nullptr);
+        if (local < 0) {
+            continue;
+        }
+        setsockopt(local, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        std::thread(session_run, local).detach();
+    }
+}
@@ -0,0 +1,341 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if 0
+#!/bin/bash
+# Host build of the RFC2217 server against a recorded session (termux or Linux).
+# REPLAY_FILE=capture.bin REPLAY_SPEED=10 bash replay_serial.cpp
+set -e
+termux='/data/data/com.termux/files'
+src="$(dirname $0)/.."
+flags="-D__LINUX__ -DREPLAY_MAIN -O2 -g -Wall -I${src}/include -I${src}/tools -I${termux}/usr/include/python3.12"
+ld_flags="-L${termux}/usr/lib -lpython3.12 -ldl -lpthread -lm -L./main.dist -lrfc2217"
+gcc -o serial.o -c ${src}/src/serial.c $flags
+g++ -std=c++17 -o main ${src}/src/rfc2217.cpp ${src}/src/rx_ring.cpp ${src}/src/rx_ring_module.cpp \
+    ${src}/src/capture.cpp ${src}/src/metrics.cpp ${src}/src/trace.cpp ${src}/src/log.cpp ${src}/src/watchdog.cpp \
+    ${src}/src/py_alloc.cpp ${src}/src/buffer_pool.cpp ${src}/src/tx_queue.cpp ${src}/src/flow_ctl.cpp \
+    ${src}/src/line_config.cpp ${src}/src/usb_engine.cpp ${src}/src/thread_sched.cpp \
+    $0 serial.o $flags $ld_flags -Wl,-rpath,./
+rm -f serial.o
+cp ./main main.dist/
+cd ./main.dist && ./main
+exit 0
+#endif
+
+// Replay stand-in for the java_method.h interface.
+//
+// Instead of a USB adapter behind JNI, every opened port is fed with the RX
+// chunks of a capture file (capture.h) through the real native receive path
+// (RxRing_Push), keeping the original inter-chunk timing scaled by
+// REPLAY_SPEED. The TX side is compared with, or recorded next to, the capture.
+//
+//   REPLAY_FILE    capture file to replay (required)
+//   REPLAY_SPEED   1 (default), 2, 10, ... or "max" to ignore timing
+//   REPLAY_SOURCE  captured port replayed on every opened id (default: same id)
+//   REPLAY_TX      "assert" (default) counts bytes differing from the captured
+//                  TX stream, "record:<path>" writes the TX stream to a file,
+//                  "ignore" drops it
+//   REPLAY_SYNC    1 (default) holds back RX chunks until the client has sent
+//                  as many bytes as it had when the chunk arrived originally,
+//                  so request/response sessions (esptool, Modbus) stay causal
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture_reader.h"
+#include "java_method.h"
+#include "rx_ring.h"
+
+#define LOG_LEVEL LOG_LEVEL_INFO
+#include "log.h"
+
+namespace {
+
+struct Chunk {
+    uint64_t timestamp_ns;
+    uint64_t tx_before; // TX bytes sent before this chunk was received
+    std::vector<uint8_t> data;
+};
+
+struct ReplayPort {
+    int id = -1;
+    std::vector<Chunk> rx;
+    std::vector<uint8_t> tx_expected;
+    std::thread feeder;
+    std::mutex lock;
+    std::condition_variable changed;
+    bool running = false;
+    uint64_t tx_written = 0;
+    uint64_t tx_mismatch = 0;
+    uint64_t rx_bytes = 0;
+    std::atomic<bool> rts{false};
+    std::atomic<bool> dtr{false};
+    FILE *tx_out = nullptr;
+    std::chrono::steady_clock::time_point started;
+};
+
+struct Replay {
+    CaptureFile capture;
+    bool loaded = false;
+    double speed = 1.0;
+    int source = -1;
+    bool sync = true;
+    std::string tx_mode = "assert";
+    ReplayPort ports[RX_RING_MAX_PORTS];
+};
+
+Replay &replay() {
+    static Replay instance;
+    return instance;
+}
+
+const char *env(const char *name, const char *fallback) {
+    const char *value = getenv(name);
+    return value && *value ? value : fallback;
+}
+
+bool replay_load() {
+    Replay &r = replay();
+    if (r.loaded) {
+        return true;
+    }
+    const char *file = getenv("REPLAY_FILE");
+    if (!file || !r.capture.load(file)) {
+        LOG_ERROR("REPLAY_FILE not set or unreadable");
+        return false;
+    }
+    std::string speed = env("REPLAY_SPEED", "1");
+    r.speed = speed == "max" ? 0.0 : atof(speed.c_str());
+    r.source = atoi(env("REPLAY_SOURCE", "-1"));
+    r.sync = atoi(env("REPLAY_SYNC", "1")) != 0;
+    r.tx_mode = env("REPLAY_TX", "assert");
+    r.loaded = true;
+    LOG_INFO("replaying %s at %s speed, tx %s", file, speed.c_str(), r.tx_mode.c_str());
+    return true;
+}
+
+void port_load(ReplayPort &port, int source) {
+    port.rx.clear();
+    port.tx_expected.clear();
+    uint64_t tx = 0;
+    replay().capture.for_each([&](const CaptureRecord &rec, const uint8_t *payload) {
+        if (rec.port != source) {
+            return;
+        }
+        if (rec.direction == CAPTURE_DIR_TX) {
+            port.tx_expected.insert(port.tx_expected.end(), payload, payload + rec.length);
+            tx += rec.length;
+        } else {
+            port.rx.push_back(Chunk{rec.timestamp_ns, tx, std::vector<uint8_t>(payload, payload + rec.length)});
+        }
+    });
+}
+
+void feeder_run(ReplayPort *port) {
+    Replay &r = replay();
+    auto origin = std::chrono::steady_clock::now();
+    uint64_t origin_ns = port->rx.empty() ? 0 : port->rx.front().timestamp_ns;
+    for (const Chunk &chunk : port->rx) {
+        std::unique_lock<std::mutex> lock(port->lock);
+        if (r.sync && port->tx_written < chunk.tx_before) {
+            // Wait for the request this chunk answered, then restart the clock from here.
+            port->changed.wait(lock, [&]() { return !port->running || port->tx_written >= chunk.tx_before; });
+            origin = std::chrono::steady_clock::now();
+            origin_ns = chunk.timestamp_ns;
+        }
+        if (!port->running) {
+            return;
+        }
+        if (r.speed > 0) {
+            auto due = origin + std::chrono::nanoseconds((int64_t) ((chunk.timestamp_ns - origin_ns) / r.speed));
+            if (port->changed.wait_until(lock, due, [&]() { return !port->running; })) {
+                return;
+            }
+        }
+        lock.unlock();
+        RxRing_Push(port->id, (const int8_t *) chunk.data.data(), (int) chunk.data.size());
+        port->rx_bytes += chunk.data.size();
+    }
+    LOG_INFO("port %d replay finished", port->id);
+}
+
+void port_report(ReplayPort &port) {
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - port.started).count();
+    uint64_t total = 0;
+    for (const Chunk &chunk : port.rx) {
+        total += chunk.data.size();
+    }
+    double captured = port.rx.size() > 1 ?
+                      (port.rx.back().timestamp_ns - port.rx.front().timestamp_ns) / 1e9 : 0.0;
+    LOG_INFO("port %d: %d chunks, %llu/%llu bytes rx, %llu bytes tx (%llu expected, %llu mismatched), "
+             "%.3f s wall for %.3f s captured",
+             port.id, (int) port.rx.size(), (unsigned long long) port.rx_bytes,
+             (unsigned long long) total, (unsigned long long) port.tx_written,
+             (unsigned long long) port.tx_expected.size(), (unsigned long long) port.tx_mismatch,
+             seconds, captured);
+}
+
+ReplayPort *port_get(int id) {
+    if (id < 0 || id >= RX_RING_MAX_PORTS) {
+        return nullptr;
+    }
+    return &replay().ports[id];
+}
+
+}
+
+extern "C" {
+
+int JavaMethod_OpenSerial(int id) {
+    ReplayPort *port = port_get(id);
+    if (!port || !replay_load() || RxRing_Open(id, RX_RING_DEFAULT_CAPACITY) < 0) {
+        return -1;
+    }
+    Replay &r = replay();
+    std::lock_guard<std::mutex> guard(port->lock);
+    if (port->running) {
+        return 1;
+    }
+    port->id = id;
+    port_load(*port, r.source >= 0 ? r.source : id);
+    port->tx_written = 0;
+    port->tx_mismatch = 0;
+    port->rx_bytes = 0;
+    if (r.tx_mode.rfind("record:", 0) == 0) {
+        std::string path = r.tx_mode.substr(7) + "." + std::to_string(id);
+        port->tx_out = fopen(path.c_str(), "wb");
+    }
+    port->running = true;
+    port->started = std::chrono::steady_clock::now();
+    port->feeder = std::thread(feeder_run, port);
+    return 1;
+}
+
+int JavaMethod_CloseSerial(int id) {
+    ReplayPort *port = port_get(id);
+    if (!port) {
+        return 0;
+    }
+    {
+        std::lock_guard<std::mutex> guard(port->lock);
+        if (!port->running) {
+            return 0;
+        }
+        port->running = false;
+        port->changed.notify_all();
+    }
+    port->feeder.join();
+    RxRing_Close(id);
+    if (port->tx_out) {
+        fclose(port->tx_out);
+        port->tx_out = nullptr;
+    }
+    port_report(*port);
+    return 1;
+}
+
+int JavaMethod_ConfigureSerial(int id, int baudRate, int dataBits, float stopBits, char parity) {
+    LOG_DEBUG("port %d baudRate: %d, dataBits: %d, stopBits: %.2f, parity: %c", id, baudRate, dataBits, stopBits, parity);
+    return port_get(id) ? 1 : 0;
+}
+
+int JavaMethod_WriteSerial(int id, int8_t *data, int length, int64_t timeout) {
+    ReplayPort *port = port_get(id);
+    if (!port) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> guard(port->lock);
+    if (replay().tx_mode == "assert") {
+        for (int i = 0; i < length; i++) {
+            uint64_t at = port->tx_written + i;
+            if (at >= port->tx_expected.size() || port->tx_expected[at] != (uint8_t) data[i]) {
+                port->tx_mismatch++;
+            }
+        }
+    } else if (port->tx_out) {
+        fwrite(data, 1, length, port->tx_out);
+    }
+    port->tx_written += length;
+    port->changed.notify_all();
+    return 0;
+}
+
+// A recording has no line to stop; claiming chip RTS/CTS keeps writes from waiting on CTS.
+int JavaMethod_FlowControlSerial(int id, bool rtscts) {
+    return port_get(id) ? 1 : -1;
+}
+
+int JavaMethod_RtsSerialSet(int id, bool state) {
+    ReplayPort *port = port_get(id);
+    if (!port) {
+        return -1;
+    }
+    port->rts = state;
+    return 0;
+}
+
+bool JavaMethod_RtsSerialGet(int id) {
+    ReplayPort *port = port_get(id);
+    return port && port->rts;
+}
+
+int JavaMethod_DtrSerialSet(int id, bool state) {
+    ReplayPort *port = port_get(id);
+    if (!port) {
+        return -1;
+    }
+    port->dtr = state;
+    return 0;
+}
+
+bool JavaMethod_DtrSerialGet(int id) {
+    ReplayPort *port = port_get(id);
+    return port && port->dtr;
+}
+
+int JavaMethod_StatusSerial(int id, const char *name) {
+    ReplayPort *port = port_get(id);
+    return port && port->running ? 0 : -1;
+}
+
+}
+
+#ifdef REPLAY_MAIN
+extern "C" {
+    int librfc2217_init_c(const char* binary_filename);
+    int librfc2217_start_c(const int port, const int tcpPort, const int verbose);
+}
+
+int main(int argc, char **argv) {
+    librfc2217_init_c(argv[0]);
+    int tcpPort = argc > 1 ? atoi(argv[1]) : 2217;
+    return librfc2217_start_c(-1, tcpPort, 2);
+}
+#endif
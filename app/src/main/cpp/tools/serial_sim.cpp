@@ -0,0 +1,392 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Virtual device farm behind the java_method.h interface.
+//
+// Every port id below SIM_PORTS is a simulated device that talks through the
+// real native receive ring. Output is paced at the wire rate implied by
+// JavaMethod_ConfigureSerial (start bit + data bits + parity + stop bits per
+// character), host writes take the same wire time, and the modem lines behave
+// like a loopback plug (CTS follows RTS, DSR and CD follow DTR).
+//
+//   SIM_PORTS             number of virtual ports (default 8)
+//   SIM_PROFILE           comma separated profiles assigned round robin:
+//                         echo, telemetry, burst, reqresp (default echo)
+//   SIM_LATENCY_US        device-side latency of reqresp (default 2000)
+//   SIM_TELEMETRY_HZ      telemetry line rate (default 10)
+//   SIM_BURST_BYTES       size of one burst of log lines (default 65536)
+//   SIM_BURST_PERIOD_MS   time between bursts (default 1000)
+//   SIM_OPEN_MS           cost of opening a port from Java (default 0); opens
+//                         and closes go through the session pool (session_pool.h)
+//
+// tools/farm_bench.cpp drives a matching set of clients.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "java_method.h"
+#include "rx_ring.h"
+#include "serial_sim.h"
+#include "session_pool.h"
+
+#define LOG_LEVEL LOG_LEVEL_INFO
+#include "log.h"
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// usb-serial adapters hand data over in full-speed bulk packets.
+const size_t USB_PACKET = 64;
+
+struct SimPort {
+    int id = -1;
+    SimProfile profile = SIM_PROFILE_ECHO;
+    std::thread device;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool running = false;
+    // line settings
+    int baudRate = 115200;
+    int dataBits = 8;
+    float stopBits = 1;
+    char parity = 'N';
+    // device output waiting for the wire, with the time it may be sent
+    std::deque<std::pair<Clock::time_point, std::string>> pending;
+    std::string request; // reqresp: partial request line
+    Clock::time_point tx_busy_until;
+    uint64_t sequence = 0;
+    std::atomic<bool> rts{false};
+    std::atomic<bool> dtr{false};
+};
+
+struct Farm {
+    int ports = 8;
+    std::vector<SimProfile> profiles;
+    int latency_us = 2000;
+    int telemetry_hz = 10;
+    int burst_bytes = 65536;
+    int burst_period_ms = 1000;
+    int open_ms = 0;
+    SimPort port[RX_RING_MAX_PORTS];
+    bool loaded = false;
+    std::mutex lock;
+};
+
+Farm &farm() {
+    static Farm instance;
+    return instance;
+}
+
+int env_int(const char *name, int fallback) {
+    const char *value = getenv(name);
+    return value && *value ? atoi(value) : fallback;
+}
+
+void farm_load() {
+    Farm &f = farm();
+    std::lock_guard<std::mutex> guard(f.lock);
+    if (f.loaded) {
+        return;
+    }
+    f.ports = std::min(env_int("SIM_PORTS", 8), RX_RING_MAX_PORTS);
+    f.latency_us = env_int("SIM_LATENCY_US", 2000);
+    f.telemetry_hz = std::max(1, env_int("SIM_TELEMETRY_HZ", 10));
+    f.burst_bytes = env_int("SIM_BURST_BYTES", 65536);
+    f.burst_period_ms = std::max(1, env_int("SIM_BURST_PERIOD_MS", 1000));
+    f.open_ms = env_int("SIM_OPEN_MS", 0);
+    const char *list = getenv("SIM_PROFILE");
+    std::string profiles = list && *list ? list : "echo";
+    size_t start = 0;
+    while (start <= profiles.size()) {
+        size_t end = profiles.find(',', start);
+        std::string name = profiles.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        f.profiles.push_back(SimProfile_FromName(name.c_str()));
+        if (end == std::string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+    f.loaded = true;
+    LOG_INFO("%d virtual ports, profiles %s", f.ports, profiles.c_str());
+}
+
+SimPort *port_get(int id) {
+    farm_load();
+    if (id < 0 || id >= farm().ports) {
+        return nullptr;
+    }
+    return &farm().port[id];
+}
+
+// Wire time of one character with the current line settings.
+std::chrono::nanoseconds char_time(const SimPort &port) {
+    double bits = 1 + port.dataBits + (port.parity == 'N' ? 0 : 1) + port.stopBits;
+    return std::chrono::nanoseconds((int64_t) (bits * 1e9 / std::max(port.baudRate, 1)));
+}
+
+void emit(SimPort &port, Clock::time_point due, std::string data) {
+    port.pending.emplace_back(due, std::move(data));
+    port.wake.notify_all();
+}
+
+std::string log_line(SimPort &port) {
+    char line[96];
+    snprintf(line, sizeof(line), "[%8llu] port %d: sensor loop ok, heap 183204, rssi -61\n",
+             (unsigned long long) port.sequence++, port.id);
+    return line;
+}
+
+// Device thread: generates profile traffic and serialises pending output
+// onto the wire, one USB packet at a time.
+void device_run(SimPort *port) {
+    Farm &f = farm();
+    auto next_event = Clock::now();
+    std::unique_lock<std::mutex> lock(port->lock);
+    while (port->running) {
+        auto now = Clock::now();
+        if (now >= next_event) {
+            if (port->profile == SIM_PROFILE_TELEMETRY) {
+                char line[96];
+                snprintf(line, sizeof(line), "T %d %llu %lld\n", port->id, (unsigned long long) port->sequence++,
+                         (long long) std::chrono::duration_cast<std::chrono::microseconds>(
+                                 now.time_since_epoch()).count());
+                emit(*port, now, line);
+                next_event = now + std::chrono::microseconds(1000000 / f.telemetry_hz);
+            } else if (port->profile == SIM_PROFILE_BURST) {
+                std::string burst;
+                while ((int) burst.size() < f.burst_bytes) {
+                    burst += log_line(*port);
+                }
+                emit(*port, now, burst);
+                next_event = now + std::chrono::milliseconds(f.burst_period_ms);
+            } else {
+                next_event = now + std::chrono::hours(1);
+            }
+        }
+        if (!port->pending.empty() && port->pending.front().first <= now) {
+            std::string &head = port->pending.front().second;
+            size_t n = std::min(head.size(), USB_PACKET);
+            std::string packet = head.substr(0, n);
+            head.erase(0, n);
+            if (head.empty()) {
+                port->pending.pop_front();
+            }
+            auto wire = char_time(*port) * n;
+            lock.unlock();
+            RxRing_Push(port->id, (const int8_t *) packet.data(), (int) packet.size());
+            std::this_thread::sleep_until(now + wire);
+            lock.lock();
+            continue;
+        }
+        auto wake_at = next_event;
+        if (!port->pending.empty()) {
+            wake_at = std::min(wake_at, port->pending.front().first);
+        }
+        port->wake.wait_until(lock, wake_at);
+    }
+}
+
+// Called with the port lock held for bytes that reached the device.
+void device_input(SimPort &port, const int8_t *data, int length, Clock::time_point arrived) {
+    Farm &f = farm();
+    switch (port.profile) {
+        case SIM_PROFILE_ECHO:
+            emit(port, arrived, std::string((const char *) data, length));
+            break;
+        case SIM_PROFILE_REQRESP:
+            for (int i = 0; i < length; i++) {
+                port.request.push_back((char) data[i]);
+                if (data[i] == '\n') {
+                    emit(port, arrived + std::chrono::microseconds(f.latency_us), port.request);
+                    port.request.clear();
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+}
+
+extern "C" SimProfile SimProfile_FromName(const char *name) {
+    if (strcmp(name, "telemetry") == 0) return SIM_PROFILE_TELEMETRY;
+    if (strcmp(name, "burst") == 0) return SIM_PROFILE_BURST;
+    if (strcmp(name, "reqresp") == 0) return SIM_PROFILE_REQRESP;
+    return SIM_PROFILE_ECHO;
+}
+
+extern "C" int SimPort_Count(void) {
+    farm_load();
+    return farm().ports;
+}
+
+extern "C" SimProfile SimPort_Profile(int id) {
+    farm_load();
+    Farm &f = farm();
+    return f.profiles[id % f.profiles.size()];
+}
+
+extern "C" {
+
+// The Java open (enumeration, probe, reader start) costs SIM_OPEN_MS.
+static int sim_open(int id) {
+    SimPort *port = port_get(id);
+    if (!port || RxRing_Open(id, RX_RING_DEFAULT_CAPACITY) < 0) {
+        return -1;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(farm().open_ms));
+    std::lock_guard<std::mutex> guard(port->lock);
+    if (port->running) {
+        return 1;
+    }
+    port->id = id;
+    port->profile = SimPort_Profile(id);
+    port->pending.clear();
+    port->request.clear();
+    port->tx_busy_until = Clock::now();
+    port->running = true;
+    port->device = std::thread(device_run, port);
+    return 1;
+}
+
+static int sim_close(int id) {
+    SimPort *port = port_get(id);
+    if (!port) {
+        return 0;
+    }
+    {
+        std::lock_guard<std::mutex> guard(port->lock);
+        if (!port->running) {
+            return 0;
+        }
+        port->running = false;
+        port->wake.notify_all();
+    }
+    port->device.join();
+    RxRing_Close(id);
+    return 1;
+}
+
+int JavaMethod_OpenSerial(int id) {
+    return SessionPool_Open(id, sim_open);
+}
+
+int JavaMethod_CloseSerial(int id) {
+    return SessionPool_Close(id, sim_close);
+}
+
+int JavaMethod_ConfigureSerial(int id, int baudRate, int dataBits, float stopBits, char parity) {
+    SimPort *port = port_get(id);
+    if (!port) {
+        return 0;
+    }
+    if (SessionPool_SameConfig(id, baudRate, dataBits, stopBits, parity)) {
+        return 1;
+    }
+    std::lock_guard<std::mutex> guard(port->lock);
+    port->baudRate = baudRate;
+    port->dataBits = dataBits;
+    port->stopBits = stopBits;
+    port->parity = parity;
+    SessionPool_SetConfig(id, baudRate, dataBits, stopBits, parity);
+    return 1;
+}
+
+int JavaMethod_WriteSerial(int id, int8_t *data, int length, int64_t timeout) {
+    SimPort *port = port_get(id);
+    if (!port) {
+        return -1;
+    }
+    std::unique_lock<std::mutex> lock(port->lock);
+    if (!port->running) {
+        return -1;
+    }
+    // The host side shares the wire rate: the call returns once the adapter
+    // has room again, the device sees the bytes when the last one was sent.
+    auto now = Clock::now();
+    auto start = std::max(now, port->tx_busy_until);
+    port->tx_busy_until = start + char_time(*port) * length;
+    device_input(*port, data, length, port->tx_busy_until);
+    auto done = port->tx_busy_until - char_time(*port) * (int) USB_PACKET;
+    lock.unlock();
+    std::this_thread::sleep_until(done);
+    return 0;
+}
+
+// No chip flow control: RTS/CTS is emulated over the looped back RTS line.
+int JavaMethod_FlowControlSerial(int id, bool rtscts) {
+    return port_get(id) ? 0 : -1;
+}
+
+int JavaMethod_RtsSerialSet(int id, bool state) {
+    SimPort *port = port_get(id);
+    if (!port) {
+        return -1;
+    }
+    port->rts = state;
+    return 0;
+}
+
+bool JavaMethod_RtsSerialGet(int id) {
+    SimPort *port = port_get(id);
+    return port && port->rts;
+}
+
+int JavaMethod_DtrSerialSet(int id, bool state) {
+    SimPort *port = port_get(id);
+    if (!port) {
+        return -1;
+    }
+    port->dtr = state;
+    return 0;
+}
+
+bool JavaMethod_DtrSerialGet(int id) {
+    SimPort *port = port_get(id);
+    return port && port->dtr;
+}
+
+int JavaMethod_StatusSerial(int id, const char *name) {
+    SimPort *port = port_get(id);
+    if (!port || !port->running) {
+        return -1;
+    }
+    if (strcmp(name, "cts") == 0) return port->rts ? 1 : 0;
+    if (strcmp(name, "dsr") == 0 || strcmp(name, "cd") == 0) return port->dtr ? 1 : 0;
+    return 0;
+}
+
+}
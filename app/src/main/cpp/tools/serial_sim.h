@@ -0,0 +1,25 @@
+//
+// Virtual device farm that implements java_method.h on the host (serial_sim.cpp).
+//
+
+#ifndef SERIALSERVER_SERIAL_SIM_H
+#define SERIALSERVER_SERIAL_SIM_H
+
+typedef enum {
+    SIM_PROFILE_ECHO,       // sends back everything it receives
+    SIM_PROFILE_TELEMETRY,  // periodic timestamped status lines
+    SIM_PROFILE_BURST,      // periodic bursts of log lines at full wire rate
+    SIM_PROFILE_REQRESP,    // answers every request line after SIM_LATENCY_US
+} SimProfile;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+SimProfile SimProfile_FromName(const char *name);
+int SimPort_Count(void);
+SimProfile SimPort_Profile(int id);
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SERIALSERVER_SERIAL_SIM_H
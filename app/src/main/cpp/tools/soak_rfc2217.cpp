@@ -0,0 +1,546 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if 0
+#!/bin/bash
+# Soak test of the RFC2217 server restart loop against a loopback device (termux or Linux).
+# SOAK_CYCLES=2000 SOAK_BYTES=65536 SOAK_RESTART_EVERY=10 bash soak_rfc2217.cpp
+# SOAK_STUB=1: a stand-in librfc2217 module built into the tool, for hosts without main.dist
+set -e
+termux='/data/data/com.termux/files'
+src="$(dirname $0)/.."
+flags="-D__LINUX__ -O2 -g -Wall -I${src}/include -I${src}/tools -I${src}/tools/fake_jni -I${termux}/usr/include/python3.12"
+ld_flags="-L${termux}/usr/lib -lpython3.12 -ldl -lpthread -lm -L./main.dist -lrfc2217"
+if [ "$SOAK_STUB" = "1" ]; then
+    flags="$flags -DSOAK_STUB_SERVER"
+    ld_flags="$(python3.12-config --ldflags --embed) -lpthread"
+fi
+gcc -o serial.o -c ${src}/src/serial.c $flags
+g++ -std=c++17 -o soak ${src}/native-lib.cpp ${src}/tools/fake_jvm.cpp ${src}/src/rfc2217.cpp ${src}/src/rx_ring.cpp \
+    ${src}/src/rx_ring_module.cpp ${src}/src/capture.cpp ${src}/src/metrics.cpp ${src}/src/trace.cpp ${src}/src/log.cpp \
+    ${src}/src/watchdog.cpp ${src}/src/py_alloc.cpp ${src}/src/buffer_pool.cpp ${src}/src/thread_sched.cpp \
+    ${src}/src/port_sched.cpp ${src}/src/session_pool.cpp ${src}/src/usb_engine.cpp ${src}/src/tx_queue.cpp \
+    ${src}/src/modbus_gw.cpp ${src}/src/mux_server.cpp ${src}/src/telnet_zip.cpp ${src}/src/lz_stream.cpp \
+    ${src}/src/esp_accel.cpp ${src}/src/flow_ctl.cpp ${src}/src/line_config.cpp \
+    $0 serial.o $flags $ld_flags -Wl,-rpath,./
+rm -f serial.o
+if [ "$SOAK_STUB" = "1" ]; then
+    ./soak
+else
+    cp ./soak main.dist/
+    cd ./main.dist && ./soak
+fi
+exit 0
+#endif
+
+// Long-running leak check of the always-on service.
+//
+// The whole native side runs as on the device: native-lib.cpp on the fake VM
+// (fake_jvm.cpp) with a loopback adapter behind Serial.writeSerial/rxPush, and
+// a "service thread" calling rfc2217Start in the same endless loop as
+// SerialService. The main thread is the network client: every cycle it
+// connects, pushes SOAK_BYTES through the server and the device and checks the
+// echo, then disconnects. Every SOAK_RESTART_EVERY cycles the adapter is
+// unplugged, which makes the server exit and the loop start it again.
+//
+// Every SOAK_SAMPLE cycles a row is printed with RSS, open fds, the Python
+// reference count (sys.gettotalrefcount on a debug build, otherwise
+// sys.getallocatedblocks), gc-tracked objects, the reference counts of the
+// server's classes and the JNI global references. At the end each is
+// compared with the first row after SOAK_WARMUP cycles; the exit status is 1
+// if one grew beyond its allowance.
+//
+//   SOAK_CYCLES         client sessions (default 2000)
+//   SOAK_BYTES          echoed per session (default 65536)
+//   SOAK_RESTART_EVERY  unplug every n sessions, 0 never (default 10)
+//   SOAK_TCP_PORT       server port (default 22170)
+//   SOAK_SAMPLE         sessions between rows (default SOAK_CYCLES / 20)
+//   SOAK_WARMUP         sessions before the baseline row (default SOAK_CYCLES / 10)
+//   SOAK_RSS_KB         allowed RSS growth (default 4096)
+//   SOAK_PY_SLACK       allowed growth of the Python counts (default 2000)
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define PY_SSIZE_T_CLEAN
+#include <python3.12/Python.h>
+
+#include "fake_jvm.h"
+#include "mono_clock.h"
+#include "rx_ring.h"
+
+#define LOG_LEVEL LOG_LEVEL_INFO
+#include "log.h"
+
+#define SOAK_PORT_ID 0
+#define SOAK_CHUNK 1024
+
+extern "C" {
+JNIEXPORT void JNICALL Java_cc_axyz_serialserver_SerialService_rfc2217Init(JNIEnv *env, jobject thiz, jstring lib_path);
+JNIEXPORT void JNICALL Java_cc_axyz_serialserver_SerialService_rfc2217Start(JNIEnv *env, jobject thiz, jint port,
+                                                                           jint tcpPort, jint verbose);
+JNIEXPORT void JNICALL Java_cc_axyz_serialserver_Serial_rxPush(JNIEnv *env, jobject thiz, jint id, jbyteArray data);
+JNIEXPORT void JNICALL Java_cc_axyz_serialserver_Serial_sessionDrop(JNIEnv *env, jobject thiz, jint id);
+}
+
+#ifdef SOAK_STUB_SERVER
+// Same surface as the prebuilt module (SerialAndroid, RFC2217Server with
+// start_server()) as far as rfc2217.cpp uses it, but a raw TCP bridge without
+// telnet options. It waits on Serial.fileno(), so the event fds are soaked too.
+static const char *STUB_SERVER = R"PY(
+import select
+import socket
+
+
+class SerialAndroid:
+    def __init__(self, serial):
+        self.serial = serial
+        self.port = None
+
+
+class RFC2217Server:
+    def __init__(self, serial, local_port=2217, verbosity=0, r0=False):
+        self.serial = serial
+        self.local_port = local_port
+
+    def start_server(self):
+        listener = socket.create_server(('127.0.0.1', self.local_port))
+        try:
+            while True:
+                client, _ = listener.accept()
+                with client:
+                    self.serve(client)
+        finally:
+            listener.close()
+
+    def serve(self, client):
+        port = self.serial.serial
+        ok, message = port.open(self.serial.port)
+        if not ok:
+            raise OSError(message)
+        try:
+            fd = port.fileno()
+            while True:
+                readable, _, _ = select.select([client, fd], [], [], 1.0)
+                if client in readable:
+                    data = client.recv(4096)
+                    if not data:
+                        return
+                    port.write(data, 1.0)
+                if fd in readable:
+                    port.events()
+                    data = port.read_nowait(4096)
+                    if data:
+                        client.sendall(data)
+        finally:
+            port.close()
+)PY";
+
+extern "C" int init_start(const char *binary_filename, const int verbose) {
+    Py_Initialize();
+    PyObject *code = Py_CompileString(STUB_SERVER, "librfc2217_stub.py", Py_file_input);
+    PyObject *module = code ? PyImport_ExecCodeModule("librfc2217", code) : nullptr;
+    Py_XDECREF(code);
+    if (!module) {
+        PyErr_Print();
+        return -1;
+    }
+    Py_DECREF(module);
+    return 0;
+}
+
+// rfc2217.cpp keeps what it gets, so hand out a borrowed reference; sys.modules holds the module.
+extern "C" void *init_import_module(const char *name) {
+    PyObject *module = PyImport_ImportModule(name);
+    Py_XDECREF(module);
+    return module;
+}
+
+extern "C" void init_exit() {
+    Py_Finalize();
+}
+#endif
+
+// --- loopback adapter (the Java side) -----------------------------------------
+
+static JavaVM *vm;
+static std::atomic<int> unplugged{0};    // failures left before the adapter is back
+static std::atomic<int> restarts{0};
+
+// An unplug costs the server exactly one failed open or write, so it restarts once.
+static bool unplug_fail() {
+    int left = unplugged.load();
+    while (left > 0 && !unplugged.compare_exchange_weak(left, left - 1)) {
+    }
+    return left > 0;
+}
+
+static jvalue java_int(jint value) {
+    jvalue ret;
+    ret.i = value;
+    return ret;
+}
+
+static jvalue java_open(const jvalue *args) {
+    return java_int(unplug_fail() ? 0 : 1);
+}
+
+static jvalue java_ok(const jvalue *args) {
+    return java_int(1);
+}
+
+static jvalue java_false(const jvalue *args) {
+    jvalue ret;
+    ret.z = JNI_FALSE;
+    return ret;
+}
+
+// What the adapter receives comes straight back through the reader's rxPush.
+static jvalue java_write(const jvalue *args) {
+    if (unplug_fail()) {
+        return java_int(-1);
+    }
+    int length = args[2].i;
+    int capacity = 0;
+    const int8_t *data = FakeJvm_ArrayData(args[1].l, &capacity);
+    JNIEnv *env = nullptr;
+    vm->GetEnv((void **) &env, JNI_VERSION_1_4);
+    jbyteArray packet = env->NewByteArray(length);
+    env->SetByteArrayRegion(packet, 0, length, data);
+    Java_cc_axyz_serialserver_Serial_rxPush(env, nullptr, args[0].i, packet);
+    env->DeleteLocalRef(packet);
+    return java_int(length);
+}
+
+static jvalue java_status(const jvalue *args) {
+    return java_int(0);
+}
+
+// --- client -------------------------------------------------------------------
+
+static int env_int(const char *name, int fallback) {
+    const char *value = getenv(name);
+    return value && *value ? atoi(value) : fallback;
+}
+
+static int client_connect(int tcpPort, int64_t timeout) {
+    int64_t deadline = MonoClock_Now() + timeout;
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(tcpPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    while (MonoClock_Now() < deadline) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            struct timeval tv = {2, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+// Received payload with telnet commands taken out (the real server negotiates
+// RFC2217 options on connect); returns false on timeout or disconnect.
+struct TelnetFilter {
+    int state = 0;
+
+    void feed(const uint8_t *data, int n, std::vector<uint8_t> &out) {
+        for (int i = 0; i < n; i++) {
+            uint8_t c = data[i];
+            switch (state) {
+                case 0:
+                    if (c == 0xff) {
+                        state = 1;
+                    } else {
+                        out.push_back(c);
+                    }
+                    break;
+                case 1:  // after IAC
+                    if (c == 0xff) {
+                        out.push_back(c);
+                        state = 0;
+                    } else if (c == 250) {
+                        state = 3;
+                    } else if (c >= 251) {
+                        state = 2;
+                    } else {
+                        state = 0;
+                    }
+                    break;
+                case 2:  // option of WILL/WONT/DO/DONT
+                    state = 0;
+                    break;
+                case 3:  // subnegotiation up to IAC SE
+                    state = c == 0xff ? 4 : 3;
+                    break;
+                case 4:
+                    state = c == 240 ? 0 : 3;
+                    break;
+            }
+        }
+    }
+};
+
+// One session: the pattern avoids 0xff so it needs no telnet escaping.
+static bool client_session(int tcpPort, int bytes, uint8_t &seed) {
+    int fd = client_connect(tcpPort, 10 * NS_PER_SEC);
+    if (fd < 0) {
+        return false;
+    }
+    TelnetFilter telnet;
+    std::vector<uint8_t> sent;
+    std::vector<uint8_t> received;
+    uint8_t chunk[SOAK_CHUNK];
+    uint8_t in[4096];
+    bool ok = true;
+    while (ok && (int) sent.size() < bytes) {
+        int n = bytes - (int) sent.size() < SOAK_CHUNK ? bytes - (int) sent.size() : SOAK_CHUNK;
+        for (int i = 0; i < n; i++) {
+            chunk[i] = seed;
+            seed = seed == 0xfe ? 0 : seed + 1;
+        }
+        ok = send(fd, chunk, n, MSG_NOSIGNAL) == n;
+        sent.insert(sent.end(), chunk, chunk + n);
+        while (ok && received.size() < sent.size()) {
+            ssize_t r = recv(fd, in, sizeof(in), 0);
+            ok = r > 0;
+            if (ok) {
+                telnet.feed(in, (int) r, received);
+            }
+        }
+    }
+    close(fd);
+    return ok && received == sent;
+}
+
+// --- sampling -----------------------------------------------------------------
+
+struct Sample {
+    int cycle;
+    int restarts;
+    long rss_kb;
+    int fds;
+    long long py_refs;
+    long long py_objects;
+    long long class_refs;
+    long long jni_globals;
+};
+
+static long rss_kb() {
+    long pages = 0;
+    long resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int open_fds() {
+    int count = 0;
+    DIR *dir = opendir("/proc/self/fd");
+    if (!dir) {
+        return -1;
+    }
+    while (struct dirent *entry = readdir(dir)) {
+        if (entry->d_name[0] != '.') {
+            count++;
+        }
+    }
+    closedir(dir);
+    return count - 1;  // the directory itself
+}
+
+
+static const char *PY_PROBE =
+        "(lambda sys, gc: (getattr(sys, 'gettotalrefcount', sys.getallocatedblocks)(), len(gc.get_objects()),"
+        " sum(sys.getrefcount(getattr(sys.modules['librfc2217'], name))"
+        " for name in ('SerialAndroid', 'RFC2217Server')) if 'librfc2217' in sys.modules else 0))"
+        "(__import__('sys'), __import__('gc'))";
+
+static void py_probe(Sample &s) {
+    s.py_refs = s.py_objects = s.class_refs = -1;
+    if (!Py_IsInitialized()) {
+        return;
+    }
+    PyGILState_STATE gil = PyGILState_Ensure();
+    PyObject *globals = PyDict_New();
+    PyObject *result = nullptr;
+    if (globals && PyDict_SetItemString(globals, "__builtins__", PyEval_GetBuiltins()) == 0) {
+        result = PyRun_String(PY_PROBE, Py_eval_input, globals, globals);
+    }
+    if (!result || !PyArg_ParseTuple(result, "LLL", &s.py_refs, &s.py_objects, &s.class_refs)) {
+        PyErr_Print();
+    }
+    Py_XDECREF(result);
+    Py_XDECREF(globals);
+    PyGILState_Release(gil);
+}
+
+// The server may still be closing the last session's socket, or a server
+// instance (holding its class) may be on its way out; take the lowest of a few looks.
+static Sample sample(int cycle) {
+    Sample s = {};
+    s.cycle = cycle;
+    s.restarts = restarts.load();
+    s.rss_kb = rss_kb();
+    s.fds = open_fds();
+    py_probe(s);
+    for (int i = 0; i < 5; i++) {
+        usleep(20000);
+        Sample look = s;
+        look.fds = open_fds();
+        py_probe(look);
+        s.fds = look.fds < s.fds ? look.fds : s.fds;
+        s.class_refs = look.class_refs < s.class_refs ? look.class_refs : s.class_refs;
+    }
+    FakeJvmStats stats;
+    FakeJvm_Stats(&stats);
+    s.jni_globals = stats.globals;
+    printf("%8d %8d %10ld %6d %12lld %10lld %8lld %8lld\n", s.cycle, s.restarts, s.rss_kb, s.fds, s.py_refs,
+           s.py_objects, s.class_refs, s.jni_globals);
+    fflush(stdout);
+    return s;
+}
+
+static bool check(const char *what, long long base, long long last, long long allowed) {
+    long long growth = last - base;
+    bool ok = growth <= allowed;
+    printf("  %-12s %+lld (allowed %lld) %s\n", what, growth, allowed, ok ? "ok" : "GROWING");
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int cycles = env_int("SOAK_CYCLES", 2000);
+    int bytes = env_int("SOAK_BYTES", 65536);
+    int restartEvery = env_int("SOAK_RESTART_EVERY", 10);
+    int tcpPort = env_int("SOAK_TCP_PORT", 22170);
+    int every = env_int("SOAK_SAMPLE", cycles / 20 > 0 ? cycles / 20 : 1);
+    int warmup = env_int("SOAK_WARMUP", cycles / 10);
+    int rssAllowed = env_int("SOAK_RSS_KB", 4096);
+    int pyAllowed = env_int("SOAK_PY_SLACK", 2000);
+
+    // Per-session open/close messages would drown the table.
+    if (!getenv("SERIAL_LOG")) {
+        Log_SetLevel("*", LOG_LEVEL_WARN);
+    }
+
+    FakeJvmConfig config = {};
+    vm = FakeJvm_Create(&config);
+    FakeJvm_Define("openSerial", "(I)I", java_open);
+    FakeJvm_Define("closeSerial", "(I)I", java_ok);
+    FakeJvm_Define("configureSerial", "(IIIFC)I", java_ok);
+    FakeJvm_Define("writeSerial", "(I[BIJ)I", java_write);
+    FakeJvm_Define("rtsSerialSet", "(IZ)I", java_ok);
+    FakeJvm_Define("rtsSerialGet", "(I)Z", java_false);
+    FakeJvm_Define("dtrSerialSet", "(IZ)I", java_ok);
+    FakeJvm_Define("dtrSerialGet", "(I)Z", java_false);
+    FakeJvm_Define("statusSerial", "(ILjava/lang/String;)I", java_status);
+
+    // SerialService: load the library, init once, then restart the server forever.
+    std::thread([tcpPort] {
+        JNIEnv *env = FakeJvm_AttachPermanently();
+        JNI_OnLoad(vm, nullptr);
+        jstring dir = env->NewStringUTF(".");
+        Java_cc_axyz_serialserver_SerialService_rfc2217Init(env, nullptr, dir);
+        env->DeleteLocalRef(dir);
+        for (;;) {
+            Java_cc_axyz_serialserver_SerialService_rfc2217Start(env, nullptr, -1, tcpPort, 0);
+            restarts++;
+            usleep(50000);
+        }
+    }).detach();
+
+    printf("soak: %d sessions of %d bytes, unplug every %d, tcp %d\n", cycles, bytes, restartEvery, tcpPort);
+    printf("%8s %8s %10s %6s %12s %10s %8s %8s\n", "session", "restarts", "rss_kb", "fds", "py_refs", "py_objects",
+           "classes", "jni_refs");
+    uint8_t seed = 0;
+    int failed = 0;
+    Sample base = {};
+    Sample last = {};
+    bool haveBase = false;
+    for (int cycle = 1; cycle <= cycles; cycle++) {
+        if (!client_session(tcpPort, bytes, seed)) {
+            failed++;
+            LOG_WARN("session %d: echo incomplete", cycle);
+        }
+        if (restartEvery > 0 && cycle % restartEvery == 0) {
+            // Unplugged: the next write fails, the server exits and the service loop starts it again.
+            int before = restarts.load();
+            unplugged = 1;
+            JNIEnv *env = FakeJvm_AttachPermanently();
+            Java_cc_axyz_serialserver_Serial_sessionDrop(env, nullptr, SOAK_PORT_ID);
+            int64_t deadline = MonoClock_Now() + 10 * NS_PER_SEC;
+            while (restarts.load() == before && MonoClock_Now() < deadline) {
+                client_session(tcpPort, 1, seed);
+            }
+            unplugged = 0;
+            if (restarts.load() == before) {
+                LOG_WARN("session %d: server did not restart after the unplug", cycle);
+            }
+        }
+        if (cycle % every == 0 || cycle == cycles) {
+            last = sample(cycle);
+            if (!haveBase && cycle >= warmup) {
+                base = last;
+                haveBase = true;
+            }
+        }
+    }
+
+    printf("growth since session %d:\n", base.cycle);
+    bool ok = failed == 0;
+    ok &= check("rss_kb", base.rss_kb, last.rss_kb, rssAllowed);
+    ok &= check("fds", base.fds, last.fds, 0);
+    ok &= check("py_refs", base.py_refs, last.py_refs, pyAllowed);
+    ok &= check("py_objects", base.py_objects, last.py_objects, pyAllowed);
+    ok &= check("classes", base.class_refs, last.class_refs, 0);
+    ok &= check("jni_refs", base.jni_globals, last.jni_globals, 0);
+    printf("%d failed sessions, %d restarts: %s\n", failed, restarts.load(), ok ? "PASS" : "FAIL");
+    fflush(stdout);
+    Log_Flush();
+    // The server thread is still inside Python; leave without finalizing it.
+    _exit(ok ? 0 : 1);
+}
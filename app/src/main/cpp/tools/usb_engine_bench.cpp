@@ -0,0 +1,157 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if 0
+#!/bin/bash
+# bash usb_engine_bench.cpp [seconds] [baud]
+# Environment: BENCH_FTDI=1, BENCH_STALL_EVERY=50, BENCH_STALL_US=8000, BENCH_LATENCY_US=200
+set -e
+src="$(dirname $0)/.."
+flags="-std=c++17 -D__LINUX__ -O2 -g -Wall -I${src}/include -I${src}/tools"
+g++ $flags -o /tmp/usb_engine_bench $0 ${src}/tools/usbfs_mock.cpp ${src}/src/usb_engine.cpp ${src}/src/rx_ring.cpp \
+    ${src}/src/buffer_pool.cpp ${src}/src/capture.cpp ${src}/src/metrics.cpp ${src}/src/trace.cpp ${src}/src/log.cpp ${src}/src/watchdog.cpp \
+    ${src}/src/thread_sched.cpp -lpthread
+/tmp/usb_engine_bench "$@"
+exit 0
+#endif
+
+// Runs usb_engine.cpp against the fake adapter in usbfs_mock.cpp, once with a
+// single bulk-IN URB (what a one-request read loop does) and once with the
+// default queue, and reports received throughput, FIFO overruns and gaps in
+// the counter pattern. A loopback pass then measures bulk-OUT writes.
+//
+// The mock holds back the reaper now and then (BENCH_STALL_*), standing in for
+// a descheduled or GC-paused reader thread.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "mono_clock.h"
+#include "rx_ring.h"
+#include "usb_engine.h"
+#include "usbfs_mock.h"
+
+using Clock = std::chrono::steady_clock;
+
+static int env_int(const char *name, int fallback) {
+    const char *value = getenv(name);
+    return value && *value ? atoi(value) : fallback;
+}
+
+static UsbMockConfig mock_config(int baud) {
+    UsbMockConfig c = {};
+    c.baud = baud;
+    c.fifo = env_int("BENCH_FIFO", 512);
+    c.ftdi = env_int("BENCH_FTDI", 0);
+    c.latency_us = env_int("BENCH_LATENCY_US", 200);
+    c.stall_every = env_int("BENCH_STALL_EVERY", 50);
+    c.stall_us = env_int("BENCH_STALL_US", 8000);
+    return c;
+}
+
+static void rx_pass(int urbs, int seconds, int baud) {
+    UsbMockConfig c = mock_config(baud);
+    UsbMock_Start(&c);
+    RxRing_Open(0, RX_RING_DEFAULT_CAPACITY);
+    if (UsbEngine_Start(0, USB_MOCK_FD, c.ftdi ? USB_FRAMING_FTDI : USB_FRAMING_RAW, 0x81, 0x02, 64, urbs, 0) != 0) {
+        fprintf(stderr, "engine start failed\n");
+        exit(1);
+    }
+    std::atomic<bool> done{false};
+    uint64_t received = 0, gaps = 0;
+    std::thread reader([&] {
+        std::vector<int8_t> buffer(16384);
+        uint8_t expect = 0;
+        while (!done.load()) {
+            int n = RxRing_Read(0, buffer.data(), (int) buffer.size(), 50 * NS_PER_MS);
+            for (int i = 0; i < n; i++) {
+                if ((uint8_t) buffer[i] != expect) {
+                    gaps++;
+                }
+                expect = (uint8_t) buffer[i] + 1;
+            }
+            received += n > 0 ? n : 0;
+        }
+    });
+    Clock::time_point start = Clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    UsbEngineStats es;
+    UsbEngine_Stats(0, &es);
+    UsbEngine_Stop(0);
+    UsbMock_Stop();
+    done = true;
+    reader.join();
+    RxRing_Close(0);
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    UsbMockStats ms;
+    UsbMock_Stats(&ms);
+    printf("%2d urb%s  %8.1f KiB/s  wire %9llu  overrun %7llu (%.2f%%)  gaps %5llu  urbs %7llu  line errors %llu\n",
+           urbs, urbs == 1 ? " " : "s", received / 1024.0 / elapsed, (unsigned long long) ms.produced,
+           (unsigned long long) ms.overruns, ms.produced ? 100.0 * ms.overruns / ms.produced : 0.0,
+           (unsigned long long) gaps, (unsigned long long) es.in_urbs, (unsigned long long) es.line_errors);
+}
+
+static void tx_pass(int urbs, int seconds) {
+    UsbMockConfig c = mock_config(0);
+    c.loopback = 1;
+    c.stall_every = 0;
+    UsbMock_Start(&c);
+    RxRing_Open(0, RX_RING_DEFAULT_CAPACITY);
+    UsbEngine_Start(0, USB_MOCK_FD, USB_FRAMING_RAW, 0x81, 0x02, 64, urbs, 0);
+    std::vector<int8_t> block(16384);
+    uint64_t sent = 0;
+    int failed = 0;
+    Clock::time_point start = Clock::now();
+    Clock::time_point end = start + std::chrono::seconds(seconds);
+    while (Clock::now() < end) {
+        if (UsbEngine_Write(0, block.data(), (int) block.size(), NS_PER_SEC) != 0) {
+            failed++;
+        } else {
+            sent += block.size();
+        }
+        RxRing_Reset(0);
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    UsbEngine_Stop(0);
+    UsbMock_Stop();
+    RxRing_Close(0);
+    printf("%2d urb%s  write %8.1f KiB/s  failed %d\n", urbs, urbs == 1 ? " " : "s", sent / 1024.0 / elapsed, failed);
+}
+
+int main(int argc, char *argv[]) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 3;
+    int baud = argc > 2 ? atoi(argv[2]) : 921600;
+    UsbEngine_SetOps(UsbMock_Ops());
+    printf("bulk-in at %d baud for %d s\n", baud, seconds);
+    rx_pass(1, seconds, baud);
+    rx_pass(USB_ENGINE_DEFAULT_URBS, seconds, baud);
+    printf("bulk-out loopback\n");
+    tx_pass(1, seconds);
+    tx_pass(USB_ENGINE_DEFAULT_URBS, seconds);
+    return 0;
+}
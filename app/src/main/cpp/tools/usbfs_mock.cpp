@@ -0,0 +1,267 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2025 by ailearncoder <panxuesen520@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Every 1 ms frame the wire adds baud / 10 bytes to the device FIFO, dropping
+// what does not fit. The device then answers the oldest bulk-IN URB with up
+// to FRAME_PACKETS max-size packets; a short packet ends the URB. Without a
+// URB queued the device NAKs and the FIFO keeps filling, which is what a slow
+// resubmit looks like on real hardware. Payload is a running byte counter so
+// the reader can spot lost data.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <linux/usbdevice_fs.h>
+#include <sys/ioctl.h>
+
+#include "usbfs_mock.h"
+
+using Clock = std::chrono::steady_clock;
+
+#define MAX_PACKET 64
+#define FRAME_PACKETS 19
+#define FTDI_OVERRUN 0x02
+
+struct Done {
+    Clock::time_point ready;
+    struct usbdevfs_urb *urb;
+};
+
+static std::mutex lock;
+static std::condition_variable reapable;
+static std::deque<struct usbdevfs_urb *> inQueue;
+static std::deque<struct usbdevfs_urb *> outQueue;
+static std::deque<Done> doneQueue;
+static std::deque<uint8_t> fifo;
+static UsbMockConfig config;
+static UsbMockStats stats;
+static uint8_t counter;
+static double carry;
+static bool overrun;
+static bool running;
+static unsigned completions;
+static std::thread bus;
+
+static void complete(struct usbdevfs_urb *urb, int status, Clock::time_point now) {
+    urb->status = status;
+    Clock::time_point ready = now + std::chrono::microseconds(config.latency_us);
+    completions++;
+    if (config.stall_every > 0 && completions % config.stall_every == 0) {
+        ready += std::chrono::microseconds(config.stall_us);
+    }
+    // The reaper sees completions in order, a stall holds back everything behind it.
+    if (!doneQueue.empty() && doneQueue.back().ready > ready) {
+        ready = doneQueue.back().ready;
+    }
+    doneQueue.push_back({ready, urb});
+    reapable.notify_all();
+}
+
+static void wire(size_t bytes, const uint8_t *data) {
+    for (size_t i = 0; i < bytes; i++) {
+        stats.produced++;
+        uint8_t value = data ? data[i] : counter++;
+        if (fifo.size() >= (size_t) config.fifo) {
+            stats.overruns++;
+            overrun = true;
+            continue;
+        }
+        fifo.push_back(value);
+    }
+}
+
+static void frame(Clock::time_point now) {
+    if (!config.loopback) {
+        carry += config.baud / 10.0 / 1000.0;
+        wire((size_t) carry, nullptr);
+        carry -= (size_t) carry;
+    }
+    int packets = FRAME_PACKETS;
+    while (packets > 0 && !outQueue.empty()) {
+        struct usbdevfs_urb *urb = outQueue.front();
+        int n = std::min(urb->buffer_length - urb->actual_length, MAX_PACKET);
+        if (config.loopback) {
+            wire(n, (const uint8_t *) urb->buffer + urb->actual_length);
+        }
+        urb->actual_length += n;
+        stats.received += n;
+        packets--;
+        if (urb->actual_length == urb->buffer_length) {
+            outQueue.pop_front();
+            complete(urb, 0, now);
+        }
+    }
+    int payload = config.ftdi ? MAX_PACKET - 2 : MAX_PACKET;
+    while (packets > 0 && !inQueue.empty() && !fifo.empty()) {
+        struct usbdevfs_urb *urb = inQueue.front();
+        auto *buffer = (uint8_t *) urb->buffer;
+        bool shortPacket = false;
+        while (packets > 0 && urb->actual_length + MAX_PACKET <= urb->buffer_length) {
+            int n = std::min((int) fifo.size(), payload);
+            if (config.ftdi) {
+                buffer[urb->actual_length++] = 0x01;
+                buffer[urb->actual_length++] = overrun ? 0x60 | FTDI_OVERRUN : 0x60;
+                overrun = false;
+            }
+            std::copy(fifo.begin(), fifo.begin() + n, buffer + urb->actual_length);
+            fifo.erase(fifo.begin(), fifo.begin() + n);
+            urb->actual_length += n;
+            stats.delivered += n;
+            packets--;
+            if (n < payload) {
+                shortPacket = true;
+                break;
+            }
+        }
+        if (shortPacket || urb->actual_length + MAX_PACKET > urb->buffer_length) {
+            inQueue.pop_front();
+            complete(urb, 0, now);
+        }
+    }
+}
+
+static void bus_run() {
+    Clock::time_point next = Clock::now();
+    std::unique_lock<std::mutex> guard(lock);
+    while (running) {
+        next += std::chrono::milliseconds(1);
+        guard.unlock();
+        std::this_thread::sleep_until(next);
+        guard.lock();
+        frame(Clock::now());
+    }
+}
+
+static bool discard(std::deque<struct usbdevfs_urb *> &queue, struct usbdevfs_urb *urb) {
+    auto it = std::find(queue.begin(), queue.end(), urb);
+    if (it == queue.end()) {
+        return false;
+    }
+    queue.erase(it);
+    complete(urb, -ENOENT, Clock::now());
+    return true;
+}
+
+static int mock_ioctl(int fd, unsigned long request, void *arg) {
+    if (fd != USB_MOCK_FD) {
+        errno = EBADF;
+        return -1;
+    }
+    std::unique_lock<std::mutex> guard(lock);
+    auto *urb = (struct usbdevfs_urb *) arg;
+    switch (request) {
+        case USBDEVFS_SUBMITURB:
+            if (!running) {
+                errno = ENODEV;
+                return -1;
+            }
+            urb->actual_length = 0;
+            urb->status = -EINPROGRESS;
+            (urb->endpoint & 0x80 ? inQueue : outQueue).push_back(urb);
+            return 0;
+        case USBDEVFS_DISCARDURB:
+            if (discard(inQueue, urb) || discard(outQueue, urb)) {
+                return 0;
+            }
+            errno = EINVAL;
+            return -1;
+        case USBDEVFS_REAPURB:
+            for (;;) {
+                if (!doneQueue.empty()) {
+                    Clock::time_point ready = doneQueue.front().ready;
+                    if (ready <= Clock::now()) {
+                        *(void **) arg = doneQueue.front().urb;
+                        doneQueue.pop_front();
+                        return 0;
+                    }
+                    reapable.wait_until(guard, ready);
+                } else if (!running && inQueue.empty() && outQueue.empty()) {
+                    errno = ENODEV;
+                    return -1;
+                } else {
+                    reapable.wait(guard);
+                }
+            }
+        default:
+            errno = ENOTTY;
+            return -1;
+    }
+}
+
+static const UsbOps mockOps = {mock_ioctl};
+
+extern "C" {
+
+void UsbMock_Start(const UsbMockConfig *c) {
+    UsbMock_Stop();
+    std::lock_guard<std::mutex> guard(lock);
+    config = *c;
+    config.fifo = config.fifo > 0 ? config.fifo : 512;
+    stats = UsbMockStats();
+    fifo.clear();
+    counter = 0;
+    carry = 0;
+    overrun = false;
+    completions = 0;
+    running = true;
+    bus = std::thread(bus_run);
+}
+
+// Unplugs the device: queued URBs complete with -ENODEV.
+void UsbMock_Stop(void) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!running) {
+            return;
+        }
+        running = false;
+    }
+    bus.join();
+    std::lock_guard<std::mutex> guard(lock);
+    Clock::time_point now = Clock::now();
+    for (auto *queue : {&inQueue, &outQueue}) {
+        for (struct usbdevfs_urb *urb : *queue) {
+            complete(urb, -ENODEV, now);
+        }
+        queue->clear();
+    }
+    reapable.notify_all();
+}
+
+const UsbOps *UsbMock_Ops(void) {
+    return &mockOps;
+}
+
+void UsbMock_Stats(UsbMockStats *s) {
+    std::lock_guard<std::mutex> guard(lock);
+    *s = stats;
+}
+
+}
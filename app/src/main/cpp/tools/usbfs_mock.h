@@ -0,0 +1,44 @@
+//
+// Fake full-speed USB serial adapter behind the usbfs ioctls (usbfs_mock.cpp),
+// for running usb_engine.cpp on the host.
+//
+
+#ifndef SERIALSERVER_USBFS_MOCK_H
+#define SERIALSERVER_USBFS_MOCK_H
+
+#include <stdint.h>
+
+#include "usb_engine.h"
+
+#define USB_MOCK_FD 1000
+
+typedef struct {
+    int baud;             // rate the device receives from the wire (8N1)
+    int fifo;             // device receive FIFO in bytes
+    int ftdi;             // add FTDI status bytes to every packet
+    int loopback;         // bulk-OUT data comes back on bulk-IN instead of the counter pattern
+    int latency_us;       // completion to REAPURB return
+    int stall_every;      // every n-th completion the reaper is held back by stall_us
+    int stall_us;
+} UsbMockConfig;
+
+typedef struct {
+    uint64_t produced;    // bytes that arrived on the wire
+    uint64_t overruns;    // bytes dropped because the FIFO was full
+    uint64_t delivered;   // payload bytes handed out in bulk-IN URBs
+    uint64_t received;    // bytes taken from bulk-OUT URBs
+} UsbMockStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Resets the device and starts the 1 ms frame clock.
+void UsbMock_Start(const UsbMockConfig *config);
+void UsbMock_Stop(void);
+const UsbOps *UsbMock_Ops(void);
+void UsbMock_Stats(UsbMockStats *stats);
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SERIALSERVER_USBFS_MOCK_H
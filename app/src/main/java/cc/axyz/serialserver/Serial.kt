@@ -28,19 +28,21 @@ import android.annotation.SuppressLint
 import android.app.PendingIntent
 import android.content.Context
 import android.content.Intent
+import android.hardware.usb.UsbDevice
 import android.hardware.usb.UsbDeviceConnection
 import android.hardware.usb.UsbManager
+import android.os.Trace
 import android.util.Log
 import com.hoho.android.usbserial.BuildConfig
+import com.hoho.android.usbserial.driver.FtdiSerialDriver
 import com.hoho.android.usbserial.driver.UsbSerialPort
 import com.hoho.android.usbserial.driver.UsbSerialProber
 import com.hoho.android.usbserial.util.SerialInputOutputManager
 import org.json.JSONArray
 import org.json.JSONObject
+import java.io.IOException
 import java.util.concurrent.Semaphore
 import java.util.concurrent.TimeUnit
-import java.util.concurrent.locks.Condition
-import java.util.concurrent.locks.ReentrantLock
 
 
 class Serial {
@@ -57,29 +59,16 @@ class Serial {
         var stopBits: Float = -1.0f,
         var parity: Char = 'N',
         var port: UsbSerialPort? = null,
-        var data: ArrayList<Byte> = arrayListOf(),
-        val lock : ReentrantLock = ReentrantLock(),
-        val notEmpty: Condition = lock.newCondition(),
         var usbIoManager : SerialInputOutputManager? = null,
         var info: String = "",
-        var deviceId: Int = -1
+        var deviceId: Int = -1,
+        var nativeUsb: Boolean = false
     )
     
-    class SerialInputOutputManagerListener(private val serialInstance: SerialInstance) : SerialInputOutputManager.Listener {
+    class SerialInputOutputManagerListener(private val id: Int, private val serialInstance: SerialInstance) : SerialInputOutputManager.Listener {
         override fun onNewData(data: ByteArray) {
-            // Handle the new incoming data
-            Log.d(TAG, "onNewData: Received new data ${data.size} bytes")
-            // 这里可以添加你的数据处理逻辑
-            serialInstance.lock.lock()
-            try {
-                val buffer = serialInstance.data
-                for (byte in data) {
-                    buffer.add(byte)
-                }
-                serialInstance.notEmpty.signalAll()
-            } finally {
-                serialInstance.lock.unlock()
-            }
+            // 数据直接写入 native 接收缓冲区 (rx_ring.cpp)
+            rxPush(id, data)
         }
 
         override fun onRunError(e: java.lang.Exception?) {
@@ -99,6 +88,12 @@ class Serial {
         private val signalPermission = Semaphore(0)
         private var classLoader: ClassLoader? = Serial::class.java.getClassLoader()
         private val lock = Any()
+        // 数据端点交给 native usbfs 引擎 (usb_engine.cpp), 由 SerialService 的 "usb_engine" 参数打开
+        @Volatile
+        var nativeUsb = false
+        // native 端口号 -> USB 串口设备, 由 SerialService 的 "port_map" 参数设置, 见 deviceFor()
+        @Volatile
+        private var portMap: Map<Int, String> = emptyMap()
         
         private fun usbSerialAdd(id: Int, serialInstance: SerialInstance) {
             synchronized(lock) {
@@ -128,25 +123,6 @@ class Serial {
             context.startForegroundService(serviceIntent)
         }
 
-        private fun printBytes(msg: String, bytes: ArrayList<Byte>?) {
-            if (bytes == null) return
-            val stringBuilder = StringBuilder()
-            if (bytes.size <= 32) {
-                for (i in 0 until bytes.size) {
-                    stringBuilder.append(String.format("%02X ", bytes[i]))
-                }
-            } else {
-                for (i in 0 until 16) {
-                    stringBuilder.append(String.format("%02X ", bytes[i]))
-                }
-                stringBuilder.append("... ")
-                for (i in bytes.size - 16 until bytes.size) {
-                    stringBuilder.append(String.format("%02X ", bytes[i]))
-                }
-            }
-            Log.d(TAG, "$msg: $stringBuilder")
-        }
-
         fun usbStateChanged() {
             val usbManager = context.getSystemService(Context.USB_SERVICE) as UsbManager
             val deviceSets = HashSet<Int>()
@@ -159,6 +135,11 @@ class Serial {
                     val entry = iterator.next()
                     // Check if the device is still connected.
                     if (!deviceSets.contains(entry.value.deviceId)) {
+                        // 空闲保持中的会话不能再复用
+                        sessionDrop(entry.key)
+                        if (entry.value.nativeUsb) {
+                            usbEngineStop(entry.key)
+                        }
                         entry.value.port?.close()
                         entry.value.usbIoManager?.stop()
                         iterator.remove()
@@ -220,14 +201,49 @@ class Serial {
             return list
         }
 
-        private fun idExist(id: Int) : Boolean {
+        private fun idExist(deviceId: Int) : Boolean {
             val usbManager = context.getSystemService(Context.USB_SERVICE) as UsbManager
             for (device in usbManager.getDeviceList().values) {
-                if(id == device.deviceId) return true
+                if(deviceId == device.deviceId) return true
             }
             return false
         }
 
+        // "端口号=设备,..." 例如 "1=1003,2=0403:6001", 设备是 deviceId 或十六进制 VID:PID; 格式错误时不改动
+        fun setPortMap(spec: String): Boolean {
+            val map = HashMap<Int, String>()
+            for (item in spec.split(',').map { it.trim() }.filter { it.isNotEmpty() }) {
+                val parts = item.split('=')
+                val id = parts.getOrNull(0)?.trim()?.toIntOrNull()
+                val device = parts.getOrNull(1)?.trim()?.lowercase()
+                if (parts.size != 2 || id == null || id < 0 || device.isNullOrEmpty()) {
+                    Log.w(TAG, "setPortMap: invalid entry $item")
+                    return false
+                }
+                map[id] = device
+            }
+            portMap = map
+            Log.i(TAG, "setPortMap: $map")
+            return true
+        }
+
+        // native 端口号对应的 USB 设备. port_map 里配置的优先; 否则端口 n (n >= 1) 是按 deviceId 排序的
+        // 第 n 个串口设备, 端口 0 (RFC2217 服务) 和端口 1 是同一个设备. deviceId 每次插拔都会变, 排序保证
+        // 同一组设备插着时编号不变
+        private fun deviceFor(usbManager: UsbManager, id: Int): UsbDevice? {
+            val prober = UsbSerialProber.getDefaultProber()
+            val devices = usbManager.deviceList.values
+                .filter { prober.probeDevice(it) != null }
+                .sortedBy { it.deviceId }
+            val key = portMap[id]
+            if (key != null) {
+                return devices.firstOrNull {
+                    key == it.deviceId.toString() || key == String.format("%04x:%04x", it.vendorId, it.productId)
+                }
+            }
+            return devices.getOrNull(if (id == 0) 0 else id - 1)
+        }
+
         fun requestSerial(id: Int) : Int {
             val usbManager = context.getSystemService(Context.USB_SERVICE) as UsbManager
             for (device in usbManager.getDeviceList().values) {
@@ -253,39 +269,58 @@ class Serial {
             val usbManager = context.getSystemService(Context.USB_SERVICE) as UsbManager
             val usbDefaultProbe = UsbSerialProber.getDefaultProber()
 
-            for (device in usbManager.getDeviceList().values) {
-                if (id == device.deviceId || id == 0) {
-                    permission = false
-                    if (!usbManager.hasPermission(device)) {
-                        Log.d(TAG, "openSerial: Requesting permission for device $id") // 添加日志
-                        requestSerial(device.deviceId)
-                        signalPermission.tryAcquire(10, TimeUnit.SECONDS)
-                        if (!permission) {
-                            Log.w(TAG, "openSerial: Permission request timed out for device $id") // 添加日志
-                            return 0
-                        }
-                    }
-                    val driver = usbDefaultProbe.probeDevice(device)
-                    if (driver != null) {
-                        val port = driver.ports[0]
-                        val connection: UsbDeviceConnection = usbManager.openDevice(driver.device)
-                        port.open(connection)
-                        val instance = SerialInstance()
-                        instance.port = port
-                        val listener = SerialInputOutputManagerListener(instance)
-                        instance.usbIoManager = SerialInputOutputManager(port, listener)
-                        val driverName = driver::class.simpleName?.replace("SerialDriver", "")
-                        instance.info = String.format("%s %X:%X", driverName, device.vendorId, device.productId)
-                        instance.deviceId = device.deviceId
-                        serviceNotify("串口打开: ${instance.info}")
-                        instance.usbIoManager!!.start()
-                        usbSerialAdd(id, instance)
-                        Log.i(TAG, "openSerial: Successfully opened serial port for device $id") // 添加日志
-                        return 1
+            val device = deviceFor(usbManager, id)
+            if (device == null) {
+                Log.e(TAG, "openSerial: No serial device for port $id") // 添加日志
+                return -1
+            }
+            val owner = synchronized(lock) {
+                usbSerialInstances.entries.firstOrNull { it.key != id && it.value.deviceId == device.deviceId }?.key
+            }
+            if (owner != null) {
+                Log.e(TAG, "openSerial: Device ${device.deviceId} for port $id is already open as port $owner")
+                return -1
+            }
+            permission = false
+            if (!usbManager.hasPermission(device)) {
+                Log.d(TAG, "openSerial: Requesting permission for port $id") // 添加日志
+                requestSerial(device.deviceId)
+                signalPermission.tryAcquire(10, TimeUnit.SECONDS)
+                if (!permission) {
+                    Log.w(TAG, "openSerial: Permission request timed out for port $id") // 添加日志
+                    return 0
+                }
+            }
+            val driver = usbDefaultProbe.probeDevice(device)
+            if (driver != null) {
+                val port = driver.ports[0]
+                val connection: UsbDeviceConnection = usbManager.openDevice(driver.device)
+                port.open(connection)
+                val instance = SerialInstance()
+                instance.port = port
+                val listener = SerialInputOutputManagerListener(id, instance)
+                instance.usbIoManager = SerialInputOutputManager(port, listener)
+                val driverName = driver::class.simpleName?.replace("SerialDriver", "")
+                instance.info = String.format("%s %X:%X", driverName, device.vendorId, device.productId)
+                instance.deviceId = device.deviceId
+                serviceNotify("串口打开: ${instance.info}")
+                if (nativeUsb) {
+                    val framing = if (driver is FtdiSerialDriver) USB_FRAMING_FTDI else USB_FRAMING_RAW
+                    instance.nativeUsb = usbEngineStart(id, connection.fileDescriptor, framing,
+                        port.readEndpoint.address, port.writeEndpoint.address,
+                        port.readEndpoint.maxPacketSize) == 0
+                    if (!instance.nativeUsb) {
+                        Log.w(TAG, "openSerial: native usb engine failed, using SerialInputOutputManager")
                     }
                 }
+                if (!instance.nativeUsb) {
+                    instance.usbIoManager!!.start()
+                }
+                usbSerialAdd(id, instance)
+                Log.i(TAG, "openSerial: Successfully opened device ${device.deviceId} as port $id") // 添加日志
+                return 1
             }
-            Log.e(TAG, "openSerial: No suitable serial port found for device $id") // 添加日志
+            Log.e(TAG, "openSerial: No suitable serial port found for port $id") // 添加日志
             return -1
         }
 
@@ -297,10 +332,13 @@ class Serial {
                 return 0
             }
             serviceNotify("串口关闭: ${instance.info}")
+            if (instance.nativeUsb) {
+                usbEngineStop(id)
+            }
             instance.port?.close()
             instance.usbIoManager?.stop()
             usbSerialRemove(id)
-            if (!idExist(id)) {
+            if (!idExist(instance.deviceId)) {
                 Log.d(TAG, "closeSerial: Port with id $id removed due to non-existence.")
                 return 0
             }
@@ -330,54 +368,52 @@ class Serial {
             return 1
         }
 
+        // 1: 芯片负责 RTS/CTS, 0: 驱动不支持 (由 native 模拟, 见 flow_ctl.h), -1: 出错
         @JvmStatic
-        fun readSerial(id: Int, size: Int, timeout: Int): ByteArray? {
+        fun flowControlSerial(id: Int, rtscts: Boolean) : Int {
             val instance = usbSerialGet(id)
-            if (instance == null) {
-                Log.e(TAG, "readSerial: Port ID $id is invalid")
-                return null
+            val port = instance?.port
+            if (port == null) {
+                Log.e(TAG, "flowControlSerial: Port ID $id is invalid")
+                return -1
             }
-            val buffer = ByteArray(size)
-            Log.d(TAG, "readSerial: Attempting to read $size bytes from port $id with timeout=$timeout")
-
-            var len = 0
-            instance.lock.lock()
-            try {
-                while (len < size) {
-                    if (instance.data.isEmpty()) {
-                        if (!instance.notEmpty.await(timeout.toLong(), TimeUnit.MILLISECONDS)) {
-                            Log.e(TAG, "readSerial: Timeout reached while reading from port $id")
-                            break
-                        }
-                    } else {
-                        buffer[len] = instance.data.removeAt(0)
-                        len++
-                    }
-                }
-            } catch (e: InterruptedException) {
-                Log.e(TAG, "readSerial: Interrupted while waiting for data on port $id: $e")
-            } finally {
-                instance.lock.unlock()
+            val mode = if (rtscts) UsbSerialPort.FlowControl.RTS_CTS else UsbSerialPort.FlowControl.NONE
+            if (!port.supportedFlowControl.contains(mode)) {
+                Log.i(TAG, "flowControlSerial: ${instance.info} has no chip $mode")
+                return 0
             }
-
-            return if (len == 0) {
-                Log.e(TAG, "readSerial: Failed to read from port $id")
-                byteArrayOf()
-            } else {
-                Log.d(TAG, "readSerial: Successfully read $len bytes from port $id")
-                buffer.copyOf(len)
+            return try {
+                port.flowControl = mode
+                Log.d(TAG, "flowControlSerial: Port $id flow control $mode")
+                1
+            } catch (e: Exception) {
+                Log.e(TAG, "flowControlSerial: Failed to set $mode on port $id", e)
+                -1
             }
         }
-    
+
+        // data 由 native 按端口复用, 只有前 length 字节有效
         @JvmStatic
-        fun writeSerial(id: Int, data : ByteArray, timeout: Int) : Int {
+        fun writeSerial(id: Int, data : ByteArray, length: Int, timeoutNs: Long) : Int {
             val instance = usbSerialGet(id)
             if (instance == null) {
                 Log.e(TAG, "writeSerial: Port ID $id is invalid")
                 return -1
             }
-            instance.port?.write(data, data.size, timeout)
-            Log.d(TAG, "writeSerial: Successfully wrote ${data.size} bytes to port $id with timeout=$timeout")
+            // 驱动只支持毫秒, 向上取整, 0.5 ms 不会变成 0 (无限等待)
+            val timeout = ((timeoutNs + 999_999) / 1_000_000).toInt()
+            // 与 native 的 JavaMethod_WriteSerial 区段嵌套显示
+            Trace.beginSection("usb write")
+            try {
+                instance.port?.write(data, length, timeout)
+            } catch (e: IOException) {
+                // 超时 (SerialTimeoutException) 或断开: 不能把异常带回 native, 返回错误码
+                Log.w(TAG, "writeSerial: Failed to write $length bytes to port $id with timeout=$timeout", e)
+                return -1
+            } finally {
+                Trace.endSection()
+            }
+            Log.d(TAG, "writeSerial: Successfully wrote $length bytes to port $id with timeout=$timeout")
             return 0
         }
 
@@ -453,39 +489,19 @@ class Serial {
         }
 
         @JvmStatic
-        fun inWaitingSerial(id: Int) : Int {
-            val res: Int
-            val instance = usbSerialGet(id)
-            if (instance == null) {
-                Log.e(TAG, "inWaiting: Port ID $id is invalid")
-                return 0
-            }
-            instance.lock.lock()
-            try {
-                res = instance.data.size
-                Log.d(TAG, "inWaiting: $res bytes in buffer for port $id")
-            } finally {
-                instance.lock.unlock()
-            }
-            return res
-        }
+        external fun rxPush(id: Int, data: ByteArray)
+
+        // framing 与 usb_engine.h 的 UsbFraming 一致
+        private const val USB_FRAMING_RAW = 0
+        private const val USB_FRAMING_FTDI = 1
 
         @JvmStatic
-        fun resetInputBufferSerial(id: Int) : Boolean {
-            val instance = usbSerialGet(id)
-            if (instance == null) {
-                Log.e(TAG, "resetInputBuffer: Port ID $id is invalid")
-                return false
-            }
-            instance.lock.lock()
-            try {
-                printBytes("resetInputBuffer", instance.data)
-                instance.data.clear()
-                Log.d(TAG, "resetInputBuffer: Cleared buffer for port $id")
-            } finally {
-                instance.lock.unlock()
-            }
-            return true
-        }
+        external fun usbEngineStart(id: Int, fd: Int, framing: Int, epIn: Int, epOut: Int, maxPacket: Int): Int
+
+        @JvmStatic
+        external fun usbEngineStop(id: Int)
+
+        @JvmStatic
+        external fun sessionDrop(id: Int)
     }
 }
@@ -185,10 +185,72 @@ class SerialService : Service() {
             defaultMessage = getString(R.string.usb_device_connected)
         }
         notificationMessage = intent?.getStringExtra("message") ?: defaultMessage
+        val metricsPort = intent?.getIntExtra("metrics_port", METRICS_PORT) ?: METRICS_PORT
+        // 端口 id 到 USB 设备: 默认端口 n 是按 deviceId 排序的第 n 个串口设备 (0 和 1 是同一个),
+        // 例如 port_map="1=1003,2=0403:6001" 按 deviceId 或 VID:PID 指定, 见 Serial.deviceFor()
+        intent?.getStringExtra("port_map")?.let { Serial.setPortMap(it) }
+        // 原始 TCP 端口 (无 telnet), 端口 id 从 1 开始, 0 留给 RFC2217 服务
+        val rawPort = intent?.getIntExtra("raw_port", 0) ?: 0
+        val rawPorts = intent?.getIntExtra("raw_ports", RAW_PORTS) ?: RAW_PORTS
+        // 压缩: raw_compress 让原始端口发往客户端的数据压缩; zip_port 是 RFC2217 的压缩入口,
+        // 客户端经 tools/lz_bridge.cpp 使用, 见 lz_stream.h / telnet_zip.h
+        val rawCompress = intent?.getBooleanExtra("raw_compress", false) ?: false
+        val zipPort = intent?.getIntExtra("zip_port", 0) ?: 0
+        // esptool 加速入口, 复位和同步在本机完成; 客户端经 tools/esp_bridge.cpp 可流水线写入, 见 esp_accel.h
+        val espPort = intent?.getIntExtra("esp_port", 0) ?: 0
+        // 多路复用端口, 一个连接承载多个串口通道, 协议见 mux_server.h
+        val muxPort = intent?.getIntExtra("mux_port", 0) ?: 0
+        // Modbus TCP 网关, modbus_id 是端口 id (>= 1, 按上面的 port_map 对应 USB 设备), 默认 1 即第一个串口设备,
+        // 和原始端口/多路复用的同号端口是同一个设备, 不能同时打开. 例如 modbus="baud=19200,parity=N,ttl=500", 见 modbus_gw.h
+        val modbusPort = intent?.getIntExtra("modbus_port", 0) ?: 0
+        val modbusId = intent?.getIntExtra("modbus_id", 1) ?: 1
+        val modbusSpec = intent?.getStringExtra("modbus") ?: ""
+        // 数据端点走 native usbfs 引擎, 多个 URB 同时排队
+        intent?.let { Serial.nativeUsb = it.getBooleanExtra("usb_engine", Serial.nativeUsb) }
+        // 客户端断开后端口保持打开 (默认不保持), 例如 "linger=30000,rx=keep", 见 session_pool.h
+        // 保持期间同一设备的其他端口号 (例如 0 和 1) 打不开
+        intent?.getStringExtra("session")?.let {
+            if (sessionConfigure(it) != 0) {
+                Log.w(TAG, "session: invalid setting $it")
+            }
+        }
+        // 线程调度, 例如 "usb.nice=-10,usb.cpus=big,server.cpus=big", 见 thread_sched.h
+        intent?.getStringExtra("sched")?.let {
+            if (schedConfigure(it) != 0) {
+                Log.w(TAG, "sched: invalid setting $it")
+            }
+        }
+        // 原始端口带宽分配, 例如 "1.weight=4,3.rate=20000", 见 port_sched.h
+        intent?.getStringExtra("raw_sched")?.let {
+            if (portSchedConfigure(it) != 0) {
+                Log.w(TAG, "raw_sched: invalid setting $it")
+            }
+        }
         startForeground(1, getNotification(notificationMessage, true))
         if (!init) {
             init = true
             Thread {
+                captureOpen(filesDir.absolutePath + "/capture.bin", CAPTURE_SIZE)
+                // Prometheus 指标, 本机访问: adb forward tcp:9217 tcp:9217
+                if (metricsPort > 0 && metricsServe(metricsPort) != 0) {
+                    Log.w(TAG, "metrics: failed to listen on $metricsPort")
+                }
+                portSchedCompress(rawCompress)
+                if (rawPort > 0 && portSchedStart(rawPort, 1, rawPorts, 0) != 0) {
+                    Log.w(TAG, "raw ports: failed to start on $rawPort")
+                }
+                if (zipPort > 0 && telnetZipStart(zipPort, 2217) != 0) {
+                    Log.w(TAG, "zip: failed to start on $zipPort")
+                }
+                if (espPort > 0 && espAccelStart(espPort, 2217, 0) != 0) {
+                    Log.w(TAG, "esp: failed to start on $espPort")
+                }
+                if (muxPort > 0 && muxStart(muxPort) != 0) {
+                    Log.w(TAG, "mux: failed to start on $muxPort")
+                }
+                if (modbusPort > 0 && modbusStart(modbusPort, modbusId, modbusSpec) != 0) {
+                    Log.w(TAG, "modbus: failed to start on $modbusPort")
+                }
                 rfc2217Init(applicationInfo.nativeLibraryDir)
                 while (true) {
                     rfc2217Start(-1, 2217, 2)
@@ -242,6 +304,9 @@ class SerialService : Service() {
             System.loadLibrary("serialserver")
         }
         private const val TAG = "SerialService"
+        private const val CAPTURE_SIZE = 16 * 1024 * 1024
+        private const val METRICS_PORT = 9217
+        private const val RAW_PORTS = 8
         /**
          * A native method that is implemented by the 'serialserver' native library,
          * which is packaged with this application.
@@ -252,5 +317,27 @@ class SerialService : Service() {
         external fun rfc2217Init( binaryFilename:String)
         @JvmStatic
         external fun rfc2217Start( port:Int, tcpPort:Int, verbose:Int)
+        @JvmStatic
+        external fun captureOpen(path: String, size: Int): Int
+        @JvmStatic
+        external fun metricsServe(tcpPort: Int): Int
+        @JvmStatic
+        external fun schedConfigure(spec: String): Int
+        @JvmStatic
+        external fun sessionConfigure(spec: String): Int
+        @JvmStatic
+        external fun portSchedStart(tcpBase: Int, firstId: Int, count: Int, workers: Int): Int
+        @JvmStatic
+        external fun portSchedCompress(compress: Boolean)
+        @JvmStatic
+        external fun portSchedConfigure(spec: String): Int
+        @JvmStatic
+        external fun telnetZipStart(tcpPort: Int, upstreamPort: Int): Int
+        @JvmStatic
+        external fun espAccelStart(tcpPort: Int, upstreamPort: Int, id: Int): Int
+        @JvmStatic
+        external fun muxStart(tcpPort: Int): Int
+        @JvmStatic
+        external fun modbusStart(tcpPort: Int, id: Int, spec: String): Int
     }
 }